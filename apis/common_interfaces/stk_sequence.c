@@ -2,11 +2,11 @@
 extern "C" {
 	#include "../lib/PLists.h"
 	#include "../lib/stk_internal.h"
-	Node *stk_sequence_first_elem(stk_sequence_t *seq);
-	Node *stk_sequence_next_elem(stk_sequence_t *seq,Node *n);
-	void stk_sequence_node_data(Node *n,char **dptr,stk_uint64 *sz);
-	stk_uint64 stk_sequence_node_type(Node *n);
-	int stk_is_at_list_end(Node *n);
+	void *stk_sequence_first_elem(stk_sequence_t *seq);
+	void *stk_sequence_next_elem(stk_sequence_t *seq,void *n);
+	void stk_sequence_node_data(void *n,char **dptr,stk_uint64 *sz);
+	stk_uint64 stk_sequence_node_type(void *n);
+	int stk_is_at_list_end(void *n);
 	stk_ret stk_copy_string_to_sequence(stk_sequence_t *seq,char *data_ptr,int sz, stk_uint64 user_type) { return stk_copy_to_sequence(seq,(void*)data_ptr,sz,user_type); }
 	stk_ret stk_copy_chars_to_sequence(stk_sequence_t *seq,unsigned long data_ptr,stk_uint64 sz, stk_uint64 user_type) { return stk_copy_to_sequence(seq,(void*)data_ptr,sz,user_type); }
 	unsigned long new_voidDataArray(int sz) { return (unsigned long) malloc(sz); }
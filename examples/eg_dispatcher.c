@@ -7,6 +7,7 @@
  */
 #include "stk_env_api.h"
 #include "stk_sequence_api.h"
+#include "stk_sequence_pool_api.h"
 #include "stk_data_flow.h"
 #include "stk_tcp_server_api.h"
 #include "stk_udp_listener_api.h"
@@ -14,6 +15,10 @@
 #include "stk_data_flow_api.h"
 #include "stk_tcp.h"
 #include "stk_timer_api.h"
+#include "stk_clock_api.h"
+#include "stk_sync_api.h"
+#include "stk_uring_api.h"
+#include "stk_worker_pool_api.h"
 #include "stk_examples.h"
 #include "eg_dispatcher_api.h"
 #include <poll.h>
@@ -26,12 +31,32 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <assert.h>
+#include <pthread.h>
 
+/* On Linux the dispatcher uses epoll, which has no limit on the number of fds
+ * and adds and removes them in O(1). Define EG_DISPATCHER_POLL to use poll() instead.
+ */
+#if defined(__linux__) && !defined(EG_DISPATCHER_POLL)
+#define EG_DISPATCHER_EPOLL
+#endif
+
+#include <sys/ioctl.h>
+
+#ifdef EG_DISPATCHER_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+/* Initial size of the fdinfo table, which is indexed by fd and grows as required */
+#define EG_FDINFO_MIN_SZ 64
+/* Max number of events returned by each call to epoll_wait() */
+#define EG_EPOLL_EVENTS 256
+#else
 /* Max number of connections and the array size to store them */
 #ifndef MAX_CONNS
 #define MAX_CONNS 500
 #endif
 #define MAX_CONN_ARRAY_SZ (MAX_CONNS + 1) /* Must have space for the wakeup fd, hence +1 */
+#endif
 
 typedef struct {
 	stk_data_flow_t *df; /* The data flow this fd is associated with */
@@ -39,19 +64,97 @@ typedef struct {
 	fd_data_cb data_cb;  /* Data callback associated with this fd */ 
 	int listening;       /* listen socket - calls accept on */
 	int pipe;            /* wakeup pipe */
+	int timer;           /* env timer fd */
 	int accepted;        /* ephemeral fd */
+	int active;          /* fd is in the epoll set */
+	int edge_triggered;  /* fd was added to the epoll set edge triggered */
+	int uring;           /* io_uring fd - completions are processed for its data flows */
+	int uring_flow;      /* fd is serviced by the io_uring, so is not in the epoll set */
+	int rcv_pending;     /* fd ran out of receive budget with data left, and is in the pending list */
+	unsigned int rcv_round; /* The dispatch round the fd was last received from in */
 } fdinfo_t;
 
+/* An fd added or removed by a thread other than the reactor which owns the dispatcher */
+typedef enum {
+	DISPATCH_FD_ADD,
+	DISPATCH_FD_ADD_SERVER,
+	DISPATCH_FD_ADD_ACCEPTED,
+	DISPATCH_FD_REMOVE
+} dispatch_fd_op_type;
+
+typedef struct dispatch_fd_op_stct {
+	struct dispatch_fd_op_stct *next;
+	dispatch_fd_op_type op;
+	stk_data_flow_t *df;
+	int fd;
+	fd_hup_cb hup_cb;
+	fd_data_cb data_cb;
+} dispatch_fd_op_t;
+
 struct stk_dispatcher_stct {
-	int wakeup_fds[2];                            /* FDs for the wakeup pipe */
+	int wakeup_fds[2];                            /* FDs for the wakeup pipe (both the same eventfd with epoll) */
+	volatile stk_uint32 wakeup_pending;           /* A wakeup has been written since the dispatcher last woke */
+	volatile stk_uint64 wakeups_issued;           /* Wakeups written to the wakeup fd */
+	volatile stk_uint64 wakeups_suppressed;       /* Wakeups coalesced with a pending wakeup */
 	int nfds;
 	int end_dispatch;                             /* Flag indicating that the dispatcher should return */
+#ifdef EG_DISPATCHER_EPOLL
+	int epoll_fd;                                 /* The epoll instance, created when the first fd is added */
+	int edge_triggered;                           /* Add data flow fds edge triggered */
+	fdinfo_t *fdinfo;                             /* fd info indexed by fd */
+	int fdinfo_sz;
+	struct epoll_event events[EG_EPOLL_EVENTS];   /* The events returned by epoll_wait() */
+#else
 	fdinfo_t fdinfo[MAX_CONN_ARRAY_SZ];
 	struct pollfd fdset[MAX_CONN_ARRAY_SZ];       /* The FD set to be passed to poll() */
+#endif
 	void *user_ref;                               /* User data */
 	stk_timer_set_t *timer_dispatch_set;
+	stk_sequence_pool_t *seq_pool;                /* Recycled sequences for receiving data */
+	int timer_fd_added;                           /* The env timer fd is in the FD set */
+	eg_reactors_t *reactors;                      /* The reactors this dispatcher is one of */
+	int reactor_idx;                              /* Index of this dispatcher in its reactors */
+	int reactor_running;                          /* The reactor thread has been started */
+	int stop_reactor;                             /* Flag indicating the reactor thread should exit */
+	volatile stk_uint32 reactor_ready;            /* The reactor thread has created its timer set */
+	pthread_t reactor_thread;
+	stk_timer_set_t *reactor_timers;              /* Timers owned by the reactor thread */
+	dispatch_fd_op_t *fd_ops;                     /* fds added/removed by other threads, applied by the reactor */
+	stk_uring_t *uring;                           /* io_uring servicing data flows created with the "io_uring" option */
+	int spin_us;                                  /* Busy poll for up to this long before sleeping (0 to always sleep) */
+	int sock_busy_poll_us;                        /* SO_BUSY_POLL set on data flow sockets added (0 to not set) */
+	volatile stk_uint64 spin_polls;               /* Non blocking polls made while spinning */
+	volatile stk_uint64 spin_hits;                /* Waits ended by events found while spinning */
+	volatile stk_uint64 sleeps;                   /* Waits which blocked */
+	stk_worker_pool_t *workers;                   /* Processes received sequences instead of the data callbacks */
+	int rcv_budget;                               /* Receive from fds until drained or the budget is spent */
+	int rcv_budget_seqs;                          /* Sequences received per event (0 for no limit) */
+	stk_uint64 rcv_budget_bytes;                  /* Bytes received per event (0 for no limit) */
+	unsigned int rcv_round;                       /* Incremented each time events are dispatched */
+	int *rcv_pending_fds;                         /* fds which ran out of receive budget, received from next round */
+	int rcv_pending_n;
+	int rcv_pending_sz;
+	volatile stk_uint64 rcv_events;               /* Receive events dispatched */
+	volatile stk_uint64 rcv_seqs;                 /* Sequences received */
+	volatile stk_uint64 rcv_budget_exhausted;     /* Receive events which spent the budget with data left */
+};
+
+struct eg_reactors_stct {
+	stk_env_t *env;
+	int nreactors;
+	volatile stk_uint32 next;                     /* Round robin index for next_reactor() */
+	stk_dispatcher_t **reactors;
 };
+
+/* The reactor running on this thread */
+static __thread stk_dispatcher_t *current_reactor;
+/* The reactor dispatching the env timers while reactors are running */
+static stk_dispatcher_t *env_timers_reactor;
+#ifdef EG_DISPATCHER_EPOLL
+stk_dispatcher_t global_dispatcher = { .wakeup_fds = { -1, -1 }, .epoll_fd = -1 }; /* Default dispatcher */
+#else
 stk_dispatcher_t global_dispatcher = { { -1, -1 } }; /* Default dispatcher */
+#endif
 
 /* Default timeout for poll() - 100ms is a decent compromise
  * timers are processed after poll() times out. Reduce for
@@ -66,6 +169,9 @@ stk_dispatcher_t *alloc_dispatcher()
 
 	d->wakeup_fds[0] = -1;
 	d->wakeup_fds[1] = -1;
+#ifdef EG_DISPATCHER_EPOLL
+	d->epoll_fd = -1;
+#endif
 	return d;
 }
 
@@ -73,6 +179,14 @@ void free_dispatcher(stk_dispatcher_t *d)
 {
 	if(d->timer_dispatch_set)
 		STK_ASSERT(stk_free_timer_set(d->timer_dispatch_set,STK_FALSE) == STK_SUCCESS,"Failed to free timer set");
+	if(d->seq_pool)
+		STK_ASSERT(stk_destroy_sequence_pool(d->seq_pool) == STK_SUCCESS,"Failed to destroy sequence pool");
+#ifdef EG_DISPATCHER_EPOLL
+	if(d->epoll_fd != -1)
+		close(d->epoll_fd);
+	free(d->fdinfo);
+#endif
+	free(d->rcv_pending_fds);
 	free(d);
 }
 
@@ -81,64 +195,344 @@ stk_dispatcher_t *default_dispatcher()
 	return &global_dispatcher;
 }
 
-/* API to set the end dispatch flag */
+/* Wake a dispatcher by writing to its wakeup fd. Wakeups are coalesced, only the first
+ * wakeup after the dispatcher last woke is written, so there is at most one per loop iteration.
+ * Safe to call from a signal handler.
+ */
+static ssize_t dispatch_wakeup(stk_dispatcher_t *d)
+{
+	if(stk_atomic_exchange_32(&d->wakeup_pending,1,STK_MO_SEQ_CST)) {
+		stk_atomic_fetch_add_64(&d->wakeups_suppressed,1,STK_MO_RELAXED);
+		return 0;
+	}
+	stk_atomic_fetch_add_64(&d->wakeups_issued,1,STK_MO_RELAXED);
+
+#ifdef EG_DISPATCHER_EPOLL
+	{
+	stk_uint64 one = 1;
+	return write(d->wakeup_fds[1],&one,sizeof(one));
+	}
+#else
+	{
+	char b = 0;
+	return write(d->wakeup_fds[1],&b,1);
+	}
+#endif
+}
+
+/* Get the number of wakeups written to a dispatcher's wakeup fd and the number coalesced with a pending wakeup */
+void dispatcher_wakeup_stats(stk_dispatcher_t *d,stk_uint64 *issued,stk_uint64 *suppressed)
+{
+	*issued = stk_atomic_load_64(&d->wakeups_issued,STK_MO_RELAXED);
+	*suppressed = stk_atomic_load_64(&d->wakeups_suppressed,STK_MO_RELAXED);
+}
+
+/* API to set the end dispatch flag.
+ * When using a timer fd the dispatcher is woken, it may be sleeping until the next timer expiration
+ */
 void stop_dispatching(stk_dispatcher_t *d)
 {
 	d->end_dispatch = 1;
+	if(d->timer_fd_added && d->wakeup_fds[1] != -1) {
+		ssize_t rc = dispatch_wakeup(d);
+		(void) rc; /* May be called from a signal handler, nothing more to be done */
+	}
+}
+
+/* API to add data flow fds edge triggered, so epoll only reports them when new data arrives
+ * and the dispatcher receives until they are drained. Applies to fds added after this call.
+ * Returns -1 when the dispatcher uses poll(), which is always level triggered.
+ */
+int dispatch_set_edge_triggered(stk_dispatcher_t *d,int edge_triggered)
+{
+#ifdef EG_DISPATCHER_EPOLL
+	d->edge_triggered = edge_triggered;
+	return 0;
+#else
+	return edge_triggered ? -1 : 0;
+#endif
+}
+
+/* API to busy poll the fds for up to spin_us microseconds before sleeping, trading a core for latency.
+ * Events which arrive while spinning are dispatched without the cost of sleeping and being woken.
+ * If sock_busy_poll_us is set, SO_BUSY_POLL is set on the data flow sockets added after this call
+ * so the kernel busy polls the device queue when they are received from (Linux only, see socket(7)).
+ * Returns -1 if SO_BUSY_POLL is not supported.
+ */
+int dispatch_set_busy_poll(stk_dispatcher_t *d,int spin_us,int sock_busy_poll_us)
+{
+	if(spin_us < 0 || sock_busy_poll_us < 0) return -1;
+#ifndef SO_BUSY_POLL
+	if(sock_busy_poll_us > 0) return -1;
+#endif
+	d->spin_us = spin_us;
+	d->sock_busy_poll_us = sock_busy_poll_us;
+	return 0;
+}
+
+/* API to hand the sequences received to a worker pool, whose callback processes them on the
+ * worker threads instead of the data callbacks being called on the dispatcher thread.
+ * The pool is flushed before the dispatcher destroys accepted data flows.
+ */
+void dispatch_set_worker_pool(stk_dispatcher_t *d,stk_worker_pool_t *pool) { d->workers = pool; }
+
+/* Get the number of non blocking polls made while spinning, the waits they ended and the waits which slept */
+void dispatcher_spin_stats(stk_dispatcher_t *d,stk_uint64 *spin_polls,stk_uint64 *spin_hits,stk_uint64 *sleeps)
+{
+	*spin_polls = stk_atomic_load_64(&d->spin_polls,STK_MO_RELAXED);
+	*spin_hits = stk_atomic_load_64(&d->spin_hits,STK_MO_RELAXED);
+	*sleeps = stk_atomic_load_64(&d->sleeps,STK_MO_RELAXED);
+}
+
+/* API to receive from an fd until it has no more data or a budget of max_seqs sequences or
+ * max_bytes bytes is spent per event, instead of receiving what one read returns. A busy fd then costs
+ * one poll per budget rather than per read. An fd which spends its budget with data left is received from
+ * again in the next round, after the other ready fds have had their turn, so it can't starve them.
+ * A limit of 0 is no limit, and 0 for both restores the default. Returns -1 if max_seqs is negative.
+ */
+int dispatch_set_rcv_budget(stk_dispatcher_t *d,int max_seqs,stk_uint64 max_bytes)
+{
+	if(max_seqs < 0) return -1;
+	d->rcv_budget_seqs = max_seqs;
+	d->rcv_budget_bytes = max_bytes;
+	d->rcv_budget = max_seqs > 0 || max_bytes > 0;
+	return 0;
+}
+
+/* Get the number of receive events, the sequences received and the events which spent the receive budget with data left */
+void dispatcher_rcv_stats(stk_dispatcher_t *d,stk_uint64 *rcv_events,stk_uint64 *rcv_seqs,stk_uint64 *budget_exhausted)
+{
+	*rcv_events = stk_atomic_load_64(&d->rcv_events,STK_MO_RELAXED);
+	*rcv_seqs = stk_atomic_load_64(&d->rcv_seqs,STK_MO_RELAXED);
+	*budget_exhausted = stk_atomic_load_64(&d->rcv_budget_exhausted,STK_MO_RELAXED);
+}
+
+/* Set SO_BUSY_POLL on a data flow socket if configured, fds which are not sockets are ignored */
+static void dispatch_set_sock_busy_poll(stk_dispatcher_t *d,int fd)
+{
+#ifdef SO_BUSY_POLL
+	if(d->sock_busy_poll_us > 0 &&
+		setsockopt(fd,SOL_SOCKET,SO_BUSY_POLL,&d->sock_busy_poll_us,sizeof(d->sock_busy_poll_us)) == -1 && errno != ENOTSOCK)
+		STK_LOG(STK_LOG_NORMAL,"Failed to set SO_BUSY_POLL on fd %d, errno %d",fd,errno);
+#endif
 }
 
-/* Init a specific index in the fdset and fdinfo tables */
-void dispatch_init_fdinfo(stk_dispatcher_t *d,int idx,stk_data_flow_t *df,int fd,fd_hup_cb hup_cb,fd_data_cb data_cb)
+#ifdef EG_DISPATCHER_EPOLL
+/* Add an fd to the epoll set and init its entry in the fdinfo table, growing the table if required */
+static fdinfo_t *dispatch_new_fdinfo(stk_dispatcher_t *d,stk_data_flow_t *df,int fd,fd_hup_cb hup_cb,fd_data_cb data_cb,int edge_triggered)
 {
+	struct epoll_event ev;
+
+	if(fd < 0) return NULL;
+
+	if(d->epoll_fd == -1) {
+		d->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		STK_ASSERT(d->epoll_fd!=-1,"failed to create dispatch epoll fd %d",errno);
+	}
+
+	if(fd >= d->fdinfo_sz) {
+		int sz = d->fdinfo_sz ? d->fdinfo_sz : EG_FDINFO_MIN_SZ;
+		fdinfo_t *fdinfo;
+
+		while(sz <= fd) sz *= 2;
+		fdinfo = realloc(d->fdinfo,sz * sizeof(fdinfo_t));
+		if(!fdinfo) return NULL;
+		memset(&fdinfo[d->fdinfo_sz],0,(sz - d->fdinfo_sz) * sizeof(fdinfo_t));
+		d->fdinfo = fdinfo;
+		d->fdinfo_sz = sz;
+	}
+	if(d->fdinfo[fd].active) return NULL;
+
+	if(d->uring && stk_uring_owns_fd(d->uring,fd)) {
+		/* The ring's completions are reported on its fd instead */
+		memset(&d->fdinfo[fd],0,sizeof(d->fdinfo[0]));
+		d->fdinfo[fd].uring_flow = 1;
+		edge_triggered = 0;
+	} else {
+		memset(&ev,0,sizeof(ev));
+		ev.events = EPOLLIN;
+		if(edge_triggered)
+			ev.events |= EPOLLET | EPOLLRDHUP;
+		ev.data.fd = fd;
+		if(epoll_ctl(d->epoll_fd,EPOLL_CTL_ADD,fd,&ev) == -1) {
+			STK_LOG(STK_LOG_ERROR,"Failed to add fd %d to dispatcher, errno %d",fd,errno);
+			return NULL;
+		}
+		memset(&d->fdinfo[fd],0,sizeof(d->fdinfo[0]));
+	}
+
+	d->fdinfo[fd].df = df;
+	d->fdinfo[fd].hup_cb = hup_cb;
+	d->fdinfo[fd].data_cb = data_cb;
+	d->fdinfo[fd].active = 1;
+	d->fdinfo[fd].edge_triggered = edge_triggered;
+	d->nfds++;
+	return &d->fdinfo[fd];
+}
+#else
+/* Init the next index in the fdset and fdinfo tables */
+static fdinfo_t *dispatch_new_fdinfo(stk_dispatcher_t *d,stk_data_flow_t *df,int fd,fd_hup_cb hup_cb,fd_data_cb data_cb,int edge_triggered)
+{
+	int idx = d->nfds;
+
+	if(d->nfds + 1 == MAX_CONN_ARRAY_SZ) return NULL;
 	memset(&d->fdinfo[idx],0,sizeof(d->fdinfo[0]));
 	d->fdset[idx].fd = fd;
 	d->fdset[idx].events = POLLIN;
 	d->fdset[idx].revents = 0;
 	d->fdinfo[idx].hup_cb = hup_cb;
 	d->fdinfo[idx].data_cb = data_cb;
-	d->fdinfo[d->nfds].df = df;
+	d->fdinfo[idx].df = df;
+	d->nfds++;
+	return &d->fdinfo[idx];
+}
+#endif
+
+/* Determine if fds must be handed off to the reactor thread which owns the dispatcher */
+static int dispatch_foreign(stk_dispatcher_t *d)
+{
+	return d->reactor_running && current_reactor != d;
+}
+
+/* Queue an fd to be added or removed by the reactor thread which owns the dispatcher, and wake it */
+static int dispatch_queue_fd_op(stk_dispatcher_t *d,dispatch_fd_op_type op,stk_data_flow_t *df,int fd,fd_hup_cb hup_cb,fd_data_cb data_cb)
+{
+	dispatch_fd_op_t *fd_op = calloc(1,sizeof(dispatch_fd_op_t));
+	if(!fd_op) return -1;
+
+	fd_op->op = op;
+	fd_op->df = df;
+	fd_op->fd = fd;
+	fd_op->hup_cb = hup_cb;
+	fd_op->data_cb = data_cb;
+
+	fd_op->next = stk_atomic_load_ptr(&d->fd_ops,STK_MO_RELAXED);
+	while(!stk_atomic_cas_ptr(&d->fd_ops,&fd_op->next,fd_op,STK_MO_RELEASE));
+
+	STK_ASSERT(dispatch_wakeup(d) != -1,"Failed to wake reactor %d, errno %d",d->reactor_idx,errno);
+	return 0;
+}
+
+/* Apply the fds added and removed by other threads, in the order they were queued */
+static void dispatch_apply_fd_ops(stk_dispatcher_t *d)
+{
+	dispatch_fd_op_t *fd_ops, *fd_op, *prev = NULL;
+
+	/* Ordered after clearing wakeup_pending, so an fd op queued while the wakeup was pending is seen */
+	if(!stk_atomic_load_ptr(&d->fd_ops,STK_MO_SEQ_CST)) return;
+
+	fd_ops = stk_atomic_exchange_ptr(&d->fd_ops,NULL,STK_MO_ACQUIRE);
+
+	/* Reverse the stack */
+	while(fd_ops) {
+		fd_op = fd_ops;
+		fd_ops = fd_op->next;
+		fd_op->next = prev;
+		prev = fd_op;
+	}
+
+	while(prev) {
+		int rc = 0;
+
+		fd_op = prev;
+		prev = fd_op->next;
+		switch(fd_op->op) {
+		case DISPATCH_FD_ADD: rc = dispatch_add_fd(d,fd_op->df,fd_op->fd,fd_op->hup_cb,fd_op->data_cb); break;
+		case DISPATCH_FD_ADD_SERVER: rc = server_dispatch_add_fd(d,fd_op->fd,fd_op->df,fd_op->data_cb); break;
+		case DISPATCH_FD_ADD_ACCEPTED: rc = dispatch_add_accepted_fd(d,fd_op->fd,fd_op->df,fd_op->data_cb); break;
+		case DISPATCH_FD_REMOVE: dispatch_remove_fd(d,fd_op->fd); break;
+		}
+		if(rc == -1)
+			STK_LOG(STK_LOG_ERROR,"Failed to add fd %d to reactor %d",fd_op->fd,d->reactor_idx);
+		free(fd_op);
+	}
 }
 
 /* Add a pipe FD to the dispatcher */
 int pipe_dispatch_add_fd(stk_dispatcher_t *d,int fd)
 {
-	if(d->nfds + 1 == MAX_CONN_ARRAY_SZ) return -1;
-	dispatch_init_fdinfo(d,d->nfds,NULL,fd,NULL,NULL);
-	d->fdinfo[d->nfds].pipe = 1;
-	d->nfds++;
+	fdinfo_t *info = dispatch_new_fdinfo(d,NULL,fd,NULL,NULL,0);
+	if(!info) return -1;
+	info->pipe = 1;
 	return 0;
 }
 
 /* Function to init the wakeup fds if not yet setup */
 inline static void dispatch_init_wakeup_fds(stk_dispatcher_t *d)
 {
-	/* create a pipe so other threads can wakeup the dispatch loop while its in poll() */
+	/* create a pipe (or eventfd) so other threads can wakeup the dispatch loop while its in poll() */
 	if(d->wakeup_fds[0] == -1) {
+#ifdef EG_DISPATCHER_EPOLL
+		int rc = eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+		STK_ASSERT(rc!=-1,"failed to create dispatch eventfd");
+		d->wakeup_fds[0] = d->wakeup_fds[1] = rc;
+#else
 		int rc = pipe(d->wakeup_fds);
 		STK_ASSERT(rc!=-1,"failed to create dispatch pipe");
+#endif
 
 		pipe_dispatch_add_fd(d,d->wakeup_fds[0]);
 	}
 }
 
+/* Add the env timer FD (if configured) to the dispatcher so it sleeps until the next timer expires */
+static void dispatch_init_timer_fd(stk_dispatcher_t *d,stk_env_t *stkbase)
+{
+	int fd = stk_env_get_timer_fd(stkbase);
+	fdinfo_t *info;
+
+	if(fd == -1 || d->timer_fd_added) return;
+	info = dispatch_new_fdinfo(d,NULL,fd,NULL,NULL,0);
+	if(!info) return;
+	info->timer = 1;
+	d->timer_fd_added = 1;
+}
+
+/* API to service the data flows created with the "io_uring" option set to ring. Their fds
+ * are not polled, the ring's fd is, and each data flow with completions is dispatched as if
+ * its fd was ready. Returns -1 when the dispatcher uses poll().
+ */
+int dispatch_set_uring(stk_dispatcher_t *d,stk_uring_t *ring)
+{
+#ifdef EG_DISPATCHER_EPOLL
+	fdinfo_t *info;
+
+	if(d->uring) return -1;
+	dispatch_init_wakeup_fds(d);
+	info = dispatch_new_fdinfo(d,NULL,stk_uring_fd(ring),NULL,NULL,0);
+	if(!info) return -1;
+	info->uring = 1;
+	d->uring = ring;
+	return 0;
+#else
+	return -1;
+#endif
+}
+
 /* Add a generic FD and data flow to the dispatcher */
 int dispatch_add_fd(stk_dispatcher_t *d,stk_data_flow_t *df,int fd,fd_hup_cb hup_cb,fd_data_cb data_cb)
 {
-	if(d->nfds + 1 == MAX_CONN_ARRAY_SZ) return -1;
+	if(dispatch_foreign(d)) return dispatch_queue_fd_op(d,DISPATCH_FD_ADD,df,fd,hup_cb,data_cb);
 	dispatch_init_wakeup_fds(d);
-	dispatch_init_fdinfo(d,d->nfds,df,fd,hup_cb,data_cb);
-	d->nfds++;
+#ifdef EG_DISPATCHER_EPOLL
+	if(!dispatch_new_fdinfo(d,df,fd,hup_cb,data_cb,d->edge_triggered)) return -1;
+#else
+	if(!dispatch_new_fdinfo(d,df,fd,hup_cb,data_cb,0)) return -1;
+#endif
+	dispatch_set_sock_busy_poll(d,fd);
 	return 0;
 }
 
 /* Add a listening FD and data flow to the dispatcher */
 int server_dispatch_add_fd(stk_dispatcher_t *d,int fd,stk_data_flow_t *df,fd_data_cb data_cb)
 {
-	if(d->nfds + 1 == MAX_CONN_ARRAY_SZ) return -1;
+	fdinfo_t *info;
+
+	if(dispatch_foreign(d)) return dispatch_queue_fd_op(d,DISPATCH_FD_ADD_SERVER,df,fd,NULL,data_cb);
 	dispatch_init_wakeup_fds(d);
-	dispatch_init_fdinfo(d,d->nfds,df,fd,NULL,data_cb);
-	d->fdinfo[d->nfds].listening = 1;
-	d->nfds++;
+	info = dispatch_new_fdinfo(d,df,fd,NULL,data_cb,0);
+	if(!info) return -1;
+	info->listening = 1;
 	return 0;
 }
 
@@ -147,6 +541,9 @@ void dispatch_destroy_accepted_cb(stk_dispatcher_t *d,stk_data_flow_t *flow,int
 	int removed = dispatch_remove_fd(d,fd);
 	STK_ASSERT(removed != -1,"remove data flow from dispatcher");
 
+	/* Workers may still be processing sequences received on the data flow */
+	if(d->workers) stk_worker_pool_flush(d->workers);
+
 	/* Force closing of fd on data flow */
 	{
 	stk_ret ret = stk_destroy_data_flow(flow);
@@ -160,11 +557,17 @@ void dispatch_destroy_accepted_cb(stk_dispatcher_t *d,stk_data_flow_t *flow,int
  */
 int dispatch_add_accepted_fd(stk_dispatcher_t *d,int fd,stk_data_flow_t *df,fd_data_cb cb)
 {
-	if(d->nfds + 1 == MAX_CONN_ARRAY_SZ) return -1;
-	dispatch_init_fdinfo(d,d->nfds,df,fd,dispatch_destroy_accepted_cb,cb);
-	d->fdinfo[d->nfds].accepted = 1;
-	d->fdinfo[d->nfds].df = df;
-	d->nfds++;
+	fdinfo_t *info;
+
+	if(dispatch_foreign(d)) return dispatch_queue_fd_op(d,DISPATCH_FD_ADD_ACCEPTED,df,fd,NULL,cb);
+#ifdef EG_DISPATCHER_EPOLL
+	info = dispatch_new_fdinfo(d,df,fd,dispatch_destroy_accepted_cb,cb,d->edge_triggered);
+#else
+	info = dispatch_new_fdinfo(d,df,fd,dispatch_destroy_accepted_cb,cb,0);
+#endif
+	if(!info) return -1;
+	info->accepted = 1;
+	dispatch_set_sock_busy_poll(d,fd);
 	return 0;
 }
 
@@ -172,18 +575,50 @@ int dispatch_add_accepted_fd(stk_dispatcher_t *d,int fd,stk_data_flow_t *df,fd_d
  * a byte to a pipe which the dispatch is listening to. On
  * receiving data poll() will return indicating there is data
  * and thus the dispatch loop is woken.
+ * While reactors are running the first reactor dispatches the env timers, so it is woken.
  */
 void wakeup_dispatcher(stk_env_t *env)
 {
-	char b = 0;
+	stk_dispatcher_t *d = stk_atomic_load_ptr(&env_timers_reactor,STK_MO_ACQUIRE);
 	ssize_t rc;
 
-	dispatch_init_wakeup_fds(&global_dispatcher);
+	if(!d) {
+		d = &global_dispatcher;
+		dispatch_init_wakeup_fds(d);
+	}
 
-	rc = write(global_dispatcher.wakeup_fds[1],&b,1);
+	rc = dispatch_wakeup(d);
 	STK_ASSERT(rc != -1,"Failed to write byte to wakeup pipe %d",errno);
 }
 
+#ifdef EG_DISPATCHER_EPOLL
+/* Remove a specific fd from the epoll set and fdinfo table */
+int dispatch_remove_fd(stk_dispatcher_t *d,int fd)
+{
+	if(dispatch_foreign(d)) return dispatch_queue_fd_op(d,DISPATCH_FD_REMOVE,NULL,fd,NULL,NULL);
+	if(fd < 0 || fd >= d->fdinfo_sz || !d->fdinfo[fd].active) return 0;
+
+	/* Fails if the fd has already been closed, which removed it from the epoll set */
+	if(!d->fdinfo[fd].uring_flow)
+		(void) epoll_ctl(d->epoll_fd,EPOLL_CTL_DEL,fd,NULL);
+	d->fdinfo[fd].active = 0;
+	d->fdinfo[fd].df = NULL;
+	d->nfds--;
+	return 0;
+}
+
+/* Kill the dispatcher and close resources (aka the wakeup pipe and epoll fd) */
+void terminate_dispatcher(stk_dispatcher_t *d)
+{
+	dispatch_remove_fd(d,d->wakeup_fds[0]);
+	close(d->wakeup_fds[0]); /* The eventfd is both wakeup fds */
+	d->wakeup_fds[0] = d->wakeup_fds[1] = -1;
+	if(d->epoll_fd != -1) {
+		close(d->epoll_fd);
+		d->epoll_fd = -1;
+	}
+}
+#else
 /* Remove a specific fdset/fdinfo index sliding the tables down */
 int dispatch_remove_fdidx(stk_dispatcher_t *d,int idx)
 {
@@ -194,10 +629,14 @@ int dispatch_remove_fdidx(stk_dispatcher_t *d,int idx)
 		d->fdset[idx2 - 1].fd = d->fdset[idx2].fd;
 		d->fdset[idx2 - 1].revents = d->fdset[idx2].revents;
 		d->fdinfo[idx2 - 1].hup_cb = d->fdinfo[idx2].hup_cb;
+		d->fdinfo[idx2 - 1].data_cb = d->fdinfo[idx2].data_cb;
 		d->fdinfo[idx2 - 1].df = d->fdinfo[idx2].df;
 		d->fdinfo[idx2 - 1].listening = d->fdinfo[idx2].listening;
 		d->fdinfo[idx2 - 1].accepted = d->fdinfo[idx2].accepted;
 		d->fdinfo[idx2 - 1].pipe = d->fdinfo[idx2].pipe;
+		d->fdinfo[idx2 - 1].timer = d->fdinfo[idx2].timer;
+		d->fdinfo[idx2 - 1].rcv_pending = d->fdinfo[idx2].rcv_pending;
+		d->fdinfo[idx2 - 1].rcv_round = d->fdinfo[idx2].rcv_round;
 	}
 	d->nfds--;
 
@@ -207,6 +646,7 @@ int dispatch_remove_fdidx(stk_dispatcher_t *d,int idx)
 /* Remove a specific fd from the fdset/fdinfo tables */
 int dispatch_remove_fd(stk_dispatcher_t *d,int fd)
 {
+	if(dispatch_foreign(d)) return dispatch_queue_fd_op(d,DISPATCH_FD_REMOVE,NULL,fd,NULL,NULL);
 	for(int idx = 0; idx <= d->nfds; idx++)
 		if(d->nfds > idx && d->fdset[idx].fd == fd) {
 			dispatch_remove_fdidx(d,idx);
@@ -226,10 +666,307 @@ void terminate_dispatcher(stk_dispatcher_t *d)
 /* Function to clear events from the fdset */
 void clear_events(stk_dispatcher_t *d)
 {
-	for(int idx = 0; idx <= MAX_CONNS; idx++) {
+	for(int idx = 0; idx < d->nfds; idx++) {
 		d->fdset[idx].revents = 0;
 	}
 }
+#endif
+
+/* Determine if a data flow has more data to receive without blocking, either buffered by the
+ * data flow or in its socket. Accepted sockets block, so they are not received from until EWOULDBLOCK.
+ */
+static int dispatch_rcv_ready(stk_dispatcher_t *d,int slot,int fd,stk_data_flow_t *df)
+{
+	int avail = 0;
+
+	if(stk_data_flow_buffered(df) == STK_SUCCESS) return 1;
+	if(d->fdinfo[slot].uring_flow) return 0; /* The ring reports when more has been received */
+	return ioctl(fd,FIONREAD,&avail) == 0 && avail > 0;
+}
+
+/* Determine if the dispatcher should receive again from a data flow after receiving a sequence.
+ * Edge triggered fds are not reported again until more data arrives, so they are received from
+ * until the socket is drained, and once more after the peer closed to receive the end of stream.
+ * With a receive budget, fds are received from until they are drained or the budget is spent.
+ */
+static int dispatch_rcv_more(stk_dispatcher_t *d,int slot,int fd,stk_data_flow_t *df,int *peer_closed)
+{
+#ifdef EG_DISPATCHER_EPOLL
+	if(!d->fdinfo[slot].active) return 0; /* Removed by the data callback */
+#else
+	if(slot >= d->nfds || d->fdset[slot].fd != fd) return 0; /* Removed by the data callback */
+#endif
+	if(!d->rcv_budget && !d->fdinfo[slot].edge_triggered)
+		return stk_data_flow_buffered(df) == STK_SUCCESS;
+	if(dispatch_rcv_ready(d,slot,fd,df)) return 1;
+#ifdef EG_DISPATCHER_EPOLL
+	if(d->fdinfo[slot].edge_triggered) {
+		if(*peer_closed) {
+			*peer_closed = 0;
+			return 1;
+		}
+	}
+#endif
+	return 0;
+}
+
+/* Determine if the receive budget for an event has been spent */
+static int dispatch_rcv_budget_spent(stk_dispatcher_t *d,int seqs,stk_uint64 bytes)
+{
+	if(!d->rcv_budget) return 0;
+	return (d->rcv_budget_seqs > 0 && seqs >= d->rcv_budget_seqs) || (d->rcv_budget_bytes > 0 && bytes >= d->rcv_budget_bytes);
+}
+
+/* Add an fd to the list received from in the next round, it spent its budget with data left */
+static void dispatch_rcv_defer(stk_dispatcher_t *d,int slot,int fd)
+{
+	stk_atomic_fetch_add_64(&d->rcv_budget_exhausted,1,STK_MO_RELAXED);
+	if(d->fdinfo[slot].rcv_pending) return; /* Already listed */
+
+	if(d->rcv_pending_n == d->rcv_pending_sz) {
+		int sz = d->rcv_pending_sz ? d->rcv_pending_sz * 2 : 16;
+		int *fds = realloc(d->rcv_pending_fds,sz * sizeof(int));
+		STK_ASSERT(fds!=NULL,"Failed to grow the receive pending list to %d fds",sz);
+		d->rcv_pending_fds = fds;
+		d->rcv_pending_sz = sz;
+	}
+	d->rcv_pending_fds[d->rcv_pending_n++] = fd;
+	d->fdinfo[slot].rcv_pending = 1;
+}
+
+/* Find the slot of an fd in the fdinfo table, or -1 if it has been removed */
+static int dispatch_fd_slot(stk_dispatcher_t *d,int fd)
+{
+#ifdef EG_DISPATCHER_EPOLL
+	return fd < d->fdinfo_sz && d->fdinfo[fd].active ? fd : -1;
+#else
+	for(int idx = 0; idx < d->nfds; idx++)
+		if(d->fdset[idx].fd == fd) return idx;
+	return -1;
+#endif
+}
+
+static void dispatch_fd_events(stk_dispatcher_t *d,stk_env_t *stkbase,int slot,int fd,short revents,int peer_closed);
+
+/* Receive from the fds which spent their budget in an earlier round and were not ready in this one */
+static void dispatch_rcv_pending(stk_dispatcher_t *d,stk_env_t *stkbase)
+{
+	int n = d->rcv_pending_n, kept = 0;
+
+	for(int idx = 0; idx < n; idx++) {
+		int fd = d->rcv_pending_fds[idx];
+		int slot = dispatch_fd_slot(d,fd);
+
+		if(slot == -1 || !d->fdinfo[slot].rcv_pending) continue; /* Removed, or drained */
+		if(d->fdinfo[slot].rcv_round == d->rcv_round) {
+			d->rcv_pending_fds[kept++] = fd; /* Had its turn this round */
+			continue;
+		}
+		dispatch_fd_events(d,stkbase,slot,fd,POLLIN,0);
+		slot = dispatch_fd_slot(d,fd);
+		if(slot != -1 && d->fdinfo[slot].rcv_pending)
+			d->rcv_pending_fds[kept++] = fd;
+	}
+
+	/* Keep the fds listed while receiving, they are not already in the kept list */
+	for(int idx = n; idx < d->rcv_pending_n; idx++)
+		d->rcv_pending_fds[kept++] = d->rcv_pending_fds[idx];
+	d->rcv_pending_n = kept;
+}
+
+#ifdef EG_DISPATCHER_EPOLL
+static void dispatch_uring(stk_dispatcher_t *d,stk_env_t *stkbase);
+#endif
+
+/* Process the events on an fd, slot is its index in the fdinfo table */
+static void dispatch_fd_events(stk_dispatcher_t *d,stk_env_t *stkbase,int slot,int fd,short revents,int peer_closed)
+{
+	int rc;
+
+#ifdef EG_DISPATCHER_EPOLL
+	/* Dispatch the data flows with completions when the io_uring fd is ready */
+	if(d->fdinfo[slot].uring && revents & POLLIN) {
+		dispatch_uring(d,stkbase);
+		return;
+	}
+#endif
+
+	/* Dispatch timers when the env timer fd expires */
+	if(d->fdinfo[slot].timer && revents & POLLIN) {
+		stk_ret ret = stk_env_dispatch_timer_fd(stkbase,0);
+		STK_ASSERT(ret == STK_SUCCESS,"Failed to dispatch timers: %d",ret);
+		return;
+	}
+
+	/* Check for new events on the wakeup pipe */
+	if(d->fdinfo[slot].pipe && revents & POLLIN) {
+		char b[64]; /* Drain multiple wakeups */
+
+		ssize_t rc = read(d->wakeup_fds[0],b,sizeof(b));
+		STK_ASSERT(rc != -1 || errno == EAGAIN,"Failed to read byte from wakeup pipe %d",errno);
+		return;
+	}
+
+	if(d->fdinfo[slot].listening && revents & POLLIN) {
+		stk_data_flow_t *newchannel;
+		STK_LOG(STK_LOG_NORMAL,"Data on well known port");
+		newchannel = stk_tcp_server_accept(d->fdinfo[slot].df);
+		return;
+	}
+
+	if(revents & POLLHUP || revents & POLLNVAL) {
+		if(d->fdinfo[slot].df == NULL) {
+			STK_LOG(STK_LOG_ERROR,"channel %d is null but event received on fd %d",slot,fd);
+			return;
+		}
+
+		if(d->fdinfo[slot].hup_cb)
+			d->fdinfo[slot].hup_cb(d,d->fdinfo[slot].df,fd);
+		else
+			dispatch_remove_fd(d,fd);
+
+		/* Error occurred receiving data from this fd */
+		STK_LOG(STK_LOG_NORMAL,"channel %d deleted, fd %d",slot,fd);
+		return;
+	}
+
+	if(revents & POLLIN) {
+		stk_sequence_t *ret_seq;
+		stk_sequence_t *rcv_seq;
+		stk_data_flow_t *df = d->fdinfo[slot].df;
+		stk_uint64 bytes = 0;
+		int seqs = 0;
+
+		if(d->fdinfo[slot].df == NULL) {
+			STK_LOG(STK_LOG_ERROR,"channel %d is null but event received on fd %d",slot,fd);
+			return;
+		}
+		d->fdinfo[slot].rcv_round = d->rcv_round;
+		stk_set_data_flow_errno(df,0);
+		do {
+			/* Acquire a sequence to receive data */
+			rcv_seq = stk_sequence_pool_acquire(d->seq_pool,"eg_dispatcher",0xfedcba90,STK_SEQUENCE_TYPE_DATA,STK_SERVICE_TYPE_DATA);
+			STK_ASSERT(rcv_seq!=NULL,"Failed to allocate rcv test sequence");
+
+			/* Receive data from this connection */
+			ret_seq = stk_data_flow_rcv(df,rcv_seq,0);
+			if(ret_seq == NULL) {
+				if(stk_data_flow_errno(df) == 0 && d->fdinfo[slot].accepted) {
+					/* Error occurred receiving data from this fd, and it was created by the dispatch loop - destroy */
+					stk_ret rc;
+
+					dispatch_remove_fd(d,fd);
+					if(d->workers) stk_worker_pool_flush(d->workers);
+
+					rc = stk_destroy_data_flow(df);
+					STK_ASSERT(rc==STK_SUCCESS,"Failed to destroy the live tcp data flow: %d",rc);
+
+					STK_LOG(STK_LOG_NORMAL,"channel %d [%p] deleted",slot,df);
+					df = NULL;
+				}
+				rc = stk_sequence_pool_release(d->seq_pool,rcv_seq);
+				STK_ASSERT(rc==STK_SUCCESS,"Failed to release the test sequence : %d",rc);
+				break;
+			}
+			else
+			{
+				seqs++;
+				if(d->rcv_budget_bytes) bytes += stk_sequence_total_size(ret_seq);
+
+				/* Process the data received on this connection, or have a worker process it */
+				if(d->workers) {
+					stk_ret ret = stk_worker_pool_dispatch(d->workers,df,ret_seq,0);
+					STK_ASSERT(ret==STK_SUCCESS,"Failed to dispatch sequence to workers : %d",ret);
+				} else
+				if(d->fdinfo[slot].data_cb)
+					d->fdinfo[slot].data_cb(d,df,ret_seq);
+			}
+
+			/* Return the sequence and its buffers to the pool */
+			rc = stk_sequence_pool_release(d->seq_pool,rcv_seq);
+			STK_ASSERT(rc==STK_SUCCESS,"Failed to release the test sequence : %d",rc);
+		} while(df && dispatch_rcv_more(d,slot,fd,df,&peer_closed) && !dispatch_rcv_budget_spent(d,seqs,bytes));
+
+		stk_atomic_fetch_add_64(&d->rcv_events,1,STK_MO_RELAXED);
+		stk_atomic_fetch_add_64(&d->rcv_seqs,seqs,STK_MO_RELAXED);
+
+		/* Receiving stopped when the data flow was drained, or the budget was spent before it was */
+		if(df && d->rcv_budget && (slot = dispatch_fd_slot(d,fd)) != -1) {
+			if(dispatch_rcv_budget_spent(d,seqs,bytes) && (dispatch_rcv_ready(d,slot,fd,df) || peer_closed))
+				dispatch_rcv_defer(d,slot,fd);
+			else
+				d->fdinfo[slot].rcv_pending = 0;
+		}
+	}
+}
+
+#ifdef EG_DISPATCHER_EPOLL
+typedef struct {
+	stk_dispatcher_t *d;
+	stk_env_t *stkbase;
+} dispatch_uring_ctx_t;
+
+/* Dispatch a data flow with io_uring completions as if poll() had reported its fd */
+static void dispatch_uring_cb(stk_uring_t *ring,stk_data_flow_t *df,int fd,int events,void *clientd)
+{
+	dispatch_uring_ctx_t *ctx = (dispatch_uring_ctx_t *) clientd;
+	stk_dispatcher_t *d = ctx->d;
+
+	if(fd >= d->fdinfo_sz || !d->fdinfo[fd].active || d->fdinfo[fd].df != df) return; /* Not added to this dispatcher */
+
+	dispatch_fd_events(d,ctx->stkbase,fd,fd,events & STK_URING_HUP ? POLLHUP : POLLIN,0);
+}
+
+static void dispatch_uring(stk_dispatcher_t *d,stk_env_t *stkbase)
+{
+	dispatch_uring_ctx_t ctx = { d, stkbase };
+	stk_ret ret = stk_uring_process(d->uring,dispatch_uring_cb,&ctx);
+	STK_ASSERT(ret == STK_SUCCESS,"Failed to process io_uring completions: %d",ret);
+}
+#endif
+
+/* Wait for events on the fds for up to timeout ms (-1 to wait until there are events) */
+static int dispatch_poll_fds(stk_dispatcher_t *d,int timeout)
+{
+#ifdef EG_DISPATCHER_EPOLL
+	return epoll_wait(d->epoll_fd,d->events,EG_EPOLL_EVENTS,timeout);
+#else
+	return poll(d->fdset,d->nfds,timeout);
+#endif
+}
+
+/* Wait for events, spinning with non blocking polls for up to the spin budget before sleeping.
+ * The spin counts towards the timeout, so timers are not dispatched late.
+ */
+static int dispatch_wait(stk_dispatcher_t *d,int timeout)
+{
+	if(d->spin_us > 0 && timeout != 0) {
+		struct timeval start, now;
+		long spin_us = d->spin_us, spun_us;
+		int rc;
+
+		if(timeout > 0 && (long) timeout * 1000 < spin_us)
+			spin_us = (long) timeout * 1000;
+
+		stk_now_precise(&start);
+		do {
+			rc = dispatch_poll_fds(d,0);
+			stk_atomic_fetch_add_64(&d->spin_polls,1,STK_MO_RELAXED);
+			if(rc != 0) {
+				if(rc > 0) stk_atomic_fetch_add_64(&d->spin_hits,1,STK_MO_RELAXED);
+				return rc;
+			}
+			if(d->end_dispatch || d->stop_reactor) return 0;
+			stk_now_precise(&now);
+			spun_us = ((now.tv_sec - start.tv_sec) * 1000000) + (now.tv_usec - start.tv_usec);
+		} while(spun_us < spin_us);
+
+		if(timeout > 0)
+			timeout = spun_us / 1000 < timeout ? timeout - (int) (spun_us / 1000) : 0;
+	}
+	if(timeout != 0) stk_atomic_fetch_add_64(&d->sleeps,1,STK_MO_RELAXED);
+	return dispatch_poll_fds(d,timeout);
+}
 
 /* An example generic dispatcher that handles timers, server data flows
  * and client data flows.
@@ -237,6 +974,8 @@ void clear_events(stk_dispatcher_t *d)
  *   IMPORTANT: It does not dictate how quickly the function returns, it is really
  *   only relevant when trying to limit time time it takes to detect an exit event
  *   or when trying to use it in a polling mode where max_idle_time is set to 0.
+ *   When the env has a timer fd, the dispatcher sleeps until the timer fd or another
+ *   fd is ready (or stop_dispatching() is called) so only 0 is significant.
  */
 void eg_dispatcher(stk_dispatcher_t *d,stk_env_t *stkbase,int max_idle_time)
 {
@@ -249,11 +988,33 @@ void eg_dispatcher(stk_dispatcher_t *d,stk_env_t *stkbase,int max_idle_time)
 		d->end_dispatch = 0;
 
 	dispatch_init_wakeup_fds(d);
+	if(!d->reactors || d->reactor_idx == 0)
+		dispatch_init_timer_fd(d,stkbase);
+
+	/* Receive sequences are recycled through a pool so their buffers are reused */
+	if(!d->seq_pool) {
+		d->seq_pool = stk_create_sequence_pool(stkbase,NULL);
+		STK_ASSERT(d->seq_pool!=NULL,"Failed to create dispatcher sequence pool");
+	}
 
 	while(1) {
+		/* Wakeups from here on must be written, the dispatcher may sleep after calculating the time to sleep */
+		stk_atomic_store_32(&d->wakeup_pending,0,STK_MO_SEQ_CST);
+
+		/* Read the clock once for the timers dispatched in this iteration */
+		stk_clock_cache_update();
+
+		/* Add and remove the fds handed off by other threads */
+		dispatch_apply_fd_ops(d);
+
 		/* Determine the time until the next timer will fire */
-		expiration_time = stk_next_timer_ms_in_pool(stkbase);
-		if(expiration_time == -1)
+		if(d->reactors && d->reactor_idx > 0)
+			expiration_time = max_idle_time; /* Only the first reactor dispatches the env timers */
+		else
+		if(d->timer_fd_added)
+			expiration_time = max_idle_time == 0 ? 0 : -1; /* Timers are dispatched when the timer fd is ready */
+		else
+		if((expiration_time = stk_next_timer_ms_in_pool(stkbase)) == -1)
 			expiration_time = max_idle_time;
 		else
 		{
@@ -263,111 +1024,95 @@ void eg_dispatcher(stk_dispatcher_t *d,stk_env_t *stkbase,int max_idle_time)
 				expiration_time = max_idle_time;
 		}
 
+		/* Dispatch the reactor's own timers */
+		if(d->reactor_timers) {
+			int ms;
+			stk_ret ret = stk_dispatch_timers(d->reactor_timers,0);
+			STK_ASSERT(ret == STK_SUCCESS,"Failed to dispatch reactor timers: %d",ret);
+
+			ms = stk_next_timer_ms(d->reactor_timers);
+			if(ms != -1 && (expiration_time == -1 || ms < expiration_time))
+				expiration_time = ms;
+		}
+
+		/* Don't sleep while fds which spent their receive budget have data left */
+		if(d->rcv_pending_n > 0)
+			expiration_time = 0;
+
+#ifdef EG_DISPATCHER_EPOLL
+		/* Submit the requests queued on the io_uring (e.g. sends) in one batch before sleeping,
+		 * and don't sleep if receiving reaped completions for data flows not yet dispatched
+		 */
+		if(d->uring) {
+			if(stk_uring_pending(d->uring))
+				dispatch_uring(d,stkbase);
+			else
+				stk_uring_submit(d->uring);
+			if(stk_uring_pending(d->uring))
+				expiration_time = 0;
+		}
+
+		/* Call epoll_wait() to wait for events */
+		do {
+			if(d->end_dispatch || d->stop_reactor) break;
+
+			rc = dispatch_wait(d,expiration_time);
+		} while(rc == -1 && errno == EINTR);
+		if(d->end_dispatch || d->stop_reactor) break;
+
+		STK_ASSERT(rc>=0,"epoll_wait returned error %d %d",rc,errno);
+#else
 		/* Clear events */
 		clear_events(d);
 
 		/* Call poll() to wait for events */
 		do {
-			if(d->end_dispatch) break;
+			if(d->end_dispatch || d->stop_reactor) break;
 
-			rc = poll(d->fdset,d->nfds,expiration_time);
+			rc = dispatch_wait(d,expiration_time);
 		} while(rc == -1 && errno == EINTR);
-		if(d->end_dispatch) break;
+		if(d->end_dispatch || d->stop_reactor) break;
 
 		STK_ASSERT(rc>=0,"poll returned error %d %d",rc,errno);
+#endif
 
-		if(rc == 0) continue; /* Timed out, nothing to check */
-		if(rc == -1) continue; /* Error occurred, no FD activity to process */
-
-		/* Iterate over the connections fd's to see if there is data, and process */
-		for(int idx = 0; idx < d->nfds; idx++) {
-			/* Check for new events on the wakeup pipe */
-			if(d->fdinfo[idx].pipe && d->fdset[idx].revents & POLLIN) {
-				char b;
-
-				ssize_t rc = read(d->wakeup_fds[0],&b,1);
-				STK_ASSERT(rc != -1,"Failed to read byte from wakeup pipe %d",errno);
-				continue;
-			}
-
-			if(d->fdinfo[idx].listening && d->fdset[idx].revents & POLLIN) {
-				stk_data_flow_t *newchannel;
-				STK_LOG(STK_LOG_NORMAL,"Data on well known port");
-				newchannel = stk_tcp_server_accept(d->fdinfo[idx].df);
-				continue;
-			}
-
-			if(d->fdset[idx].revents & POLLHUP || d->fdset[idx].revents & POLLNVAL) {
-				int fd = d->fdset[idx].fd;
+		/* Each fd is received from at most once per round, see dispatch_rcv_pending() */
+		d->rcv_round++;
 
-				if(d->fdinfo[idx].df == NULL) {
-					STK_LOG(STK_LOG_ERROR,"channel %d is null but event received on fd %d",idx,d->fdset[idx].fd);
-					continue;
-				}
+		if(rc == 0) {
+			/* Timed out, only the fds which spent their receive budget to check */
+			dispatch_rcv_pending(d,stkbase);
+			continue;
+		}
 
-				if(d->fdinfo[idx].hup_cb)
-					d->fdinfo[idx].hup_cb(d,d->fdinfo[idx].df,d->fdset[idx].fd);
-				else
-					dispatch_remove_fd(d,d->fdset[idx].fd);
+		/* ... and once for the data received after poll() */
+		stk_clock_cache_update();
+		if(rc == -1) continue; /* Error occurred, no FD activity to process */
 
-				/* Error occurred receiving data from this fd */
-				STK_LOG(STK_LOG_NORMAL,"channel %d deleted, fd %d",idx,fd);
-				continue;
-			}
+#ifdef EG_DISPATCHER_EPOLL
+		/* Process the fds which have events */
+		for(int idx = 0; idx < rc; idx++) {
+			int fd = d->events[idx].data.fd;
+			short revents = 0;
 
-			if(d->fdset[idx].revents & POLLIN) {
-				ssize_t len;
-				stk_sequence_t *ret_seq;
-				stk_sequence_t *rcv_seq;
-				stk_data_flow_t *df = d->fdinfo[idx].df;
+			if(fd >= d->fdinfo_sz || !d->fdinfo[fd].active) continue; /* Removed by an earlier callback */
 
-				if(d->fdinfo[idx].df == NULL) {
-					STK_LOG(STK_LOG_ERROR,"channel %d is null but event received on fd %d",idx,d->fdset[idx].fd);
-					continue;
-				}
-				stk_set_data_flow_errno(df,0);
-				do {
-					/* Allocate a sequence to receive data */
-					rcv_seq = stk_create_sequence(stkbase,"eg_dispatcher",0xfedcba90,STK_SEQUENCE_TYPE_DATA,STK_SERVICE_TYPE_DATA,NULL);
-					STK_ASSERT(rcv_seq!=NULL,"Failed to allocate rcv test sequence");
-
-					/* Receive data from this connection */
-					ret_seq = stk_data_flow_rcv(df,rcv_seq,0);
-					if(ret_seq == NULL) {
-/* a df could be removed at this point, so this would access the wrong d->fdinfo */
-if(stk_data_flow_errno(df) != 0) break;
-						if(d->fdinfo[idx].accepted) {
-							/* Error occurred receiving data from this fd, and it was created by the dispatch loop - destroy */
-							stk_ret rc;
-
-							rc = stk_destroy_data_flow(d->fdinfo[idx].df);
-							STK_ASSERT(rc==STK_SUCCESS,"Failed to destroy the live tcp data flow: %d",rc);
-
-							STK_LOG(STK_LOG_NORMAL,"channel %d [%p] deleted",idx,d->fdinfo[idx].df);
-							d->fdinfo[idx].df = NULL;
-							df = NULL;
-
-							dispatch_remove_fdidx(d,idx);
-						}
-						rc = stk_destroy_sequence(rcv_seq);
-						STK_ASSERT(rc==STK_SUCCESS,"Failed to destroy the test sequence : %d",rc);
-						break;
-					}
-					else
-					{
-						/* Process the data received on this connection */
-						if(d->fdinfo[idx].data_cb)
-							d->fdinfo[idx].data_cb(d,df,ret_seq);
-					}
-
-					/* free the data in the sequence */
-					rc = stk_destroy_sequence(rcv_seq);
-					STK_ASSERT(rc==STK_SUCCESS,"Failed to destroy the test sequence : %d",rc);
-				} while(df && stk_data_flow_buffered(df) == STK_SUCCESS);
-				continue;
-			}
+			if(d->events[idx].events & (EPOLLIN|EPOLLRDHUP)) revents |= POLLIN;
+			if(d->events[idx].events & EPOLLHUP) revents |= POLLHUP;
+			dispatch_fd_events(d,stkbase,fd,fd,revents,d->events[idx].events & EPOLLRDHUP ? 1 : 0);
 		}
+#else
+		/* Iterate over the connections fd's to see if there is data, and process */
+		for(int idx = 0; idx < d->nfds; idx++)
+			dispatch_fd_events(d,stkbase,idx,d->fdset[idx].fd,d->fdset[idx].revents,0);
+#endif
+
+		/* Then the fds which spent their receive budget and were not ready again */
+		dispatch_rcv_pending(d,stkbase);
 	}
+
+	/* Callers of the dispatcher may use the clock directly */
+	stk_clock_cache_clear();
 }
 
 int timedout = 0;
@@ -446,3 +1191,142 @@ void stk_set_dispatcher_user_data(stk_dispatcher_t *d,void *user_data) { d->user
 
 /* Get the user data for a dispatcher */
 void *stk_get_dispatcher_user_data(stk_dispatcher_t *d) { return d->user_ref; }
+
+/* Get the sequence pool used to receive data (NULL until the dispatcher has run) */
+stk_sequence_pool_t *dispatcher_sequence_pool(stk_dispatcher_t *d) { return d->seq_pool; }
+
+/* Wake a reactor when other threads queue timer requests to its timer set */
+static void reactor_timers_wakeup(stk_timer_set_t *timer_set,void *user_setdata)
+{
+	stk_dispatcher_t *d = (stk_dispatcher_t *) user_setdata;
+	STK_ASSERT(dispatch_wakeup(d) != -1,"Failed to wake reactor %d for timer requests, errno %d",d->reactor_idx,errno);
+}
+
+/* The main loop of a reactor thread, which owns the reactor's fds and timer set */
+static void *reactor_main(void *arg)
+{
+	stk_dispatcher_t *d = (stk_dispatcher_t *) arg;
+	stk_env_t *stkbase = d->reactors->env;
+	stk_options_t options[] = { { "timer_owner_thread", (void *) STK_TRUE },
+		{ "timer_wakeup_cb", (void *) reactor_timers_wakeup }, { NULL, NULL } };
+
+	current_reactor = d;
+	d->reactor_timers = stk_new_timer_set_with_options(stkbase,d,0,STK_FALSE,options);
+	STK_ASSERT(d->reactor_timers!=NULL,"Failed to create timer set for reactor %d",d->reactor_idx);
+	stk_atomic_store_32(&d->reactor_ready,1,STK_MO_RELEASE);
+
+	while(!d->stop_reactor) eg_dispatcher(d,stkbase,DEFAULT_EXPIRATION_TIME);
+
+	STK_ASSERT(stk_free_timer_set(d->reactor_timers,STK_TRUE) == STK_SUCCESS,"Failed to free timer set of reactor %d",d->reactor_idx);
+	d->reactor_timers = NULL;
+	current_reactor = NULL;
+	return NULL;
+}
+
+/*
+ * Allocate a set of reactors - dispatchers which each run in their own thread
+ * and own their fds and timer set, so socket I/O is spread over multiple cores.
+ * The first reactor also dispatches the env timers.
+ */
+eg_reactors_t *alloc_reactors(stk_env_t *stkbase,int nreactors)
+{
+	eg_reactors_t *r;
+
+	if(nreactors <= 0) return NULL;
+
+	r = calloc(1,sizeof(eg_reactors_t));
+	if(!r) return NULL;
+	r->reactors = calloc(nreactors,sizeof(stk_dispatcher_t *));
+	if(!r->reactors) {
+		free(r);
+		return NULL;
+	}
+	r->env = stkbase;
+	r->nreactors = nreactors;
+
+	for(int idx = 0; idx < nreactors; idx++) {
+		stk_dispatcher_t *d = alloc_dispatcher();
+		STK_ASSERT(d!=NULL,"Failed to allocate reactor %d",idx);
+		d->reactors = r;
+		d->reactor_idx = idx;
+		dispatch_init_wakeup_fds(d);
+		r->reactors[idx] = d;
+	}
+	return r;
+}
+
+/* Start the reactor threads, returning when they are ready to have timers scheduled */
+int start_reactors(eg_reactors_t *r)
+{
+	for(int idx = 0; idx < r->nreactors; idx++) {
+		stk_dispatcher_t *d = r->reactors[idx];
+		int rc;
+
+		d->reactor_running = 1;
+		rc = pthread_create(&d->reactor_thread,NULL,reactor_main,d);
+		if(rc != 0) {
+			d->reactor_running = 0;
+			STK_LOG(STK_LOG_ERROR,"Failed to start reactor %d thread, rc %d",idx,rc);
+			return -1;
+		}
+	}
+	for(int idx = 0; idx < r->nreactors; idx++)
+		while(!stk_atomic_load_32(&r->reactors[idx]->reactor_ready,STK_MO_ACQUIRE)) usleep(100);
+	stk_atomic_store_ptr(&env_timers_reactor,r->reactors[0],STK_MO_RELEASE);
+	return 0;
+}
+
+/* Stop the reactor threads and wait for them to exit */
+void stop_reactors(eg_reactors_t *r)
+{
+	stk_dispatcher_t *env_timers_d = r->reactors[0];
+
+	(void) stk_atomic_cas_ptr(&env_timers_reactor,&env_timers_d,NULL,STK_MO_RELEASE);
+	for(int idx = 0; idx < r->nreactors; idx++) {
+		stk_dispatcher_t *d = r->reactors[idx];
+
+		if(!d->reactor_running) continue;
+		d->stop_reactor = 1;
+		STK_ASSERT(dispatch_wakeup(d) != -1,"Failed to wake reactor %d, errno %d",idx,errno);
+	}
+	for(int idx = 0; idx < r->nreactors; idx++) {
+		stk_dispatcher_t *d = r->reactors[idx];
+
+		if(!d->reactor_running) continue;
+		STK_ASSERT(pthread_join(d->reactor_thread,NULL) == 0,"Failed to join reactor %d thread",idx);
+		d->reactor_running = 0;
+		dispatch_apply_fd_ops(d); /* Free fd ops queued while stopping */
+	}
+}
+
+/* Free reactors, which must have been stopped */
+void free_reactors(eg_reactors_t *r)
+{
+	for(int idx = 0; idx < r->nreactors; idx++) {
+		terminate_dispatcher(r->reactors[idx]);
+		free_dispatcher(r->reactors[idx]);
+	}
+	free(r->reactors);
+	free(r);
+}
+
+/* Get the number of reactors */
+int reactor_count(eg_reactors_t *r) { return r->nreactors; }
+
+/* Get a reactor by index (modulo the number of reactors), so services may pin their fds and timers to a reactor */
+stk_dispatcher_t *reactor_dispatcher(eg_reactors_t *r,int idx) { return r->reactors[(unsigned) idx % r->nreactors]; }
+
+/* Get the next reactor in round robin order, to distribute accepted data flows across the reactors */
+stk_dispatcher_t *next_reactor(eg_reactors_t *r)
+{
+	return r->reactors[stk_atomic_fetch_add_32(&r->next,1,STK_MO_RELAXED) % r->nreactors];
+}
+
+/* Get the reactor running on this thread, or the default dispatcher if this thread is not a reactor */
+stk_dispatcher_t *current_dispatcher() { return current_reactor ? current_reactor : default_dispatcher(); }
+
+/* Get the timer set owned by a reactor thread (NULL if the dispatcher is not a running reactor).
+ * Timers should be scheduled from the reactor's callbacks, timers scheduled by
+ * other threads wake the reactor to apply them.
+ */
+stk_timer_set_t *reactor_timer_set(stk_dispatcher_t *d) { return d->reactor_timers; }
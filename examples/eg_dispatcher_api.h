@@ -2,6 +2,10 @@
 #define EG_DISPATCHER_API_H
 #include "stk_env.h"
 #include "stk_data_flow.h"
+#include "stk_sequence_pool.h"
+#include "stk_timer.h"
+#include "stk_uring.h"
+#include "stk_worker_pool.h"
 
 /*
  * This example dispatcher provides an example main loop and is used by the
@@ -14,9 +18,41 @@
  *
  * Applications must provide a process_data() function. It is expected
  * that customers change/modify this dispatcher as they need.
+ *
+ * On Linux the dispatcher uses epoll and has no limit on the number of fds,
+ * elsewhere (or when built with EG_DISPATCHER_POLL) it uses poll() and is
+ * limited to MAX_CONNS fds. dispatch_set_edge_triggered() adds data flow fds
+ * to epoll edge triggered.
+ *
+ * A process may run multiple reactors (see alloc_reactors()), each a dispatcher
+ * running in its own thread which owns its fds and timer set. fds may be added to
+ * and removed from any reactor by any thread, they are handed off to the reactor.
+ * Accepted data flows may be spread across the reactors with next_reactor(), or
+ * each reactor may have its own listening data flow created with the "reuseport" option.
+ *
+ * TCP data flows created with the "io_uring" option are serviced by the ring
+ * set with dispatch_set_uring(), which is polled instead of their fds (epoll only).
+ * Each reactor needs its own ring.
+ *
+ * Latency critical services may use dispatch_set_busy_poll() to have a dispatcher
+ * spin on non blocking polls for a while before sleeping, optionally setting SO_BUSY_POLL
+ * on its sockets. dispatcher_spin_stats() reports how often spinning found events versus
+ * how often the dispatcher slept, to tune the spin budget.
+ *
+ * So slow processing does not stall every fd of a dispatcher, dispatch_set_worker_pool()
+ * hands the sequences received to a worker pool (see stk_worker_pool_api.h) to be processed
+ * on its threads. When a worker falls behind, the dispatcher waits for space in its queue.
+ * The pool's "shard_key" option spreads one busy connection across the workers while keeping
+ * each key in order, see pipeline_test.c.
+ *
+ * By default one read is made from an fd each time it is ready. dispatch_set_rcv_budget() has the
+ * dispatcher receive until the data flow is drained or a budget of sequences or bytes is spent,
+ * then move on to the other ready fds and return to it in the next round. dispatcher_rcv_stats()
+ * reports how often the budget was spent, to tune latency against throughput.
  */
 
 typedef struct stk_dispatcher_stct stk_dispatcher_t;
+typedef struct eg_reactors_stct eg_reactors_t;
 typedef void (*fd_hup_cb)(stk_dispatcher_t *d,stk_data_flow_t *flow,int fd);
 typedef void (*fd_data_cb)(stk_dispatcher_t *d,stk_data_flow_t *rcvchannel,stk_sequence_t *rcv_seq);
 
@@ -36,5 +72,23 @@ void *stk_get_dispatcher_user_data(stk_dispatcher_t *d);
 int server_dispatch_add_fd(stk_dispatcher_t *d,int fd,stk_data_flow_t *df,fd_data_cb data_cb);
 void eg_dispatcher(stk_dispatcher_t *d,stk_env_t *stkbase,int max_idle_time);
 int dispatch_add_accepted_fd(stk_dispatcher_t *d,int fd,stk_data_flow_t *df,fd_data_cb cb);
+stk_sequence_pool_t *dispatcher_sequence_pool(stk_dispatcher_t *d);
+int dispatch_set_edge_triggered(stk_dispatcher_t *d,int edge_triggered);
+void dispatcher_wakeup_stats(stk_dispatcher_t *d,stk_uint64 *issued,stk_uint64 *suppressed);
+int dispatch_set_uring(stk_dispatcher_t *d,stk_uring_t *ring);
+int dispatch_set_busy_poll(stk_dispatcher_t *d,int spin_us,int sock_busy_poll_us);
+void dispatch_set_worker_pool(stk_dispatcher_t *d,stk_worker_pool_t *pool);
+void dispatcher_spin_stats(stk_dispatcher_t *d,stk_uint64 *spin_polls,stk_uint64 *spin_hits,stk_uint64 *sleeps);
+int dispatch_set_rcv_budget(stk_dispatcher_t *d,int max_seqs,stk_uint64 max_bytes);
+void dispatcher_rcv_stats(stk_dispatcher_t *d,stk_uint64 *rcv_events,stk_uint64 *rcv_seqs,stk_uint64 *budget_exhausted);
+eg_reactors_t *alloc_reactors(stk_env_t *stkbase,int nreactors);
+int start_reactors(eg_reactors_t *r);
+void stop_reactors(eg_reactors_t *r);
+void free_reactors(eg_reactors_t *r);
+int reactor_count(eg_reactors_t *r);
+stk_dispatcher_t *reactor_dispatcher(eg_reactors_t *r,int idx);
+stk_dispatcher_t *next_reactor(eg_reactors_t *r);
+stk_dispatcher_t *current_dispatcher();
+stk_timer_set_t *reactor_timer_set(stk_dispatcher_t *d);
 
 #endif
@@ -0,0 +1,332 @@
+/*
+ * Copyright Dave Trollope 2015
+ *
+ * This file implements a benchmark of sharded processing of the sequences received on one
+ * busy TCP connection. A sender thread sends sequences for a number of keys (think instruments)
+ * and the dispatcher hands them to a worker pool, which shards them across its workers by key.
+ * Each worker checks the sequences of its keys arrive in order and simulates the work of processing them.
+ *
+ * The test is repeated with 1, 2, 4... workers to show how processing scales with the number
+ * of workers while the order of each key is preserved. Keying by data flow puts every sequence
+ * of the connection on one worker, for comparison.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <string.h>
+#include <strings.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include "stk_env_api.h"
+#include "stk_sequence_api.h"
+#include "stk_data_flow_api.h"
+#include "stk_tcp_server_api.h"
+#include "stk_tcp_client_api.h"
+#include "stk_tcp.h"
+#include "stk_clock_api.h"
+#include "stk_worker_pool_api.h"
+#include "eg_dispatcher_api.h"
+
+/* Use examples header for asserts */
+#include "stk_examples.h"
+
+/* User types of the sequence elements sent */
+#define PIPELINE_COUNT_TYPE 0x1
+#define PIPELINE_KEY_TYPE 0x2
+
+struct cmdopts {
+	int max_workers;
+	int keys;
+	int seqs;
+	int spin_us;
+	int sleep_us;
+	char *shard_key;
+	char *port;
+} opts;
+
+stk_env_t *stkbase;
+stk_dispatcher_t *d;
+stk_data_flow_t *client_df;
+stk_uint32 *next_count;         /* The count each key expects next, only updated by the key's worker */
+volatile stk_uint32 accepted_destroyed;
+
+void usage()
+{
+	fprintf(stderr,"Usage: pipeline_test [options]\n");
+	fprintf(stderr,"       -h                        : This help!\n");
+	fprintf(stderr,"       -w #                      : Maximum number of workers [default 8]\n");
+	fprintf(stderr,"       -k #                      : Number of keys [default 64]\n");
+	fprintf(stderr,"       -s #                      : Number of sequences [default 100000]\n");
+	fprintf(stderr,"       -u #                      : Microseconds of CPU work per sequence [default 5]\n");
+	fprintf(stderr,"       -b #                      : Microseconds each sequence blocks, e.g. on a downstream call [default 0]\n");
+	fprintf(stderr,"       -K <id|type|flow>         : Shard by sequence ID, user type element or data flow [default id]\n");
+	fprintf(stderr,"       -p <port>                 : Port of the connection [default 29320]\n");
+}
+
+int process_cmdline(int argc,char *argv[],struct cmdopts *opts)
+{
+	int rc;
+
+	while(1) {
+		rc = getopt(argc, argv, "hw:k:s:u:b:K:p:");
+		if(rc == -1) return 0;
+
+		switch(rc) {
+		case 'h': /* Help! */
+			usage();
+			exit(0);
+
+		case 'w': /* Maximum number of workers */
+			opts->max_workers = atoi(optarg);
+			if(opts->max_workers <= 0) return -1;
+			break;
+
+		case 'k': /* Number of keys */
+			opts->keys = atoi(optarg);
+			if(opts->keys <= 0) return -1;
+			break;
+
+		case 's': /* Number of sequences */
+			opts->seqs = atoi(optarg);
+			if(opts->seqs <= 0) return -1;
+			break;
+
+		case 'u': /* CPU work per sequence */
+			opts->spin_us = atoi(optarg);
+			break;
+
+		case 'b': /* Blocking time per sequence */
+			opts->sleep_us = atoi(optarg);
+			break;
+
+		case 'K': /* The key sequences are sharded by */
+			if(strcasecmp(optarg,"id") == 0) opts->shard_key = "sequence_id";
+			else
+			if(strcasecmp(optarg,"type") == 0) opts->shard_key = "user_type";
+			else
+			if(strcasecmp(optarg,"flow") == 0) opts->shard_key = "data_flow";
+			else
+				return -1;
+			break;
+
+		case 'p': /* Port of the connection */
+			opts->port = optarg;
+			break;
+
+		default:
+			return -1;
+		}
+	}
+	return 0;
+}
+
+stk_uint64 now_us()
+{
+	struct timeval tv;
+
+	stk_now_precise(&tv);
+	return (stk_uint64) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* Process a sequence on a worker - check its key is in order and simulate the work */
+void process_seq(stk_worker_pool_t *pool,stk_data_flow_t *df,stk_sequence_t *seq,void *clientd)
+{
+	stk_uint32 *key, *count;
+	stk_uint64 sz;
+	stk_ret rc;
+
+	if(stk_get_sequence_type(seq) != STK_SEQUENCE_TYPE_DATA) return;
+
+	rc = stk_sequence_find_data_by_type(seq,PIPELINE_KEY_TYPE,(void **) &key,&sz);
+	STK_ASSERT(rc==STK_SUCCESS && sz==sizeof(*key),"Failed to find the key of sequence %lu",stk_get_sequence_id(seq));
+	rc = stk_sequence_find_data_by_type(seq,PIPELINE_COUNT_TYPE,(void **) &count,&sz);
+	STK_ASSERT(rc==STK_SUCCESS && sz==sizeof(*count),"Failed to find the count of sequence %lu",stk_get_sequence_id(seq));
+	STK_ASSERT(*count==next_count[*key],"Key %u received count %u, expected %u",*key,*count,next_count[*key]);
+	next_count[*key]++;
+
+	if(opts.spin_us > 0) {
+		stk_uint64 until = now_us() + opts.spin_us;
+		while(now_us() < until);
+	}
+	if(opts.sleep_us > 0) {
+		struct timespec ts = { 0, opts.sleep_us * 1000 };
+		nanosleep(&ts,NULL);
+	}
+}
+
+/* Send the sequences of each key in turn on the one connection */
+void *sender(void *arg)
+{
+	for(int i = 0; i < opts.seqs; i++) {
+		stk_uint32 key = (stk_uint32) (i % opts.keys);
+		stk_uint32 count = (stk_uint32) (i / opts.keys);
+		stk_sequence_t *seq = stk_create_sequence(stkbase,NULL,key + 1,STK_SEQUENCE_TYPE_DATA,STK_SERVICE_TYPE_DATA,NULL);
+		stk_ret rc;
+
+		STK_ASSERT(seq!=NULL,"Failed to create sequence %d",i);
+		rc = stk_copy_to_sequence(seq,&key,sizeof(key),PIPELINE_KEY_TYPE);
+		STK_ASSERT(rc==STK_SUCCESS,"Failed to copy key to sequence %d",i);
+		rc = stk_copy_to_sequence(seq,&count,sizeof(count),PIPELINE_COUNT_TYPE);
+		STK_ASSERT(rc==STK_SUCCESS,"Failed to copy count to sequence %d",i);
+		rc = stk_data_flow_send(client_df,seq,0);
+		STK_ASSERT(rc==STK_SUCCESS,"Failed to send sequence %d",i);
+		stk_destroy_sequence(seq);
+	}
+	return NULL;
+}
+
+void fd_created_cb(stk_data_flow_t *df,stk_data_flow_id id,int fd)
+{
+	int rc = 0;
+
+	/* The client data flow is only sent on, by the sender thread */
+	switch(stk_get_data_flow_type(df)) {
+	case STK_TCP_SERVER_FLOW: rc = server_dispatch_add_fd(d,fd,df,NULL); break;
+	case STK_TCP_ACCEPTED_FLOW: rc = dispatch_add_accepted_fd(d,fd,df,NULL); break;
+	default: break;
+	}
+	STK_ASSERT(rc==0,"Failed to add fd %d to dispatcher",fd);
+}
+
+void fd_destroyed_cb(stk_data_flow_t *df,stk_data_flow_id id,int fd)
+{
+	if(stk_get_data_flow_type(df) == STK_TCP_CLIENT_FLOW) return;
+
+	dispatch_remove_fd(d,fd);
+	if(stk_get_data_flow_type(df) == STK_TCP_ACCEPTED_FLOW)
+		accepted_destroyed++;
+}
+
+/* Run the test with a number of workers, returning the sequences processed per second */
+double run_workers(int nworkers)
+{
+	char workers_str[16];
+	stk_options_t pool_options[] = { { "workers", workers_str }, { "shard_key", opts.shard_key },
+		{ "shard_user_type", "0x2" }, { NULL, NULL } };
+	stk_options_t client_options[] = { { "connect_address", "127.0.0.1"}, {"connect_port", opts.port}, { "nodelay", (void *) STK_TRUE},
+		{ "fd_created_cb", (void *) fd_created_cb }, { "fd_destroyed_cb", (void *) fd_destroyed_cb }, { NULL, NULL } };
+	stk_worker_pool_stats_t stats;
+	stk_worker_pool_t *pool;
+	stk_uint64 start, elapsed, busiest = 0;
+	pthread_t sender_thread;
+	stk_ret rc;
+
+	snprintf(workers_str,sizeof(workers_str),"%d",nworkers);
+	pool = stk_create_worker_pool(stkbase,process_seq,NULL,pool_options);
+	STK_ASSERT(pool!=NULL,"Failed to create a worker pool of %d workers",nworkers);
+	dispatch_set_worker_pool(d,pool);
+	memset(next_count,0,opts.keys * sizeof(*next_count));
+	accepted_destroyed = 0;
+
+	client_df = stk_tcp_client_create_data_flow(stkbase,"pipeline client",2,client_options);
+	STK_ASSERT(client_df!=NULL,"Failed to create client data flow");
+
+	start = now_us();
+	STK_ASSERT(pthread_create(&sender_thread,NULL,sender,NULL)==0,"Failed to start sender thread");
+
+	/* Receive until every sequence has been dispatched, then wait for the workers */
+	do {
+		client_dispatcher_timed(d,stkbase,NULL,10);
+		rc = stk_worker_pool_get_stats(pool,&stats);
+		STK_ASSERT(rc==STK_SUCCESS,"Failed to get worker pool stats");
+	} while(stats.dispatched < (stk_uint64) opts.seqs);
+	rc = stk_worker_pool_flush(pool);
+	STK_ASSERT(rc==STK_SUCCESS,"Failed to flush worker pool");
+	elapsed = now_us() - start;
+
+	pthread_join(sender_thread,NULL);
+	for(int key = 0; key < opts.keys; key++)
+		STK_ASSERT(next_count[key]==(stk_uint32) ((opts.seqs - key + opts.keys - 1) / opts.keys),"Key %d processed %u sequences",key,next_count[key]);
+
+	rc = stk_worker_pool_get_stats(pool,&stats);
+	STK_ASSERT(rc==STK_SUCCESS,"Failed to get worker pool stats");
+	for(int idx = 0; idx < nworkers; idx++) {
+		stk_worker_pool_stats_t worker_stats;
+
+		rc = stk_worker_pool_get_worker_stats(pool,idx,&worker_stats);
+		STK_ASSERT(rc==STK_SUCCESS,"Failed to get stats of worker %d",idx);
+		if(worker_stats.processed > busiest) busiest = worker_stats.processed;
+	}
+
+	printf("%3d workers: %10.0f sequences/sec, busiest worker processed %5.1f%%, queue full %lu times, blocked %lu ms, longest wait %lu us\n",
+		nworkers,opts.seqs * 1000000.0 / elapsed,busiest * 100.0 / stats.processed,stats.full,stats.blocked_us / 1000,stats.wait_max_us);
+
+	/* The accepted data flow is destroyed when the client closes, after the pool is flushed */
+	rc = stk_destroy_data_flow(client_df);
+	STK_ASSERT(rc==STK_SUCCESS,"Failed to destroy client data flow");
+	while(accepted_destroyed == 0)
+		client_dispatcher_timed(d,stkbase,NULL,10);
+
+	dispatch_set_worker_pool(d,NULL);
+	rc = stk_destroy_worker_pool(pool);
+	STK_ASSERT(rc==STK_SUCCESS,"Failed to destroy worker pool");
+
+	return opts.seqs * 1000000.0 / elapsed;
+}
+
+int main(int argc,char *argv[])
+{
+	stk_data_flow_t *server_df;
+	double rate1 = 0;
+	stk_ret rc;
+
+	sigignore(SIGPIPE); /* Some system benefit from ignoring SIGPIPE */
+
+	opts.max_workers = 8;
+	opts.keys = 64;
+	opts.seqs = 100000;
+	opts.spin_us = 5;
+	opts.shard_key = "sequence_id";
+	opts.port = "29320";
+
+	if(process_cmdline(argc,argv,&opts) == -1) {
+		usage();
+		exit(5);
+	}
+
+	stk_set_stderr_level(STK_LOG_ERROR);
+
+	{
+	stk_options_t options[] = { { "inhibit_name_service", (void *)STK_TRUE}, { "wakeup_cb", (void *) wakeup_dispatcher}, { NULL, NULL } };
+
+	stkbase = stk_create_env(options);
+	STK_ASSERT(stkbase!=NULL,"Failed to allocate an stk environment");
+	}
+
+	d = alloc_dispatcher();
+	STK_ASSERT(d!=NULL,"Failed to allocate dispatcher");
+
+	next_count = calloc(opts.keys,sizeof(*next_count));
+	STK_ASSERT(next_count!=NULL,"Failed to allocate counts of %d keys",opts.keys);
+
+	{
+	stk_options_t options[] = { { "bind_address", "127.0.0.1"}, {"bind_port", opts.port}, { "reuseaddr", (void *) STK_TRUE},
+		{ "fd_created_cb", (void *) fd_created_cb }, { "fd_destroyed_cb", (void *) fd_destroyed_cb }, { NULL, NULL } };
+
+	server_df = stk_tcp_server_create_data_flow(stkbase,"pipeline server",1,options);
+	STK_ASSERT(server_df!=NULL,"Failed to create listening data flow");
+	}
+
+	printf("%d sequences, %d keys sharded by %s, %d us CPU and %d us blocked per sequence\n",
+		opts.seqs,opts.keys,opts.shard_key,opts.spin_us,opts.sleep_us);
+
+	for(int nworkers = 1; nworkers <= opts.max_workers; nworkers *= 2) {
+		double rate = run_workers(nworkers);
+
+		if(nworkers == 1) rate1 = rate;
+		else printf("%3d workers: %.2fx the rate of 1 worker\n",nworkers,rate / rate1);
+	}
+
+	rc = stk_destroy_data_flow(server_df);
+	STK_ASSERT(rc==STK_SUCCESS,"Failed to destroy listening data flow");
+
+	terminate_dispatcher(d);
+	free_dispatcher(d);
+	free(next_count);
+
+	rc = stk_destroy_env(stkbase);
+	STK_ASSERT(rc==STK_SUCCESS,"Failed to destroy stk env");
+	return 0;
+}
@@ -22,6 +22,7 @@
 #include "stk_sg_automation_api.h"
 #include "stk_name_service_api.h"
 #include "stk_tcp.h"
+#include "stk_uring_api.h"
 #include "stk_ids.h"
 #include "stk_examples.h"
 #include "eg_dispatcher_api.h"
@@ -68,6 +69,11 @@ struct cmdopts {
 	char *multicast_ip;
 	char *multicast_port;
 	char protocol;
+	int spin_us;
+	int sock_busy_poll_us;
+	int rcv_budget_seqs;
+	stk_uint64 rcv_budget_bytes;
+	char uring;
 	/* See stk_examples.h */
 	STK_NAME_SERVER_OPTS
 	STK_MONITOR_OPTS
@@ -255,8 +261,10 @@ void usage()
 	fprintf(stderr,"       -h                             : This help!\n");
 	fprintf(stderr,"       -q                             : Quiet\n");
 	fprintf(stderr,"       -0                             : 0 Responses (passive mode)\n");
+	fprintf(stderr,"       -b <spin usecs>[:<usecs>]      : Busy poll for spin usecs before sleeping, optionally setting SO_BUSY_POLL\n");
 	fprintf(stderr,"       -B ip[:port]                   : IP and port to be bound (default: 0.0.0.0:29312)\n");
 	fprintf(stderr,"       -G <name>                      : Group Name for services\n");
+	fprintf(stderr,"       -r <seqs>[:<bytes>]            : Receive until drained or seqs/bytes are received per event (0 for no limit)\n");
 	fprintf(stderr,"       -m lookup:<name>               : Lookup <name> to get the protocol/ip/port from the name server\n");
 	fprintf(stderr,"       or <[protocol:]ip[:port]>      : IP and port of monitor (default: tcp:127.0.0.1:20001)\n");
 	fprintf(stderr,"                                      : protocol may be <tcp|udp>\n");
@@ -264,6 +272,7 @@ void usage()
 	fprintf(stderr,"       -P <tcp|udp|multicast>         : Protocol to receive on [default tcp]\n");
 	fprintf(stderr,"       -R <[protocol:]ip[:port]>      : IP and port of name server\n");
 	fprintf(stderr,"                                      : protocol may be <tcp|udp>\n");
+	fprintf(stderr,"       -U                             : Use io_uring for data flows (Linux, epoll dispatcher)\n");
 }
 
 int process_cmdline(int argc,char *argv[],struct cmdopts *opts )
@@ -271,7 +280,7 @@ int process_cmdline(int argc,char *argv[],struct cmdopts *opts )
 	int rc;
 
 	while(1) {
-		rc = getopt(argc, argv, "0hqG:B:P:m:M:R:");
+		rc = getopt(argc, argv, "0hqb:G:B:P:m:M:R:r:U");
 		if(rc == -1) return 0;
 
 		switch(rc) {
@@ -291,6 +300,24 @@ int process_cmdline(int argc,char *argv[],struct cmdopts *opts )
 			process_name_server_string(opts,optarg);
 			break;
 
+		case 'b': /* Busy poll the dispatcher */
+			{
+			char *colon = strchr(optarg,':');
+
+			opts->spin_us = atoi(optarg);
+			if(colon) opts->sock_busy_poll_us = atoi(++colon);
+			}
+			break;
+
+		case 'r': /* Receive budget per event */
+			{
+			char *colon = strchr(optarg,':');
+
+			opts->rcv_budget_seqs = atoi(optarg);
+			if(colon) opts->rcv_budget_bytes = strtoull(++colon,NULL,10);
+			}
+			break;
+
 		case 'B': /* Set the IP/Port to bind to */
 			process_bind_string(opts,optarg);
 			break;
@@ -321,6 +348,10 @@ int process_cmdline(int argc,char *argv[],struct cmdopts *opts )
 		case '0': /* Don't respond to data */
 			opts->passive = 1;
 			break;
+
+		case 'U': /* Receive and send data through io_uring */
+			opts->uring = 1;
+			break;
 		}
 	}
 	return 0;
@@ -397,6 +428,7 @@ int main(int argc,char *argv[])
 	/*
 	 * Create an STK environment. Since we are using the example listening dispatcher,
 	 * set an option for the environment to ensure the dispatcher wakeup API is called.
+	 * The timer fd lets the dispatcher sleep until the next timer expires (where supported).
 	 */
 	{
 	stk_options_t name_server_data_flow_options[] = { { "destination_address", "127.0.0.1"}, {"destination_port", "20002"}, { "nodelay", (void *)STK_TRUE},
@@ -406,7 +438,7 @@ int main(int argc,char *argv[])
 		{ "name_server_data_flow_protocol", opts.name_server_protocol }, { "name_server_data_flow_options", name_server_data_flow_options },
 		{ NULL, NULL } };
 	stk_options_t env_opts[] = { { "name_server_options", name_server_options },
-		{ "wakeup_cb", (void *) wakeup_dispatcher}, { NULL, NULL } };
+		{ "wakeup_cb", (void *) wakeup_dispatcher}, { "timer_fd", (void *) STK_TRUE}, { NULL, NULL } };
 
 	if(opts.name_server_ip) name_server_data_flow_options[0].data = opts.name_server_ip;
 	if(opts.name_server_port) name_server_data_flow_options[1].data = opts.name_server_port;
@@ -421,6 +453,7 @@ int main(int argc,char *argv[])
 	{
 	stk_data_flow_t *df;
 	stk_data_flow_t *monitoring_df;
+	stk_uring_t *ring = NULL;
 	stk_options_t svcgrp_opts[7] = { { "service_added_cb", (void *) service_added_cb }, { "service_removed_cb", (void *) service_removed_cb }, 
 									 { "state_change_cb", (void *) service_state_change_cb }, { "service_smartbeat_cb", (void *) service_smartbeat_cb },
 									 { "monitoring_data_flow", NULL }, { "listening_data_flow", NULL }, { NULL, NULL } };
@@ -446,6 +479,17 @@ int main(int argc,char *argv[])
 	svcgrp_opts[4].data = monitoring_df;
 	}
 
+	if(opts.uring) {
+		/* Datagrams are received whole, so the udp listeners need buffers large enough for any datagram */
+		char buffer_sz[16];
+		stk_options_t uring_options[] = { { "uring_buffer_size", buffer_sz }, { NULL, NULL } };
+
+		snprintf(buffer_sz,sizeof(buffer_sz),"%d",STK_URING_DATAGRAM_BUFFER_SIZE);
+		ring = stk_create_uring(stkbase,opts.protocol != 0 ? uring_options : NULL);
+		STK_ASSERT(ring!=NULL,"Failed to create io_uring, not supported on this system?");
+		STK_ASSERT(dispatch_set_uring(default_dispatcher(),ring)==0,"Failed to add io_uring to the dispatcher");
+	}
+
 	/*
 	 * Create the server data flow (aka a listening socket)
 	 */
@@ -458,7 +502,7 @@ int main(int argc,char *argv[])
 			{ "receive_buffer_size", "16000000" },
 			{ "fd_created_cb", (void *) data_fd_created_cb }, { "fd_destroyed_cb", (void *) fd_destroyed_cb },
 			{ NULL, NULL /* placeholder for multicast */ },
-			{ NULL, NULL } };
+			{ NULL, NULL /* placeholder for io_uring */ }, { NULL, NULL } };
 
 		if(opts.protocol == 2) {
 			/* Set default multicast options */
@@ -475,6 +519,11 @@ int main(int argc,char *argv[])
 		if(opts.bind_port)
 			udp_options[1].data = opts.bind_port;
 
+		if(ring) {
+			udp_options[7].name = "io_uring";
+			udp_options[7].data = ring;
+		}
+
 		df = stk_udp_listener_create_data_flow(stkbase,"udp listener socket for simple_server", STK_EG_SERVER_DATA_FLOW_ID, udp_options);
 		STK_ASSERT(df!=NULL,"Failed to create udp listener data flow");
 		break;
@@ -485,13 +534,18 @@ int main(int argc,char *argv[])
 		stk_options_t tcp_options[] = { { "bind_address", "0.0.0.0"}, {"bind_port", "29312"}, {"nodelay", NULL},
 			{ "send_buffer_size", "800000" }, { "receive_buffer_size", "16000000" },{ "reuseaddr", (void *) 1 },
 			{ "fd_created_cb", (void *) data_fd_created_cb }, { "fd_destroyed_cb", (void *) fd_destroyed_cb },
-			{ NULL, NULL } };
+			{ NULL, NULL /* placeholder for io_uring */ }, { NULL, NULL } };
 
 		if(opts.bind_ip)
 			tcp_options[0].data = opts.bind_ip;
 		if(opts.bind_port)
 			tcp_options[1].data = opts.bind_port;
 
+		if(ring) {
+			tcp_options[8].name = "io_uring";
+			tcp_options[8].data = ring;
+		}
+
 		df = stk_tcp_server_create_data_flow(stkbase,"tcp server socket for simple_server", STK_EG_SERVER_DATA_FLOW_ID, tcp_options);
 		STK_ASSERT(df!=NULL,"Failed to create tcp server data flow");
 		break;
@@ -516,14 +570,43 @@ int main(int argc,char *argv[])
 	 * 
 	 * The dispatcher only returns when a shutdown is detected.
 	 */
+	if(opts.spin_us > 0 || opts.sock_busy_poll_us > 0) {
+		int set = dispatch_set_busy_poll(default_dispatcher(),opts.spin_us,opts.sock_busy_poll_us);
+		STK_ASSERT(set==0,"Failed to set dispatcher busy poll (spin %d usecs SO_BUSY_POLL %d usecs)",opts.spin_us,opts.sock_busy_poll_us);
+	}
+
+	if(opts.rcv_budget_seqs > 0 || opts.rcv_budget_bytes > 0) {
+		int set = dispatch_set_rcv_budget(default_dispatcher(),opts.rcv_budget_seqs,opts.rcv_budget_bytes);
+		STK_ASSERT(set==0,"Failed to set dispatcher receive budget (%d sequences %lu bytes)",opts.rcv_budget_seqs,opts.rcv_budget_bytes);
+	}
+
 	eg_dispatcher(default_dispatcher(),stkbase,100);
 
+	if(opts.spin_us > 0) {
+		stk_uint64 spin_polls, spin_hits, sleeps;
+
+		dispatcher_spin_stats(default_dispatcher(),&spin_polls,&spin_hits,&sleeps);
+		printf("Dispatcher spun %lu polls, %lu waits ended spinning, %lu slept\n",spin_polls,spin_hits,sleeps);
+	}
+
+	if(opts.rcv_budget_seqs > 0 || opts.rcv_budget_bytes > 0) {
+		stk_uint64 rcv_events, rcv_seqs, budget_exhausted;
+
+		dispatcher_rcv_stats(default_dispatcher(),&rcv_events,&rcv_seqs,&budget_exhausted);
+		printf("Dispatcher received %lu sequences in %lu events, receive budget spent %lu times\n",rcv_seqs,rcv_events,budget_exhausted);
+	}
+
 	terminate_dispatcher(default_dispatcher());
 
 	/* The dispatcher returned, destroy the data flow, sequence, service group and environment */
 	rc = stk_destroy_data_flow(df);
 	STK_ASSERT(rc==STK_SUCCESS,"Failed to destroy the tcp data flow: %d",rc);
 
+	if(ring) {
+		rc = stk_destroy_uring(ring);
+		STK_ASSERT(rc==STK_SUCCESS,"Failed to destroy io_uring : %d",rc);
+	}
+
 	rc = stk_destroy_service_group(svcgrp);
 	STK_ASSERT(rc==STK_SUCCESS,"Failed to destroy the service group object : %d",rc);
 
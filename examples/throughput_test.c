@@ -36,6 +36,7 @@ char *strdup(const char *);
 #include "stk_udp.h"
 #include "stk_ids.h"
 #include "eg_dispatcher_api.h"
+#include "stk_uring_api.h"
 
 /* Use examples header for asserts */
 #include "stk_examples.h"
@@ -50,6 +51,7 @@ struct cmdopts {
 	char quiet;
 	char protocol;
 	char passive;
+	char uring;
 	char *server_ip;
 	char *server_port;
 	char *server_name;
@@ -202,6 +204,7 @@ void usage()
 	fprintf(stderr,"       -R <[protocol:]ip[:port]> : IP and port of name server\n");
 	fprintf(stderr,"                                 : protocol may be <tcp|udp>\n");
 	fprintf(stderr,"       -0                        : 0 Responses (passive mode)\n");
+	fprintf(stderr,"       -U                        : Use io_uring for data flows (Linux, epoll dispatcher)\n");
 }
 
 int process_cmdline(int argc,char *argv[],struct cmdopts *opts )
@@ -209,7 +212,7 @@ int process_cmdline(int argc,char *argv[],struct cmdopts *opts )
 	int rc;
 
 	while(1) {
-		rc = getopt(argc, argv, "0a:hi:m:vs:l:p:S:R:");
+		rc = getopt(argc, argv, "0a:hi:m:vs:l:p:S:R:U");
 		if(rc == -1) return 0;
 
 		switch(rc) {
@@ -278,6 +281,10 @@ int process_cmdline(int argc,char *argv[],struct cmdopts *opts )
 		case '0': /* Passive mode - no responses expected */
 			opts->passive = 1;
 			break;
+
+		case 'U': /* Receive and send data through io_uring */
+			opts->uring = 1;
+			break;
 		}
 	}
 	return 0;
@@ -350,6 +357,7 @@ int main(int argc,char *argv[])
 	stk_sequence_t *ret_seq;
 	stk_service_t *svc;
 	stk_data_flow_t *df,*monitoring_df;
+	stk_uring_t *ring = NULL;
 	stk_bool rc;
 	stk_sequence_id snd_id,rcv_id;
 
@@ -453,6 +461,12 @@ int main(int argc,char *argv[])
 			client_dispatcher_timed(default_dispatcher(),stkbase,NULL,500);
 	}
 
+	if(opts.uring) {
+		ring = stk_create_uring(stkbase,NULL);
+		STK_ASSERT(ring!=NULL,"Failed to create io_uring, not supported on this system?");
+		STK_ASSERT(dispatch_set_uring(default_dispatcher(),ring)==0,"Failed to add io_uring to the dispatcher");
+	}
+
 	/* Create a data flow shared by data and notifications */
 	switch(opts.protocol)
 	{
@@ -460,7 +474,8 @@ int main(int argc,char *argv[])
 	case 3:
 		{
 		stk_options_t data_flow_options[] = { { "destination_address", "127.0.0.1"}, {"destination_port", "29312"},
-			{ "fd_created_cb", (void *) data_fd_created_cb }, { "fd_destroyed_cb", (void *) fd_destroyed_cb }, { NULL, NULL } };
+			{ "fd_created_cb", (void *) data_fd_created_cb }, { "fd_destroyed_cb", (void *) fd_destroyed_cb },
+			{ NULL, NULL /* placeholder for io_uring */ }, { NULL, NULL } };
 
 		if(opts.protocol == 3)
 			data_flow_options[0].data = "224.10.10.20"; /* Set default for multicast */
@@ -468,6 +483,11 @@ int main(int argc,char *argv[])
 		if(opts.server_ip) data_flow_options[0].data = opts.server_ip;
 		if(opts.server_port) data_flow_options[1].data = opts.server_port;
 
+		if(ring) {
+			data_flow_options[4].name = "io_uring";
+			data_flow_options[4].data = ring;
+		}
+
 		df = stk_udp_client_create_data_flow(stkbase,"udp client socket for throughput_test", 29090, data_flow_options);
 		STK_ASSERT(df!=NULL,"Failed to create udp client data flow");
 
@@ -478,11 +498,17 @@ int main(int argc,char *argv[])
 	case 1:
 		{
 		stk_options_t data_flow_options[] = { { "destination_address", "127.0.0.1"}, {"destination_port", "29312"},
-			{ "fd_created_cb", (void *) data_fd_created_cb }, { "fd_destroyed_cb", (void *) fd_destroyed_cb }, { NULL, NULL } };
+			{ "fd_created_cb", (void *) data_fd_created_cb }, { "fd_destroyed_cb", (void *) fd_destroyed_cb },
+			{ NULL, NULL /* placeholder for io_uring */ }, { NULL, NULL } };
 
 		if(opts.server_ip) data_flow_options[0].data = opts.server_ip;
 		if(opts.server_port) data_flow_options[1].data = opts.server_port;
 
+		if(ring) {
+			data_flow_options[4].name = "io_uring";
+			data_flow_options[4].data = ring;
+		}
+
 		df = stk_rawudp_client_create_data_flow(stkbase,"rawudp client socket for throughput_test", 29090, data_flow_options);
 		STK_ASSERT(df!=NULL,"Failed to create rawudp client data flow");
 
@@ -496,11 +522,17 @@ int main(int argc,char *argv[])
 	default:
 		{
 		stk_options_t data_flow_options[] = { { "connect_address", "127.0.0.1"}, {"connect_port", "29312"}, { "nodelay", (void*) STK_TRUE},
-			{ "fd_created_cb", (void *) data_fd_created_cb }, { "fd_destroyed_cb", (void *) fd_destroyed_cb }, { NULL, NULL } };
+			{ "fd_created_cb", (void *) data_fd_created_cb }, { "fd_destroyed_cb", (void *) fd_destroyed_cb },
+			{ NULL, NULL /* placeholder for io_uring */ }, { NULL, NULL } };
 
 		if(opts.server_ip) data_flow_options[0].data = opts.server_ip;
 		if(opts.server_port) data_flow_options[1].data = opts.server_port;
 
+		if(ring) {
+			data_flow_options[5].name = "io_uring";
+			data_flow_options[5].data = ring;
+		}
+
 		df = stk_tcp_client_create_data_flow(stkbase,"tcp client socket for throughput_test", 29090, data_flow_options);
 		STK_ASSERT(df!=NULL,"Failed to create tcp client data flow");
 		}
@@ -640,6 +672,11 @@ int main(int argc,char *argv[])
 	rc = stk_destroy_data_flow(df);
 	STK_ASSERT(rc==STK_SUCCESS,"Failed to destroy the data/notification data flow : %d",rc);
 
+	if(ring) {
+		rc = stk_destroy_uring(ring);
+		STK_ASSERT(rc==STK_SUCCESS,"Failed to destroy io_uring : %d",rc);
+	}
+
 	rc = stk_destroy_env(stkbase);
 	STK_ASSERT(rc==STK_SUCCESS,"Failed to destroy a stk env object : %d",rc);
 
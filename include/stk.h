@@ -27,8 +27,11 @@
  */
 #include "stk_common.h"
 
+#include "stk_clock_api.h"
 #include "stk_env_api.h"
 #include "stk_sequence_api.h"
+#include "stk_sequence_pool_api.h"
+#include "stk_shm_sequence_api.h"
 #include "stk_service_api.h"
 #include "stk_service_group_api.h"
 #include "stk_options_api.h"
@@ -38,5 +41,7 @@
 #include "stk_data_flow_api.h"
 #include "stk_smartbeat_api.h"
 #include "stk_sync_api.h"
+#include "stk_slab_api.h"
 #include "stk_timer_api.h"
+#include "stk_worker_pool_api.h"
 
@@ -0,0 +1,51 @@
+/** @file stk_clock_api.h
+ * The stk_clock API's provide the time source used by STK modules.
+ *
+ * Timers and timeouts use a monotonic clock so they are not affected by
+ * changes to the wall clock. Times exchanged with other processes (e.g. smartbeats)
+ * and reported to applications use the wall clock.
+ *
+ * A dispatcher may cache the time once per loop iteration with stk_clock_cache_update()
+ * so a burst of events costs one clock read. The cache is per thread and remains in
+ * use until stk_clock_cache_clear() is called, so threads which cache the time
+ * must update it regularly.
+ */
+#ifndef STK_CLOCK_API_H
+#define STK_CLOCK_API_H
+#include "stk_common.h"
+#include <sys/time.h>
+
+/**
+ * Get the monotonic time, or the time cached by stk_clock_cache_update() on this thread
+ * \returns STK_SUCCESS if the time was read
+ */
+stk_ret stk_now(struct timeval *tv);
+/**
+ * Get the monotonic time at a lower resolution (typically a few ms) but at a lower cost.
+ * This is intended for non critical paths, the cached time is used if available.
+ * \returns STK_SUCCESS if the time was read
+ */
+stk_ret stk_now_coarse(struct timeval *tv);
+/**
+ * Get the monotonic time, always reading the clock rather than using the cached time.
+ * This is intended for measuring durations, e.g. of callbacks.
+ * \returns STK_SUCCESS if the time was read
+ */
+stk_ret stk_now_precise(struct timeval *tv);
+/**
+ * Get the wall clock time, or the time cached by stk_clock_cache_update() on this thread
+ * \returns STK_SUCCESS if the time was read
+ */
+stk_ret stk_now_realtime(struct timeval *tv);
+/**
+ * Read the clocks and cache the times for use by this thread
+ * \see stk_clock_cache_clear()
+ */
+void stk_clock_cache_update(void);
+/**
+ * Stop using cached times on this thread
+ * \see stk_clock_cache_update()
+ */
+void stk_clock_cache_clear(void);
+
+#endif
@@ -17,6 +17,7 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <sys/time.h>
 
 /**
  * \typedef stk_data_flow_t
@@ -83,6 +84,27 @@ typedef void (*stk_data_flow_fd_destroyed_cb)(stk_data_flow_t *flow,stk_data_flo
 #define STK_UDP_CLIENT_FLOW 6      /*!< The Data Flow Type for client UDP data flows */
 #define STK_TCP_ACCEPTED_FLOW 7    /*!< The Data Flow Type for server accepted TCP data flows */
 
+/** Transport protocols sequences are received on */
+typedef enum {
+	STK_DATA_FLOW_PROTOCOL_UNKNOWN = 0, /*!< Not received, or an application defined protocol */
+	STK_DATA_FLOW_PROTOCOL_TCP,         /*!< "tcp" */
+	STK_DATA_FLOW_PROTOCOL_UDP,         /*!< "udp" */
+	STK_DATA_FLOW_PROTOCOL_RAWUDP       /*!< "rawudp" */
+} stk_data_flow_protocol_id;
+
+/**
+ * Transport meta data stored in a fixed slot of every sequence, so receiving
+ * a sequence does not allocate meta data.
+ * \see stk_data_flow_set_received()
+ */
+typedef struct stk_data_flow_transport_stct {
+	struct sockaddr_in client_ip;       /*!< Address of the sender */
+	socklen_t addrlen;                  /*!< Length of client_ip, 0 if not set */
+	stk_data_flow_protocol_id protocol; /*!< Protocol the sequence was received on */
+	struct timeval received;            /*!< Time the sequence was received */
+	stk_data_flow_t *df;                /*!< Data flow the sequence was received on, held by the sequence */
+} stk_data_flow_transport_t;
+
 typedef struct stk_protocol_def_stct
 {
 	char protocol[16];
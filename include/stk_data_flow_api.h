@@ -42,6 +42,8 @@ stk_ret stk_free_data_flow(stk_data_flow_t *df);
 void *stk_data_flow_module_data(stk_data_flow_t *df);
 /**
  * Get the data flow error code.
+ * After a receive returns NULL, EWOULDBLOCK means no more data was available (tcp and rawudp data flows),
+ * and 0 on a tcp data flow means the peer closed the connection.
  * \returns the errno related to this data flow
  */
 int stk_data_flow_errno(stk_data_flow_t *df);
@@ -141,6 +143,34 @@ stk_ret stk_data_flow_client_protocol(stk_sequence_t *seq,char *protocol_ptr, st
  */
 stk_ret stk_data_flow_add_client_protocol(stk_sequence_t *seq,char *protocol);
 
+/**
+ * API for data flow modules to record the transport meta data of a received sequence:
+ * the client IP, the data flow's protocol, the data flow and the time of receipt.
+ * These are stored in fixed fields of the sequence so no memory is allocated.
+ * \returns STK_SUCCESS if the transport meta data was set
+ */
+stk_ret stk_data_flow_set_received(stk_data_flow_t *df,stk_sequence_t *seq,struct sockaddr_in *client_ip,socklen_t addrlen);
+
+/**
+ * API to get the protocol a sequence was received on
+ * \returns The protocol, or STK_DATA_FLOW_PROTOCOL_UNKNOWN
+ */
+stk_data_flow_protocol_id stk_data_flow_client_protocol_id(stk_sequence_t *seq);
+
+/**
+ * API to get the time a sequence was received
+ * \returns STK_SUCCESS if the receive time was filled out
+ */
+stk_ret stk_data_flow_receive_time(stk_sequence_t *seq,struct timeval *tv);
+
+/**
+ * API to get the data flow a sequence was received on. The sequence holds the data flow until it is
+ * destroyed, recycled or received on another data flow, so the pointer stays valid for e.g. worker threads
+ * processing the sequence after the data flow was destroyed (though it can then no longer be used).
+ * \returns The data flow or NULL if not known
+ */
+stk_data_flow_t *stk_data_flow_received_on(stk_sequence_t *seq);
+
 /**
  * Utility to find a data flow option and do all the necessary work for data flow creation and auto create it if needed.
  * Pass in a data flow option name like "monitoring_data_flow" and if that option exists in the set, it is returned.
@@ -13,6 +13,7 @@
 #include "stk_smartbeat.h"
 #include "stk_name_service.h"
 #include "stk_data_flow.h"
+#include "stk_slab.h"
 
 /**
  * \brief Create an STK environment.
@@ -35,8 +36,10 @@ stk_bool stk_destroy_env(stk_env_t *env);
 
 /* Timer pool management */
 /**
- * Add a timer set to the timer pool
- * \returns if there was space for a new timer set
+ * Add a timer set to the timer pool.
+ * The pool is ordered by the earliest timer in each set, so finding the next timer
+ * and dispatching only touches the sets with the earliest timers.
+ * \returns if the set was added (the pool grows as required)
  */
 stk_ret stk_env_add_timer_set(stk_env_t *env,stk_timer_set_t *tset);
 /**
@@ -45,20 +48,51 @@ stk_ret stk_env_add_timer_set(stk_env_t *env,stk_timer_set_t *tset);
  */
 stk_ret stk_env_remove_timer_set(stk_env_t *env,stk_timer_set_t *tset);
 /**
- * Dispatch timers for all timer pools
+ * Dispatch timers for the timer sets in the timer pool which have expired timers
  * \returns Whether all the timer sets were dispatched successfully
  */
 stk_ret stk_env_dispatch_timer_pools(stk_env_t *env,unsigned short max_callbacks);
 /**
- * Dispatch timers for a timer pool
- * \returns Whether all the timer sets were dispatched successfully
+ * Dispatch timers for a timer set in the timer pool
+ * \param pool The position of the set in the pool, which changes as timers are scheduled
+ * \returns Whether the timer set was dispatched successfully
+ * \see stk_env_get_timer_set()
  */
 stk_ret stk_env_dispatch_timer_pool(stk_env_t *env,unsigned short max_callbacks,int pool);
+/**
+ * Get a timer set in the timer pool. The set at position 0 has the earliest timer,
+ * the order of other sets is not defined.
+ * \returns The timer set or NULL if pool_idx is beyond the number of sets in the pool
+ */
+stk_timer_set_t *stk_env_get_timer_set(stk_env_t *env,int pool_idx);
+/**
+ * Get the timer set the env schedules its own timers on, the first set added to the pool.
+ * Unlike stk_env_get_timer_set() it doesn't change as timers are scheduled.
+ * \returns The timer set or NULL if it has been removed from the pool
+ */
+stk_timer_set_t *stk_env_get_default_timer_set(stk_env_t *env);
 /**
  * Determine the interval to the next timer in the pool that will expire.
  * \returns The number of ms to the next timer expiration (or -1 if there are no timers).
  */
 int stk_next_timer_ms_in_pool(stk_env_t *env);
+/**
+ * Get the timer fd of an environment created with the "timer_fd" option (Linux only).
+ *
+ * The fd is armed to the earliest timer deadline in the timer pools and becomes
+ * readable when it expires, so a dispatcher may poll it with its other fds
+ * instead of calculating a timeout with stk_next_timer_ms_in_pool(). Scheduling
+ * a timer rearms the fd rather than calling the wakeup callback.
+ * \returns The fd or -1 if the environment has no timer fd
+ * \see stk_env_dispatch_timer_fd()
+ */
+int stk_env_get_timer_fd(stk_env_t *env);
+/**
+ * Dispatch the timer pools when the timer fd is readable, and rearm it to the next timer deadline
+ * \returns Whether all the timer sets were dispatched successfully
+ * \see stk_env_get_timer_fd() stk_env_dispatch_timer_pools()
+ */
+stk_ret stk_env_dispatch_timer_fd(stk_env_t *env,unsigned short max_callbacks);
 /**
  * This function calls any registered dispatcher wakeup callback
  */
@@ -75,6 +109,12 @@ stk_name_service_t *stk_env_get_name_service(stk_env_t *env);
  * Get the default Monitoring Data Flow 
  */
 stk_data_flow_t *stk_env_get_monitoring_data_flow(stk_env_t *env);
+/**
+ * Get the slab allocator configured for this environment.
+ * The allocator is created when the "slab_allocator" option is passed to stk_create_env()
+ * \returns The slab allocator or NULL if the system allocator is in use
+ */
+stk_slab_allocator_t *stk_env_get_slab_allocator(stk_env_t *env);
 /**
  * Get the default dispatcher
  */
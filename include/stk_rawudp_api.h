@@ -39,6 +39,11 @@ stk_sequence_t *stk_rawudp_listener_data_flow_rcv(stk_data_flow_t *df,stk_sequen
  * \returns The bytes read (also stored in bufread)
  */
 stk_uint64 stk_rawudp_listener_recv(stk_data_flow_t *df,stk_udp_wire_read_buf_t *bufread);
+/**
+ * Determine if a RAW UDP data flow has datagrams received (by its io_uring) which are not yet read
+ * \returns STK_SUCCESS if datagrams are buffered
+ */
+stk_ret stk_rawudp_listener_data_flow_buffered(stk_data_flow_t *df);
 /**
  * Add the client IP to a sequence
  * \returns Whether the client IP was added
@@ -44,13 +44,23 @@ void stk_hold_sequence(stk_sequence_t *seq);
 /**
  * Acquire a sequence ID from the STK environment.
  *
- * Sequence ID's are currently generated by using rand(), but in the future
- * will be managed per type of service.
+ * Sequence ID's are generated from a per environment random seed and counter, so they
+ * are unique within the environment and unlikely to collide with other processes.
+ * Each thread reserves IDs in blocks, so acquiring an ID is lock free and usually
+ * touches no shared data. In the future IDs may be managed per type of service.
  * A sequence ID is atomic so the stkenv must be passed in to both acquire and release an ID
  * \see stk_release_sequence_id()
  */
 stk_sequence_id stk_acquire_sequence_id(stk_env_t *env,stk_service_type type);
 
+/**
+ * Acquire a number of sequence IDs from the STK environment in one call, for
+ * applications creating many sequences. The IDs are written to ids.
+ * \returns The number of IDs acquired (count)
+ * \see stk_acquire_sequence_id()
+ */
+stk_uint64 stk_acquire_sequence_ids(stk_env_t *env,stk_service_type type,stk_sequence_id *ids,stk_uint64 count);
+
 /**
  * Release a sequence ID from the STK environment.
  * A sequence ID is atomic so the stkenv must be passed in to both acquire and release an ID
@@ -97,12 +107,27 @@ stk_ret stk_add_sequence_reference_in_sequence(stk_sequence_t *seq,stk_sequence_
  * stk_update_ref_data_in_sequence() updates the data generation of a sequence and
  * copies reference data if there are references to it for archival purposes. For
  * most efficiency, this API should be called when ready to modify data.
- * [Not implemented]
+ *
+ * Only data still shared with clones (see stk_clone_sequence()) is copied, so the clones
+ * keep the archived generation while the application modifies its buffers.
+ * Data which is not shared is not copied.
  *
  * \returns the generation ID of data archived in gen_id if not NULL
  */
 stk_ret stk_update_ref_data_in_sequence(stk_sequence_t *seq, stk_generation_id *gen_id);
 
+/**
+ * Create a clone of a sequence which shares its data rather than copying it.
+ * Clones are useful for fanning out or queueing a sequence without copying payloads.
+ * Data is copied on write: when the original is archived with stk_update_ref_data_in_sequence()
+ * or either sequence's data is modified through an iterator.
+ * Meta data is copied to the clone.
+ *
+ * Clones must be destroyed with stk_destroy_sequence().
+ * \returns The clone or NULL on failure
+ */
+stk_sequence_t *stk_clone_sequence(stk_sequence_t *seq);
+
 /**
  * Copy some data to the sequence.
  * The sequence, data pointer and size must all be non-null or non-0
@@ -164,6 +189,14 @@ stk_ret stk_set_sequence_type(stk_sequence_t *seq,stk_sequence_type type);
  */
 stk_ret stk_set_sequence_name(stk_sequence_t *seq,char *name);
 
+/**
+ * API to copy a Name in to a sequence.
+ * Unlike stk_set_sequence_name(), the name is copied in to memory owned by the sequence
+ * (from the environment's slab allocator if configured) so the caller retains ownership of name.
+ * \returns Whether the Name was set
+ */
+stk_ret stk_copy_sequence_name(stk_sequence_t *seq,char *name);
+
 /**
  * API to get the name of a sequence.
  * \returns The name of the sequence or NULL
@@ -202,6 +235,13 @@ int stk_number_of_sequence_elements(stk_sequence_t *seq);
  */
 int stk_has_any_sequence_elements(stk_sequence_t *seq);
 
+/**
+ * API to get the total size of the data in all elements of a sequence, including merged sequences
+ *
+ * \returns The sum of the element sizes in bytes
+ */
+stk_uint64 stk_sequence_total_size(stk_sequence_t *seq);
+
 /**
  * Allocate a sequence element at the end of the sequence
  * \returns Whether the element was allocated or not
@@ -332,13 +372,28 @@ stk_ret stk_sequence_iterator_set_size(stk_sequence_iterator_t *seqiter,stk_uint
 stk_ret stk_sequence_iterator_set_user_type(stk_sequence_iterator_t *seqiter,stk_uint64 user_type);
 
 /**
- * API to find an element by user type. Use of this API likely leads to slower applications
- * if used repeatedly. When searching for more than one item, use an iterator.
+ * API to find an element by user type. Sequences with more than a few elements
+ * are indexed by user type as elements are added, so lookups are O(1).
+ * Finds don't modify the sequence, so a sequence which isn't being changed may be searched on several threads.
+ * When searching for more than one item, use an iterator.
+ *
+ * If an iterator is passed as seq, it is positioned on the element found so
+ * stk_sequence_iterator_find_next_by_type() may be used to find further elements of the same type.
  *
  * \returns STK_SUCCESS if the user type was found or an error (E.G STK_NOT_FOUND if not)
  */
 stk_ret stk_sequence_find_data_by_type(stk_sequence_t *seq,stk_uint64 user_type,void **data_ptr,stk_uint64 *sz);
 
+/**
+ * API to find the next element of a user type after the current element of an iterator,
+ * typically after stk_sequence_find_data_by_type() or stk_sequence_find_meta_data_by_type()
+ * was called with the iterator to find the first.
+ * The iterator is positioned on the element found.
+ *
+ * \returns STK_SUCCESS if another element of the user type was found or STK_NOT_FOUND if not
+ */
+stk_ret stk_sequence_iterator_find_next_by_type(stk_sequence_iterator_t *seqiter,stk_uint64 user_type,void **data_ptr,stk_uint64 *sz);
+
 /**
  * API to find an element by user type in the meta data.
  *
@@ -0,0 +1,32 @@
+/** @file stk_sequence_pool.h
+ * This file provides definitions and typdefs etc required for sequence pools
+ */
+#ifndef STK_SEQUENCE_POOL_H
+#define STK_SEQUENCE_POOL_H
+
+#include "stk_common.h"
+
+/**
+ * \typedef stk_sequence_pool_t
+ * A sequence pool holds released sequences so receive loops may reuse them,
+ * along with their element payload buffers, rather than creating and destroying
+ * a sequence for every receive.
+ * \see stk_create_sequence_pool()
+ */
+typedef struct stk_sequence_pool_stct stk_sequence_pool_t;
+
+/**
+ * Statistics maintained by a sequence pool.
+ * The hit rate of a pool is hits / acquires.
+ * \see stk_sequence_pool_get_stats()
+ */
+typedef struct stk_sequence_pool_stats_stct {
+	stk_uint64 acquires;  /*!< Number of sequences acquired from the pool */
+	stk_uint64 hits;      /*!< Acquires satisfied by a recycled sequence */
+	stk_uint64 misses;    /*!< Acquires which had to create a sequence */
+	stk_uint64 releases;  /*!< Number of sequences released to the pool */
+	stk_uint64 discards;  /*!< Released sequences destroyed because the pool was full */
+	stk_uint64 held;      /*!< Released sequences not recycled because the application still held them */
+} stk_sequence_pool_stats_t;
+
+#endif
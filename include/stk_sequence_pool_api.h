@@ -0,0 +1,46 @@
+/** @file stk_sequence_pool_api.h
+ * Sequence pools recycle sequences for receive loops. A released sequence is
+ * emptied but keeps its copied element buffers, so the next receive in to it
+ * reuses them (see stk_alloc_in_sequence() and stk_sequence_iterator_ensure_segment_size())
+ * without reallocating.
+ *
+ * If an application holds a sequence (stk_hold_sequence()) it is not recycled on
+ * release, the application's stk_destroy_sequence() frees it as normal.
+ * Pools are thread safe.
+ */
+#ifndef STK_SEQUENCE_POOL_API_H
+#define STK_SEQUENCE_POOL_API_H
+
+#include "stk_sequence_pool.h"
+#include "stk_sequence.h"
+#include "stk_env.h"
+#include "stk_service.h"
+
+/**
+ * Create a sequence pool
+ * \param env The environment sequences are created in
+ * \param options Options - "sequence_pool_size" sets the max number of sequences retained (default 64)
+ * \returns A new pool or NULL on failure
+ */
+stk_sequence_pool_t *stk_create_sequence_pool(stk_env_t *env,stk_options_t *options);
+/**
+ * Destroy a sequence pool and the sequences it retains.
+ * Sequences acquired from the pool and not yet released remain valid and must be destroyed with stk_destroy_sequence()
+ */
+stk_ret stk_destroy_sequence_pool(stk_sequence_pool_t *pool);
+/**
+ * Acquire a sequence from a pool, the parameters are as for stk_create_sequence()
+ * \returns An empty sequence. Return it with stk_sequence_pool_release()
+ */
+stk_sequence_t *stk_sequence_pool_acquire(stk_sequence_pool_t *pool,char *name,stk_sequence_id id,stk_sequence_type type,stk_service_type svctype);
+/**
+ * Release a sequence to a pool. The sequence must not be used by the caller after this call.
+ * \returns Whether the sequence was released
+ */
+stk_ret stk_sequence_pool_release(stk_sequence_pool_t *pool,stk_sequence_t *seq);
+/**
+ * Get the statistics of a sequence pool
+ */
+stk_ret stk_sequence_pool_get_stats(stk_sequence_pool_t *pool,stk_sequence_pool_stats_t *stats);
+
+#endif
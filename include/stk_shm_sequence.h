@@ -0,0 +1,40 @@
+/** @file stk_shm_sequence.h
+ * This file provides definitions and typdefs etc required for shared memory sequences
+ */
+#ifndef STK_SHM_SEQUENCE_H
+#define STK_SHM_SEQUENCE_H
+
+#include "stk_common.h"
+
+/**
+ * \typedef stk_shm_arena_t
+ * A shared memory arena is a memory mapped segment which stores sequences so
+ * processes on the same host can exchange them without encoding/decoding them.
+ * \see stk_create_shm_arena()
+ */
+typedef struct stk_shm_arena_stct stk_shm_arena_t;
+
+/**
+ * \typedef stk_shm_handle_t
+ * A handle to a sequence in a shared memory arena. Handles are offsets in to the
+ * arena so they are valid in every process attached to it, and may be passed
+ * between processes by any means (e.g. in a sequence sent over a data flow).
+ */
+typedef stk_uint64 stk_shm_handle_t;
+
+/** The value of an invalid shared memory handle */
+#define STK_SHM_HANDLE_INVALID 0
+
+/**
+ * Statistics maintained by a shared memory arena, shared by all attached processes.
+ * \see stk_shm_arena_get_stats()
+ */
+typedef struct stk_shm_arena_stats_stct {
+	stk_uint64 size;           /*!< Size of the arena in bytes */
+	stk_uint64 used;           /*!< Bytes in allocated blocks */
+	stk_uint64 allocs;         /*!< Number of blocks allocated */
+	stk_uint64 frees;          /*!< Number of blocks freed */
+	stk_uint64 alloc_failures; /*!< Allocations which failed because the arena was full */
+} stk_shm_arena_stats_t;
+
+#endif
@@ -0,0 +1,63 @@
+/** @file stk_shm_sequence_api.h
+ * Shared memory sequences allow services on the same host to exchange sequences
+ * without serializing them. A sequence is exported in to a shared memory arena once
+ * and may then be imported by any process attached to the arena, the imported
+ * sequence references the data in the arena rather than copying it.
+ *
+ * Exported sequences are reference counted, the exporting process owns the first
+ * reference. Typically a producer takes a hold (stk_shm_hold()) for each consumer before passing
+ * the handle to it and releases its own, and each consumer releases the handle
+ * (stk_shm_release()) after destroying its imported sequence.
+ *
+ * Meta data is not exported.
+ */
+#ifndef STK_SHM_SEQUENCE_API_H
+#define STK_SHM_SEQUENCE_API_H
+
+#include "stk_shm_sequence.h"
+#include "stk_sequence.h"
+#include "stk_env.h"
+
+/**
+ * Create or attach to a shared memory arena
+ * \param env The environment imported sequences are created in
+ * \param options Options - "shm_name" is the name of the shared memory segment (required),
+ *        "shm_create" creates and initializes the segment, otherwise an existing segment is attached,
+ *        "shm_size" sets the size of a created segment (default 16MB)
+ * \returns A new arena or NULL on failure
+ */
+stk_shm_arena_t *stk_create_shm_arena(stk_env_t *env,stk_options_t *options);
+/**
+ * Detach from a shared memory arena. The creator of an arena also removes its name,
+ * processes still attached may continue to use it.
+ */
+stk_ret stk_destroy_shm_arena(stk_shm_arena_t *arena);
+/**
+ * Export a sequence in to a shared memory arena.
+ * The data of the sequence (including merged sequences) is copied in to one block in the arena.
+ * \returns A handle to the exported sequence, or STK_SHM_HANDLE_INVALID if the arena is full.
+ *          The caller owns a reference to the handle, see stk_shm_release()
+ */
+stk_shm_handle_t stk_shm_export_sequence(stk_shm_arena_t *arena,stk_sequence_t *seq);
+/**
+ * Import a sequence from a shared memory arena.
+ * The sequence elements reference the data in the arena, so the caller must hold a
+ * reference to the handle until the sequence is destroyed.
+ * The data must not be modified.
+ * \returns A sequence to be destroyed with stk_destroy_sequence() or NULL on failure
+ */
+stk_sequence_t *stk_shm_import_sequence(stk_shm_arena_t *arena,stk_shm_handle_t handle);
+/**
+ * Take a reference to a sequence in a shared memory arena
+ */
+stk_ret stk_shm_hold(stk_shm_arena_t *arena,stk_shm_handle_t handle);
+/**
+ * Release a reference to a sequence in a shared memory arena, the last release frees it
+ */
+stk_ret stk_shm_release(stk_shm_arena_t *arena,stk_shm_handle_t handle);
+/**
+ * Get the statistics of a shared memory arena
+ */
+stk_ret stk_shm_arena_get_stats(stk_shm_arena_t *arena,stk_shm_arena_stats_t *stats);
+
+#endif
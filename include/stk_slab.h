@@ -0,0 +1,30 @@
+/** @file stk_slab.h
+ * This file provides definitions and typdefs etc required for the slab allocator
+ */
+#ifndef STK_SLAB_H
+#define STK_SLAB_H
+
+#include "stk_common.h"
+
+/**
+ * \typedef stk_slab_allocator_t
+ * The slab allocator caches fixed size classes of memory so that sequences,
+ * their elements and payloads may be allocated and freed without calling
+ * the system allocator once a steady state has been reached.
+ * \see stk_env_get_slab_allocator()
+ */
+typedef struct stk_slab_allocator_stct stk_slab_allocator_t;
+
+/**
+ * Statistics maintained by a slab allocator
+ * \see stk_slab_get_stats()
+ */
+typedef struct stk_slab_stats_stct {
+	stk_uint64 allocs;          /*!< Number of allocations served from the slab */
+	stk_uint64 frees;           /*!< Number of frees returned to the slab */
+	stk_uint64 chunk_allocs;    /*!< Number of chunks requested from the system allocator */
+	stk_uint64 bytes_reserved;  /*!< Total bytes held in chunks */
+	stk_uint64 sys_allocs;      /*!< Allocations too large for the slab which used the system allocator */
+} stk_slab_stats_t;
+
+#endif
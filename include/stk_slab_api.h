@@ -0,0 +1,56 @@
+/** @file stk_slab_api.h
+ * The slab allocator provides size classed free lists for frequently allocated
+ * objects such as sequences, their data definitions and payloads. Memory is
+ * requested from the system in chunks and is only returned when the allocator
+ * is destroyed.
+ *
+ * Allocators are normally created by the environment when the "slab_allocator"
+ * option is passed to stk_create_env(). If "slab_thread_cache" is also passed,
+ * each thread keeps a private cache of free objects so allocations from the
+ * same thread do not contend on the allocator lock.
+ *
+ * All APIs accept a NULL allocator, in which case the system allocator is used.
+ */
+#ifndef STK_SLAB_API_H
+#define STK_SLAB_API_H
+
+#include "stk_slab.h"
+#include "stk_common.h"
+
+/**
+ * Create a slab allocator
+ * \param options Options - "slab_thread_cache" and "slab_chunk_size" are supported
+ * \returns A new allocator or NULL on failure
+ */
+stk_slab_allocator_t *stk_create_slab_allocator(stk_options_t *options);
+/**
+ * Destroy a slab allocator, releasing all its memory back to the system.
+ * Any objects still allocated from the slab are invalid after this call.
+ */
+stk_ret stk_destroy_slab_allocator(stk_slab_allocator_t *sa);
+/**
+ * Allocate sz bytes from a slab allocator (uninitialized)
+ * \returns A pointer to the memory or NULL
+ */
+void *stk_slab_alloc(stk_slab_allocator_t *sa,stk_uint64 sz);
+/**
+ * Allocate sz bytes from a slab allocator and zero them
+ * \returns A pointer to the memory or NULL
+ */
+void *stk_slab_calloc(stk_slab_allocator_t *sa,stk_uint64 sz);
+/**
+ * Return memory to a slab allocator.
+ * \param sz The size requested at allocation time, or any size up to stk_slab_capacity() of it
+ */
+void stk_slab_free(stk_slab_allocator_t *sa,void *ptr,stk_uint64 sz);
+/**
+ * Get the usable size of an allocation of sz bytes.
+ * Memory allocated for sz bytes may be used up to this size without reallocating.
+ */
+stk_uint64 stk_slab_capacity(stk_slab_allocator_t *sa,stk_uint64 sz);
+/**
+ * Get the statistics of a slab allocator (summed over all thread caches)
+ */
+stk_ret stk_slab_get_stats(stk_slab_allocator_t *sa,stk_slab_stats_t *stats);
+
+#endif
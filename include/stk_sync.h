@@ -13,5 +13,16 @@
 typedef pthread_mutex_t stk_mutex_t;
 typedef struct { volatile int v;  } stk_int_t;
 
+/**
+ * Memory ordering constraints for the stk_atomic_* APIs.
+ * These map directly onto the compiler's atomic memory models.
+ */
+typedef enum {
+	STK_MO_RELAXED = __ATOMIC_RELAXED, /*!< No ordering, only atomicity */
+	STK_MO_ACQUIRE = __ATOMIC_ACQUIRE, /*!< Later accesses are not reordered before this operation */
+	STK_MO_RELEASE = __ATOMIC_RELEASE, /*!< Earlier accesses are not reordered after this operation */
+	STK_MO_ACQ_REL = __ATOMIC_ACQ_REL, /*!< Both acquire and release semantics */
+	STK_MO_SEQ_CST = __ATOMIC_SEQ_CST  /*!< Sequentially consistent */
+} stk_memory_order;
 
 #endif
@@ -7,9 +7,14 @@
 #include "stk_common.h"
 #include <pthread.h>
 
-#define STK_ATOMIC_INCR(_ptr) stk_fetch_and_incr_int((stk_int_t*)_ptr) /*!< Atomic Increment an integer */
-#define STK_ATOMIC_DECR(_ptr) stk_fetch_and_decr_int((stk_int_t*)_ptr) /*!< Atomic Decrement an integer */
-#define STK_ATOMIC_ADD(_ptr,_val) stk_fetch_and_add_int((stk_int_t*)_ptr,_val) /*!< Atomic add of a number to an integer */
+/*
+ * The STK_ATOMIC_* macros are type generic and operate on the natural size of
+ * the integer pointed to (16, 32 or 64 bits). They return the old value and
+ * use acquire/release ordering which is sufficient for reference counting.
+ */
+#define STK_ATOMIC_INCR(_ptr) __atomic_fetch_add(_ptr,1,__ATOMIC_ACQ_REL) /*!< Atomic Increment an integer */
+#define STK_ATOMIC_DECR(_ptr) __atomic_fetch_sub(_ptr,1,__ATOMIC_ACQ_REL) /*!< Atomic Decrement an integer */
+#define STK_ATOMIC_ADD(_ptr,_val) __atomic_fetch_add(_ptr,_val,__ATOMIC_ACQ_REL) /*!< Atomic add of a number to an integer */
 
 /**
  * Create a non-recursive mutex
@@ -62,4 +67,41 @@ _stk_inline int stk_fetch_and_add_int(stk_int_t *ptr, int val);
 _stk_inline int stk_fetch_and_incr_int(stk_int_t *ptr);
 _stk_inline int stk_fetch_and_decr_int(stk_int_t *ptr);
 
+/*
+ * Sized lock-free atomics with explicit memory ordering.
+ * These are inlined and compile to single instructions on supported platforms.
+ */
+#define STK_ATOMIC_SIZED_OPS(_bits) \
+/** Atomic add returning the old value */ \
+static inline stk_uint##_bits stk_atomic_fetch_add_##_bits(volatile stk_uint##_bits *ptr, stk_uint##_bits val, stk_memory_order mo) \
+	{ return __atomic_fetch_add(ptr,val,mo); } \
+/** Atomic subtract returning the old value */ \
+static inline stk_uint##_bits stk_atomic_fetch_sub_##_bits(volatile stk_uint##_bits *ptr, stk_uint##_bits val, stk_memory_order mo) \
+	{ return __atomic_fetch_sub(ptr,val,mo); } \
+/** Atomic compare and swap. On failure, *expected is updated with the current value */ \
+static inline stk_bool stk_atomic_cas_##_bits(volatile stk_uint##_bits *ptr, stk_uint##_bits *expected, stk_uint##_bits desired, stk_memory_order mo) \
+	{ return __atomic_compare_exchange_n(ptr,expected,desired,0,mo,mo == STK_MO_ACQ_REL || mo == STK_MO_RELEASE ? STK_MO_ACQUIRE : mo) ? STK_TRUE : STK_FALSE; } \
+/** Atomic load */ \
+static inline stk_uint##_bits stk_atomic_load_##_bits(volatile stk_uint##_bits *ptr, stk_memory_order mo) \
+	{ return __atomic_load_n(ptr,mo); } \
+/** Atomic store */ \
+static inline void stk_atomic_store_##_bits(volatile stk_uint##_bits *ptr, stk_uint##_bits val, stk_memory_order mo) \
+	{ __atomic_store_n(ptr,val,mo); } \
+/** Atomic exchange returning the old value */ \
+static inline stk_uint##_bits stk_atomic_exchange_##_bits(volatile stk_uint##_bits *ptr, stk_uint##_bits val, stk_memory_order mo) \
+	{ return __atomic_exchange_n(ptr,val,mo); }
+
+STK_ATOMIC_SIZED_OPS(16)
+STK_ATOMIC_SIZED_OPS(32)
+STK_ATOMIC_SIZED_OPS(64)
+
+/** Atomic load of a pointer */
+#define stk_atomic_load_ptr(_ptr,_mo) __atomic_load_n(_ptr,_mo)
+/** Atomic store of a pointer */
+#define stk_atomic_store_ptr(_ptr,_val,_mo) __atomic_store_n(_ptr,_val,_mo)
+/** Atomic compare and swap of a pointer */
+#define stk_atomic_cas_ptr(_ptr,_expected,_desired,_mo) __atomic_compare_exchange_n(_ptr,_expected,_desired,0,_mo,__ATOMIC_RELAXED)
+/** Atomic exchange of a pointer, returning the old value */
+#define stk_atomic_exchange_ptr(_ptr,_val,_mo) __atomic_exchange_n(_ptr,_val,_mo)
+
 #endif
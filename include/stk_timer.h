@@ -4,6 +4,8 @@
 #ifndef STK_TIMER_H
 #define STK_TIMER_H
 
+#include "stk_common.h"
+
 /**
  * \typedef stk_timer_set_t
  * The timer set consitutes a grouping of related timers. Applications
@@ -27,7 +29,29 @@ typedef int stk_timer_cb_type;
 #define STK_TIMER_EXPIRED 1     /*!< Timer has Expired */
 #define STK_TIMER_CANCELLED 2   /*!< Timer was Cancelled */
 
+/** The number of buckets in timer statistics histograms */
+#define STK_TIMER_HISTOGRAM_BUCKETS 24
+
+/**
+ * Statistics maintained by a timer set.
+ * Histograms have power of 2 microsecond buckets, bucket 0 counts values under 1us,
+ * bucket N counts values from 2^(N-1)us up to 2^Nus, and the last bucket also counts all larger values.
+ * \see stk_timer_set_get_stats()
+ */
+typedef struct stk_timer_set_stats_stct {
+	stk_uint64 scheduled;         /*!< Timers scheduled, including rescheduled timers */
+	stk_uint64 cancelled;         /*!< Timers cancelled */
+	stk_uint64 fired;             /*!< Timers which expired and were called back */
+	stk_uint64 lateness_max_us;   /*!< The latest a timer was called back after it expired */
+	stk_uint64 callback_max_us;   /*!< The longest expired timer callback */
+	stk_uint64 lateness[STK_TIMER_HISTOGRAM_BUCKETS]; /*!< How late expired timers were called back */
+	stk_uint64 callback[STK_TIMER_HISTOGRAM_BUCKETS]; /*!< How long expired timer callbacks took */
+} stk_timer_set_stats_t;
+
 /** The callback signature to be used for timer callbacks */
 typedef void (*stk_timer_cb)(stk_timer_set_t *timer_set,stk_timer_t *timer,int id,void *userdata,void * user_setdata, stk_timer_cb_type cb_type);
 
+/** The callback signature used to wake the owner of a timer set when other threads queue requests to it */
+typedef void (*stk_timer_set_wakeup_cb)(stk_timer_set_t *timer_set,void *user_setdata);
+
 #endif
@@ -3,6 +3,7 @@
  * It is based on a linked list whic could be improved performance wise
  * but allow multiple timer sets that can be used to offset the overhead
  * in insertions by reducing the number of timers per set.
+ * Timer sets with many timers should use a timing wheel, see stk_new_timer_set_with_options().
  *
  * This timer API is not thread safe at this time
  */
@@ -11,6 +12,7 @@
 #include "stk_timer.h"
 #include "stk_env.h"
 #include "stk_common.h"
+#include <sys/time.h>
 
 /**
  * Allocate a new timer set.
@@ -28,6 +30,34 @@
  * \see stk_free_timer_set() stk_env_dispatch_timer_pools()
  */
 stk_timer_set_t *stk_new_timer_set(stk_env_t *env,void *user_setdata,stk_uint32 max_timers,stk_bool add_to_pool);
+/**
+ * Allocate a new timer set with options.
+ *
+ * The "timer_wheel" option selects a hierarchical timing wheel with a 1ms resolution
+ * instead of sorted lists. Scheduling and cancelling timers in a wheel is O(1)
+ * regardless of the number of timers in the set, at the cost of timers
+ * expiring up to 1ms later than requested.
+ *
+ * The "timer_owner_thread" option makes the calling thread the owner of the set.
+ * The owner schedules and cancels timers without locking the set. Other threads
+ * may schedule, reschedule and cancel timers, which queues the request lock free
+ * for the owner to apply when it next uses the set, so cancellations by other
+ * threads always return STK_SUCCESS and are called back in the owner thread.
+ * Only the owner may dispatch, query or free the set, so the set should be created
+ * by the thread which dispatches the environment's timers.
+ * Queued requests wake the env's dispatcher, sets which are not in the env timer pools
+ * should pass a stk_timer_set_wakeup_cb as the "timer_wakeup_cb" option to wake their owner instead.
+ * Requests for timers which expired or were cancelled before the owner applied them are dropped.
+ *
+ * \param env The environment which this timer set should be a part of
+ * \param user_setdata A user pointer passed to each call back for this set
+ * \param max_timers The maximum number of timers this set shall contain
+ * \param add_to_pool Indicates if the timer should be added to the environment timer pools
+ * \param options Options for the timer set, may be NULL
+ * \returns A handle to the allocated timer set
+ * \see stk_new_timer_set()
+ */
+stk_timer_set_t *stk_new_timer_set_with_options(stk_env_t *env,void *user_setdata,stk_uint32 max_timers,stk_bool add_to_pool,stk_options_t *options);
 /**
  * Free a timer set.
  *
@@ -85,6 +115,29 @@ stk_ret stk_cancel_timer(stk_timer_set_t *timer_set,stk_timer_t *timer);
  * \see stk_schedule_timer() stk_timer_cb_type STK_NOT_FOUND
  */
 stk_ret stk_cancel_timer_id(stk_timer_set_t *timer_set,stk_uint64 id);
+/**
+ * Find a scheduled timer by its ID.
+ * Timers are hashed by ID so this does not search the timer set.
+ * If ID's are reused, the timer which expires first is returned.
+ *
+ * \returns The timer or NULL if no timer with the ID is scheduled
+ * \see stk_schedule_timer() stk_cancel_timer_id()
+ */
+stk_timer_t *stk_find_timer_id(stk_timer_set_t *timer_set,stk_uint64 id);
+/**
+ * Determine if a timer is scheduled. Timers are no longer scheduled once
+ * they have been cancelled or their callback has been called for expiry,
+ * unless they are rescheduled.
+ *
+ * \see stk_schedule_timer() stk_reschedule_timer()
+ */
+stk_bool stk_timer_is_scheduled(stk_timer_set_t *timer_set,stk_timer_t *timer);
+/**
+ * Get the statistics of a timer set, which show how late timers are called back
+ * and how long their callbacks take.
+ * \see stk_timer_set_stats_t
+ */
+stk_ret stk_timer_set_get_stats(stk_timer_set_t *timer_set,stk_timer_set_stats_t *stats);
 /**
  * Dispatch the timers that have expired
  *
@@ -101,6 +154,14 @@ stk_ret stk_dispatch_timers(stk_timer_set_t *timer_set,unsigned short max_callba
  * \returns milliseconds until next timer expiration (or -1 if there is no timer)
  */
 int stk_next_timer_ms(stk_timer_set_t *timer_set);
+/**
+ * Get the time of the next timer expiration, on the clock used by stk_now()
+ * \param timer_set The timer set being queried
+ * \param deadline Filled with the time the next timer expires
+ * \returns STK_SUCCESS, or STK_NOT_FOUND if there is no timer
+ * \see stk_now()
+ */
+stk_ret stk_next_timer_deadline(stk_timer_set_t *timer_set,struct timeval *deadline);
 /**
  * Get the STK Environment from a timer set
  * \param timer_set The timer set from which the STK environ,ent is desired
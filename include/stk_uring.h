@@ -0,0 +1,50 @@
+/** @file stk_uring.h
+ * This file provides definitions and typdefs etc required for the io_uring I/O engine
+ */
+#ifndef STK_URING_H
+#define STK_URING_H
+
+#include "stk_common.h"
+#include "stk_data_flow.h"
+
+/**
+ * \typedef stk_uring_t
+ * An io_uring I/O engine. TCP, rawudp and udp data flows created with the "io_uring" option
+ * receive, send and accept through the ring instead of with system calls per operation.
+ * \see stk_create_uring()
+ */
+typedef struct stk_uring_stct stk_uring_t;
+
+/** The minimum "uring_buffer_size" of rings receiving datagrams, each buffer holds a datagram and its sender's address */
+#define STK_URING_DATAGRAM_BUFFER_SIZE 65600
+
+/** The data flow has data to be received, or a listening data flow has accepted a connection */
+#define STK_URING_READABLE 0x1
+/** The peer closed the data flow (or it failed) and all data received has been consumed */
+#define STK_URING_HUP      0x2
+
+/**
+ * Callback for data flows with completions, see stk_uring_process()
+ * \param ring The ring the data flow is using
+ * \param df The data flow
+ * \param fd The socket of the data flow
+ * \param events STK_URING_READABLE and/or STK_URING_HUP
+ * \param clientd The client data passed to stk_uring_process()
+ */
+typedef void (*stk_uring_cb)(stk_uring_t *ring,stk_data_flow_t *df,int fd,int events,void *clientd);
+
+/**
+ * Statistics maintained by an io_uring I/O engine
+ * \see stk_uring_get_stats()
+ */
+typedef struct stk_uring_stats_stct {
+	stk_uint64 submits;        /*!< System calls made to submit requests */
+	stk_uint64 sqes;           /*!< Requests submitted */
+	stk_uint64 completions;    /*!< Completions reaped */
+	stk_uint64 recv_bytes;     /*!< Bytes received in to provided buffers */
+	stk_uint64 send_bytes;     /*!< Bytes sent */
+	stk_uint64 accepts;        /*!< Connections accepted */
+	stk_uint64 starved;        /*!< Receives stopped because every provided buffer was in use */
+} stk_uring_stats_t;
+
+#endif
@@ -0,0 +1,75 @@
+/** @file stk_uring_api.h
+ * The io_uring I/O engine is an optional alternative to receiving and sending
+ * with a system call per operation on Linux. TCP, rawudp and udp data flows created with the "io_uring" option
+ * set to a ring are serviced by it:
+ *
+ * - Listening data flows accept connections with a multishot accept, and the
+ *   accepted data flows use the same ring.
+ * - Data is received by a multishot receive in to a ring of buffers provided to the kernel,
+ *   and copied out of them as each sequence is received.
+ * - Sends are copied and queued, and submitted in batches by stk_uring_submit().
+ *   A data flow has one send in flight at a time, sends queued meanwhile are coalesced.
+ * - Datagrams are received by a multishot recvmsg, one per buffer with the sender's address,
+ *   and each datagram sent is queued as a sendmsg. A data flow may have many datagrams in flight.
+ *
+ * The ring's fd is readable when there are completions, and stk_uring_process() calls back
+ * each data flow with data, much like the events from poll() for sockets. A ring is
+ * not thread safe, it should be used by the thread which dispatches its data flows.
+ */
+#ifndef STK_URING_API_H
+#define STK_URING_API_H
+
+#include "stk_uring.h"
+#include "stk_env.h"
+#include "stk_options.h"
+
+/**
+ * Create an io_uring I/O engine
+ * \param env The environment the ring is created in
+ * \param options Options - "uring_entries" sets the size of the submission queue (default 256),
+ *        "uring_buffers" the number of receive buffers provided to the kernel, a power of 2 (default 256),
+ *        "uring_buffer_size" the size of each receive buffer (default 16384), rings receiving datagrams need
+ *        buffers of at least STK_URING_DATAGRAM_BUFFER_SIZE bytes
+ * \returns A new ring, or NULL if io_uring is not supported by this system
+ */
+stk_uring_t *stk_create_uring(stk_env_t *env,stk_options_t *options);
+/**
+ * Destroy an io_uring I/O engine. Data flows using the ring must have been destroyed.
+ */
+stk_ret stk_destroy_uring(stk_uring_t *ring);
+/**
+ * Get the fd of a ring, which is readable when stk_uring_process() has completions to process
+ */
+int stk_uring_fd(stk_uring_t *ring);
+/**
+ * Submit the requests queued since the last submission (e.g. sends) in one system call
+ */
+stk_ret stk_uring_submit(stk_uring_t *ring);
+/**
+ * Process the completions of a ring and call back the data flows they are for.
+ * Each data flow with data is called back once, listening data flows are called
+ * back once per accepted connection.
+ * Queued requests are submitted first.
+ * \param ring The ring to be processed
+ * \param cb The callback for each data flow with events
+ * \param clientd Client data passed to the callback
+ * \see stk_uring_pending()
+ */
+stk_ret stk_uring_process(stk_uring_t *ring,stk_uring_cb cb,void *clientd);
+/**
+ * Determine if data flows have completions which were reaped (e.g. while receiving from another data flow)
+ * but not yet called back, in which case stk_uring_process() should be called before sleeping
+ */
+stk_bool stk_uring_pending(stk_uring_t *ring);
+/**
+ * Determine if an fd belongs to a data flow using a ring, such fds are not
+ * polled for readiness, the ring's fd is polled instead.
+ */
+stk_bool stk_uring_owns_fd(stk_uring_t *ring,int fd);
+/**
+ * Get the statistics of a ring
+ * \see stk_uring_stats_t
+ */
+stk_ret stk_uring_get_stats(stk_uring_t *ring,stk_uring_stats_t *stats);
+
+#endif
@@ -0,0 +1,65 @@
+/** @file stk_worker_pool.h
+ * This file provides definitions and typdefs etc required for worker pools
+ */
+#ifndef STK_WORKER_POOL_H
+#define STK_WORKER_POOL_H
+
+#include "stk_common.h"
+#include "stk_sequence.h"
+#include "stk_data_flow.h"
+
+/**
+ * \typedef stk_worker_pool_t
+ * A fixed pool of worker threads which process sequences handed to them
+ * by an I/O thread, so slow processing does not stall the I/O thread.
+ * \see stk_create_worker_pool()
+ */
+typedef struct stk_worker_pool_stct stk_worker_pool_t;
+
+/**
+ * Callback to process a sequence on a worker thread, see stk_worker_pool_dispatch()
+ * \param pool The worker pool
+ * \param df The data flow the sequence was dispatched for
+ * \param seq The sequence. The pool's hold is released when the callback returns,
+ *        use stk_hold_sequence() to retain it.
+ * \param clientd The client data passed to stk_create_worker_pool()
+ */
+typedef void (*stk_worker_cb)(stk_worker_pool_t *pool,stk_data_flow_t *df,stk_sequence_t *seq,void *clientd);
+
+/**
+ * The key which selects the worker a sequence is dispatched to. Sequences with the same
+ * key are processed in order by one worker, sequences with different keys in parallel.
+ * \see the "shard_key" option of stk_create_worker_pool()
+ */
+typedef enum {
+	STK_WORKER_POOL_KEY_DATA_FLOW,     /*!< The data flow the sequence was received on (the default) */
+	STK_WORKER_POOL_KEY_SEQUENCE_ID,   /*!< The sequence ID */
+	STK_WORKER_POOL_KEY_USER_TYPE      /*!< The data of the sequence's element of a user type */
+} stk_worker_pool_key_t;
+
+/** Return STK_WOULDBLOCK instead of waiting if the worker's queue is full */
+#define STK_WORKER_POOL_NONBLOCK 0x1
+
+/** The number of buckets in worker pool statistics histograms */
+#define STK_WORKER_POOL_HISTOGRAM_BUCKETS 24
+
+/**
+ * Statistics maintained by a worker pool, totals of all its workers or those of one worker.
+ * Histograms have power of 2 microsecond buckets, bucket 0 counts values under 1us,
+ * bucket N counts values from 2^(N-1)us up to 2^Nus, and the last bucket also counts all larger values.
+ * \see stk_worker_pool_get_stats() stk_worker_pool_get_worker_stats()
+ */
+typedef struct stk_worker_pool_stats_stct {
+	stk_uint64 dispatched;     /*!< Sequences queued to workers */
+	stk_uint64 processed;      /*!< Sequences processed by workers */
+	stk_uint64 unkeyed;        /*!< Sequences without the element keying them, dispatched by data flow */
+	stk_uint64 full;           /*!< Dispatches which found the worker's queue full */
+	stk_uint64 rejected;       /*!< Non blocking dispatches which returned STK_WOULDBLOCK */
+	stk_uint64 blocked_us;     /*!< Time dispatches waited for space in full queues */
+	stk_uint64 depth;          /*!< Sequences dispatched and not yet processed, including those being processed */
+	stk_uint64 depth_max;      /*!< The most sequences dispatched to one worker and not yet processed */
+	stk_uint64 wait_max_us;    /*!< The longest a sequence was queued before it was processed */
+	stk_uint64 wait[STK_WORKER_POOL_HISTOGRAM_BUCKETS]; /*!< How long sequences were queued before they were processed */
+} stk_worker_pool_stats_t;
+
+#endif
@@ -0,0 +1,84 @@
+/** @file stk_worker_pool_api.h
+ * Worker pools decouple the processing of received sequences from the thread
+ * receiving them. The receiving thread dispatches each sequence to a worker,
+ * which calls back the pool's callback on its own thread, so a slow callback
+ * only delays the sequences queued to that worker.
+ *
+ * Each worker has a fixed size lock free queue. Sequences are sharded across the workers by
+ * a key, by default the data flow they were received on. Sequences with the same key always
+ * go to the same worker, so they are processed in the order they were dispatched, while
+ * sequences with different keys are processed in parallel. The "shard_key" option keys
+ * sequences by their ID or by an element of a user type instead (e.g. an instrument),
+ * so one busy data flow is spread across the workers.
+ * When a worker's queue is full dispatching waits for space, applying backpressure
+ * to the receiving thread (and so to the peer), or returns STK_WOULDBLOCK
+ * if STK_WORKER_POOL_NONBLOCK is passed.
+ *
+ * Callbacks run concurrently on the workers. Data flows are not thread safe, so a callback
+ * which sends on a data flow should be the only thread sending on it.
+ */
+#ifndef STK_WORKER_POOL_API_H
+#define STK_WORKER_POOL_API_H
+
+#include "stk_worker_pool.h"
+#include "stk_env.h"
+#include "stk_options.h"
+
+/**
+ * Create a worker pool and start its threads
+ * \param env The environment the pool is created in
+ * \param cb The callback for each sequence, called on a worker thread
+ * \param clientd Client data passed to the callback
+ * \param options Options - "workers" sets the number of worker threads (default 4),
+ *        "worker_queue_size" the number of sequences each worker may have queued, rounded up to a power of 2 (default 1024),
+ *        "shard_key" the key selecting the worker of a sequence - "data_flow" (default), "sequence_id" or "user_type",
+ *        "shard_user_type" the user type of the element keying sequences when "shard_key" is "user_type".
+ *        Sequences without an element of that type are keyed by their data flow.
+ * \see stk_worker_pool_key_t
+ * \returns A new pool, or NULL on failure
+ */
+stk_worker_pool_t *stk_create_worker_pool(stk_env_t *env,stk_worker_cb cb,void *clientd,stk_options_t *options);
+/**
+ * Destroy a worker pool. The sequences queued are processed, then the workers exit.
+ * Must not be called from a worker.
+ */
+stk_ret stk_destroy_worker_pool(stk_worker_pool_t *pool);
+/**
+ * Dispatch a sequence to be processed by a worker. The sequence is held
+ * until it has been processed, so it may be released (e.g. to a sequence pool) on return.
+ * \param pool The worker pool
+ * \param df The data flow the sequence was received on
+ * \param seq The sequence
+ * \param flags STK_WORKER_POOL_NONBLOCK or 0 to wait for space in the worker's queue
+ * \returns STK_SUCCESS if queued, STK_WOULDBLOCK if the queue was full and STK_WORKER_POOL_NONBLOCK was passed
+ * \see stk_worker_pool_key_t
+ */
+stk_ret stk_worker_pool_dispatch(stk_worker_pool_t *pool,stk_data_flow_t *df,stk_sequence_t *seq,int flags);
+/**
+ * Dispatch a sequence to the worker of a key chosen by the application, instead of the pool's "shard_key".
+ * Sequences with the same key are processed in order. \see stk_worker_pool_dispatch()
+ */
+stk_ret stk_worker_pool_dispatch_key(stk_worker_pool_t *pool,stk_data_flow_t *df,stk_sequence_t *seq,stk_uint64 key,int flags);
+/**
+ * Wait for the sequences dispatched before this call to be processed, e.g. before
+ * destroying a data flow they were dispatched for. Must not be called from a worker.
+ */
+stk_ret stk_worker_pool_flush(stk_worker_pool_t *pool);
+/**
+ * Get the number of worker threads in a pool
+ */
+int stk_worker_pool_workers(stk_worker_pool_t *pool);
+/**
+ * Get the statistics of a worker pool
+ * \see stk_worker_pool_stats_t
+ */
+stk_ret stk_worker_pool_get_stats(stk_worker_pool_t *pool,stk_worker_pool_stats_t *stats);
+/**
+ * Get the statistics of one worker of a pool, e.g. to find keys skewed on to one worker
+ * \param pool The worker pool
+ * \param idx The worker, from 0 to stk_worker_pool_workers() - 1
+ * \param stats The statistics of the worker
+ */
+stk_ret stk_worker_pool_get_worker_stats(stk_worker_pool_t *pool,int idx,stk_worker_pool_stats_t *stats);
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef STK_ASSERT_LOG_H
 #define STK_ASSERT_LOG_H
 #include "stdio.h"
+#include "stk_clock_api.h"
 
 extern FILE * stk_assert_log_file;
 extern int stk_assert_log;
@@ -60,7 +61,7 @@ void stk_assert_init();
 #define STK_ASSERT_LOG_COMMON(_file,_expr,_result,...) do { \
 	struct timeval ltv; \
 	pthread_t tid = pthread_self(); \
-	gettimeofday(&ltv,NULL); \
+	stk_now_realtime(&ltv); \
 	fprintf(_file,"%lu:%5d.%06d:%s[%d]:"#_expr ":%s: ",(unsigned long)tid,(int)(ltv.tv_sec % 86400),(int)(ltv.tv_usec),__FUNCTION__, __LINE__, __FILE__); \
 	fprintf(_file,__VA_ARGS__); \
 	if(!(_result)) fprintf(_file," ** FAILED **"); \
@@ -0,0 +1,69 @@
+#include "stk_clock_api.h"
+#include "stk_internal.h"
+#include <time.h>
+
+#ifndef CLOCK_MONOTONIC_COARSE
+#define CLOCK_MONOTONIC_COARSE CLOCK_MONOTONIC
+#endif
+
+/* Times cached by a dispatcher for its thread */
+static __thread struct {
+	stk_bool valid;
+	struct timeval mono;
+	struct timeval real;
+} stk_clock_cache;
+
+static stk_ret stk_clock_read(clockid_t clk,struct timeval *tv)
+{
+	struct timespec ts;
+
+	if(clock_gettime(clk,&ts) == -1) return STK_SYSERR;
+	tv->tv_sec = ts.tv_sec;
+	tv->tv_usec = ts.tv_nsec / 1000;
+	return STK_SUCCESS;
+}
+
+stk_ret stk_now(struct timeval *tv)
+{
+	if(stk_clock_cache.valid) {
+		*tv = stk_clock_cache.mono;
+		return STK_SUCCESS;
+	}
+	return stk_clock_read(CLOCK_MONOTONIC,tv);
+}
+
+stk_ret stk_now_precise(struct timeval *tv)
+{
+	return stk_clock_read(CLOCK_MONOTONIC,tv);
+}
+
+stk_ret stk_now_coarse(struct timeval *tv)
+{
+	if(stk_clock_cache.valid) {
+		*tv = stk_clock_cache.mono;
+		return STK_SUCCESS;
+	}
+	return stk_clock_read(CLOCK_MONOTONIC_COARSE,tv);
+}
+
+stk_ret stk_now_realtime(struct timeval *tv)
+{
+	if(stk_clock_cache.valid) {
+		*tv = stk_clock_cache.real;
+		return STK_SUCCESS;
+	}
+	return gettimeofday(tv,NULL) == 0 ? STK_SUCCESS : STK_SYSERR;
+}
+
+void stk_clock_cache_update(void)
+{
+	stk_clock_cache.valid = STK_FALSE;
+	if(stk_clock_read(CLOCK_MONOTONIC,&stk_clock_cache.mono) != STK_SUCCESS) return;
+	if(gettimeofday(&stk_clock_cache.real,NULL) != 0) return;
+	stk_clock_cache.valid = STK_TRUE;
+}
+
+void stk_clock_cache_clear(void)
+{
+	stk_clock_cache.valid = STK_FALSE;
+}
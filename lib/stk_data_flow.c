@@ -5,9 +5,16 @@
 #include "stk_options_api.h"
 #include "stk_sequence_api.h"
 #include "stk_sync_api.h"
+#include "stk_clock_api.h"
 #include <string.h>
 #include <ctype.h>
 
+/* Implemented in stk_sequence.c */
+stk_data_flow_transport_t *stk_sequence_transport(stk_sequence_t *seq);
+
+/* Indexed by stk_data_flow_protocol_id */
+static char *stk_data_flow_protocol_names[] = { NULL, "tcp", "udp", "rawudp" };
+
 typedef struct stk_data_flow_cbs_stct {
 	stk_data_flow_destroyed_cb destroyed_cb;
 } stk_data_flow_cbs;
@@ -22,6 +29,7 @@ struct stk_data_flow_stct {
 	int errno;
 	int refcnt;
 	stk_data_flow_cbs df_cbs;
+	stk_data_flow_protocol_id protocol_id; /* Cached from the module protocol on first receive */
 	void *module_data;
 };
 
@@ -155,35 +163,54 @@ stk_ret stk_data_flow_buffered(stk_data_flow_t *df)
 
 stk_ret stk_data_flow_client_ip(stk_sequence_t *seq,struct sockaddr_in *client_ip,socklen_t *addrlen)
 {
-	struct sockaddr_in *client_ip_ptr;
-	stk_uint64 len = (stk_uint64) *addrlen;
-	stk_ret rc;
+	stk_data_flow_transport_t *transport = stk_sequence_transport(seq);
+
+	if(transport->addrlen > 0) {
+		*addrlen = transport->addrlen;
+		memcpy(client_ip,&transport->client_ip,*addrlen);
+	} else {
+		/* Client IPs may also be added as meta data */
+		struct sockaddr_in *client_ip_ptr;
+		stk_uint64 len = (stk_uint64) *addrlen;
+		stk_ret rc = stk_sequence_find_meta_data_by_type(seq, STK_DATA_FLOW_CLIENTIP_ID, (void **) &client_ip_ptr,&len);
+		if(rc != STK_SUCCESS) return rc;
 
-	rc = stk_sequence_find_meta_data_by_type(seq, STK_DATA_FLOW_CLIENTIP_ID, (void **) &client_ip_ptr,&len);
-	if(rc == STK_SUCCESS) {
 		*addrlen = (int) len;
 		memcpy(client_ip,client_ip_ptr,*addrlen);
-		client_ip->sin_addr.s_addr = ntohl((unsigned long)client_ip->sin_addr.s_addr);
-		client_ip->sin_port = ntohs(client_ip->sin_port);
 	}
-	return rc;
+	client_ip->sin_addr.s_addr = ntohl((unsigned long)client_ip->sin_addr.s_addr);
+	client_ip->sin_port = ntohs(client_ip->sin_port);
+	return STK_SUCCESS;
 }
 
 stk_ret stk_data_flow_add_client_ip(stk_sequence_t *seq,struct sockaddr_in *client_ip_ptr,socklen_t addrlen)
 {
-	struct sockaddr_in client_ip;
-	memcpy(&client_ip,client_ip_ptr,addrlen);
-	client_ip.sin_addr.s_addr = ntohl((unsigned long)client_ip.sin_addr.s_addr);
-	client_ip.sin_port = ntohs(client_ip.sin_port);
-	return stk_copy_to_sequence_meta_data(seq,(struct sockaddr *)&client_ip,addrlen,STK_DATA_FLOW_CLIENTIP_ID);
+	stk_data_flow_transport_t *transport = stk_sequence_transport(seq);
+
+	STK_CHECK_RET(STKA_DF,addrlen > 0 && addrlen <= sizeof(transport->client_ip),!STK_SUCCESS,"client IP length %d is invalid",(int) addrlen);
+
+	memcpy(&transport->client_ip,client_ip_ptr,addrlen);
+	transport->client_ip.sin_addr.s_addr = ntohl((unsigned long)transport->client_ip.sin_addr.s_addr);
+	transport->client_ip.sin_port = ntohs(transport->client_ip.sin_port);
+	transport->addrlen = addrlen;
+	return STK_SUCCESS;
 }
 
 stk_ret stk_data_flow_client_protocol(stk_sequence_t *seq,char *protocol_ptr, stk_uint64 *plen)
 {
+	stk_data_flow_transport_t *transport = stk_sequence_transport(seq);
 	stk_uint64 len = (stk_uint64) *plen;
 	stk_ret rc;
 	char *ptr;
 
+	if(transport->protocol != STK_DATA_FLOW_PROTOCOL_UNKNOWN) {
+		ptr = stk_data_flow_protocol_names[transport->protocol];
+		*plen = strlen(ptr) + 1;
+		memcpy(protocol_ptr,ptr,(int)*plen);
+		return STK_SUCCESS;
+	}
+
+	/* Application defined protocols are stored as meta data */
 	rc = stk_sequence_find_meta_data_by_type(seq, STK_DATA_FLOW_CLIENT_PROTOCOL_ID, (void **) &ptr, &len);
 	if(rc == STK_SUCCESS) {
 		*plen = len;
@@ -192,11 +219,66 @@ stk_ret stk_data_flow_client_protocol(stk_sequence_t *seq,char *protocol_ptr, st
 	return rc;
 }
 
+static stk_data_flow_protocol_id stk_data_flow_protocol_lookup(char *protocol)
+{
+	for(int idx = 1; idx < (int) (sizeof(stk_data_flow_protocol_names) / sizeof(stk_data_flow_protocol_names[0])); idx++)
+		if(!strcmp(protocol,stk_data_flow_protocol_names[idx])) return (stk_data_flow_protocol_id) idx;
+	return STK_DATA_FLOW_PROTOCOL_UNKNOWN;
+}
+
 stk_ret stk_data_flow_add_client_protocol(stk_sequence_t *seq,char *protocol)
 {
+	stk_data_flow_protocol_id protocol_id = stk_data_flow_protocol_lookup(protocol);
+
+	if(protocol_id != STK_DATA_FLOW_PROTOCOL_UNKNOWN) {
+		stk_sequence_transport(seq)->protocol = protocol_id;
+		return STK_SUCCESS;
+	}
 	return stk_copy_to_sequence_meta_data(seq,protocol,strlen(protocol) + 1,STK_DATA_FLOW_CLIENT_PROTOCOL_ID);
 }
 
+stk_ret stk_data_flow_set_received(stk_data_flow_t *df,stk_sequence_t *seq,struct sockaddr_in *client_ip,socklen_t addrlen)
+{
+	stk_data_flow_transport_t *transport = stk_sequence_transport(seq);
+	stk_ret rc;
+
+	STK_ASSERT(STKA_DF,df->stct_type==STK_STCT_DATA_FLOW,"data flow %p passed in to stk_data_flow_set_received is structure type %d",df,df->stct_type);
+
+	rc = stk_data_flow_add_client_ip(seq,client_ip,addrlen);
+	if(rc != STK_SUCCESS) return rc;
+
+	if(df->protocol_id == STK_DATA_FLOW_PROTOCOL_UNKNOWN && df->fptr.data_flow_protocol)
+		df->protocol_id = stk_data_flow_protocol_lookup(df->fptr.data_flow_protocol(df));
+	transport->protocol = df->protocol_id;
+	if(transport->df != df) {
+		/* Sequences may outlive the data flow, e.g. queued to a worker pool */
+		stk_hold_data_flow(df);
+		if(transport->df) stk_free_data_flow(transport->df);
+		transport->df = df;
+	}
+	stk_now_realtime(&transport->received);
+	return STK_SUCCESS;
+}
+
+stk_data_flow_protocol_id stk_data_flow_client_protocol_id(stk_sequence_t *seq)
+{
+	return stk_sequence_transport(seq)->protocol;
+}
+
+stk_ret stk_data_flow_receive_time(stk_sequence_t *seq,struct timeval *tv)
+{
+	stk_data_flow_transport_t *transport = stk_sequence_transport(seq);
+
+	if(!transport->df) return STK_NOT_FOUND;
+	*tv = transport->received;
+	return STK_SUCCESS;
+}
+
+stk_data_flow_t *stk_data_flow_received_on(stk_sequence_t *seq)
+{
+	return stk_sequence_transport(seq)->df;
+}
+
 /* Utility to find a data flow option and do all the necessary work for data flow creation */
 stk_data_flow_t *stk_data_flow_process_extended_options(stk_env_t *env, stk_options_t *options, char *option_name, stk_create_data_flow_t create_data_flow)
 {
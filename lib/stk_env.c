@@ -10,22 +10,107 @@
 #include "stk_data_flow_api.h"
 #include "stk_tcp_client_api.h"
 #include "stk_udp_client_api.h"
+#include "stk_sync_api.h"
+#include "stk_clock_api.h"
 #include <limits.h>
 #include <string.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <errno.h>
+#ifdef __linux__
+#include <sys/timerfd.h>
+#endif
+
+/* The timer pool is a min-heap of timer sets ordered by their earliest timer deadline */
+typedef struct stk_env_timer_entry_stct {
+	stk_timer_set_t *tset;
+	struct timeval deadline; /* May be earlier than the set's deadline (e.g. timers were cancelled), never later */
+} stk_env_timer_entry_t;
+
+#define STK_ENV_TIMER_POOL_INITIAL_SZ 16
+#define STK_ENV_NO_DEADLINE LONG_MAX /* tv_sec of the deadline of timer sets without timers */
+
+/* Values of a timer set's pool index when it is not in the heap, either not pooled or due (being dispatched) */
+#define STK_ENV_TIMER_NOT_POOLED -1
+#define STK_ENV_TIMER_DUE(_due_idx) (-2 - (_due_idx))
+#define STK_ENV_TIMER_DUE_IDX(_pool_idx) (-2 - (_pool_idx))
 
-#define MAX_TIMER_POOL_SZ 25
 struct stk_env_stct 
 {
 	stk_stct_type stct_type;
-	stk_timer_set_t *timer_pool[MAX_TIMER_POOL_SZ];
+	stk_env_timer_entry_t *timer_pool; /* Heap of timer sets */
+	int timer_pool_count;
+	int timer_pool_sz;
+	stk_env_timer_entry_t *timer_due;  /* Timer sets taken off the heap while they are dispatched */
+	int timer_due_count;
+	stk_mutex_t *timer_pool_lock;      /* Protects the timer pool and timer fd */
+	struct timeval timer_pool_wake;    /* Earliest deadline last seen by a dispatcher, it need not be woken for later timers */
+	stk_timer_set_t *default_timer_set; /* First set added (the smartbeat set), env timers are scheduled on it */
 	stk_wakeup_dispatcher_cb wakeup_cb;
 	stk_smartbeat_ctrl_t *smb;
 	stk_name_service_t *name_svc;
 	stk_data_flow_t *monitoring_df;
 	void *dispatcher;
+	stk_slab_allocator_t *slab;
+	stk_uint64 seqid_seed;          /* Random per env, so IDs from different processes don't collide */
+	volatile stk_uint64 seqid_next; /* Next sequence ID counter to be reserved */
+	int timer_fd;                   /* Armed to the earliest timer deadline in the timer pools, or -1 */
+	stk_bool timer_fd_armed;
+	struct timeval timer_fd_deadline;
 };
 
+void stk_env_timer_scheduled(stk_env_t *env,stk_timer_set_t *tset,struct timeval *deadline);
+
+/* Implemented in stk_timer.c */
+int *stk_timer_set_pool_idx(stk_timer_set_t *timer_set);
+
+/* Sequence ID counters for sequences created without an env */
+static stk_uint64 stk_global_seqid_seed;
+static volatile stk_uint64 stk_global_seqid_next;
+
+static stk_uint64 stk_random_seed(void)
+{
+	stk_uint64 seed = 0;
+	int fd = open("/dev/urandom",O_RDONLY);
+
+	if(fd != -1) {
+		if(read(fd,&seed,sizeof(seed)) != sizeof(seed)) seed = 0;
+		close(fd);
+	}
+	if(seed == 0) {
+		struct timeval tv;
+
+		gettimeofday(&tv,NULL);
+		seed = ((stk_uint64) getpid() << 32) ^ ((stk_uint64) tv.tv_sec << 20) ^ (stk_uint64) tv.tv_usec;
+	}
+	return seed;
+}
+
+/* Reserve a block of sequence ID counters, the caller mixes them with the seed to generate IDs */
+stk_uint64 stk_env_reserve_sequence_ids(stk_env_t *env,stk_uint64 count,stk_uint64 *seed)
+{
+	if(!env) {
+		stk_uint64 global_seed = stk_atomic_load_64(&stk_global_seqid_seed,STK_MO_ACQUIRE);
+
+		if(global_seed == 0) {
+			stk_uint64 expected = 0;
+			stk_uint64 new_seed = stk_random_seed() | 1;
+
+			if(stk_atomic_cas_64(&stk_global_seqid_seed,&expected,new_seed,STK_MO_ACQ_REL))
+				global_seed = new_seed;
+			else
+				global_seed = expected;
+		}
+		*seed = global_seed;
+		return stk_atomic_fetch_add_64(&stk_global_seqid_next,count,STK_MO_RELAXED);
+	}
+
+	*seed = env->seqid_seed;
+	return stk_atomic_fetch_add_64(&env->seqid_next,count,STK_MO_RELAXED);
+}
+
 stk_env_t *stk_create_env(stk_options_t *options)
 {
 	stk_env_t * env;
@@ -34,6 +119,26 @@ stk_env_t *stk_create_env(stk_options_t *options)
 	STK_CALLOC_STCT(STK_STCT_ENV,stk_env_t,env);
 	env->wakeup_cb = (stk_wakeup_dispatcher_cb) stk_find_option(options,"wakeup_cb",NULL);
 	env->dispatcher = stk_find_option(options,"dispatcher",NULL);
+	env->seqid_seed = stk_random_seed();
+	env->timer_fd = -1;
+	env->timer_pool_wake.tv_sec = STK_ENV_NO_DEADLINE;
+
+	ret = stk_mutex_init(&env->timer_pool_lock);
+	STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"create env timer pool lock");
+
+	if(stk_find_option(options,"timer_fd",NULL)) {
+#ifdef __linux__
+		env->timer_fd = timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK|TFD_CLOEXEC);
+		STK_ASSERT(STKA_TIMER,env->timer_fd!=-1,"create env timer fd errno %d",errno);
+#else
+		STK_LOG(STK_LOG_ERROR,"timer_fd is not supported on this platform, timers will be dispatched by polling");
+#endif
+	}
+
+	if(stk_find_option(options,"slab_allocator",NULL)) {
+		env->slab = stk_create_slab_allocator(options);
+		STK_ASSERT(STKA_MEM,env->slab!=NULL,"create slab allocator");
+	}
 
 	env->smb = stk_create_smartbeat_ctrl(env);
 	STK_ASSERT(STK_STCT_ENV,env->smb!=NULL,"create smartbeat controller");
@@ -76,7 +181,7 @@ stk_ret stk_set_env_monitoring_data_flow(stk_env_t *env,stk_options_t *options)
 		/* Schedule current monitoring_df to be reaped later 
 		 * callback for stk_data_flow_destroy(env->monitoring_df)
 		 */
-		stk_timer_t *reap_timer = stk_schedule_timer(env->timer_pool[0],stk_reap_monitoring_cb,0,env->monitoring_df,60000);
+		stk_timer_t *reap_timer = stk_schedule_timer(stk_env_get_default_timer_set(env),stk_reap_monitoring_cb,0,env->monitoring_df,60000);
 		STK_ASSERT(STKA_DF,reap_timer!=NULL,"schedule monitoring reaper timer for data flow %p",env->monitoring_df);
 	}
 	env->monitoring_df = df;
@@ -103,74 +208,435 @@ stk_bool stk_destroy_env(stk_env_t *env)
 		STK_ASSERT(STKA_MEM,rc == STK_SUCCESS,"destroy smartbeat controller");
 	}
 
-	for(int idx = 0; idx < MAX_TIMER_POOL_SZ; idx++) {
-		STK_ASSERT(STKA_MEM,env->timer_pool[idx] == NULL,"Timer pool %d not freed when closing env",idx);
+	STK_ASSERT(STKA_MEM,env->timer_pool_count == 0,"%d timer sets not freed when closing env",env->timer_pool_count);
+	if(env->timer_pool) free(env->timer_pool);
+	if(env->timer_due) free(env->timer_due);
+
+	if(env->slab) {
+		stk_ret rc = stk_destroy_slab_allocator(env->slab);
+		STK_ASSERT(STKA_MEM,rc == STK_SUCCESS,"destroy slab allocator");
+	}
+
+	if(env->timer_fd != -1)
+		close(env->timer_fd);
+
+	{
+	stk_ret rc = stk_mutex_destroy(env->timer_pool_lock);
+	STK_ASSERT(STKA_TIMER,rc == STK_SUCCESS,"destroy env timer pool lock");
 	}
 
 	STK_FREE_STCT(STK_STCT_ENV,env);
 	return STK_SUCCESS;
 }
 
+/* Timer pool heap operations, called with timer_pool_lock held */
+static void stk_env_timer_pool_place(stk_env_t *env,int idx,stk_env_timer_entry_t *entry)
+{
+	env->timer_pool[idx] = *entry;
+	*stk_timer_set_pool_idx(entry->tset) = idx;
+}
+
+static void stk_env_timer_pool_sift_up(stk_env_t *env,int idx)
+{
+	stk_env_timer_entry_t entry = env->timer_pool[idx];
+
+	while(idx > 0) {
+		int parent = (idx - 1) / 2;
+		if(!timercmp(&entry.deadline,&env->timer_pool[parent].deadline,<)) break;
+		stk_env_timer_pool_place(env,idx,&env->timer_pool[parent]);
+		idx = parent;
+	}
+	stk_env_timer_pool_place(env,idx,&entry);
+}
+
+static void stk_env_timer_pool_sift_down(stk_env_t *env,int idx)
+{
+	stk_env_timer_entry_t entry = env->timer_pool[idx];
+
+	for(;;) {
+		int child = (idx * 2) + 1;
+		if(child >= env->timer_pool_count) break;
+		if(child + 1 < env->timer_pool_count && timercmp(&env->timer_pool[child + 1].deadline,&env->timer_pool[child].deadline,<))
+			child++;
+		if(!timercmp(&env->timer_pool[child].deadline,&entry.deadline,<)) break;
+		stk_env_timer_pool_place(env,idx,&env->timer_pool[child]);
+		idx = child;
+	}
+	stk_env_timer_pool_place(env,idx,&entry);
+}
+
+/* Add a set to the heap. Sets with an unknown (NULL) deadline are treated as due until their deadline is refreshed */
+static void stk_env_timer_pool_insert(stk_env_t *env,stk_timer_set_t *tset,struct timeval *deadline)
+{
+	stk_env_timer_entry_t entry;
+
+	entry.tset = tset;
+	if(deadline)
+		entry.deadline = *deadline;
+	else
+		timerclear(&entry.deadline);
+	env->timer_pool[env->timer_pool_count++] = entry;
+	stk_env_timer_pool_sift_up(env,env->timer_pool_count - 1);
+}
+
+static void stk_env_timer_pool_delete(stk_env_t *env,int idx)
+{
+	*stk_timer_set_pool_idx(env->timer_pool[idx].tset) = STK_ENV_TIMER_NOT_POOLED;
+	if(--env->timer_pool_count == idx) return;
+
+	{
+	stk_timer_set_t *moved = env->timer_pool[env->timer_pool_count].tset;
+
+	env->timer_pool[idx] = env->timer_pool[env->timer_pool_count];
+	stk_env_timer_pool_sift_up(env,idx);
+	if(*stk_timer_set_pool_idx(moved) == idx)
+		stk_env_timer_pool_sift_down(env,idx);
+	}
+}
+
+static void stk_env_timer_set_deadline(stk_timer_set_t *tset,struct timeval *deadline)
+{
+	if(stk_next_timer_deadline(tset,deadline) != STK_SUCCESS) {
+		deadline->tv_sec = STK_ENV_NO_DEADLINE;
+		deadline->tv_usec = 0;
+	}
+}
+
+/* Get the earliest deadline in the timer pool, refreshing the deadline of the set at the top of the heap until it is current.
+ * Deadlines are read without timer_pool_lock held because timer callbacks may schedule timers with their timer set locked.
+ * \returns Whether any timer set in the pool has timers
+ */
+static stk_bool stk_env_timer_pool_earliest(stk_env_t *env,struct timeval *earliest)
+{
+	for(;;) {
+		stk_timer_set_t *tset;
+		struct timeval pooled, deadline;
+		stk_ret rc = stk_mutex_lock(env->timer_pool_lock);
+		STK_ASSERT(STKA_TIMER,rc==STK_SUCCESS,"lock env %p timer pool",env);
+
+		if(env->timer_pool_count == 0) {
+			env->timer_pool_wake.tv_sec = STK_ENV_NO_DEADLINE;
+			env->timer_pool_wake.tv_usec = 0;
+			rc = stk_mutex_unlock(env->timer_pool_lock);
+			STK_ASSERT(STKA_TIMER,rc==STK_SUCCESS,"unlock env %p timer pool",env);
+			return STK_FALSE;
+		}
+		tset = env->timer_pool[0].tset;
+		pooled = env->timer_pool[0].deadline;
+
+		rc = stk_mutex_unlock(env->timer_pool_lock);
+		STK_ASSERT(STKA_TIMER,rc==STK_SUCCESS,"unlock env %p timer pool",env);
+
+		stk_env_timer_set_deadline(tset,&deadline);
+
+		rc = stk_mutex_lock(env->timer_pool_lock);
+		STK_ASSERT(STKA_TIMER,rc==STK_SUCCESS,"lock env %p timer pool",env);
+
+		/* Retry if the heap changed while the deadline was read */
+		if(env->timer_pool_count > 0 && env->timer_pool[0].tset == tset && !timercmp(&env->timer_pool[0].deadline,&pooled,!=)) {
+			if(!timercmp(&deadline,&pooled,!=)) {
+				env->timer_pool_wake = deadline;
+				rc = stk_mutex_unlock(env->timer_pool_lock);
+				STK_ASSERT(STKA_TIMER,rc==STK_SUCCESS,"unlock env %p timer pool",env);
+
+				*earliest = deadline;
+				return deadline.tv_sec != STK_ENV_NO_DEADLINE;
+			}
+			env->timer_pool[0].deadline = deadline;
+			stk_env_timer_pool_sift_down(env,0);
+		}
+
+		rc = stk_mutex_unlock(env->timer_pool_lock);
+		STK_ASSERT(STKA_TIMER,rc==STK_SUCCESS,"unlock env %p timer pool",env);
+	}
+}
+
 stk_ret stk_env_add_timer_set(stk_env_t *env,stk_timer_set_t *tset)
 {
-	for(int idx = 0; idx < MAX_TIMER_POOL_SZ; idx++) {
-		if(env->timer_pool[idx] == NULL) {
-			env->timer_pool[idx] = tset;
-			return STK_SUCCESS;
+	stk_ret rc = stk_mutex_lock(env->timer_pool_lock);
+	STK_ASSERT(STKA_TIMER,rc==STK_SUCCESS,"lock env %p timer pool",env);
+
+	if(env->timer_pool_count == env->timer_pool_sz) {
+		int sz = env->timer_pool_sz ? env->timer_pool_sz * 2 : STK_ENV_TIMER_POOL_INITIAL_SZ;
+		stk_env_timer_entry_t *pool = realloc(env->timer_pool,sz * sizeof(stk_env_timer_entry_t));
+		stk_env_timer_entry_t *due = realloc(env->timer_due,sz * sizeof(stk_env_timer_entry_t));
+
+		if(pool) env->timer_pool = pool;
+		if(due) env->timer_due = due;
+		if(!pool || !due) {
+			rc = stk_mutex_unlock(env->timer_pool_lock);
+			STK_ASSERT(STKA_TIMER,rc==STK_SUCCESS,"unlock env %p timer pool",env);
+			STK_LOG(STK_LOG_ERROR,"grow env %p timer pool to %d timer sets",env,sz);
+			return STK_MEMERR;
 		}
+		env->timer_pool_sz = sz;
 	}
-	return !STK_SUCCESS;
+	stk_env_timer_pool_insert(env,tset,NULL);
+	if(!env->default_timer_set) env->default_timer_set = tset;
+
+	rc = stk_mutex_unlock(env->timer_pool_lock);
+	STK_ASSERT(STKA_TIMER,rc==STK_SUCCESS,"unlock env %p timer pool",env);
+
+	/* The set may already have timers scheduled */
+	if(env->timer_fd != -1) {
+		struct timeval deadline;
+		if(stk_next_timer_deadline(tset,&deadline) == STK_SUCCESS)
+			stk_env_timer_scheduled(env,tset,&deadline);
+	}
+	return STK_SUCCESS;
 }
 
 stk_ret stk_env_remove_timer_set(stk_env_t *env,stk_timer_set_t *tset)
 {
-	for(int idx = 0; idx < MAX_TIMER_POOL_SZ; idx++) {
-		if(env->timer_pool[idx] == tset) {
-			env->timer_pool[idx] = NULL;
-			return STK_SUCCESS;
-		}
+	int *pool_idx = stk_timer_set_pool_idx(tset);
+	stk_ret ret = STK_SUCCESS;
+	stk_ret rc = stk_mutex_lock(env->timer_pool_lock);
+	STK_ASSERT(STKA_TIMER,rc==STK_SUCCESS,"lock env %p timer pool",env);
+
+	if(*pool_idx >= 0 && *pool_idx < env->timer_pool_count && env->timer_pool[*pool_idx].tset == tset)
+		stk_env_timer_pool_delete(env,*pool_idx);
+	else if(*pool_idx < STK_ENV_TIMER_NOT_POOLED) {
+		env->timer_due[STK_ENV_TIMER_DUE_IDX(*pool_idx)].tset = NULL;
+		*pool_idx = STK_ENV_TIMER_NOT_POOLED;
 	}
-	return !STK_SUCCESS;
+	else
+		ret = !STK_SUCCESS;
+	if(env->default_timer_set == tset) env->default_timer_set = NULL;
+
+	rc = stk_mutex_unlock(env->timer_pool_lock);
+	STK_ASSERT(STKA_TIMER,rc==STK_SUCCESS,"unlock env %p timer pool",env);
+	return ret;
 }
 
 stk_ret stk_env_dispatch_timer_pool(stk_env_t *env,unsigned short max_callbacks,int idx)
 {
-	if(env->timer_pool[idx])
-		return stk_dispatch_timers(env->timer_pool[idx],max_callbacks);
-	return !STK_SUCCESS;
+	stk_timer_set_t *tset = stk_env_get_timer_set(env,idx);
+	stk_ret rc;
+
+	if(!tset) return !STK_SUCCESS;
+
+	rc = stk_dispatch_timers(tset,max_callbacks);
+
+	/* The set's deadline is refreshed when it reaches the top of the heap */
+	{
+	stk_ret ret = stk_mutex_lock(env->timer_pool_lock);
+	STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"lock env %p timer pool",env);
+
+	idx = *stk_timer_set_pool_idx(tset);
+	if(idx >= 0) {
+		timerclear(&env->timer_pool[idx].deadline);
+		stk_env_timer_pool_sift_up(env,idx);
+	}
+
+	ret = stk_mutex_unlock(env->timer_pool_lock);
+	STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"unlock env %p timer pool",env);
+	}
+	return rc;
 }
 
+/* Only the timer sets at the top of the heap with expired (or unknown) deadlines are dispatched.
+ * They are taken off the heap while they are dispatched, timers scheduled in them meanwhile
+ * lower their due deadline, and they are put back with their new deadline.
+ */
 stk_ret stk_env_dispatch_timer_pools(stk_env_t *env,unsigned short max_callbacks)
 {
-	stk_ret rc;
+	stk_ret rc = STK_SUCCESS, ret;
+	struct timeval now;
+	int due, dispatched;
 
-	for(int idx = 0; idx < MAX_TIMER_POOL_SZ; idx++) {
-		if(env->timer_pool[idx]) {
-			rc = stk_env_dispatch_timer_pool(env,max_callbacks,idx);
-			if(rc != STK_SUCCESS) return rc;
-		}
+	if(stk_now(&now) != STK_SUCCESS) return STK_SYSERR;
+
+	ret = stk_mutex_lock(env->timer_pool_lock);
+	STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"lock env %p timer pool",env);
+
+	while(env->timer_pool_count > 0 && !timercmp(&env->timer_pool[0].deadline,&now,>)) {
+		stk_env_timer_entry_t *entry = &env->timer_due[env->timer_due_count];
+
+		entry->tset = env->timer_pool[0].tset;
+		entry->deadline.tv_sec = STK_ENV_NO_DEADLINE;
+		entry->deadline.tv_usec = 0;
+		stk_env_timer_pool_delete(env,0);
+		*stk_timer_set_pool_idx(entry->tset) = STK_ENV_TIMER_DUE(env->timer_due_count);
+		env->timer_due_count++;
 	}
-	return STK_SUCCESS;
+	due = env->timer_due_count;
+
+	for(dispatched = 0; dispatched < due && rc == STK_SUCCESS; dispatched++) {
+		stk_timer_set_t *tset = env->timer_due[dispatched].tset;
+		struct timeval deadline;
+		if(!tset) continue; /* Removed by a timer callback */
+
+		ret = stk_mutex_unlock(env->timer_pool_lock);
+		STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"unlock env %p timer pool",env);
+
+		rc = stk_dispatch_timers(tset,max_callbacks);
+		stk_env_timer_set_deadline(tset,&deadline);
+
+		ret = stk_mutex_lock(env->timer_pool_lock);
+		STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"lock env %p timer pool",env);
+
+		if(env->timer_due[dispatched].tset && timercmp(&deadline,&env->timer_due[dispatched].deadline,<))
+			env->timer_due[dispatched].deadline = deadline;
+	}
+
+	/* Sets which were not dispatched have unknown deadlines */
+	for(int idx = 0; idx < due; idx++) {
+		if(env->timer_due[idx].tset)
+			stk_env_timer_pool_insert(env,env->timer_due[idx].tset,idx < dispatched ? &env->timer_due[idx].deadline : NULL);
+	}
+	env->timer_due_count = 0;
+
+	ret = stk_mutex_unlock(env->timer_pool_lock);
+	STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"unlock env %p timer pool",env);
+
+	return rc;
 }
 
 int stk_next_timer_ms_in_pool(stk_env_t *env)
 {
-	int mintime = INT_MAX;
+	struct timeval earliest, now;
+	int ms;
+
+	if(!stk_env_timer_pool_earliest(env,&earliest)) return INT_MAX;
+	if(stk_now(&now) != STK_SUCCESS) return 0;
+
+	if(!timercmp(&earliest,&now,>)) return 0;
 
-	for(int idx = 0; idx < MAX_TIMER_POOL_SZ; idx++) {
-		if(env->timer_pool[idx]) {
-			int nxt_timer = stk_next_timer_ms(env->timer_pool[idx]);
-			if(nxt_timer != -1 && nxt_timer < mintime) mintime = nxt_timer;
+	if(earliest.tv_sec - now.tv_sec >= INT_MAX / 1000) return INT_MAX;
+	ms = (earliest.tv_sec - now.tv_sec) * 1000 + (earliest.tv_usec - now.tv_usec) / 1000;
+
+	return ms > 0 ? ms : 1; /* If we rounded down to 0, lets assume a 1ms delay */
+}
+
+void stk_wakeup_dispatcher(stk_env_t *env) { if(env->wakeup_cb) env->wakeup_cb(env); }
+
+#ifdef __linux__
+/* Arm the timer fd to an absolute deadline, or disarm it if deadline is NULL. Called with timer_pool_lock held */
+static void stk_env_arm_timer_fd(stk_env_t *env,struct timeval *deadline)
+{
+	struct itimerspec its;
+	int rc;
+
+	memset(&its,0,sizeof(its));
+	if(deadline) {
+		its.it_value.tv_sec = deadline->tv_sec;
+		its.it_value.tv_nsec = deadline->tv_usec * 1000;
+		if(its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+			its.it_value.tv_nsec = 1; /* 0 would disarm it */
+		env->timer_fd_deadline = *deadline;
+	}
+	env->timer_fd_armed = deadline ? STK_TRUE : STK_FALSE;
+
+	rc = timerfd_settime(env->timer_fd,TFD_TIMER_ABSTIME,&its,NULL);
+	STK_CHECK(STKA_TIMER,rc==0,"arm env %p timer fd %d errno %d",env,env->timer_fd,errno);
+}
+
+/* Arm the timer fd to the earliest deadline in the timer pool */
+static void stk_env_rearm_timer_fd(stk_env_t *env,stk_bool timers_due)
+{
+	struct timeval earliest;
+	stk_bool found;
+	stk_ret rc;
+
+	if(timers_due)
+		found = stk_now(&earliest) == STK_SUCCESS;
+	else
+		found = stk_env_timer_pool_earliest(env,&earliest);
+
+	rc = stk_mutex_lock(env->timer_pool_lock);
+	STK_ASSERT(STKA_TIMER,rc==STK_SUCCESS,"lock env %p timer pool",env);
+
+	/* Timers may have been scheduled since the earliest deadline was determined */
+	if(env->timer_pool_count > 0 && env->timer_pool[0].deadline.tv_sec != STK_ENV_NO_DEADLINE &&
+		(!found || timercmp(&env->timer_pool[0].deadline,&earliest,<))) {
+		earliest = env->timer_pool[0].deadline;
+		found = STK_TRUE;
+	}
+	stk_env_arm_timer_fd(env,found ? &earliest : NULL);
+
+	rc = stk_mutex_unlock(env->timer_pool_lock);
+	STK_ASSERT(STKA_TIMER,rc==STK_SUCCESS,"unlock env %p timer pool",env);
+}
+#endif
+
+/* Called when a timer is scheduled to lower the deadline of its timer set in the timer pool, and to
+ * rearm the timer fd if the timer expires before it, or wake the dispatcher so it may recalculate
+ * the time until the next timer. The dispatcher is only woken for timers earlier than it last saw,
+ * so scheduling many timers does not wake it for each one.
+ */
+void stk_env_timer_scheduled(stk_env_t *env,stk_timer_set_t *tset,struct timeval *deadline)
+{
+	int pool_idx;
+	stk_bool wakeup = STK_TRUE;
+	stk_ret rc = stk_mutex_lock(env->timer_pool_lock);
+	STK_ASSERT(STKA_TIMER,rc==STK_SUCCESS,"lock env %p timer pool",env);
+
+	pool_idx = *stk_timer_set_pool_idx(tset);
+	if(pool_idx != STK_ENV_TIMER_NOT_POOLED) {
+		if(timercmp(deadline,&env->timer_pool_wake,<))
+			env->timer_pool_wake = *deadline;
+		else
+			wakeup = STK_FALSE;
+	}
+	if(pool_idx >= 0) {
+		if(timercmp(deadline,&env->timer_pool[pool_idx].deadline,<)) {
+			env->timer_pool[pool_idx].deadline = *deadline;
+			stk_env_timer_pool_sift_up(env,pool_idx);
 		}
+	} else if(pool_idx < STK_ENV_TIMER_NOT_POOLED) {
+		stk_env_timer_entry_t *entry = &env->timer_due[STK_ENV_TIMER_DUE_IDX(pool_idx)];
+		if(timercmp(deadline,&entry->deadline,<)) entry->deadline = *deadline;
 	}
-	return mintime;
+
+#ifdef __linux__
+	if(env->timer_fd != -1) {
+		if(!env->timer_fd_armed || timercmp(deadline,&env->timer_fd_deadline,<))
+			stk_env_arm_timer_fd(env,deadline);
+
+		rc = stk_mutex_unlock(env->timer_pool_lock);
+		STK_ASSERT(STKA_TIMER,rc==STK_SUCCESS,"unlock env %p timer pool",env);
+		return;
+	}
+#endif
+	rc = stk_mutex_unlock(env->timer_pool_lock);
+	STK_ASSERT(STKA_TIMER,rc==STK_SUCCESS,"unlock env %p timer pool",env);
+
+	if(wakeup)
+		stk_wakeup_dispatcher(env);
 }
 
-void stk_wakeup_dispatcher(stk_env_t *env) { if(env->wakeup_cb) env->wakeup_cb(env); }
+int stk_env_get_timer_fd(stk_env_t *env) { return env->timer_fd; }
+
+stk_ret stk_env_dispatch_timer_fd(stk_env_t *env,unsigned short max_callbacks)
+{
+#ifdef __linux__
+	stk_uint64 expirations;
+	stk_ret rc;
+
+	STK_CHECK_RET(STKA_TIMER,env->timer_fd!=-1,!STK_SUCCESS,"dispatch timer fd of env %p which has no timer fd",env);
+
+	/* Clear the readable state of the fd, it may already have been read (EAGAIN) */
+	if(read(env->timer_fd,&expirations,sizeof(expirations)) == -1 && errno != EAGAIN)
+		STK_LOG(STK_LOG_ERROR,"read env timer fd %d errno %d",env->timer_fd,errno);
+
+	rc = stk_env_dispatch_timer_pools(env,max_callbacks);
+
+	/* If max_callbacks was met, fire again immediately for the remaining timers */
+	stk_env_rearm_timer_fd(env,rc == STK_MAX_TIMERS);
+	return rc;
+#else
+	return !STK_SUCCESS;
+#endif
+}
 
 void *stk_env_get_dispatcher(stk_env_t *env) { return env->dispatcher; }
 
-stk_timer_set_t *stk_env_get_timer_set(stk_env_t *env,int pool_idx) { return env->timer_pool[pool_idx]; }
+stk_timer_set_t *stk_env_get_timer_set(stk_env_t *env,int pool_idx)
+{
+	return pool_idx >= 0 && pool_idx < env->timer_pool_count ? env->timer_pool[pool_idx].tset : NULL;
+}
+
+stk_timer_set_t *stk_env_get_default_timer_set(stk_env_t *env) { return env->default_timer_set; }
 
 stk_smartbeat_ctrl_t *stk_env_get_smartbeat_ctrl(stk_env_t *env) { return env->smb; }
 
@@ -178,6 +644,8 @@ stk_name_service_t *stk_env_get_name_service(stk_env_t *env) { return env->name_
 
 stk_data_flow_t *stk_env_get_monitoring_data_flow(stk_env_t *env) { return env->monitoring_df; }
 
+stk_slab_allocator_t *stk_env_get_slab_allocator(stk_env_t *env) { return env->slab; }
+
 
 /* Assert functions */
 FILE *stk_assert_log_file;
@@ -4,6 +4,7 @@
 #include "stk_common.h"
 #include "stk_assert_log.h"
 #include "stk_df_internal.h"
+#include "stk_slab_api.h"
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -24,6 +25,8 @@
 #define STK_STCT_SEQUENCE_DATA_COPY 0x202
 #define STK_STCT_SEQUENCE_ITERATOR 0x203
 #define STK_STCT_SEQUENCE_MERGED_SEQ 0x204
+#define STK_STCT_SEQUENCE_POOL 0x205
+#define STK_STCT_SHM_ARENA 0x206
 
 #define STK_STCT_SERVICE  0x300
 #define STK_STCT_SERVICE_GROUP  0x310
@@ -39,6 +42,12 @@
 #define STK_STCT_NAME_SERVICE 0x700
 #define STK_STCT_NAME_SERVICE_ACTIVITY 0x701
 
+#define STK_STCT_SLAB 0x800
+
+#define STK_STCT_URING 0x900
+
+#define STK_STCT_WORKER_POOL 0xA00
+
 typedef stk_uint16 stk_stct_type;
 
 /* Allocation macros */
@@ -69,4 +78,21 @@ typedef stk_uint16 stk_stct_type;
 	free(_ptr); \
 } while(0)
 
+/* Slab variants of the structure allocation macros, _slab may be NULL to use the system allocator */
+#define STK_SLAB_CALLOC_STCT(_slab,_stct_type,_type,_uptr) do { \
+	_type *_ptr; \
+	_ptr = stk_slab_calloc(_slab,sizeof(_type)); \
+	if(_ptr) \
+		_ptr->stct_type = _stct_type; \
+	else \
+		STK_ASSERT(STKA_MEM,_ptr!=NULL,"Failed to alloc structure type %d (%ld bytes) from slab %p",_stct_type,sizeof(_type),_slab); \
+	_uptr = _ptr; \
+} while(0)
+
+#define STK_SLAB_FREE_STCT(_slab,_stct_type,_ptr) do { \
+	STK_ASSERT(STKA_MEM,_ptr->stct_type==_stct_type,"Mismatched structure types on free of 0x%p (%d != %d)",_ptr,_ptr->stct_type,_stct_type); \
+	_ptr->stct_type=0; /* Clear the structure type so misuse after a free is easily identified */ \
+	stk_slab_free(_slab,_ptr,sizeof(*_ptr)); \
+} while(0)
+
 #endif
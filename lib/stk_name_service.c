@@ -13,6 +13,7 @@
 #include "stk_smartbeat_api.h"
 #include "stk_options_api.h"
 #include "stk_timer_api.h"
+#include "stk_clock_api.h"
 #include "stk_tcp.h"
 #include "stk_ports.h"
 #include "PLists.h"
@@ -87,7 +88,7 @@ void stk_request_gc_cb(stk_timer_set_t *timer_set,stk_timer_t *timer,int id,void
 
 	if(cb_type == STK_TIMER_CANCELLED) return;
 
-	if(gettimeofday(&current_tv,NULL) == -1) return;
+	if(stk_now(&current_tv) != STK_SUCCESS) return;
 
 	for(Node *n = FirstNode(named->request_list); !AtListEnd(n); n = nxt) {
 		nxt = NxtNode(n);
@@ -217,7 +218,7 @@ void update_name_server_activity(stk_name_service_t *named,stk_uint64 id)
 	 * if a lock is ever added to the list, this entire block needs to
 	 * be protected.
 	 */
-	gettimeofday(&ns_activity->expired_tv,NULL);
+	stk_now(&ns_activity->expired_tv);
 	ns_activity->expired_tv.tv_usec += ((long)expiration_ms*1000);
 	while(ns_activity->expired_tv.tv_usec >= 1000000L) {
 		ns_activity->expired_tv.tv_sec++;
@@ -233,7 +234,7 @@ void expire_name_servers(stk_name_service_t *named)
 
 	if(!named->name_server_list || IsPListEmpty(named->name_server_list)) return;
 
-	gettimeofday(&current_tv,NULL);
+	stk_now(&current_tv);
 	for(Node *n = FirstNode(named->name_server_list); !AtListEnd(n); n = nxt) {
 		stk_name_service_activity_t *ns_activity = NodeData(n);
 		nxt = NxtNode(n);
@@ -356,7 +357,7 @@ stk_name_request_t *stk_alloc_name_request(char *name, char *group_name, stk_seq
 	request->num_cbs = num_cbs;
 	request->subscription = subscription;
 
-	if(gettimeofday(&request->expired_tv,NULL) == -1) {
+	if(stk_now(&request->expired_tv) != STK_SUCCESS) {
 		STK_FREE(request);
 		return NULL;
 	}
@@ -637,7 +638,7 @@ void stk_invoke_name_cbs(stk_name_service_t *named,stk_ns_rcv_data_t *ns)
 	STK_ASSERT(STKA_NS,named!=NULL,"invalid name server passed to invoke_name_cbs");
 	STK_ASSERT(STKA_NS,named->stct_type==STK_STCT_NAME_SERVICE,"invoke name callback, the pointer was to a structure of type %d",named->stct_type);
 
-	if(gettimeofday(&current_tv,NULL) == -1) return;
+	if(stk_now(&current_tv) != STK_SUCCESS) return;
 
 	for(Node *n = FirstNode(named->request_list); !AtListEnd(n); n = nxt) {
 		nxt = NxtNode(n);
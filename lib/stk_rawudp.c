@@ -13,6 +13,7 @@
 #include "stk_timer_api.h"
 #include "stk_sync_api.h"
 #include "stk_udp.h"
+#include "stk_uring_internal.h"
 
 
 #define STK_DUMP_RCV_HEX 1
@@ -65,6 +66,7 @@ static stk_data_flow_module_t rawudp_listener_fptrs = {
 
 typedef struct stk_rawudp_listener_stct {
 	int sock;
+	stk_uring_flow_t *uring; /* Set if the socket uses an io_uring, must follow sock as in the client which sends as a listener */
 	short port;
 	struct sockaddr_in client_addr;
 	struct sockaddr_in server_addr;
@@ -100,6 +102,7 @@ static stk_data_flow_module_t rawudp_client_fptrs = {
 
 typedef struct stk_rawudp_client_stct {
 	int sock;
+	stk_uring_flow_t *uring; /* Set if the socket uses an io_uring, must follow sock as in the listener */
 	short port;
 	struct sockaddr_in server_addr;
 	struct sockaddr_in client_addr;
@@ -159,6 +162,7 @@ stk_data_flow_t *stk_rawudp_listener_create_data_flow(stk_env_t *env,char *name,
 		void *destaddr_str = stk_find_option(options,"destination_address",NULL);
 		void *destport_str = stk_find_option(options,"destination_port",NULL);
 		void *cb_df = stk_find_option(options,"callback_data_flow",NULL);
+		stk_uring_t *ring = (stk_uring_t *) stk_find_option(options,"io_uring",NULL);
 
 		/* Set the callers data flow to be used in callbacks */
 		if(cb_df)
@@ -266,6 +270,18 @@ stk_data_flow_t *stk_rawudp_listener_create_data_flow(stk_env_t *env,char *name,
 				return NULL;
 			}
 		}
+
+		/* Datagrams are received and sent by the ring, which calls back the callers data flow */
+		if(ring) {
+			ts->uring = stk_uring_attach(ring,ts->cb_df,ts->sock,STK_URING_ATTACH_DATAGRAM);
+			if(!ts->uring) {
+				STK_LOG(STK_LOG_ERROR,"Failed to attach socket for data flow '%s'[%lu] to io_uring, env %p",name,id,env);
+				free(ts->seq_name);
+				close(ts->sock);
+				stk_free_data_flow(df);
+				return NULL;
+			}
+		}
 		}
 
 		STK_LOG(STK_LOG_NORMAL,"data flow %p %s[%lu] to port %d created (fd %d)",df,stk_data_flow_name(df),stk_get_data_flow_id(df),ntohs(ts->client_addr.sin_port),ts->sock);
@@ -288,6 +304,7 @@ stk_ret stk_rawudp_listener_destroy_data_flow(stk_data_flow_t *df)
 	if(ts->fd_destroyed_cb)
 		ts->fd_destroyed_cb(df,stk_get_data_flow_id(df),ts->sock);
 
+	if(ts->uring) stk_uring_detach(ts->uring);
 	if(ts->sock) close(ts->sock);
 
 	return stk_free_data_flow(df);
@@ -305,6 +322,15 @@ stk_ret stk_rawudp_listener_data_flow_send_dest(stk_data_flow_t *df,char *buf,st
 	stk_rawudp_listener_t *ts = stk_data_flow_module_data(df); /* Asserts on structure type */
 	ssize_t sendsz = 0,sentsz;
 
+	if(ts->uring) {
+		/* Queued and submitted in a batch with other sends on the ring */
+		stk_ret rc = stk_uring_sendto(ts->uring,buf,buflen,(struct sockaddr *) dest_addr,sz);
+		if(rc != STK_SUCCESS)
+			STK_LOG(STK_LOG_NET_ERROR,"Send failed on rawudp fd %d for data flow '%s[%lu]' size %lu, env %p rc %d",
+				ts->sock,stk_data_flow_name(df),stk_get_data_flow_id(df),buflen,stk_env_from_data_flow(df),rc);
+		return rc;
+	}
+
 	if(flags & STK_UDP_SEND_FLAG_NONBLOCK) {
 		sentsz = sendto(ts->sock, buf, (int)buflen, STK_NB_SEND_FLAGS, (struct sockaddr *) dest_addr, sz);
 	} else {
@@ -380,7 +406,17 @@ stk_uint64 stk_rawudp_listener_recv(stk_data_flow_t *df,stk_udp_wire_read_buf_t
 	bufread->from_address_len = sizeof(bufread->from_address);
 
 	stk_set_data_flow_errno(df,0);
-	ret = recvfrom(ts->sock,bufread->buf,sizeof(bufread->buf),0,(struct sockaddr *) &bufread->from_address,&bufread->from_address_len);
+	if(ts->uring) {
+		/* Copy from the buffer the ring received the datagram in to, errors are as recvfrom() would return them */
+		int err;
+
+		ret = (ssize_t) stk_uring_recvfrom(ts->uring,bufread->buf,sizeof(bufread->buf),(struct sockaddr *) &bufread->from_address,&bufread->from_address_len,&err);
+		if(err) {
+			ret = -1;
+			errno = err;
+		}
+	} else
+		ret = recvfrom(ts->sock,bufread->buf,sizeof(bufread->buf),0,(struct sockaddr *) &bufread->from_address,&bufread->from_address_len);
 
 	STK_DEBUG(STKA_NET,"recv df %p fd %d ret %ld errno %d",df,ts->sock,ret,errno);
 	if(ret == -1) {
@@ -389,7 +425,10 @@ stk_uint64 stk_rawudp_listener_recv(stk_data_flow_t *df,stk_udp_wire_read_buf_t
 			STK_LOG(STK_LOG_ERROR,"recv failed, bad fd %d",ts->sock);
 			return 0;
 		}
-		if(errno != EWOULDBLOCK && errno != ECONNRESET && errno != EINTR) {
+		if(errno == EWOULDBLOCK || errno == EAGAIN)
+			stk_set_data_flow_errno(df,EWOULDBLOCK); /* No more data, as distinct from the peer closing */
+		else
+		if(errno != ECONNRESET && errno != EINTR) {
 			stk_set_data_flow_errno(df,errno);
 			STK_LOG(STK_LOG_ERROR,"recv failed, errno %d",errno);
 		}
@@ -407,7 +446,8 @@ stk_sequence_t *stk_rawudp_listener_data_flow_rcv_internal(stk_data_flow_t *df,s
 {
 	stk_ret rc;
 
-	stk_rawudp_listener_recv(df,&ts->readbuf);
+	if(stk_rawudp_listener_recv(df,&ts->readbuf) == 0 && stk_data_flow_errno(df) != 0)
+		return NULL; /* Nothing received (EWOULDBLOCK) or an error, don't deliver the last datagram again */
 
 	/* Update the sequence with the type and ID from the wire */
 	rc = stk_set_sequence_type(data_sequence,ts->seq_type);
@@ -423,7 +463,7 @@ stk_sequence_t *stk_rawudp_listener_data_flow_rcv_internal(stk_data_flow_t *df,s
 		return NULL;
 	}
 	/* Sequence Name is in the next element */
-	rc = stk_set_sequence_name(data_sequence,strdup(ts->seq_name));
+	rc = stk_copy_sequence_name(data_sequence,ts->seq_name);
 	if(rc != STK_SUCCESS) {
 		STK_LOG(STK_LOG_ERROR,"update the sequence name for a sequence from rawudp fd %d for data flow %s[%lu], env %p rc %d",
 			ts->sock,stk_data_flow_name(df),stk_get_data_flow_id(df),stk_env_from_data_flow(df),rc);
@@ -437,13 +477,6 @@ stk_sequence_t *stk_rawudp_listener_data_flow_rcv_internal(stk_data_flow_t *df,s
 		return NULL;
 	}
 
-	rc = stk_data_flow_add_client_protocol(data_sequence,stk_rawudp_data_flow_protocol(df));
-	if(rc != STK_SUCCESS) {
-		STK_LOG(STK_LOG_ERROR,"update the client protocol for a sequence from rawudp fd %d for data flow %s[%lu], env %p rc %d",
-			stk_rawudp_listener_fd(df),stk_data_flow_name(df),stk_get_data_flow_id(df),stk_env_from_data_flow(df),rc);
-		return NULL;
-	}
-
 	if(stk_number_of_sequence_elements(data_sequence) == 0) {
 		/* Add received data to seq */
 		rc = stk_copy_to_sequence(data_sequence,ts->readbuf.buf,ts->readbuf.read,ts->seq_user_type);
@@ -494,12 +527,13 @@ stk_ret stk_rawudp_listener_data_flow_clientip(stk_data_flow_t *df,struct sockad
 stk_ret stk_rawudp_listener_data_flow_buffered(stk_data_flow_t *df)
 {
 	stk_rawudp_listener_t *ts = stk_data_flow_module_data(df); /* Asserts on structure type */
+	if(ts->uring && stk_uring_buffered(ts->uring) > 0) return STK_SUCCESS;
 	return !STK_SUCCESS;
 }
 
 stk_ret stk_rawudp_listener_add_client_ip(stk_data_flow_t *df,stk_sequence_t *seq,stk_udp_wire_read_buf_t *bufread)
 {
-	return stk_data_flow_add_client_ip(seq,&bufread->from_address,sizeof(bufread->from_address));
+	return stk_data_flow_set_received(df,seq,&bufread->from_address,sizeof(bufread->from_address));
 }
 
 char *stk_rawudp_data_flow_protocol(stk_data_flow_t *df) { return "rawudp"; }
@@ -526,6 +560,7 @@ stk_data_flow_t *stk_rawudp_client_create_data_flow(stk_env_t *env,char *name,st
 		void *mcastintf_str = stk_find_option(options,"multicast_interface",NULL);
 		void *sndbuf_str = stk_find_option(options,"send_buffer_size",NULL);
 		void *cb_df = stk_find_option(options,"callback_data_flow",NULL);
+		stk_uring_t *ring = (stk_uring_t *) stk_find_option(options,"io_uring",NULL);
 		int sndbuf = 1048576; /* Default to 1MB Send buf */
 
 		/* Set the callers data flow to be used in callbacks */
@@ -593,6 +628,17 @@ stk_data_flow_t *stk_rawudp_client_create_data_flow(stk_env_t *env,char *name,st
 			}
 		}
 
+		/* Clients only send, their datagrams are queued on the ring */
+		if(ring) {
+			ts->uring = stk_uring_attach(ring,ts->cb_df,ts->sock,STK_URING_ATTACH_DATAGRAM|STK_URING_ATTACH_SEND_ONLY);
+			if(!ts->uring) {
+				STK_LOG(STK_LOG_ERROR,"Failed to attach socket for data flow %p %s[%lu] to io_uring",df,stk_data_flow_name(df),stk_get_data_flow_id(df));
+				close(ts->sock);
+				stk_free_data_flow(df);
+				return NULL;
+			}
+		}
+
 		STK_LOG(STK_LOG_NORMAL,"data flow %p %s[%lu] to port %d created (fd %d)",df,stk_data_flow_name(df),stk_get_data_flow_id(df),ntohs(ts->server_addr.sin_port),ts->sock);
 
 		if(ts->fd_created_cb)
@@ -612,6 +658,10 @@ stk_ret stk_rawudp_client_unhook_data_flow(stk_data_flow_t *df)
 	if(ts->fd_destroyed_cb)
 		ts->fd_destroyed_cb(ts->cb_df,stk_get_data_flow_id(ts->cb_df),ts->sock);
 
+	if(ts->uring) {
+		stk_uring_detach(ts->uring);
+		ts->uring = NULL;
+	}
 	close(ts->sock);
 	ts->sock = -1;
 
@@ -4,11 +4,83 @@
 #include "stk_common.h"
 #include "stk_sync_api.h"
 #include "stk_options_api.h"
-#include "PLists.h"
+#include "stk_env_api.h"
+#include "stk_slab_api.h"
+#include "stk_data_flow.h"
+#include "stk_data_flow_api.h"
 #include <string.h>
-#include <sys/time.h>
 
 #define STK_SEQUENCE_FLAG_ALLOCID 1
+#define STK_SEQUENCE_FLAG_SLAB_NAME 2 /* name was copied in to slab memory, not passed in by the app */
+
+/* Number of elements stored in the sequence structure before an element array is allocated */
+#define STK_SEQUENCE_INLINE_ELEMENTS 4
+#define STK_SEQUENCE_INLINE_META_DATA 2
+
+/* Lists with more elements than this are indexed by user type when searched */
+#define STK_SEQUENCE_INDEX_MIN 8
+
+/* Element data shared between a sequence and its clones. The data is either
+ * application memory (reference data) or a buffer owned by this structure.
+ * Holders may be on different threads, so nothing but refcnt and archive changes once it is shared.
+ * Writers take a private copy instead. Application memory is archived by publishing a copy
+ * of it in archive once, which the holders then read in place of data_ptr.
+ */
+typedef struct stk_sequence_shared_stct
+{
+	stk_uint32 refcnt;
+	stk_bool owned;
+	void *data_ptr;
+	stk_uint64 bufsz;
+	stk_uint64 allocsz;
+	void *archive; /* Copy of application memory, allocated for allocsz */
+	stk_slab_allocator_t *slab;
+} stk_sequence_shared_t;
+
+typedef struct stk_sequence_data_def_stct
+{
+	stk_stct_type stct_type;
+	stk_uint64 allocsz;
+	stk_uint64 sz;
+	stk_uint64 user_type;
+	void *data_ptr;
+	stk_uint64 bufsz; /* Usable size of data_ptr for copied data */
+	stk_sequence_shared_t *shared; /* Set when data is shared with clones, data_ptr is then not used */
+} stk_sequence_data_def_t;
+
+#define STK_DATADEF_DATA(_datadef) ((_datadef)->shared ? stk_sequence_shared_data((_datadef)->shared) : (_datadef)->data_ptr)
+
+static inline void *stk_sequence_shared_data(stk_sequence_shared_t *shared)
+{
+	void *archive = stk_atomic_load_ptr(&shared->archive,STK_MO_ACQUIRE);
+	return archive ? archive : shared->data_ptr;
+}
+
+/* Hash index of element user types, kept for lists with more than STK_SEQUENCE_INDEX_MIN elements.
+ * It is maintained by the paths changing the list: appended elements extend it, other changes rebuild it.
+ * Finds only read it, so sequences may be searched on several threads (e.g. by worker pools).
+ * Arrays follow this structure in the same allocation.
+ */
+typedef struct stk_sequence_type_index_stct
+{
+	int nslots;   /* Power of 2, twice the number of elements which may be indexed */
+	int indexed;  /* Number of elements (from the start of the list) in the index */
+	int *heads;   /* Per slot, first element of a user type or -1 */
+	int *tails;   /* Per slot, last element of a user type */
+	int *next;    /* Per element, next element of the same user type or -1 */
+} stk_sequence_type_index_t;
+
+/* Contiguous, growable array of elements. elems points at inline storage until it outgrows it */
+typedef struct stk_sequence_elements_stct
+{
+	stk_sequence_data_def_t *elems;
+	int count;
+	int alloc;
+	int merged;           /* Number of elements which are merged sequences */
+	int spare;            /* Payload buffers retained after count by a recycled sequence */
+	stk_uint64 total_sz;  /* Sum of element sizes, excluding merged sequences */
+	stk_sequence_type_index_t *index; /* NULL until a search needs it */
+} stk_sequence_elements_t;
 
 struct stk_sequence_stct
 {
@@ -18,39 +90,86 @@ struct stk_sequence_stct
 	char *name;
 	stk_sequence_type type;
 	stk_generation_id generation;
-	List *data_list;
+	stk_sequence_elements_t data;
 	int flags;
 	int refcnt;
-	List *meta_data_list; /* untransmitted local meta data */
+	stk_sequence_elements_t meta_data; /* untransmitted local meta data */
+	stk_slab_allocator_t *slab;
+	stk_data_flow_transport_t transport; /* Set by data flows on receipt */
+	stk_sequence_data_def_t inline_data[STK_SEQUENCE_INLINE_ELEMENTS];
+	stk_sequence_data_def_t inline_meta_data[STK_SEQUENCE_INLINE_META_DATA];
 };
 
-typedef struct stk_sequence_data_def_stct
-{
-	stk_stct_type stct_type;
-	stk_uint64 allocsz;
-	stk_uint64 sz;
-	stk_uint64 user_type;
-	void *data_ptr;
-} stk_sequence_data_def_t;
-
 struct stk_sequence_iterator_stct
 {
 	stk_stct_type stct_type;
 	stk_sequence_t *seq;
-	Node *curr;
+	stk_sequence_elements_t *list; /* Element array the current index refers to */
+	int curr;                      /* Index of the current element, -1 if none */
+	stk_slab_allocator_t *slab;
 };
 
-static int seed;
+#define STK_SEQITER_CURR(_seqiter) ((_seqiter)->curr >= 0 ? &(_seqiter)->list->elems[(_seqiter)->curr] : NULL)
+
+/* Update an element size, keeping the cached total for its list in step */
+#define STK_SEQUENCE_SET_ELEM_SZ(_list,_datadef,_sz) { (_list)->total_sz += (_sz); (_list)->total_sz -= (_datadef)->sz; (_datadef)->sz = (_sz); }
+
+/* Implemented in stk_env.c */
+stk_uint64 stk_env_reserve_sequence_ids(stk_env_t *env,stk_uint64 count,stk_uint64 *seed);
+
+/* Sequence IDs are generated by mixing a per env random seed with a counter. The mix (splitmix64's finalizer)
+ * is a bijection so IDs are unique within an env, and random seeds make collisions between processes unlikely.
+ * Threads reserve blocks of counters so the fast path has no shared writes.
+ */
+#define STK_SEQUENCE_ID_BLOCK 256
+
+typedef struct stk_sequence_id_cache_stct {
+	stk_env_t *env;
+	stk_uint64 seed;
+	stk_uint64 next;
+	stk_uint64 end;
+} stk_sequence_id_cache_t;
+
+static __thread stk_sequence_id_cache_t stk_seqid_cache;
+
+static inline stk_sequence_id stk_sequence_id_mix(stk_uint64 seed,stk_uint64 counter)
+{
+	stk_uint64 z = seed + (counter * 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return (stk_sequence_id) (z ^ (z >> 31));
+}
+
 stk_sequence_id stk_acquire_sequence_id(stk_env_t *env,stk_service_type type)
 {
-	if(seed == 0) {
-		struct timeval tv;
+	stk_sequence_id_cache_t *cache = &stk_seqid_cache;
+	stk_sequence_id id;
 
-		gettimeofday(&tv,NULL);
-		srand((unsigned int) (tv.tv_sec + tv.tv_usec)); 
-		seed = 1;
+	do {
+		if(cache->env != env || cache->next == cache->end) {
+			cache->next = stk_env_reserve_sequence_ids(env,STK_SEQUENCE_ID_BLOCK,&cache->seed);
+			cache->end = cache->next + STK_SEQUENCE_ID_BLOCK;
+			cache->env = env;
+		}
+		id = stk_sequence_id_mix(cache->seed,cache->next++);
+	} while(id == STK_SEQUENCE_ID_INVALID);
+
+	return id;
+}
+
+stk_uint64 stk_acquire_sequence_ids(stk_env_t *env,stk_service_type type,stk_sequence_id *ids,stk_uint64 count)
+{
+	stk_uint64 seed, counter;
+	stk_uint64 acquired = 0;
+
+	/* Reserve one extra in case an ID maps to STK_SEQUENCE_ID_INVALID */
+	counter = stk_env_reserve_sequence_ids(env,count + 1,&seed);
+	for(stk_uint64 idx = 0; idx <= count && acquired < count; idx++) {
+		stk_sequence_id id = stk_sequence_id_mix(seed,counter + idx);
+		if(id != STK_SEQUENCE_ID_INVALID)
+			ids[acquired++] = id;
 	}
-	return (stk_sequence_id) (rand()<<((sizeof(int)*8)-1)|rand());
+	return acquired;
 }
 
 stk_ret stk_release_sequence_id(stk_env_t *env,stk_sequence_id id)
@@ -58,17 +177,321 @@ stk_ret stk_release_sequence_id(stk_env_t *env,stk_sequence_id id)
 	return STK_SUCCESS;
 }
 
+/* Drop an element's hold on shared data, freeing it with the last hold */
+static void stk_sequence_release_shared(stk_sequence_data_def_t *datadef)
+{
+	stk_sequence_shared_t *shared = datadef->shared;
+
+	datadef->shared = NULL;
+	if(stk_atomic_fetch_sub_32(&shared->refcnt,1,STK_MO_ACQ_REL) == 1) {
+		if(shared->owned)
+			stk_slab_free(shared->slab,shared->data_ptr,shared->bufsz);
+		if(shared->archive)
+			stk_slab_free(shared->slab,shared->archive,shared->allocsz);
+		stk_slab_free(shared->slab,shared,sizeof(*shared));
+	}
+}
+
+/* Release the payload of an element (if owned) */
+static void stk_sequence_free_datadef(stk_sequence_t *seq,stk_sequence_data_def_t *datadef)
+{
+	if(datadef->shared)
+		stk_sequence_release_shared(datadef);
+	else
+	if(datadef->stct_type == STK_STCT_SEQUENCE_DATA_COPY && datadef->data_ptr) {
+		void *p = datadef->data_ptr;
+		datadef->data_ptr = (void *) 0xdeadbeef;
+		stk_slab_free(seq->slab,p,datadef->bufsz);
+	}
+	datadef->stct_type = 0;
+}
+
+#define STK_SEQUENCE_INDEX_ALLOC_SZ(_nslots) (sizeof(stk_sequence_type_index_t) + (((_nslots) * 2 + (_nslots) / 2) * sizeof(int)))
+
+static void stk_sequence_drop_index(stk_sequence_t *seq,stk_sequence_elements_t *list)
+{
+	if(!list->index) return;
+	stk_slab_free(seq->slab,list->index,STK_SEQUENCE_INDEX_ALLOC_SZ(list->index->nslots));
+	list->index = NULL;
+}
+
+static inline int stk_sequence_index_slot(stk_sequence_type_index_t *index,stk_uint64 user_type)
+{
+	return (int) ((user_type * 0x9e3779b97f4a7c15ULL) >> 32) & (index->nslots - 1);
+}
+
+/* Bring a list's type index up to date after the list changed.
+ * Returns NULL if the list is too small to be worth indexing, or the index couldn't be allocated.
+ */
+static stk_sequence_type_index_t *stk_sequence_update_index(stk_sequence_t *seq,stk_sequence_elements_t *list)
+{
+	stk_sequence_type_index_t *index = list->index;
+
+	if(list->count <= STK_SEQUENCE_INDEX_MIN) return NULL;
+
+	if(!index || list->count > index->nslots / 2) {
+		int nslots = 32;
+
+		while(nslots / 2 < list->count) nslots *= 2;
+		stk_sequence_drop_index(seq,list);
+		index = stk_slab_alloc(seq->slab,STK_SEQUENCE_INDEX_ALLOC_SZ(nslots));
+		if(!index) return NULL;
+
+		index->nslots = nslots;
+		index->indexed = 0;
+		index->heads = (int *) (index + 1);
+		index->tails = index->heads + nslots;
+		index->next = index->tails + nslots;
+		memset(index->heads,0xff,nslots * sizeof(int));
+		list->index = index;
+	}
+
+	for(; index->indexed < list->count; index->indexed++) {
+		int idx = index->indexed;
+		stk_uint64 user_type = list->elems[idx].user_type;
+		int slot = stk_sequence_index_slot(index,user_type);
+
+		while(index->heads[slot] != -1 && list->elems[index->heads[slot]].user_type != user_type)
+			slot = (slot + 1) & (index->nslots - 1);
+
+		if(index->heads[slot] == -1)
+			index->heads[slot] = idx;
+		else
+			index->next[index->tails[slot]] = idx;
+		index->tails[slot] = idx;
+		index->next[idx] = -1;
+	}
+	return index;
+}
+
+/* Drop a list's index after changes other than appending and index it again */
+static void stk_sequence_rebuild_index(stk_sequence_t *seq,stk_sequence_elements_t *list)
+{
+	stk_sequence_drop_index(seq,list);
+	stk_sequence_update_index(seq,list);
+}
+
+/* The index of a list for finds, NULL if the list must be scanned */
+static inline stk_sequence_type_index_t *stk_sequence_list_index(stk_sequence_elements_t *list)
+{
+	stk_sequence_type_index_t *index = list->index;
+	return index && index->indexed == list->count ? index : NULL;
+}
+
+/* Share an element's data with a clone, moving ownership of copied data to the shared structure */
+static stk_ret stk_sequence_share_element(stk_sequence_t *seq,stk_sequence_data_def_t *datadef)
+{
+	if(!datadef->shared) {
+		stk_sequence_shared_t *shared = stk_slab_alloc(seq->slab,sizeof(stk_sequence_shared_t));
+		if(!shared) return STK_MEMERR;
+
+		shared->refcnt = 1;
+		shared->slab = seq->slab;
+		shared->data_ptr = datadef->data_ptr;
+		shared->allocsz = datadef->allocsz;
+		shared->archive = NULL;
+		if(datadef->stct_type == STK_STCT_SEQUENCE_DATA_COPY) {
+			shared->owned = STK_TRUE;
+			shared->bufsz = datadef->bufsz;
+			datadef->bufsz = 0;
+		} else {
+			shared->owned = STK_FALSE;
+			shared->bufsz = 0;
+		}
+		datadef->shared = shared;
+	}
+	stk_atomic_fetch_add_32(&datadef->shared->refcnt,1,STK_MO_ACQ_REL);
+	return STK_SUCCESS;
+}
+
+/* Copy on write - called before an element's data is modified in place.
+ * If the data is still shared, the element takes a private copy of it and drops its hold,
+ * the shared structure is never modified for it. Application memory referenced by the element
+ * is instead archived: a copy is published to the other holders, the first copy published wins.
+ * If nothing else shares the data, the element simply takes back ownership.
+ */
+static stk_ret stk_sequence_unshare_element(stk_sequence_t *seq,stk_sequence_data_def_t *datadef)
+{
+	stk_sequence_shared_t *shared = datadef->shared;
+	void *archive;
+
+	if(!shared) return STK_SUCCESS;
+
+	archive = stk_atomic_load_ptr(&shared->archive,STK_MO_ACQUIRE);
+	if(stk_atomic_load_32(&shared->refcnt,STK_MO_ACQUIRE) == 1) {
+		if(shared->owned) {
+			datadef->stct_type = STK_STCT_SEQUENCE_DATA_COPY;
+			datadef->data_ptr = shared->data_ptr;
+			datadef->bufsz = shared->bufsz;
+		} else if(archive) {
+			datadef->stct_type = STK_STCT_SEQUENCE_DATA_COPY;
+			datadef->data_ptr = archive;
+			datadef->bufsz = stk_slab_capacity(shared->slab,shared->allocsz);
+		}
+		datadef->shared = NULL;
+		stk_slab_free(shared->slab,shared,sizeof(*shared));
+		return STK_SUCCESS;
+	}
+
+	{
+	stk_uint64 bufsz = stk_slab_capacity(seq->slab,datadef->allocsz);
+	void *copy = stk_slab_alloc(seq->slab,datadef->allocsz);
+	if(!copy && datadef->allocsz > 0) return STK_MEMERR;
+
+	if(shared->owned || archive) {
+		memcpy(copy,shared->owned ? shared->data_ptr : archive,datadef->sz);
+		datadef->stct_type = STK_STCT_SEQUENCE_DATA_COPY;
+		datadef->data_ptr = copy;
+		datadef->bufsz = bufsz;
+	} else {
+		/* Application memory, the element keeps referencing it and the other holders read the archive */
+		memcpy(copy,shared->data_ptr,datadef->sz);
+		if(!stk_atomic_cas_ptr(&shared->archive,&archive,copy,STK_MO_RELEASE))
+			stk_slab_free(seq->slab,copy,datadef->allocsz); /* Archived by another holder */
+	}
+	}
+	stk_sequence_release_shared(datadef);
+	return STK_SUCCESS;
+}
+
+/* Append an uninitialized element to an element array, growing it if necessary.
+ * Growth invalidates pointers to existing elements, so callers must hold indexes.
+ * Copied elements take over a spare payload buffer (data_ptr/bufsz) when one is retained.
+ */
+static stk_sequence_data_def_t *stk_sequence_new_element(stk_sequence_t *seq,stk_sequence_elements_t *list,stk_stct_type stct_type)
+{
+	stk_sequence_data_def_t *datadef;
+
+	if(list->count + list->spare == list->alloc) {
+		int newalloc = list->alloc * 2;
+		stk_sequence_data_def_t *newelems = stk_slab_alloc(seq->slab,newalloc * sizeof(stk_sequence_data_def_t));
+		if(!newelems) return NULL;
+
+		memcpy(newelems,list->elems,(list->count + list->spare) * sizeof(stk_sequence_data_def_t));
+		if(list->elems != seq->inline_data && list->elems != seq->inline_meta_data)
+			stk_slab_free(seq->slab,list->elems,list->alloc * sizeof(stk_sequence_data_def_t));
+		list->elems = newelems;
+		list->alloc = newalloc;
+	}
+
+	datadef = &list->elems[list->count++];
+	if(list->spare > 0) {
+		if(stct_type == STK_STCT_SEQUENCE_DATA_COPY) {
+			void *data_ptr = datadef->data_ptr;
+			stk_uint64 bufsz = datadef->bufsz;
+
+			list->spare--;
+			memset(datadef,0,sizeof(*datadef));
+			datadef->data_ptr = data_ptr;
+			datadef->bufsz = bufsz;
+			datadef->stct_type = stct_type;
+			return datadef;
+		}
+		/* Move the spare out of the way, there is always room after the last spare */
+		list->elems[list->count + list->spare - 1] = *datadef;
+	}
+
+	memset(datadef,0,sizeof(*datadef));
+	datadef->stct_type = stct_type;
+	return datadef;
+}
+
+static void stk_free_sequence_elements(stk_sequence_t *seq,stk_sequence_elements_t *list)
+{
+	for(int idx = 0; idx < list->count + list->spare; idx++)
+		stk_sequence_free_datadef(seq,&list->elems[idx]);
+
+	if(list->elems != seq->inline_data && list->elems != seq->inline_meta_data)
+		stk_slab_free(seq->slab,list->elems,list->alloc * sizeof(stk_sequence_data_def_t));
+	stk_sequence_drop_index(seq,list);
+	list->count = 0;
+	list->merged = 0;
+	list->spare = 0;
+	list->total_sz = 0;
+}
+
+/* Empty an element array, retaining copied payload buffers as spares for reuse */
+static void stk_retain_sequence_elements(stk_sequence_t *seq,stk_sequence_elements_t *list)
+{
+	int spare = 0;
+
+	for(int idx = 0; idx < list->count + list->spare; idx++) {
+		stk_sequence_data_def_t *datadef = &list->elems[idx];
+
+		if(datadef->shared) {
+			stk_sequence_release_shared(datadef);
+			continue;
+		}
+
+		if(datadef->stct_type == STK_STCT_SEQUENCE_DATA_COPY && datadef->data_ptr) {
+			if(spare != idx) list->elems[spare] = *datadef;
+			list->elems[spare].sz = list->elems[spare].allocsz = 0;
+			spare++;
+		}
+	}
+	stk_sequence_drop_index(seq,list);
+	list->count = 0;
+	list->merged = 0;
+	list->spare = spare;
+	list->total_sz = 0;
+}
+
 /*
- *TODO: At some point, we should have a shared memory option so that sequences and all its reference data in
- * shared memory. Would need to alloc a semaphore for it too. No copy data would be allowed for
- * a shared sequence - but this would allow services to share data through a sequence without
- * having to call sequence APIs.
- * Shared memory should store multiple sequences - so it might be a shared memory manager etc..
+ * Sharing sequences between processes on the same host is provided by shared memory arenas
+ * (stk_shm_sequence.c). Sequences are exported in to an arena and imported sequences reference
+ * the data in place.
  */
+static void stk_sequence_free_name(stk_sequence_t *seq)
+{
+	if(!seq->name) return;
+
+	if(seq->flags & STK_SEQUENCE_FLAG_SLAB_NAME)
+		stk_slab_free(seq->slab,seq->name,strlen(seq->name) + 1);
+	else
+		free(seq->name);
+	seq->name = NULL;
+	seq->flags &= ~STK_SEQUENCE_FLAG_SLAB_NAME;
+}
+
+/* Set the identity of a new or recycled sequence */
+static void stk_init_sequence(stk_sequence_t *seq,char *name, stk_sequence_id id, stk_sequence_type type,stk_service_type svctype,stk_generation_id gen_id)
+{
+	if(name)
+		stk_copy_sequence_name(seq,name);
+	else
+		stk_sequence_free_name(seq);
+	if(id == STK_SEQUENCE_ID_INVALID) {
+		seq->id = stk_acquire_sequence_id(seq->env,svctype);
+		seq->flags |= STK_SEQUENCE_FLAG_ALLOCID;
+	} else
+		seq->id = id;
+	seq->generation = gen_id;
+	seq->type = type;
+	seq->refcnt = 1;
+	memset(&seq->transport,0,sizeof(seq->transport));
+}
+
+/* Drop the hold a received sequence has on the data flow it was received on */
+static void stk_sequence_release_transport(stk_sequence_t *seq)
+{
+	if(!seq->transport.df) return;
+	stk_free_data_flow(seq->transport.df);
+	seq->transport.df = NULL;
+}
+
+/* Data flow support - transport meta data of a received sequence */
+stk_data_flow_transport_t *stk_sequence_transport(stk_sequence_t *seq)
+{
+	STK_ASSERT(STKA_SEQ,seq->stct_type==STK_STCT_SEQUENCE,"sequence %p passed in to stk_sequence_transport is structure type %d",seq,seq->stct_type);
+	return &seq->transport;
+}
+
 stk_sequence_t *stk_create_sequence(stk_env_t *env,char *name, stk_sequence_id id, stk_sequence_type type,stk_service_type svctype, stk_options_t *options)
 {
 	stk_sequence_t * seq;
-	STK_CALLOC_STCT(STK_STCT_SEQUENCE,stk_sequence_t,seq);
+	stk_slab_allocator_t *slab = env ? stk_env_get_slab_allocator(env) : NULL;
+
+	STK_SLAB_CALLOC_STCT(slab,STK_STCT_SEQUENCE,stk_sequence_t,seq);
 	if(seq) {
 		stk_generation_id gen_id = 0;
 
@@ -76,37 +499,41 @@ stk_sequence_t *stk_create_sequence(stk_env_t *env,char *name, stk_sequence_id i
 			gen_id = (stk_generation_id) stk_find_option(options,"generation",NULL); /* Obfuscated feature */
 		}
 
-		if(name) seq->name = strdup(name);
+		seq->slab = slab;
+		seq->data.elems = seq->inline_data;
+		seq->data.alloc = STK_SEQUENCE_INLINE_ELEMENTS;
+		seq->meta_data.elems = seq->inline_meta_data;
+		seq->meta_data.alloc = STK_SEQUENCE_INLINE_META_DATA;
 		seq->env = env;
-		if(id == STK_SEQUENCE_ID_INVALID) {
-			seq->id = stk_acquire_sequence_id(env,svctype);
-			seq->flags |= STK_SEQUENCE_FLAG_ALLOCID;
-		} else
-			seq->id = id;
-		seq->generation = gen_id;
-		seq->type = type;
-		seq->refcnt = 1;
+		stk_init_sequence(seq,name,id,type,svctype,gen_id);
 	}
 	return seq;
 }
 
-void stk_free_sequence_data_list(List *data_list)
+/* Sequence pool support - drop a hold on a sequence and if it is no longer held, empty it
+ * retaining its payload buffers. Returns STK_TRUE if the sequence may be reused.
+ */
+stk_bool stk_recycle_sequence(stk_sequence_t *seq)
 {
-	stk_sequence_data_def_t *datadef;
+	STK_ASSERT(STKA_SEQ,seq->stct_type==STK_STCT_SEQUENCE,"recycle a sequence, the pointer was to a structure of type %d",seq->stct_type);
 
-	if(data_list) {
-		while(!IsPListEmpty(data_list)) {
-			Node *n = FirstNode(data_list);
-			Remove(n);
-			datadef = (stk_sequence_data_def_t *) NodeData(n);
+	if(STK_ATOMIC_DECR(&seq->refcnt) != 1) return STK_FALSE;
 
-			if(datadef->stct_type == STK_STCT_SEQUENCE_DATA_COPY)
-				if(datadef->data_ptr) free(datadef->data_ptr);
+	if(seq->flags & STK_SEQUENCE_FLAG_ALLOCID)
+		stk_release_sequence_id(seq->env,seq->id);
+	seq->flags &= ~STK_SEQUENCE_FLAG_ALLOCID;
 
-			FreeNode(n);
-		}
-		FreeList(data_list);
-	}
+	stk_sequence_release_transport(seq);
+	stk_retain_sequence_elements(seq,&seq->data);
+	stk_retain_sequence_elements(seq,&seq->meta_data);
+	return STK_TRUE;
+}
+
+/* Sequence pool support - reinitialize a recycled sequence */
+void stk_reuse_sequence(stk_sequence_t *seq,char *name, stk_sequence_id id, stk_sequence_type type,stk_service_type svctype)
+{
+	STK_ASSERT(STKA_SEQ,seq->stct_type==STK_STCT_SEQUENCE,"reuse a sequence, the pointer was to a structure of type %d",seq->stct_type);
+	stk_init_sequence(seq,name,id,type,svctype,0);
 }
 
 stk_ret stk_destroy_sequence(stk_sequence_t *seq)
@@ -117,12 +544,13 @@ stk_ret stk_destroy_sequence(stk_sequence_t *seq)
 		if(seq->flags & STK_SEQUENCE_FLAG_ALLOCID)
 			stk_release_sequence_id(seq->env,seq->id);
 
-		stk_free_sequence_data_list(seq->data_list);
-		stk_free_sequence_data_list(seq->meta_data_list);
+		stk_sequence_release_transport(seq);
+		stk_free_sequence_elements(seq,&seq->data);
+		stk_free_sequence_elements(seq,&seq->meta_data);
 
-		{ char *name = stk_get_sequence_name(seq); if(name) free(name); }
+		stk_sequence_free_name(seq);
 
-		STK_FREE_STCT(STK_STCT_SEQUENCE,seq);
+		STK_SLAB_FREE_STCT(seq->slab,STK_STCT_SEQUENCE,seq);
 	}
 	return STK_SUCCESS;
 }
@@ -136,161 +564,129 @@ void stk_hold_sequence(stk_sequence_t *seq)
 stk_ret stk_add_reference_to_sequence(stk_sequence_t *seq,void *data_ptr,stk_uint64 sz, stk_uint64 user_type)
 {
 	stk_sequence_data_def_t *datadef;
-	Node *n;
 
 	if(!seq) return !STK_SUCCESS;
 
-	STK_CALLOC_STCT(STK_STCT_SEQUENCE_DATA_REF,stk_sequence_data_def_t,datadef);
+	datadef = stk_sequence_new_element(seq,&seq->data,STK_STCT_SEQUENCE_DATA_REF);
 	if(!datadef) return !STK_SUCCESS;
 
 	datadef->allocsz = sz;
 	datadef->sz = sz;
+	seq->data.total_sz += sz;
 	datadef->user_type = user_type;
 	datadef->data_ptr = data_ptr;
+	stk_sequence_update_index(seq,&seq->data);
 	STK_DEBUG(STKA_SEQ,"copy data_ptr stk_add_reference_to_sequence %p",datadef->data_ptr);
 
-	n = NewNode();
-	if(!n) {
-		STK_FREE_STCT(STK_STCT_SEQUENCE_DATA_COPY,datadef);
-		return !STK_SUCCESS;
-	}
-
-	SetData(n,datadef);
-
-	if(!seq->data_list) seq->data_list = NewPList();
-	STK_ASSERT(STKA_SEQ,seq->data_list!=NULL,"allocate sequence %p data list for reference data",seq);
-
-	AddTail(seq->data_list,n);
-
 	return STK_SUCCESS;
 }
 
 stk_ret stk_add_sequence_reference_in_sequence(stk_sequence_t *seq,stk_sequence_t *merge_seq, stk_uint64 user_type)
 {
 	stk_sequence_data_def_t *datadef;
-	Node *n;
 
 	if(!seq) return !STK_SUCCESS;
 
-	STK_CALLOC_STCT(STK_STCT_SEQUENCE_MERGED_SEQ,stk_sequence_data_def_t,datadef);
+	datadef = stk_sequence_new_element(seq,&seq->data,STK_STCT_SEQUENCE_MERGED_SEQ);
 	if(!datadef) return !STK_SUCCESS;
 
 	datadef->allocsz = 0;
 	datadef->sz = 0;
+	seq->data.merged++;
 	datadef->user_type = user_type;
 	datadef->data_ptr = merge_seq;
+	stk_sequence_update_index(seq,&seq->data);
 	STK_DEBUG(STKA_SEQ,"copy data_ptr stk_add_reference_to_sequence %p",datadef->data_ptr);
 
-	n = NewNode();
-	if(!n) {
-		STK_FREE_STCT(STK_STCT_SEQUENCE_DATA_COPY,datadef);
-		return !STK_SUCCESS;
-	}
-
-	SetData(n,datadef);
-
-	if(!seq->data_list) seq->data_list = NewPList();
-	STK_ASSERT(STKA_SEQ,seq->data_list!=NULL,"allocate sequence %p data list for reference data",seq);
-
-	AddTail(seq->data_list,n);
-
 	return STK_SUCCESS;
 }
 
-void *stk_realloc_data_in_sequence(stk_sequence_t *seq,stk_sequence_data_def_t *datadef,stk_uint64 sz)
+static void *stk_realloc_data_in_sequence(stk_sequence_t *seq,stk_sequence_elements_t *list,stk_sequence_data_def_t *datadef,stk_uint64 sz)
 {
 	void *newdata;
 
+	if(stk_sequence_unshare_element(seq,datadef) != STK_SUCCESS) return NULL;
+
 	STK_ASSERT(STKA_SEQ,datadef->stct_type==STK_STCT_SEQUENCE_DATA_COPY,"Invalid data definition (%d) passed to stk_realloc_datadef_in_sequence",datadef->stct_type);
-	newdata = datadef->data_ptr;
-	STK_REALLOC(newdata,sz);
+	if(sz <= datadef->bufsz) {
+		/* Existing buffer (or its slab class) is big enough */
+		datadef->allocsz = sz;
+		STK_SEQUENCE_SET_ELEM_SZ(list,datadef,sz);
+		return datadef->data_ptr;
+	}
+
+	if(seq->slab) {
+		newdata = stk_slab_alloc(seq->slab,sz);
+		if(newdata) {
+			memcpy(newdata,datadef->data_ptr,datadef->sz);
+			stk_slab_free(seq->slab,datadef->data_ptr,datadef->bufsz);
+		}
+	} else {
+		newdata = datadef->data_ptr;
+		STK_REALLOC(newdata,sz);
+	}
 	STK_DEBUG(STKA_SEQ,"realloc data_ptr stk_realloc_data_in_sequence %p -> %p",datadef->data_ptr,newdata);
 	if(newdata) {
 		datadef->allocsz = sz;
-		datadef->sz = sz;
+		STK_SEQUENCE_SET_ELEM_SZ(list,datadef,sz);
+		datadef->bufsz = stk_slab_capacity(seq->slab,sz);
 		datadef->data_ptr = newdata;
 	}
 	return newdata;
 }
 
-Node *stk_ialloc_in_sequence(stk_sequence_t *seq,void *data_ptr,stk_uint64 sz, stk_uint64 user_type)
+static stk_sequence_data_def_t *stk_ialloc_in_sequence(stk_sequence_t *seq,stk_sequence_elements_t *list,void *data_ptr,stk_uint64 sz, stk_uint64 user_type)
 {
 	stk_sequence_data_def_t *datadef;
-	Node *n;
 
 	if(!seq) return NULL;
 
-	STK_CALLOC_STCT(STK_STCT_SEQUENCE_DATA_COPY,stk_sequence_data_def_t,datadef);
+	datadef = stk_sequence_new_element(seq,list,STK_STCT_SEQUENCE_DATA_COPY);
 	if(!datadef) return NULL;
 
 	datadef->allocsz = sz;
 	datadef->sz = sz;
 	datadef->user_type = user_type;
-	datadef->data_ptr = malloc(sz);
-	if(!datadef->data_ptr) {
-		STK_FREE_STCT(STK_STCT_SEQUENCE_DATA_COPY,datadef);
-		return NULL;
+	if(datadef->bufsz < sz) {
+		/* No spare buffer, or it is too small */
+		stk_slab_free(seq->slab,datadef->data_ptr,datadef->bufsz);
+		datadef->bufsz = 0;
+		datadef->data_ptr = stk_slab_alloc(seq->slab,sz);
+		if(!datadef->data_ptr) {
+			/* Leave the empty slot as a spare, it holds no buffer */
+			list->count--;
+			list->spare++;
+			return NULL;
+		}
+		datadef->bufsz = stk_slab_capacity(seq->slab,sz);
 	}
+	list->total_sz += sz;
+	stk_sequence_update_index(seq,list);
 	STK_DEBUG(STKA_SEQ,"malloc data_ptr stk_ialloc_in_sequence %p",datadef->data_ptr);
 	if(data_ptr)
 		memcpy(datadef->data_ptr,data_ptr,sz);
 
-	n = NewNode();
-	if(!n) {
-		free(datadef->data_ptr);
-		STK_FREE_STCT(STK_STCT_SEQUENCE_DATA_COPY,datadef);
-		return NULL;
-	}
-	SetData(n,datadef);
-
-	return n;
+	return datadef;
 }
 
 stk_ret stk_alloc_in_sequence(stk_sequence_t *seq,stk_uint64 sz, stk_uint64 user_type)
 {
-	Node *n = stk_ialloc_in_sequence(seq,NULL,sz,user_type);
-	if(!n) return !STK_SUCCESS;
-
-	if(!seq->data_list) seq->data_list = NewPList();
-	STK_ASSERT(STKA_SEQ,seq->data_list!=NULL,"allocate sequence %p data list for copied data",seq);
-
-	AddTail(seq->data_list,n);
-
-	return STK_SUCCESS;
+	return stk_ialloc_in_sequence(seq,&seq->data,NULL,sz,user_type) ? STK_SUCCESS : !STK_SUCCESS;
 }
 
 
 stk_ret stk_copy_to_sequence(stk_sequence_t *seq,void *data_ptr,stk_uint64 sz, stk_uint64 user_type)
 {
-	Node *n;
-
 	STK_ASSERT(STKA_SEQ,data_ptr!=NULL,"Data is invalid");
 
-	n = stk_ialloc_in_sequence(seq,data_ptr,sz,user_type);
-	if(!n) return !STK_SUCCESS;
-
-	if(!seq->data_list) seq->data_list = NewPList();
-	STK_ASSERT(STKA_SEQ,seq->data_list!=NULL,"allocate sequence %p data list for copied data",seq);
-
-	AddTail(seq->data_list,n);
-
-	return STK_SUCCESS;
+	return stk_ialloc_in_sequence(seq,&seq->data,data_ptr,sz,user_type) ? STK_SUCCESS : !STK_SUCCESS;
 }
 
 stk_ret stk_copy_to_sequence_meta_data(stk_sequence_t *seq,void *data_ptr,stk_uint64 sz, stk_uint64 user_type)
 {
-	Node *n;
-
 	STK_ASSERT(STKA_SEQ,data_ptr!=NULL,"Data is invalid");
-	n = stk_ialloc_in_sequence(seq,data_ptr,sz,user_type);
-	if(!n) return !STK_SUCCESS;
-
-	if(!seq->meta_data_list) seq->meta_data_list = NewPList();
-	STK_ASSERT(STKA_SEQ,seq->meta_data_list!=NULL,"allocate sequence %p meta data list for copied data",seq);
-
-	AddTail(seq->meta_data_list,n);
 
-	return STK_SUCCESS;
+	return stk_ialloc_in_sequence(seq,&seq->meta_data,data_ptr,sz,user_type) ? STK_SUCCESS : !STK_SUCCESS;
 }
 
 stk_uint64 stk_remove_sequence_data_by_type(stk_sequence_t *seq, stk_uint64 user_type, stk_uint64 max_instances)
@@ -298,52 +694,118 @@ stk_uint64 stk_remove_sequence_data_by_type(stk_sequence_t *seq, stk_uint64 user
 	stk_uint64 removed = 0;
 	if(!seq) return !STK_SUCCESS;
 
-	if(!IsPListEmpty(seq->data_list)) {
-		stk_sequence_data_def_t *datadef;
+	{
+	/* Compact the element array in a single pass */
+	int keep = 0;
 
-		for(Node *n = FirstNode(seq->data_list); (removed < max_instances || max_instances == 0) && !AtListEnd(n);) {
-			datadef = (stk_sequence_data_def_t *) NodeData(n);
-			if(datadef->user_type == user_type) {
-				Node *c = n;
-				n = NxtNode(n);
-				Remove(c);
-				removed++;
-
-				if(datadef->stct_type == STK_STCT_SEQUENCE_DATA_COPY) {
-					void *p = datadef->data_ptr;
-					datadef->data_ptr = (void *) 0xdeadbeef;
-					free(p);
-					STK_FREE_STCT(STK_STCT_SEQUENCE_DATA_COPY,datadef);
-				}
-				else
-					STK_FREE_STCT(STK_STCT_SEQUENCE_DATA_REF,datadef);
-				
-				SetData(c,NULL);
-				FreeNode(c);
-			}
+	for(int idx = 0; idx < seq->data.count; idx++) {
+		stk_sequence_data_def_t *datadef = &seq->data.elems[idx];
+
+		if(datadef->user_type == user_type && (removed < max_instances || max_instances == 0)) {
+			if(datadef->stct_type == STK_STCT_SEQUENCE_MERGED_SEQ)
+				seq->data.merged--;
 			else
-				n = NxtNode(n);
+				seq->data.total_sz -= datadef->sz;
+			stk_sequence_free_datadef(seq,datadef);
+			removed++;
+		} else {
+			if(keep != idx) seq->data.elems[keep] = *datadef;
+			keep++;
 		}
 	}
+	/* Slide any spare buffers down behind the remaining elements */
+	if(keep != seq->data.count && seq->data.spare > 0)
+		memmove(&seq->data.elems[keep],&seq->data.elems[seq->data.count],seq->data.spare * sizeof(stk_sequence_data_def_t));
+	seq->data.count = keep;
+	if(removed > 0) stk_sequence_rebuild_index(seq,&seq->data);
+	}
 
 	return removed;
 }
 
 stk_generation_id stk_bump_sequence_generation(stk_sequence_t *seq)
 {
-	return STK_ATOMIC_INCR(&seq->generation);
+	return stk_atomic_fetch_add_16(&seq->generation,1,STK_MO_RELAXED);
 }
 
 stk_generation_id stk_get_sequence_generation(stk_sequence_t *seq)
 {
-	return seq->generation;
+	return stk_atomic_load_16(&seq->generation,STK_MO_RELAXED);
 }
 
 stk_ret stk_update_ref_data_in_sequence(stk_sequence_t *seq, stk_generation_id *gen_id)
 {
-	/* Duplicate the buffer for any referenced data and bump the generation number */
-	STK_LOG(STK_LOG_ERROR,"Data archiving not implemented yet");
-	return !STK_SUCCESS;
+	stk_generation_id gen;
+
+	STK_ASSERT(STKA_SEQ,seq!=NULL,"sequence null or invalid :%p",seq);
+	STK_ASSERT(STKA_SEQ,seq->stct_type==STK_STCT_SEQUENCE,"sequence %p passed in to stk_update_ref_data_in_sequence is structure type %d",seq,seq->stct_type);
+
+	/* Only application memory still shared with clones is duplicated, the clones keep the archived generation.
+	 * Owned buffers are already copied on write, so they stay shared.
+	 */
+	gen = stk_bump_sequence_generation(seq);
+	for(int idx = 0; idx < seq->data.count; idx++) {
+		stk_sequence_data_def_t *datadef = &seq->data.elems[idx];
+		stk_ret rc;
+
+		if(!datadef->shared || datadef->shared->owned || stk_atomic_load_ptr(&datadef->shared->archive,STK_MO_ACQUIRE))
+			continue;
+		rc = stk_sequence_unshare_element(seq,datadef);
+		if(rc != STK_SUCCESS) return rc;
+	}
+
+	if(gen_id) *gen_id = gen;
+	return STK_SUCCESS;
+}
+
+stk_sequence_t *stk_clone_sequence(stk_sequence_t *seq)
+{
+	stk_sequence_t *clone;
+
+	STK_ASSERT(STKA_SEQ,seq!=NULL,"sequence null or invalid :%p",seq);
+	STK_ASSERT(STKA_SEQ,seq->stct_type==STK_STCT_SEQUENCE,"sequence %p passed in to stk_clone_sequence is structure type %d",seq,seq->stct_type);
+
+	clone = stk_create_sequence(seq->env,seq->name,seq->id,seq->type,STK_SERVICE_TYPE_DATA,NULL);
+	if(!clone) return NULL;
+	clone->generation = stk_get_sequence_generation(seq);
+	clone->transport = seq->transport;
+	if(clone->transport.df) stk_hold_data_flow(clone->transport.df);
+
+	for(int idx = 0; idx < seq->data.count; idx++) {
+		stk_sequence_data_def_t *datadef = &seq->data.elems[idx];
+		stk_sequence_data_def_t *clonedef;
+
+		if(datadef->stct_type == STK_STCT_SEQUENCE_MERGED_SEQ) {
+			if(stk_add_sequence_reference_in_sequence(clone,datadef->data_ptr,datadef->user_type) != STK_SUCCESS) break;
+			continue;
+		}
+
+		if(stk_sequence_share_element(seq,datadef) != STK_SUCCESS) break;
+
+		clonedef = stk_sequence_new_element(clone,&clone->data,datadef->stct_type);
+		if(!clonedef) {
+			stk_sequence_release_shared(datadef);
+			break;
+		}
+		clonedef->allocsz = datadef->allocsz;
+		clonedef->sz = datadef->sz;
+		clonedef->user_type = datadef->user_type;
+		clonedef->data_ptr = datadef->shared->data_ptr;
+		clonedef->shared = datadef->shared;
+		clone->data.total_sz += clonedef->sz;
+		stk_sequence_update_index(clone,&clone->data);
+	}
+
+	for(int idx = 0; idx < seq->meta_data.count; idx++) {
+		stk_sequence_data_def_t *datadef = &seq->meta_data.elems[idx];
+		if(!stk_ialloc_in_sequence(clone,&clone->meta_data,datadef->data_ptr,datadef->sz,datadef->user_type)) break;
+	}
+
+	if(clone->data.count != seq->data.count || clone->meta_data.count != seq->meta_data.count) {
+		stk_destroy_sequence(clone);
+		return NULL;
+	}
+	return clone;
 }
 
 stk_ret stk_iterate_complete_sequence(stk_sequence_t *seq,
@@ -376,40 +838,34 @@ stk_ret stk_iterate_complete_sequence(stk_sequence_t *seq,
 		}
 	}
 
-	if(!seq->data_list) {
-		/* No elements to iterate over */
-		if(after_cb) 
-			return after_cb(seq,NULL,0,seq_type,clientd);
-		else
-			return STK_SUCCESS;
-	}
-
-	if(!IsPListEmpty(seq->data_list)) {
-		for(Node *n = FirstNode(seq->data_list); !AtListEnd(n); n = NxtNode(n)) {
-			stk_sequence_data_def_t *datadef = (stk_sequence_data_def_t *) NodeData(n);
-			if(datadef->stct_type != STK_STCT_SEQUENCE_MERGED_SEQ) {
-				if(seqiter) seqiter->curr = n;
-				rc = element_cb(seq,datadef->data_ptr,datadef->sz,datadef->user_type,clientd);
+	/* Elements are re-fetched by index each time as callbacks may grow the element array */
+	for(int idx = 0; idx < seq->data.count; idx++) {
+		stk_sequence_data_def_t *datadef = &seq->data.elems[idx];
+		if(datadef->stct_type != STK_STCT_SEQUENCE_MERGED_SEQ) {
+			if(seqiter) {
+				seqiter->list = &seq->data;
+				seqiter->curr = idx;
+			}
+			rc = element_cb(seq,STK_DATADEF_DATA(datadef),datadef->sz,datadef->user_type,clientd);
+			if(rc != STK_SUCCESS) {
+				if(after_cb) after_cb(seq,NULL,0,seq_type,clientd);
+				return rc;
+			}
+		} else {
+			if(seqiter) {
+				/* TODO: This might work but is not tested - not sure if calling next() after this works */
+				seqiter->seq = datadef->data_ptr;
+				rc = stk_iterate_sequence((stk_sequence_t *) seqiter,element_cb,clientd);
+				seqiter->seq = seq;
 				if(rc != STK_SUCCESS) {
 					if(after_cb) after_cb(seq,NULL,0,seq_type,clientd);
 					return rc;
 				}
 			} else {
-				if(seqiter) {
-					/* TODO: This might work but is not tested - not sure if calling next() after this works */
-					seqiter->seq = datadef->data_ptr;
-					rc = stk_iterate_sequence((stk_sequence_t *) seqiter,element_cb,clientd);
-					seqiter->seq = seq;
-					if(rc != STK_SUCCESS) {
-						if(after_cb) after_cb(seq,NULL,0,seq_type,clientd);
-						return rc;
-					}
-				} else {
-					rc = stk_iterate_sequence((stk_sequence_t *) datadef->data_ptr,element_cb,clientd);
-					if(rc != STK_SUCCESS) {
-						if(after_cb) after_cb(seq,NULL,0,seq_type,clientd);
-						return rc;
-					}
+				rc = stk_iterate_sequence((stk_sequence_t *) datadef->data_ptr,element_cb,clientd);
+				if(rc != STK_SUCCESS) {
+					if(after_cb) after_cb(seq,NULL,0,seq_type,clientd);
+					return rc;
 				}
 			}
 		}
@@ -424,22 +880,46 @@ stk_ret stk_iterate_sequence(stk_sequence_t *seq,stk_sequence_cb element_cb,void
 }
 
 
-stk_ret stk_sequence_find_data_list_by_type(
-	stk_sequence_t *seq,stk_sequence_iterator_t *seqiter,List *data_list,
+static stk_ret stk_sequence_find_data_list_by_type(
+	stk_sequence_t *seq,stk_sequence_iterator_t *seqiter,stk_sequence_elements_t *list,
 	stk_uint64 user_type,void **data_ptr,stk_uint64 *sz)
 {
-	if(!data_list) return STK_NOT_FOUND; /* No elements to iterate over */
+	stk_sequence_type_index_t *index = stk_sequence_list_index(list);
 
-	if(!IsPListEmpty(data_list)) {
-		for(Node *n = FirstNode(data_list); !AtListEnd(n); n = NxtNode(n)) {
-			stk_sequence_data_def_t *datadef = (stk_sequence_data_def_t *) NodeData(n);
-			if(seqiter) seqiter->curr = n;
+	if(index) {
+		int slot = stk_sequence_index_slot(index,user_type);
+
+		for(; index->heads[slot] != -1; slot = (slot + 1) & (index->nslots - 1)) {
+			stk_sequence_data_def_t *datadef = &list->elems[index->heads[slot]];
 			if(datadef->user_type == user_type) {
-				*data_ptr = datadef->data_ptr;
+				if(seqiter) {
+					seqiter->list = list;
+					seqiter->curr = index->heads[slot];
+				}
+				*data_ptr = STK_DATADEF_DATA(datadef);
 				*sz = datadef->sz;
 				return STK_SUCCESS;
 			}
 		}
+		/* Leave the iterator where a full scan would */
+		if(seqiter) {
+			seqiter->list = list;
+			seqiter->curr = list->count - 1;
+		}
+		return STK_NOT_FOUND;
+	}
+
+	for(int idx = 0; idx < list->count; idx++) {
+		stk_sequence_data_def_t *datadef = &list->elems[idx];
+		if(seqiter) {
+			seqiter->list = list;
+			seqiter->curr = idx;
+		}
+		if(datadef->user_type == user_type) {
+			*data_ptr = STK_DATADEF_DATA(datadef);
+			*sz = datadef->sz;
+			return STK_SUCCESS;
+		}
 	}
 	return STK_NOT_FOUND;
 }
@@ -465,7 +945,7 @@ stk_ret stk_sequence_find_meta_data_by_type(stk_sequence_t *seq,stk_uint64 user_
 	STK_ASSERT(STKA_SEQ,seq->stct_type==STK_STCT_SEQUENCE,"sequence %p passed in to stk_iterate_sequence is structure type %d",seq,seq->stct_type);
 	if(seqiter) STK_ASSERT(STKA_SEQ,seq==seqiter->seq,"The iterator %p was initialized with sequence %p but sequence %p was passed to stk_iterate_sequence()",seqiter,seqiter->seq,seq);
 
-	return stk_sequence_find_data_list_by_type(seq,seqiter,seq->meta_data_list,user_type,data_ptr,sz);
+	return stk_sequence_find_data_list_by_type(seq,seqiter,&seq->meta_data,user_type,data_ptr,sz);
 }
 
 stk_ret stk_sequence_find_data_by_type(stk_sequence_t *seq,stk_uint64 user_type,void **data_ptr,stk_uint64 *sz)
@@ -486,7 +966,37 @@ stk_ret stk_sequence_find_data_by_type(stk_sequence_t *seq,stk_uint64 user_type,
 	STK_ASSERT(STKA_SEQ,seq->stct_type==STK_STCT_SEQUENCE,"sequence %p passed in to stk_iterate_sequence is structure type %d",seq,seq->stct_type);
 	if(seqiter) STK_ASSERT(STKA_SEQ,seq==seqiter->seq,"The iterator %p was initialized with sequence %p but sequence %p was passed to stk_iterate_sequence()",seqiter,seqiter->seq,seq);
 
-	return stk_sequence_find_data_list_by_type(seq,seqiter,seq->data_list,user_type,data_ptr,sz);
+	return stk_sequence_find_data_list_by_type(seq,seqiter,&seq->data,user_type,data_ptr,sz);
+}
+
+stk_ret stk_sequence_iterator_find_next_by_type(stk_sequence_iterator_t *seqiter,stk_uint64 user_type,void **data_ptr,stk_uint64 *sz)
+{
+	stk_sequence_elements_t *list;
+	stk_sequence_type_index_t *index;
+	int idx;
+
+	STK_ASSERT(STKA_SEQ,seqiter!=NULL,"sequence iterator null or invalid :%p",seqiter);
+	STK_ASSERT(STKA_SEQ,seqiter->stct_type==STK_STCT_SEQUENCE_ITERATOR,"sequence iterator %p passed in to stk_sequence_iterator_find_next_by_type is structure type %d",seqiter,seqiter->stct_type);
+
+	*data_ptr = NULL;
+	*sz = 0;
+	if(seqiter->curr < 0) return STK_NOT_FOUND;
+
+	list = seqiter->list;
+	index = stk_sequence_list_index(list);
+	if(index && list->elems[seqiter->curr].user_type == user_type)
+		idx = index->next[seqiter->curr];
+	else {
+		for(idx = seqiter->curr + 1; idx < list->count; idx++)
+			if(list->elems[idx].user_type == user_type) break;
+		if(idx == list->count) idx = -1;
+	}
+	if(idx == -1) return STK_NOT_FOUND;
+
+	seqiter->curr = idx;
+	*data_ptr = STK_DATADEF_DATA(&list->elems[idx]);
+	*sz = list->elems[idx].sz;
+	return STK_SUCCESS;
 }
 
 stk_sequence_id stk_get_sequence_id(stk_sequence_t *seq) { return seq->id; }
@@ -501,26 +1011,41 @@ char *stk_get_sequence_name(stk_sequence_t *seq) { return seq->name; }
 
 stk_ret stk_set_sequence_name(stk_sequence_t *seq, char *name)
 {
-	if(seq->name) free(seq->name);
+	stk_sequence_free_name(seq);
 	seq->name = name;
 	return STK_SUCCESS;
 }
 
+stk_ret stk_copy_sequence_name(stk_sequence_t *seq, char *name)
+{
+	int len = strlen(name) + 1;
+
+	/* Reuse the current buffer if it came from the same slab class */
+	if(seq->name && (seq->flags & STK_SEQUENCE_FLAG_SLAB_NAME) &&
+		stk_slab_capacity(seq->slab,strlen(seq->name) + 1) == stk_slab_capacity(seq->slab,len)) {
+		memcpy(seq->name,name,len);
+		return STK_SUCCESS;
+	}
+
+	stk_sequence_free_name(seq);
+	seq->name = stk_slab_alloc(seq->slab,len);
+	if(!seq->name) return STK_MEMERR;
+	memcpy(seq->name,name,len);
+	seq->flags |= STK_SEQUENCE_FLAG_SLAB_NAME;
+	return STK_SUCCESS;
+}
+
 int stk_number_of_sequence_elements(stk_sequence_t *seq)
 {
 	STK_ASSERT(STKA_SEQ,seq!=NULL,"sequence null or invalid :%p",seq);
 	STK_ASSERT(STKA_SEQ,seq->stct_type==STK_STCT_SEQUENCE,"sequence %p passed in to stk_number_of_sequence_elements is structure type %d",seq,seq->stct_type);
-	if(!seq->data_list)
-		return 0;
-	else {
-		/* return NodeCount(seq->data_list); - could do this if we knew sequences had merged sequences - chance for a flag perhaps but NodeCount() isn't optimized either so... */
-		int count = 0;
+	{
+		int count = seq->data.count - seq->data.merged;
 
-		for(Node *n = FirstNode(seq->data_list); !AtListEnd(n); n = NxtNode(n)) {
-			stk_sequence_data_def_t *datadef = (stk_sequence_data_def_t *) NodeData(n);
-			if(datadef->stct_type != STK_STCT_SEQUENCE_MERGED_SEQ)
-				count++;
-			else
+		/* Merged sequences may change after being merged so their elements are counted on demand */
+		for(int idx = 0; seq->data.merged > 0 && idx < seq->data.count; idx++) {
+			stk_sequence_data_def_t *datadef = &seq->data.elems[idx];
+			if(datadef->stct_type == STK_STCT_SEQUENCE_MERGED_SEQ)
 				count += stk_number_of_sequence_elements(datadef->data_ptr);
 		}
 
@@ -528,24 +1053,37 @@ int stk_number_of_sequence_elements(stk_sequence_t *seq)
 	}
 }
 
+stk_uint64 stk_sequence_total_size(stk_sequence_t *seq)
+{
+	STK_ASSERT(STKA_SEQ,seq!=NULL,"sequence null or invalid :%p",seq);
+	STK_ASSERT(STKA_SEQ,seq->stct_type==STK_STCT_SEQUENCE,"sequence %p passed in to stk_sequence_total_size is structure type %d",seq,seq->stct_type);
+	{
+		stk_uint64 total = seq->data.total_sz;
+
+		for(int idx = 0; seq->data.merged > 0 && idx < seq->data.count; idx++) {
+			stk_sequence_data_def_t *datadef = &seq->data.elems[idx];
+			if(datadef->stct_type == STK_STCT_SEQUENCE_MERGED_SEQ)
+				total += stk_sequence_total_size(datadef->data_ptr);
+		}
+
+		return total;
+	}
+}
+
 int stk_has_any_sequence_elements(stk_sequence_t *seq)
 {
 	STK_ASSERT(STKA_SEQ,seq!=NULL,"sequence null or invalid :%p",seq);
 	STK_ASSERT(STKA_SEQ,seq->stct_type==STK_STCT_SEQUENCE,"sequence %p passed in to stk_number_of_sequence_elements is structure type %d",seq,seq->stct_type);
-	if(!seq->data_list || IsPListEmpty(seq->data_list))
-		return 0;
-	else
-		return 1;
+	return seq->data.count > 0 ? 1 : 0;
 }
 
 void *stk_last_sequence_element(stk_sequence_t *seq)
 {
 	STK_ASSERT(STKA_SEQ,seq!=NULL,"sequence null or invalid :%p",seq);
 	STK_ASSERT(STKA_SEQ,seq->stct_type==STK_STCT_SEQUENCE,"sequence %p passed in to stk_last_sequence_element is structure type %d",seq,seq->stct_type);
-	STK_ASSERT(STKA_SEQ,seq->data_list!=NULL,"sequence %p passed in to stk_last_sequence_element is not initialized with any segments",seq);
-	STK_ASSERT(STKA_SEQ,!IsPListEmpty(seq->data_list),"sequence %p passed in to stk_last_sequence_element is empty",seq);
+	STK_ASSERT(STKA_SEQ,seq->data.count > 0,"sequence %p passed in to stk_last_sequence_element is empty",seq);
 
-	return ((stk_sequence_data_def_t *)NodeData(LastNode(seq->data_list)))->data_ptr;
+	return STK_DATADEF_DATA(&seq->data.elems[seq->data.count - 1]);
 }
 
 stk_env_t *stk_env_from_sequence(stk_sequence_t *seq)
@@ -562,18 +1100,19 @@ stk_sequence_iterator_t *stk_sequence_iterator(stk_sequence_t *seq)
 	STK_ASSERT(STKA_SEQ,seq!=NULL,"sequence null or invalid :%p",seq);
 	STK_ASSERT(STKA_SEQ,seq->stct_type==STK_STCT_SEQUENCE,"sequence %p passed in to stk_sequence_iterator is structure type %d",seq,seq->stct_type);
 
-	STK_CALLOC_STCT(STK_STCT_SEQUENCE_ITERATOR,stk_sequence_iterator_t,seqiter);
+	STK_SLAB_CALLOC_STCT(seq->slab,STK_STCT_SEQUENCE_ITERATOR,stk_sequence_iterator_t,seqiter);
 	if(seqiter) {
 		seqiter->seq = seq;
-		if(seq->data_list && !IsPListEmpty(seq->data_list))
-			seqiter->curr = FirstNode(seqiter->seq->data_list);
+		seqiter->slab = seq->slab;
+		seqiter->list = &seq->data;
+		seqiter->curr = seq->data.count > 0 ? 0 : -1;
 	}
 	return seqiter;
 }
 
 stk_ret stk_end_sequence_iterator(stk_sequence_iterator_t *seqiter)
 {
-	STK_FREE_STCT(STK_STCT_SEQUENCE_ITERATOR,seqiter);
+	STK_SLAB_FREE_STCT(seqiter->slab,STK_STCT_SEQUENCE_ITERATOR,seqiter);
 	return STK_SUCCESS;
 }
 
@@ -582,37 +1121,29 @@ void *stk_sequence_iterator_data(stk_sequence_iterator_t *seqiter)
 	STK_ASSERT(STKA_SEQ,seqiter!=NULL,"sequence iterator null or invalid :%p",seqiter);
 	STK_ASSERT(STKA_SEQ,seqiter->stct_type==STK_STCT_SEQUENCE_ITERATOR,"sequence iterator %p passed in to stk_sequence_iterator_data is structure type %d",seqiter,seqiter->stct_type);
 
-	if(!seqiter->curr) return NULL;
+	if(seqiter->curr < 0) return NULL;
 
-	{
-	stk_sequence_data_def_t *datadef = (stk_sequence_data_def_t *) NodeData(seqiter->curr);
-	return datadef->data_ptr;
-	}
+	return STK_DATADEF_DATA(STK_SEQITER_CURR(seqiter));
 }
 
 void *stk_sequence_iterator_next(stk_sequence_iterator_t *seqiter)
 {
 	STK_ASSERT(STKA_SEQ,seqiter!=NULL,"sequence iterator null or invalid :%p",seqiter);
 	STK_ASSERT(STKA_SEQ,seqiter->stct_type==STK_STCT_SEQUENCE_ITERATOR,"sequence iterator %p passed in to stk_sequence_iterator_next is structure type %d",seqiter,seqiter->stct_type);
-	if(seqiter->curr) {
-		if (!IsLastNode(seqiter->curr)) {
-			seqiter->curr = NxtNode(seqiter->curr);
-			stk_sequence_data_def_t *datadef = (stk_sequence_data_def_t *) NodeData(seqiter->curr);
-			return datadef->data_ptr;
+	if(seqiter->curr >= 0) {
+		if(seqiter->curr + 1 < seqiter->list->count) {
+			seqiter->curr++;
+			return STK_DATADEF_DATA(STK_SEQITER_CURR(seqiter));
 		}
 		else {
-			seqiter->curr = NULL;
+			seqiter->curr = -1;
 			return NULL;
 		}
 	} else {
-		if(seqiter->seq->data_list && !IsPListEmpty(seqiter->seq->data_list)) {
-			seqiter->curr = FirstNode(seqiter->seq->data_list);
-			STK_ASSERT(STKA_SEQ,seqiter->curr != NULL,"Null first node in non empty list in stk_sequence_iterator_next");
-
-			{
-				stk_sequence_data_def_t *datadef = (stk_sequence_data_def_t *) NodeData(seqiter->curr);
-				return datadef->data_ptr;
-			}
+		seqiter->list = &seqiter->seq->data;
+		if(seqiter->list->count > 0) {
+			seqiter->curr = 0;
+			return STK_DATADEF_DATA(STK_SEQITER_CURR(seqiter));
 		}
 		else
 			return NULL;
@@ -623,28 +1154,19 @@ void *stk_sequence_iterator_prev(stk_sequence_iterator_t *seqiter)
 {
 	STK_ASSERT(STKA_SEQ,seqiter!=NULL,"sequence iterator null or invalid :%p",seqiter);
 	STK_ASSERT(STKA_SEQ,seqiter->stct_type==STK_STCT_SEQUENCE_ITERATOR,"sequence iterator %p passed in to stk_sequence_iterator_prev is structure type %d",seqiter,seqiter->stct_type);
-	if(seqiter->curr) {
-		if(FirstNode(seqiter->seq->data_list) == seqiter->curr) {
-			seqiter->curr = NULL;
-			return seqiter->curr;
+	if(seqiter->curr >= 0) {
+		if(seqiter->curr == 0) {
+			seqiter->curr = -1;
+			return NULL;
 		}
 
-		seqiter->curr = PrvNode(seqiter->curr);
-		if (seqiter->curr) {
-			stk_sequence_data_def_t *datadef = (stk_sequence_data_def_t *) NodeData(seqiter->curr);
-			return datadef->data_ptr;
-		}
-		else
-			return NULL;
+		seqiter->curr--;
+		return STK_DATADEF_DATA(STK_SEQITER_CURR(seqiter));
 	} else {
-		if(seqiter->seq->data_list && !IsPListEmpty(seqiter->seq->data_list)) {
-			seqiter->curr = LastNode(seqiter->seq->data_list);
-			if (seqiter->curr) {
-				stk_sequence_data_def_t *datadef = (stk_sequence_data_def_t *) NodeData(seqiter->curr);
-				return datadef->data_ptr;
-			}
-			else
-				return NULL;
+		seqiter->list = &seqiter->seq->data;
+		if(seqiter->list->count > 0) {
+			seqiter->curr = seqiter->list->count - 1;
+			return STK_DATADEF_DATA(STK_SEQITER_CURR(seqiter));
 		}
 		else
 			return NULL;
@@ -655,15 +1177,18 @@ stk_ret stk_sequence_iterator_copy_data(stk_sequence_iterator_t *seqiter,void *d
 {
 	STK_ASSERT(STKA_SEQ,seqiter!=NULL,"sequence iterator null or invalid :%p",seqiter);
 	STK_ASSERT(STKA_SEQ,seqiter->stct_type==STK_STCT_SEQUENCE_ITERATOR,"sequence iterator %p passed in to stk_sequence_iterator_copy_data is structure type %d",seqiter,seqiter->stct_type);
-	if(!seqiter->curr) return !STK_SUCCESS;
+	if(seqiter->curr < 0) return !STK_SUCCESS;
 
 	{
-	stk_sequence_data_def_t *datadef = NodeData(seqiter->curr);
+	stk_sequence_data_def_t *datadef = STK_SEQITER_CURR(seqiter);
 
 	if(sz > datadef->allocsz)
 		return !STK_SUCCESS; /* Allocated data too small */
 
-	datadef->sz = sz;
+	if(stk_sequence_unshare_element(seqiter->seq,datadef) != STK_SUCCESS)
+		return STK_MEMERR;
+
+	STK_SEQUENCE_SET_ELEM_SZ(seqiter->list,datadef,sz);
 	memcpy(datadef->data_ptr,data_ptr,sz);
 	}
 	return STK_SUCCESS;
@@ -673,36 +1198,30 @@ stk_uint64 stk_sequence_iterator_data_size(stk_sequence_iterator_t *seqiter)
 {
 	STK_ASSERT(STKA_SEQ,seqiter!=NULL,"sequence iterator null or invalid :%p",seqiter);
 	STK_ASSERT(STKA_SEQ,seqiter->stct_type==STK_STCT_SEQUENCE_ITERATOR,"sequence iterator %p passed in to stk_sequence_iterator_data_size is structure type %d",seqiter,seqiter->stct_type);
-	if(!seqiter->curr) return 0;
+	if(seqiter->curr < 0) return 0;
 
-	{
-	stk_sequence_data_def_t *datadef = NodeData(seqiter->curr);
-	return datadef->sz;
-	}
+	return STK_SEQITER_CURR(seqiter)->sz;
 }
 
 stk_uint64 stk_sequence_iterator_alloc_size(stk_sequence_iterator_t *seqiter)
 {
 	STK_ASSERT(STKA_SEQ,seqiter!=NULL,"sequence iterator null or invalid :%p",seqiter);
 	STK_ASSERT(STKA_SEQ,seqiter->stct_type==STK_STCT_SEQUENCE_ITERATOR,"sequence iterator %p passed in to stk_sequence_iterator_alloc_size is structure type %d",seqiter,seqiter->stct_type);
-	if(!seqiter->curr) return 0;
+	if(seqiter->curr < 0) return 0;
 
-	{
-	stk_sequence_data_def_t *datadef = NodeData(seqiter->curr);
-	return datadef->allocsz;
-	}
+	return STK_SEQITER_CURR(seqiter)->allocsz;
 }
 
 stk_ret stk_sequence_iterator_set_size(stk_sequence_iterator_t *seqiter,stk_uint64 sz)
 {
 	STK_ASSERT(STKA_SEQ,seqiter!=NULL,"sequence iterator null or invalid :%p",seqiter);
 	STK_ASSERT(STKA_SEQ,seqiter->stct_type==STK_STCT_SEQUENCE_ITERATOR,"sequence iterator %p passed in to stk_sequence_iterator_alloc_size is structure type %d",seqiter,seqiter->stct_type);
-	if(!seqiter->curr) return !STK_SUCCESS;
+	if(seqiter->curr < 0) return !STK_SUCCESS;
 
 	{
-	stk_sequence_data_def_t *datadef = NodeData(seqiter->curr);
+	stk_sequence_data_def_t *datadef = STK_SEQITER_CURR(seqiter);
 	if(sz > datadef->allocsz) return !STK_SUCCESS;
-	datadef->sz = sz;
+	STK_SEQUENCE_SET_ELEM_SZ(seqiter->list,datadef,sz);
 	}
 	return STK_SUCCESS;
 }
@@ -711,24 +1230,22 @@ stk_ret stk_sequence_iterator_set_user_type(stk_sequence_iterator_t *seqiter,stk
 {
 	STK_ASSERT(STKA_SEQ,seqiter!=NULL,"sequence iterator null or invalid :%p",seqiter);
 	STK_ASSERT(STKA_SEQ,seqiter->stct_type==STK_STCT_SEQUENCE_ITERATOR,"sequence iterator %p passed in to stk_sequence_iterator_alloc_size is structure type %d",seqiter,seqiter->stct_type);
-	if(!seqiter->curr) return !STK_SUCCESS;
+	if(seqiter->curr < 0) return !STK_SUCCESS;
 
-	{
-	stk_sequence_data_def_t *datadef = NodeData(seqiter->curr);
-	datadef->user_type = user_type;
+	if(STK_SEQITER_CURR(seqiter)->user_type != user_type) {
+		STK_SEQITER_CURR(seqiter)->user_type = user_type;
+		stk_sequence_rebuild_index(seqiter->seq,seqiter->list);
 	}
 	return STK_SUCCESS;
 }
 
 void *stk_sequence_iterator_realloc_segment(stk_sequence_iterator_t *seqiter,stk_uint64 sz)
 {
-	stk_sequence_data_def_t *datadef = NodeData(seqiter->curr);
-
 	STK_ASSERT(STKA_SEQ,seqiter!=NULL,"sequence iterator null or invalid :%p",seqiter);
 	STK_ASSERT(STKA_SEQ,seqiter->stct_type==STK_STCT_SEQUENCE_ITERATOR,"sequence iterator %p passed in to stk_sequence_iterator_alloc_size is structure type %d",seqiter,seqiter->stct_type);
-	if(!seqiter->curr) return NULL;
+	if(seqiter->curr < 0) return NULL;
 
-	return stk_realloc_data_in_sequence(seqiter->seq,datadef,sz);
+	return stk_realloc_data_in_sequence(seqiter->seq,seqiter->list,STK_SEQITER_CURR(seqiter),sz);
 }
 
 void *stk_sequence_iterator_ensure_segment_size(stk_sequence_iterator_t *seqiter,stk_uint64 sz)
@@ -743,23 +1260,30 @@ void *stk_sequence_iterator_ensure_segment_size(stk_sequence_iterator_t *seqiter
 		return data;
 	}
 
-	{
-	stk_sequence_data_def_t *datadef = NodeData(seqiter->curr);
+	/* The caller writes to the segment, so it must not be shared */
+	if(stk_sequence_unshare_element(seqiter->seq,STK_SEQITER_CURR(seqiter)) != STK_SUCCESS)
+		return NULL;
+
 	rc = stk_sequence_iterator_set_size(seqiter,sz);
 	STK_ASSERT(STKA_SEQ,rc==STK_SUCCESS,"re-set sequence size");
-	return datadef->data_ptr;
-	}
+	return STK_DATADEF_DATA(STK_SEQITER_CURR(seqiter));
 }
 
-/* Python APIs - not made public until a better iterator API is created */
-Node *stk_sequence_first_elem(stk_sequence_t *seq) { return FirstNode(seq->data_list); }
-Node *stk_sequence_next_elem(stk_sequence_t *seq,Node *n) { return NxtNode(n); }
-stk_uint64 stk_sequence_node_type(Node *n) { return ((stk_sequence_data_def_t *)NodeData(n))->user_type; }
-void stk_sequence_node_data(Node *n,char **dptr,stk_uint64 *sz)
+/* Python APIs - not made public until a better iterator API is created
+ * Elements are passed as opaque handles which are NULL at the end of the sequence
+ */
+void *stk_sequence_first_elem(stk_sequence_t *seq) { return seq->data.count > 0 ? &seq->data.elems[0] : NULL; }
+void *stk_sequence_next_elem(stk_sequence_t *seq,void *n)
+{
+	stk_sequence_data_def_t *datadef = (stk_sequence_data_def_t *) n + 1;
+	return datadef < &seq->data.elems[seq->data.count] ? datadef : NULL;
+}
+stk_uint64 stk_sequence_node_type(void *n) { return ((stk_sequence_data_def_t *) n)->user_type; }
+void stk_sequence_node_data(void *n,char **dptr,stk_uint64 *sz)
 {
-	stk_sequence_data_def_t *def = NodeData(n);
-	*dptr = def->data_ptr;
+	stk_sequence_data_def_t *def = n;
+	*dptr = STK_DATADEF_DATA(def);
 	*sz = def->sz;
 }
 
-int stk_is_at_list_end(Node *n) { return AtListEnd(n) ? 1 : 0; }
+int stk_is_at_list_end(void *n) { return n == NULL ? 1 : 0; }
@@ -0,0 +1,130 @@
+#include "stk_sequence_pool_api.h"
+#include "stk_sequence_api.h"
+#include "stk_internal.h"
+#include "stk_common.h"
+#include "stk_options_api.h"
+#include "stk_sync_api.h"
+#include <string.h>
+
+#define STK_SEQUENCE_POOL_DEFAULT_SZ 64
+
+struct stk_sequence_pool_stct {
+	stk_stct_type stct_type;
+	stk_env_t *env;
+	stk_mutex_t *lock;
+	stk_sequence_t **seqs;  /* Stack of recycled sequences, most recently released on top to keep them cache warm */
+	int count;
+	int max;
+	stk_sequence_pool_stats_t stats;
+};
+
+/* Implemented in stk_sequence.c */
+stk_bool stk_recycle_sequence(stk_sequence_t *seq);
+void stk_reuse_sequence(stk_sequence_t *seq,char *name, stk_sequence_id id, stk_sequence_type type,stk_service_type svctype);
+
+stk_sequence_pool_t *stk_create_sequence_pool(stk_env_t *env,stk_options_t *options)
+{
+	stk_sequence_pool_t *pool;
+	STK_CALLOC_STCT(STK_STCT_SEQUENCE_POOL,stk_sequence_pool_t,pool);
+	if(pool) {
+		char *pool_sz_str = stk_find_option(options,"sequence_pool_size",NULL);
+		stk_ret rc;
+
+		pool->env = env;
+		pool->max = pool_sz_str ? atoi(pool_sz_str) : STK_SEQUENCE_POOL_DEFAULT_SZ;
+		if(pool->max < 1) pool->max = 1;
+
+		pool->seqs = STK_CALLOC(pool->max * sizeof(stk_sequence_t *));
+		if(!pool->seqs) {
+			STK_FREE_STCT(STK_STCT_SEQUENCE_POOL,pool);
+			return NULL;
+		}
+
+		rc = stk_mutex_init(&pool->lock);
+		if(rc != STK_SUCCESS) {
+			STK_FREE(pool->seqs);
+			STK_FREE_STCT(STK_STCT_SEQUENCE_POOL,pool);
+			return NULL;
+		}
+	}
+	return pool;
+}
+
+stk_ret stk_destroy_sequence_pool(stk_sequence_pool_t *pool)
+{
+	STK_ASSERT(STKA_SEQ,pool->stct_type==STK_STCT_SEQUENCE_POOL,"destroy a sequence pool, the pointer was to a structure of type %d",pool->stct_type);
+
+	/* Recycled sequences have no holds, take one so they can be destroyed */
+	for(int idx = 0; idx < pool->count; idx++) {
+		stk_hold_sequence(pool->seqs[idx]);
+		STK_CHECK(STKA_SEQ,stk_destroy_sequence(pool->seqs[idx])==STK_SUCCESS,"destroy sequence %p in pool %p",pool->seqs[idx],pool);
+	}
+
+	stk_mutex_destroy(pool->lock);
+	STK_FREE(pool->seqs);
+	STK_FREE_STCT(STK_STCT_SEQUENCE_POOL,pool);
+	return STK_SUCCESS;
+}
+
+stk_sequence_t *stk_sequence_pool_acquire(stk_sequence_pool_t *pool,char *name,stk_sequence_id id,stk_sequence_type type,stk_service_type svctype)
+{
+	stk_sequence_t *seq = NULL;
+
+	STK_ASSERT(STKA_SEQ,pool->stct_type==STK_STCT_SEQUENCE_POOL,"acquire from a sequence pool, the pointer was to a structure of type %d",pool->stct_type);
+
+	stk_mutex_lock(pool->lock);
+	pool->stats.acquires++;
+	if(pool->count > 0) {
+		seq = pool->seqs[--pool->count];
+		pool->stats.hits++;
+	} else
+		pool->stats.misses++;
+	stk_mutex_unlock(pool->lock);
+
+	if(seq)
+		stk_reuse_sequence(seq,name,id,type,svctype);
+	else
+		seq = stk_create_sequence(pool->env,name,id,type,svctype,NULL);
+
+	return seq;
+}
+
+stk_ret stk_sequence_pool_release(stk_sequence_pool_t *pool,stk_sequence_t *seq)
+{
+	STK_ASSERT(STKA_SEQ,pool->stct_type==STK_STCT_SEQUENCE_POOL,"release to a sequence pool, the pointer was to a structure of type %d",pool->stct_type);
+
+	if(!stk_recycle_sequence(seq)) {
+		/* Still held by the application, it will be destroyed when it is released */
+		stk_mutex_lock(pool->lock);
+		pool->stats.releases++;
+		pool->stats.held++;
+		stk_mutex_unlock(pool->lock);
+		return STK_SUCCESS;
+	}
+
+	stk_mutex_lock(pool->lock);
+	pool->stats.releases++;
+	if(pool->count < pool->max) {
+		pool->seqs[pool->count++] = seq;
+		seq = NULL;
+	} else
+		pool->stats.discards++;
+	stk_mutex_unlock(pool->lock);
+
+	if(seq) {
+		/* Pool is full - recycling dropped the last hold so take one to destroy it */
+		stk_hold_sequence(seq);
+		return stk_destroy_sequence(seq);
+	}
+	return STK_SUCCESS;
+}
+
+stk_ret stk_sequence_pool_get_stats(stk_sequence_pool_t *pool,stk_sequence_pool_stats_t *stats)
+{
+	STK_ASSERT(STKA_SEQ,pool->stct_type==STK_STCT_SEQUENCE_POOL,"get stats of a sequence pool, the pointer was to a structure of type %d",pool->stct_type);
+
+	stk_mutex_lock(pool->lock);
+	*stats = pool->stats;
+	stk_mutex_unlock(pool->lock);
+	return STK_SUCCESS;
+}
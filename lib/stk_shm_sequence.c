@@ -0,0 +1,417 @@
+#include "stk_shm_sequence_api.h"
+#include "stk_sequence_api.h"
+#include "stk_internal.h"
+#include "stk_common.h"
+#include "stk_options_api.h"
+#include "stk_sync_api.h"
+#include "stk_service.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define STK_SHM_MAGIC 0x53544b5348414d31ULL /* STKSHAM1 */
+#define STK_SHM_BLOCK_MAGIC 0x53484d42 /* SHMB */
+#define STK_SHM_DEFAULT_SZ (16 * 1024 * 1024)
+
+/* Blocks are powers of 2 from 64 bytes, freed blocks are kept on per size class free lists */
+#define STK_SHM_MIN_SHIFT 6
+#define STK_SHM_NUM_CLASSES 40
+#define STK_SHM_ALIGN(_sz) (((_sz) + 7) & ~7UL)
+
+/* The header at the start of the segment, shared by all attached processes.
+ * Allocation is protected by a robust process shared mutex, block references are atomic.
+ */
+typedef struct stk_shm_header_stct {
+	stk_uint64 magic;
+	pthread_mutex_t lock;
+	stk_uint64 brk;         /* Offset of the unallocated space at the end of the arena */
+	stk_uint64 free_list[STK_SHM_NUM_CLASSES]; /* Offsets of free blocks, linked through their first word */
+	stk_shm_arena_stats_t stats;
+} stk_shm_header_t;
+
+typedef struct stk_shm_block_stct {
+	stk_uint32 magic;
+	stk_uint32 refcnt;
+	stk_uint32 cls;
+	stk_uint32 reserved;
+} stk_shm_block_t;
+
+/* Exported sequences are one block, all offsets are relative to the block */
+typedef struct stk_shm_element_stct {
+	stk_uint64 user_type;
+	stk_uint64 sz;
+	stk_uint64 offset;
+} stk_shm_element_t;
+
+typedef struct stk_shm_sequence_stct {
+	stk_sequence_id id;
+	stk_sequence_type type;
+	stk_generation_id generation;
+	stk_uint32 count;
+	stk_uint64 total_sz;
+	stk_uint64 name_offset; /* 0 if unnamed */
+	stk_shm_element_t elems[];
+} stk_shm_sequence_t;
+
+struct stk_shm_arena_stct {
+	stk_stct_type stct_type;
+	stk_env_t *env;
+	char *name;
+	stk_bool created;
+	stk_uint64 size;
+	stk_shm_header_t *hdr; /* Base of the mapping */
+};
+
+#define STK_SHM_PTR(_arena,_offset) ((void *) (((char *) (_arena)->hdr) + (_offset)))
+
+static inline int stk_shm_class(stk_uint64 sz)
+{
+	if(sz <= (1UL << STK_SHM_MIN_SHIFT)) return 0;
+	return ((int) (sizeof(unsigned long) * 8) - __builtin_clzl(sz - 1)) - STK_SHM_MIN_SHIFT;
+}
+
+static inline stk_uint64 stk_shm_class_sz(int cls) { return 1UL << (cls + STK_SHM_MIN_SHIFT); }
+
+/* Lock the arena. If a process died holding the lock, the lock is recovered rather than
+ * deadlocking the others. Each critical section is a few stores, so at worst a block is leaked.
+ */
+static void stk_shm_lock(stk_shm_header_t *hdr)
+{
+	int err = pthread_mutex_lock(&hdr->lock);
+
+	if(err == EOWNERDEAD) {
+		STK_LOG(STK_LOG_WARNING,"WARNING: A process died holding the shared memory arena lock, recovering it");
+		pthread_mutex_consistent(&hdr->lock);
+	} else
+		STK_ASSERT(STKA_MEM,err==0,"lock shared memory arena (rc %d)",err);
+}
+
+static stk_ret stk_shm_init_header(stk_shm_header_t *hdr,stk_uint64 size)
+{
+	pthread_mutexattr_t attr;
+	int err;
+
+	memset(hdr,0,sizeof(*hdr));
+	pthread_mutexattr_init(&attr);
+	err = pthread_mutexattr_setpshared(&attr,PTHREAD_PROCESS_SHARED);
+	if(err == 0)
+		err = pthread_mutexattr_setrobust(&attr,PTHREAD_MUTEX_ROBUST);
+	if(err == 0)
+		err = pthread_mutex_init(&hdr->lock,&attr);
+	pthread_mutexattr_destroy(&attr);
+	STK_CHECK_RET(STKA_MEM,err==0,!STK_SUCCESS,"initialize shared memory arena lock (rc %d)",err);
+
+	hdr->brk = stk_shm_class_sz(0) * ((sizeof(*hdr) + stk_shm_class_sz(0) - 1) / stk_shm_class_sz(0));
+	hdr->stats.size = size;
+	/* Attaching processes check the magic, so it is set last */
+	__atomic_store_n(&hdr->magic,STK_SHM_MAGIC,__ATOMIC_RELEASE);
+	return STK_SUCCESS;
+}
+
+stk_shm_arena_t *stk_create_shm_arena(stk_env_t *env,stk_options_t *options)
+{
+	char *name = stk_find_option(options,"shm_name",NULL);
+	stk_bool create = stk_find_option(options,"shm_create",NULL) ? STK_TRUE : STK_FALSE;
+	stk_shm_arena_t *arena;
+	stk_uint64 size;
+	void *base;
+	int fd;
+
+	STK_CHECK_RET(STKA_MEM,name!=NULL,NULL,"shm_name option must be specified to create a shared memory arena");
+
+	if(create) {
+		char *size_str = stk_find_option(options,"shm_size",NULL);
+		size = size_str ? (stk_uint64) atol(size_str) : STK_SHM_DEFAULT_SZ;
+		if(size < 4096) size = 4096;
+
+		fd = shm_open(name,O_RDWR|O_CREAT|O_TRUNC,0600);
+		STK_CHECK_RET(STKA_MEM,fd!=-1,NULL,"create shared memory segment '%s' (errno %d)",name,errno);
+		if(ftruncate(fd,(off_t) size) != 0) {
+			STK_LOG(STK_LOG_ERROR,"size shared memory segment '%s' to %lu bytes (errno %d)",name,size,errno);
+			close(fd);
+			shm_unlink(name);
+			return NULL;
+		}
+	} else {
+		struct stat st;
+
+		fd = shm_open(name,O_RDWR,0);
+		STK_CHECK_RET(STKA_MEM,fd!=-1,NULL,"attach to shared memory segment '%s' (errno %d)",name,errno);
+		if(fstat(fd,&st) != 0 || st.st_size < (off_t) sizeof(stk_shm_header_t)) {
+			close(fd);
+			return NULL;
+		}
+		size = (stk_uint64) st.st_size;
+	}
+
+	base = mmap(NULL,size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+	close(fd);
+	if(base == MAP_FAILED) {
+		STK_LOG(STK_LOG_ERROR,"map shared memory segment '%s' (errno %d)",name,errno);
+		if(create) shm_unlink(name);
+		return NULL;
+	}
+
+	if(create) {
+		if(stk_shm_init_header(base,size) != STK_SUCCESS) {
+			munmap(base,size);
+			shm_unlink(name);
+			return NULL;
+		}
+	} else if(__atomic_load_n(&((stk_shm_header_t *) base)->magic,__ATOMIC_ACQUIRE) != STK_SHM_MAGIC) {
+		STK_LOG(STK_LOG_ERROR,"shared memory segment '%s' is not an initialized arena",name);
+		munmap(base,size);
+		return NULL;
+	}
+
+	STK_CALLOC_STCT(STK_STCT_SHM_ARENA,stk_shm_arena_t,arena);
+	if(arena) {
+		arena->name = strdup(name);
+		if(!arena->name) {
+			STK_FREE_STCT(STK_STCT_SHM_ARENA,arena);
+			arena = NULL;
+		}
+	}
+	if(!arena) {
+		munmap(base,size);
+		if(create) shm_unlink(name);
+		return NULL;
+	}
+
+	arena->env = env;
+	arena->created = create;
+	arena->size = size;
+	arena->hdr = base;
+	return arena;
+}
+
+stk_ret stk_destroy_shm_arena(stk_shm_arena_t *arena)
+{
+	STK_ASSERT(STKA_MEM,arena->stct_type==STK_STCT_SHM_ARENA,"destroy a shared memory arena, the pointer was to a structure of type %d",arena->stct_type);
+
+	if(arena->created)
+		shm_unlink(arena->name);
+	munmap(arena->hdr,arena->size);
+	free(arena->name);
+	STK_FREE_STCT(STK_STCT_SHM_ARENA,arena);
+	return STK_SUCCESS;
+}
+
+/* Allocate a block with a single reference, returns the offset of the block or 0 if the arena is full */
+static stk_uint64 stk_shm_alloc(stk_shm_arena_t *arena,stk_uint64 sz)
+{
+	stk_shm_header_t *hdr = arena->hdr;
+	int cls = stk_shm_class(sizeof(stk_shm_block_t) + sz);
+	stk_uint64 offset = 0;
+	stk_shm_block_t *block;
+
+	if(cls >= STK_SHM_NUM_CLASSES) return 0;
+
+	stk_shm_lock(hdr);
+	if(hdr->free_list[cls]) {
+		offset = hdr->free_list[cls];
+		hdr->free_list[cls] = *(stk_uint64 *) STK_SHM_PTR(arena,offset + sizeof(stk_shm_block_t));
+	} else if(hdr->brk + stk_shm_class_sz(cls) <= arena->size) {
+		offset = hdr->brk;
+		hdr->brk += stk_shm_class_sz(cls);
+	}
+	if(offset) {
+		hdr->stats.allocs++;
+		hdr->stats.used += stk_shm_class_sz(cls);
+	} else
+		hdr->stats.alloc_failures++;
+	pthread_mutex_unlock(&hdr->lock);
+
+	if(offset) {
+		block = STK_SHM_PTR(arena,offset);
+		block->cls = cls;
+		block->refcnt = 1;
+		block->magic = STK_SHM_BLOCK_MAGIC;
+	}
+	return offset;
+}
+
+/* Validate a handle, which may have been received from another process.
+ * The block's class is read once and returned in cls, callers must use it rather than reading it again.
+ */
+static stk_shm_block_t *stk_shm_block(stk_shm_arena_t *arena,stk_shm_handle_t handle,stk_uint32 *cls)
+{
+	stk_shm_block_t *block;
+
+	if(handle < sizeof(stk_shm_header_t) || handle + sizeof(stk_shm_block_t) > arena->size || (handle & 7))
+		return NULL;
+
+	block = STK_SHM_PTR(arena,handle);
+	*cls = stk_atomic_load_32(&block->cls,STK_MO_RELAXED);
+	if(block->magic != STK_SHM_BLOCK_MAGIC || *cls >= STK_SHM_NUM_CLASSES ||
+		handle + stk_shm_class_sz(*cls) > arena->size)
+		return NULL;
+	return block;
+}
+
+typedef struct stk_shm_export_stct {
+	stk_shm_sequence_t *shmseq;
+	stk_uint32 count;
+	stk_uint64 data_sz;    /* Size of the data, each element aligned */
+	stk_uint64 offset;     /* Offset of the next element's data when copying */
+} stk_shm_export_t;
+
+static stk_ret stk_shm_size_element(stk_sequence_t *seq, void *data, stk_uint64 sz, stk_uint64 user_type, void *clientd)
+{
+	stk_shm_export_t *exp = (stk_shm_export_t *) clientd;
+	exp->count++;
+	exp->data_sz += STK_SHM_ALIGN(sz);
+	return STK_SUCCESS;
+}
+
+static stk_ret stk_shm_copy_element(stk_sequence_t *seq, void *data, stk_uint64 sz, stk_uint64 user_type, void *clientd)
+{
+	stk_shm_export_t *exp = (stk_shm_export_t *) clientd;
+	stk_shm_element_t *elem = &exp->shmseq->elems[exp->shmseq->count++];
+
+	elem->user_type = user_type;
+	elem->sz = sz;
+	elem->offset = exp->offset;
+	memcpy(((char *) exp->shmseq) + exp->offset,data,sz);
+	exp->offset += STK_SHM_ALIGN(sz);
+	exp->shmseq->total_sz += sz;
+	return STK_SUCCESS;
+}
+
+stk_shm_handle_t stk_shm_export_sequence(stk_shm_arena_t *arena,stk_sequence_t *seq)
+{
+	stk_shm_export_t exp;
+	stk_shm_sequence_t *shmseq;
+	stk_uint64 offset, hdrsz, namesz;
+	char *name = stk_get_sequence_name(seq);
+	stk_ret rc;
+
+	STK_ASSERT(STKA_MEM,arena->stct_type==STK_STCT_SHM_ARENA,"export to a shared memory arena, the pointer was to a structure of type %d",arena->stct_type);
+
+	memset(&exp,0,sizeof(exp));
+	rc = stk_iterate_sequence(seq,stk_shm_size_element,&exp);
+	if(rc != STK_SUCCESS) return STK_SHM_HANDLE_INVALID;
+
+	hdrsz = STK_SHM_ALIGN(sizeof(stk_shm_sequence_t) + (exp.count * sizeof(stk_shm_element_t)));
+	namesz = name ? STK_SHM_ALIGN(strlen(name) + 1) : 0;
+
+	offset = stk_shm_alloc(arena,hdrsz + namesz + exp.data_sz);
+	if(!offset) return STK_SHM_HANDLE_INVALID;
+
+	shmseq = STK_SHM_PTR(arena,offset + sizeof(stk_shm_block_t));
+	shmseq->id = stk_get_sequence_id(seq);
+	shmseq->type = stk_get_sequence_type(seq);
+	shmseq->generation = stk_get_sequence_generation(seq);
+	shmseq->count = 0;
+	shmseq->total_sz = 0;
+	if(name) {
+		shmseq->name_offset = hdrsz;
+		strcpy(((char *) shmseq) + hdrsz,name);
+	} else
+		shmseq->name_offset = 0;
+
+	exp.shmseq = shmseq;
+	exp.offset = hdrsz + namesz;
+	rc = stk_iterate_sequence(seq,stk_shm_copy_element,&exp);
+	STK_ASSERT(STKA_MEM,rc==STK_SUCCESS && shmseq->count==exp.count,"copy %u elements of sequence %p to shared memory, copied %u",exp.count,seq,shmseq->count);
+
+	/* Make the sequence visible to other processes before the handle is passed to them */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	return offset;
+}
+
+stk_sequence_t *stk_shm_import_sequence(stk_shm_arena_t *arena,stk_shm_handle_t handle)
+{
+	stk_shm_block_t *block;
+	stk_shm_sequence_t *shmseq;
+	stk_sequence_t *seq;
+	stk_uint64 limit, name_offset;
+	stk_uint32 count, cls;
+
+	STK_ASSERT(STKA_MEM,arena->stct_type==STK_STCT_SHM_ARENA,"import from a shared memory arena, the pointer was to a structure of type %d",arena->stct_type);
+
+	block = stk_shm_block(arena,handle,&cls);
+	STK_CHECK_RET(STKA_MEM,block!=NULL,NULL,"import invalid shared memory handle %lu",handle);
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	/* The block may be written by another process, so offsets and sizes are read once and checked against it */
+	shmseq = (stk_shm_sequence_t *) (block + 1);
+	limit = stk_shm_class_sz(cls) - sizeof(stk_shm_block_t);
+	count = shmseq->count;
+	name_offset = shmseq->name_offset;
+	STK_CHECK_RET(STKA_MEM,count <= (limit - sizeof(stk_shm_sequence_t)) / sizeof(stk_shm_element_t),NULL,
+		"import shared memory sequence %lu with %u elements, more than its block holds",handle,count);
+	STK_CHECK_RET(STKA_MEM,name_offset == 0 || (name_offset < limit && memchr(((char *) shmseq) + name_offset,'\0',limit - name_offset)),NULL,
+		"import shared memory sequence %lu with a name outside its block",handle);
+	{
+	stk_options_t options[] = { { "generation", (void *) (stk_uint64) shmseq->generation }, { NULL, NULL } };
+	char *name = name_offset ? ((char *) shmseq) + name_offset : NULL;
+
+	seq = stk_create_sequence(arena->env,name,shmseq->id,shmseq->type,STK_SERVICE_TYPE_DATA,options);
+	if(!seq) return NULL;
+	}
+
+	for(stk_uint32 idx = 0; idx < count; idx++) {
+		stk_shm_element_t *elem = &shmseq->elems[idx];
+		stk_uint64 offset = elem->offset, sz = elem->sz;
+		stk_ret rc;
+
+		if(offset > limit || sz > limit - offset) {
+			STK_LOG(STK_LOG_ERROR,"import shared memory sequence %lu, element %u is outside its block",handle,idx);
+			stk_destroy_sequence(seq);
+			return NULL;
+		}
+		rc = stk_add_reference_to_sequence(seq,((char *) shmseq) + offset,sz,elem->user_type);
+		if(rc != STK_SUCCESS) {
+			stk_destroy_sequence(seq);
+			return NULL;
+		}
+	}
+	return seq;
+}
+
+stk_ret stk_shm_hold(stk_shm_arena_t *arena,stk_shm_handle_t handle)
+{
+	stk_uint32 cls;
+	stk_shm_block_t *block = stk_shm_block(arena,handle,&cls);
+
+	STK_CHECK_RET(STKA_MEM,block!=NULL,!STK_SUCCESS,"hold invalid shared memory handle %lu",handle);
+	stk_atomic_fetch_add_32(&block->refcnt,1,STK_MO_RELAXED);
+	return STK_SUCCESS;
+}
+
+stk_ret stk_shm_release(stk_shm_arena_t *arena,stk_shm_handle_t handle)
+{
+	stk_uint32 cls;
+	stk_shm_block_t *block = stk_shm_block(arena,handle,&cls);
+	stk_shm_header_t *hdr = arena->hdr;
+
+	STK_CHECK_RET(STKA_MEM,block!=NULL,!STK_SUCCESS,"release invalid shared memory handle %lu",handle);
+
+	if(stk_atomic_fetch_sub_32(&block->refcnt,1,STK_MO_ACQ_REL) != 1)
+		return STK_SUCCESS;
+
+	block->magic = 0; /* Stale handles are detected until the block is reused */
+
+	stk_shm_lock(hdr);
+	*(stk_uint64 *) (block + 1) = hdr->free_list[cls];
+	hdr->free_list[cls] = handle;
+	hdr->stats.frees++;
+	hdr->stats.used -= stk_shm_class_sz(cls);
+	pthread_mutex_unlock(&hdr->lock);
+	return STK_SUCCESS;
+}
+
+stk_ret stk_shm_arena_get_stats(stk_shm_arena_t *arena,stk_shm_arena_stats_t *stats)
+{
+	STK_ASSERT(STKA_MEM,arena->stct_type==STK_STCT_SHM_ARENA,"get stats of a shared memory arena, the pointer was to a structure of type %d",arena->stct_type);
+
+	stk_shm_lock(arena->hdr);
+	*stats = arena->hdr->stats;
+	pthread_mutex_unlock(&arena->hdr->lock);
+	return STK_SUCCESS;
+}
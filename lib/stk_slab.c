@@ -0,0 +1,323 @@
+#include "stk_slab_api.h"
+#include "stk_internal.h"
+#include "stk_common.h"
+#include "stk_options_api.h"
+#include "stk_sync_api.h"
+#include <string.h>
+#include <pthread.h>
+
+/* Size classes are powers of 2 from 32 bytes to 64KB, larger requests use the system allocator */
+#define STK_SLAB_MIN_SHIFT 5
+#define STK_SLAB_MAX_SHIFT 16
+#define STK_SLAB_NUM_CLASSES (STK_SLAB_MAX_SHIFT - STK_SLAB_MIN_SHIFT + 1)
+#define STK_SLAB_MAX_SZ (1UL << STK_SLAB_MAX_SHIFT)
+#define STK_SLAB_DEFAULT_CHUNK_SZ (256 * 1024)
+#define STK_SLAB_MIN_OBJS_PER_CHUNK 8
+
+/* Thread caches move objects to/from the shared lists in batches */
+#define STK_SLAB_CACHE_BATCH 32
+#define STK_SLAB_CACHE_MAX (STK_SLAB_CACHE_BATCH * 4)
+
+typedef struct stk_slab_free_stct {
+	struct stk_slab_free_stct *next;
+} stk_slab_free_t;
+
+/* Chunk header is 16 bytes to keep objects 16 byte aligned */
+typedef struct stk_slab_chunk_stct {
+	struct stk_slab_chunk_stct *next;
+	stk_uint64 sz;
+} stk_slab_chunk_t;
+
+typedef struct stk_slab_thread_cache_stct {
+	stk_slab_allocator_t *sa;
+	struct stk_slab_thread_cache_stct *next;
+	stk_slab_free_t *free_list[STK_SLAB_NUM_CLASSES];
+	int count[STK_SLAB_NUM_CLASSES];
+	stk_uint64 allocs;
+	stk_uint64 frees;
+} stk_slab_thread_cache_t;
+
+struct stk_slab_allocator_stct {
+	stk_stct_type stct_type;
+	stk_mutex_t *lock;
+	stk_slab_free_t *free_list[STK_SLAB_NUM_CLASSES];
+	stk_slab_chunk_t *chunks;
+	stk_uint64 chunk_sz;
+	stk_bool thread_cache;
+	pthread_key_t cache_key;
+	stk_slab_thread_cache_t *thread_caches;
+	stk_slab_stats_t stats;
+};
+
+static inline int stk_slab_class(stk_uint64 sz)
+{
+	if(sz <= (1UL << STK_SLAB_MIN_SHIFT)) return 0;
+	return ((int) (sizeof(unsigned long) * 8) - __builtin_clzl(sz - 1)) - STK_SLAB_MIN_SHIFT;
+}
+
+static inline stk_uint64 stk_slab_class_sz(int cls) { return 1UL << (cls + STK_SLAB_MIN_SHIFT); }
+
+void stk_slab_thread_cache_destroyed(void *arg);
+
+stk_slab_allocator_t *stk_create_slab_allocator(stk_options_t *options)
+{
+	stk_slab_allocator_t *sa;
+	STK_CALLOC_STCT(STK_STCT_SLAB,stk_slab_allocator_t,sa);
+	if(sa) {
+		char *chunk_sz_str = stk_find_option(options,"slab_chunk_size",NULL);
+		stk_ret rc = stk_mutex_init(&sa->lock);
+		if(rc != STK_SUCCESS) {
+			STK_FREE_STCT(STK_STCT_SLAB,sa);
+			return NULL;
+		}
+
+		sa->chunk_sz = chunk_sz_str ? (stk_uint64) atol(chunk_sz_str) : STK_SLAB_DEFAULT_CHUNK_SZ;
+		if(sa->chunk_sz < 4096) sa->chunk_sz = 4096;
+
+		if(stk_find_option(options,"slab_thread_cache",NULL)) {
+			int err = pthread_key_create(&sa->cache_key,stk_slab_thread_cache_destroyed);
+			STK_CHECK(STKA_MEM,err==0,"create slab thread cache key (rc %d)",err);
+			sa->thread_cache = err == 0 ? STK_TRUE : STK_FALSE;
+		}
+	}
+	return sa;
+}
+
+stk_ret stk_destroy_slab_allocator(stk_slab_allocator_t *sa)
+{
+	STK_ASSERT(STKA_MEM,sa->stct_type==STK_STCT_SLAB,"destroy a slab allocator, the pointer was to a structure of type %d",sa->stct_type);
+
+	if(sa->thread_cache) {
+		pthread_key_delete(sa->cache_key);
+		while(sa->thread_caches) {
+			stk_slab_thread_cache_t *tc = sa->thread_caches;
+			sa->thread_caches = tc->next;
+			free(tc);
+		}
+	}
+
+	while(sa->chunks) {
+		stk_slab_chunk_t *chunk = sa->chunks;
+		sa->chunks = chunk->next;
+		free(chunk);
+	}
+
+	stk_mutex_destroy(sa->lock);
+	STK_FREE_STCT(STK_STCT_SLAB,sa);
+	return STK_SUCCESS;
+}
+
+/* Internal function - called with the allocator locked */
+static stk_ret stk_slab_add_chunk(stk_slab_allocator_t *sa,int cls)
+{
+	stk_uint64 objsz = stk_slab_class_sz(cls);
+	stk_uint64 chunk_sz = sa->chunk_sz;
+	stk_slab_chunk_t *chunk;
+	char *obj;
+
+	if(chunk_sz < objsz * STK_SLAB_MIN_OBJS_PER_CHUNK)
+		chunk_sz = objsz * STK_SLAB_MIN_OBJS_PER_CHUNK;
+
+	chunk = malloc(sizeof(stk_slab_chunk_t) + chunk_sz);
+	if(!chunk) return STK_MEMERR;
+
+	chunk->sz = chunk_sz;
+	chunk->next = sa->chunks;
+	sa->chunks = chunk;
+	sa->stats.chunk_allocs++;
+	sa->stats.bytes_reserved += chunk_sz;
+
+	/* Carve the chunk in to objects, building the free list back to front so allocations walk forward */
+	obj = ((char *) (chunk + 1)) + chunk_sz - objsz;
+	for(; obj >= (char *) (chunk + 1); obj -= objsz) {
+		stk_slab_free_t *f = (stk_slab_free_t *) obj;
+		f->next = sa->free_list[cls];
+		sa->free_list[cls] = f;
+	}
+	return STK_SUCCESS;
+}
+
+/* Internal function - called with the allocator locked */
+static void *stk_slab_shared_alloc(stk_slab_allocator_t *sa,int cls)
+{
+	stk_slab_free_t *f = sa->free_list[cls];
+
+	if(!f) {
+		if(stk_slab_add_chunk(sa,cls) != STK_SUCCESS) return NULL;
+		f = sa->free_list[cls];
+	}
+	sa->free_list[cls] = f->next;
+	return f;
+}
+
+static stk_slab_thread_cache_t *stk_slab_get_thread_cache(stk_slab_allocator_t *sa)
+{
+	stk_slab_thread_cache_t *tc = pthread_getspecific(sa->cache_key);
+	if(!tc) {
+		tc = calloc(1,sizeof(stk_slab_thread_cache_t));
+		if(!tc) return NULL;
+		tc->sa = sa;
+
+		stk_mutex_lock(sa->lock);
+		tc->next = sa->thread_caches;
+		sa->thread_caches = tc;
+		stk_mutex_unlock(sa->lock);
+
+		pthread_setspecific(sa->cache_key,tc);
+	}
+	return tc;
+}
+
+/* Called by pthreads on thread exit, return the cached objects to the shared lists */
+void stk_slab_thread_cache_destroyed(void *arg)
+{
+	stk_slab_thread_cache_t *tc = (stk_slab_thread_cache_t *) arg;
+	stk_slab_allocator_t *sa = tc->sa;
+
+	stk_mutex_lock(sa->lock);
+	for(int cls = 0; cls < STK_SLAB_NUM_CLASSES; cls++) {
+		while(tc->free_list[cls]) {
+			stk_slab_free_t *f = tc->free_list[cls];
+			tc->free_list[cls] = f->next;
+			f->next = sa->free_list[cls];
+			sa->free_list[cls] = f;
+		}
+	}
+
+	sa->stats.allocs += tc->allocs;
+	sa->stats.frees += tc->frees;
+
+	for(stk_slab_thread_cache_t **tcp = &sa->thread_caches; *tcp; tcp = &(*tcp)->next) {
+		if(*tcp == tc) {
+			*tcp = tc->next;
+			break;
+		}
+	}
+	stk_mutex_unlock(sa->lock);
+	free(tc);
+}
+
+void *stk_slab_alloc(stk_slab_allocator_t *sa,stk_uint64 sz)
+{
+	int cls;
+	void *ptr;
+
+	if(!sa) return malloc(sz);
+
+	if(sz > STK_SLAB_MAX_SZ) {
+		stk_mutex_lock(sa->lock);
+		sa->stats.sys_allocs++;
+		stk_mutex_unlock(sa->lock);
+		return malloc(sz);
+	}
+
+	cls = stk_slab_class(sz);
+
+	if(sa->thread_cache) {
+		stk_slab_thread_cache_t *tc = stk_slab_get_thread_cache(sa);
+		if(tc) {
+			stk_slab_free_t *f = tc->free_list[cls];
+			if(!f) {
+				/* Refill a batch from the shared list */
+				stk_mutex_lock(sa->lock);
+				for(int i = 0; i < STK_SLAB_CACHE_BATCH; i++) {
+					stk_slab_free_t *nf = stk_slab_shared_alloc(sa,cls);
+					if(!nf) break;
+					nf->next = tc->free_list[cls];
+					tc->free_list[cls] = nf;
+					tc->count[cls]++;
+				}
+				stk_mutex_unlock(sa->lock);
+				f = tc->free_list[cls];
+				if(!f) return NULL;
+			}
+			tc->free_list[cls] = f->next;
+			tc->count[cls]--;
+			tc->allocs++;
+			return f;
+		}
+	}
+
+	stk_mutex_lock(sa->lock);
+	ptr = stk_slab_shared_alloc(sa,cls);
+	if(ptr) sa->stats.allocs++;
+	stk_mutex_unlock(sa->lock);
+	return ptr;
+}
+
+void *stk_slab_calloc(stk_slab_allocator_t *sa,stk_uint64 sz)
+{
+	void *ptr;
+
+	if(!sa) return calloc(1,sz);
+
+	ptr = stk_slab_alloc(sa,sz);
+	if(ptr) memset(ptr,0,sz);
+	return ptr;
+}
+
+void stk_slab_free(stk_slab_allocator_t *sa,void *ptr,stk_uint64 sz)
+{
+	stk_slab_free_t *f = (stk_slab_free_t *) ptr;
+	int cls;
+
+	if(!ptr) return;
+
+	if(!sa || sz > STK_SLAB_MAX_SZ) {
+		free(ptr);
+		return;
+	}
+
+	cls = stk_slab_class(sz);
+
+	if(sa->thread_cache) {
+		stk_slab_thread_cache_t *tc = stk_slab_get_thread_cache(sa);
+		if(tc) {
+			f->next = tc->free_list[cls];
+			tc->free_list[cls] = f;
+			tc->count[cls]++;
+			tc->frees++;
+
+			if(tc->count[cls] > STK_SLAB_CACHE_MAX) {
+				/* Return a batch to the shared list so other threads may use it */
+				stk_mutex_lock(sa->lock);
+				for(int i = 0; i < STK_SLAB_CACHE_BATCH * 2; i++) {
+					stk_slab_free_t *rf = tc->free_list[cls];
+					tc->free_list[cls] = rf->next;
+					rf->next = sa->free_list[cls];
+					sa->free_list[cls] = rf;
+				}
+				tc->count[cls] -= STK_SLAB_CACHE_BATCH * 2;
+				stk_mutex_unlock(sa->lock);
+			}
+			return;
+		}
+	}
+
+	stk_mutex_lock(sa->lock);
+	f->next = sa->free_list[cls];
+	sa->free_list[cls] = f;
+	sa->stats.frees++;
+	stk_mutex_unlock(sa->lock);
+}
+
+stk_uint64 stk_slab_capacity(stk_slab_allocator_t *sa,stk_uint64 sz)
+{
+	if(!sa || sz > STK_SLAB_MAX_SZ) return sz;
+	return stk_slab_class_sz(stk_slab_class(sz));
+}
+
+stk_ret stk_slab_get_stats(stk_slab_allocator_t *sa,stk_slab_stats_t *stats)
+{
+	STK_ASSERT(STKA_MEM,sa->stct_type==STK_STCT_SLAB,"get stats of a slab allocator, the pointer was to a structure of type %d",sa->stct_type);
+
+	stk_mutex_lock(sa->lock);
+	*stats = sa->stats;
+	/* Thread cache counters are read without synchronization, they are approximate while threads are active */
+	for(stk_slab_thread_cache_t *tc = sa->thread_caches; tc; tc = tc->next) {
+		stats->allocs += tc->allocs;
+		stats->frees += tc->frees;
+	}
+	stk_mutex_unlock(sa->lock);
+	return STK_SUCCESS;
+}
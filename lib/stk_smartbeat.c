@@ -5,6 +5,7 @@
 #include "stk_common.h"
 #include "stk_internal.h"
 #include "stk_timer_api.h"
+#include "stk_clock_api.h"
 #include "stk_sequence_api.h"
 #include "stk_name_service_api.h"
 #include "stk_sg_automation_api.h"
@@ -68,11 +69,12 @@ int stk_min_smartbeat_interval(stk_smartbeat_ctrl_t *smb)
 stk_ret stk_smartbeat_update_current_time(stk_smartbeat_t *sb)
 {
 	struct timeval tv;
-	int rc = gettimeofday(&tv,NULL);
+	/* Smartbeats are compared with the times of other processes, so use the wall clock */
+	stk_ret rc = stk_now_realtime(&tv);
 	sb->sec = (stk_uint64) tv.tv_sec;
 	sb->usec = (stk_uint64) tv.tv_usec;
-	if(rc == -1) {
-		STK_LOG(STK_LOG_ERROR,"gettimeofday failed!");
+	if(rc != STK_SUCCESS) {
+		STK_LOG(STK_LOG_ERROR,"reading the wall clock failed!");
 		return !STK_SUCCESS;
 	}
 	else return STK_SUCCESS;
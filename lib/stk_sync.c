@@ -59,32 +59,26 @@ stk_ret stk_mutex_unlock(stk_mutex_t *mutex)
 	return mutex_error ? STK_SYSERR : STK_SUCCESS;
 }
 
+/*
+ * Out of line versions of the legacy atomic APIs. The STK_ATOMIC_* macros
+ * no longer call these, but they are retained for binary compatibility.
+ */
 _stk_inline int stk_fetch_and_add_int(stk_int_t *ptr, int val)
 {
-	__asm__ __volatile__ ("lock ; xadd %0,%1"
-	: "=r" (val), "=m" (ptr->v)
-	:  "0" (val),  "m" (ptr->v));
-	return val;
+	return __atomic_fetch_add(&ptr->v,val,__ATOMIC_ACQ_REL);
 }
 
-pthread_mutex_t stk_atomic_lock;
-
 _stk_inline int stk_fetch_and_incr_int(stk_int_t *ptr)
 {
-	int prev;
-	pthread_mutex_lock(&stk_atomic_lock);
-	prev = ptr->v;
-	++(ptr->v);
-	pthread_mutex_unlock(&stk_atomic_lock);
-	return prev;
+	return __atomic_fetch_add(&ptr->v,1,__ATOMIC_ACQ_REL);
 }
 
 _stk_inline int stk_fetch_and_decr_int(stk_int_t *ptr)
 {
-	int prev;
-	pthread_mutex_lock(&stk_atomic_lock);
-	prev = ptr->v;
-	--(ptr->v);
-	pthread_mutex_unlock(&stk_atomic_lock);
-	return prev;
+	return __atomic_fetch_sub(&ptr->v,1,__ATOMIC_ACQ_REL);
+}
+
+int stk_fetch_and_add( int * variable, int value )
+{
+	return __atomic_fetch_add(variable,value,__ATOMIC_ACQ_REL);
 }
@@ -7,6 +7,7 @@
 #include "stk_tcp_client_api.h"
 #include "stk_tcp_server_api.h"
 #include "stk_tcp_internal.h"
+#include "stk_uring_internal.h"
 #include "stk_options_api.h"
 #include "stk_timer_api.h"
 #include "stk_sync_api.h"
@@ -47,6 +48,7 @@ typedef struct stk_tcp_client_stct {
 	struct sockaddr_in server_addr;
 	struct sockaddr_in client_addr;
 	stk_tcp_wire_read_buf_t readbuf;
+	stk_uring_flow_t *uring; /* Must follow readbuf, as in the server module which receives for the client */
 	stk_timer_t *reconnect_timer;
 	stk_data_flow_fd_created_cb fd_created_cb;
 	stk_data_flow_fd_destroyed_cb fd_destroyed_cb;
@@ -55,6 +57,7 @@ typedef struct stk_tcp_client_stct {
 	int rcvbuf;
 	int reconnect_ivl;
 	short seq_connect_failures;
+	stk_uring_t *ring; /* The io_uring each connection is attached to */
 } stk_tcp_client_t;
 
 stk_ret stk_tcp_client_connect(stk_data_flow_t *df);
@@ -88,6 +91,7 @@ stk_data_flow_t *stk_tcp_client_create_data_flow(stk_env_t *env,char *name,stk_u
 		void *reconnect_str = stk_find_option(options,"reconnect_interval",NULL);
 
 		ts->sock = -1;
+		ts->ring = (stk_uring_t *) stk_find_option(options,"io_uring",NULL);
 
 		ts->fd_created_cb = (stk_data_flow_fd_created_cb) stk_find_option(options,"fd_created_cb",NULL);
 		ts->fd_destroyed_cb = (stk_data_flow_fd_destroyed_cb) stk_find_option(options,"fd_destroyed_cb",NULL);
@@ -155,6 +159,10 @@ stk_ret stk_tcp_client_unhook_data_flow(stk_data_flow_t *df)
 	if(ts->fd_destroyed_cb)
 		ts->fd_destroyed_cb(df,stk_get_data_flow_id(df),ts->sock);
 
+	if(ts->uring) {
+		stk_uring_detach(ts->uring);
+		ts->uring = NULL;
+	}
 	close(ts->sock);
 	ts->sock = -1;
 
@@ -256,6 +264,14 @@ stk_ret stk_tcp_client_connect(stk_data_flow_t *df)
 		return !STK_SUCCESS;
 	}
 	}
+
+	if(ts->ring) {
+		ts->uring = stk_uring_attach(ts->ring,df,ts->sock,0);
+		if(!ts->uring) {
+			STK_LOG(STK_LOG_ERROR,"Failed to attach socket for data flow %p %s[%lu] to io_uring",df,stk_data_flow_name(df),stk_get_data_flow_id(df));
+			return !STK_SUCCESS;
+		}
+	}
 	return STK_SUCCESS;
 }
 
@@ -315,7 +331,7 @@ stk_sequence_t *stk_tcp_client_data_flow_rcv(stk_data_flow_t *df,stk_sequence_t
 	{
 	stk_sequence_t *ret_seq = stk_tcp_server_data_flow_rcv(df,data_sequence,flags);
 
-	if(ret_seq == NULL && stk_data_flow_errno(df) != 0) {
+	if(ret_seq == NULL && stk_data_flow_errno(df) != 0 && stk_data_flow_errno(df) != EWOULDBLOCK) {
 
 		stk_ret ret = stk_tcp_client_unhook_data_flow(df);
 		STK_ASSERT(STKA_NET,ret==STK_SUCCESS,"unhook fd %d for data flow %p",ts->sock,df);
@@ -348,6 +364,7 @@ stk_ret stk_tcp_client_data_flow_buffered(stk_data_flow_t *df)
 {
 	stk_tcp_client_t *ts = stk_data_flow_module_data(df); /* Asserts on structure type */
 	STK_API_DEBUG();
+	if(ts->uring && stk_uring_buffered(ts->uring) > 0) return STK_SUCCESS;
 	return stk_tcp_data_buffered(&ts->readbuf) > 0 ? STK_SUCCESS : !STK_SUCCESS;
 }
 
@@ -3,11 +3,13 @@
 #include "stk_common.h"
 #include "stk_internal.h"
 #include "stk_env.h"
+#include "stk_env_api.h"
 #include "stk_sequence.h"
 #include "stk_sequence_api.h"
 #include "stk_tcp_server_api.h"
 #include "stk_tcp.h"
 #include "stk_tcp_internal.h"
+#include "stk_uring_internal.h"
 #include "stk_options_api.h"
 #include "stk_ports.h"
 
@@ -63,7 +65,7 @@ stk_sequence_t *stk_tcp_server_data_flow_rcv(stk_data_flow_t *df,stk_sequence_t
 stk_ret stk_tcp_shift_buf(stk_tcp_wire_read_buf_t *readbuf);
 stk_ret stk_tcp_server_data_flow_buffered(stk_data_flow_t *flow);
 char *stk_tcp_server_data_flow_protocol(stk_data_flow_t *flow);
-stk_ret stk_send_vector(stk_data_flow_t *df,struct iovec *vectors,int num_chunks,int start_idx,stk_uint64 flags);
+stk_ret stk_send_vector(stk_data_flow_t *df,struct iovec *vectors,int num_chunks,stk_uint64 flags);
 
 static stk_data_flow_module_t tcp_server_fptrs = {
 	stk_tcp_server_create_data_flow, stk_tcp_server_destroy_data_flow,
@@ -78,6 +80,7 @@ typedef struct stk_tcp_server_stct {
 	struct sockaddr_in server_addr;
 	struct sockaddr_in client_addr;
 	stk_tcp_wire_read_buf_t readbuf;
+	stk_uring_flow_t *uring; /* Set if the socket uses an io_uring, shared with the client module */
 	stk_data_flow_fd_created_cb fd_created_cb;
 	stk_data_flow_fd_destroyed_cb fd_destroyed_cb;
 	stk_data_flow_destroyed_cb df_destroyed_cb;
@@ -121,10 +124,12 @@ stk_data_flow_t *stk_tcp_server_create_data_flow(stk_env_t *env,char *name,stk_u
 		{
 		void *bindaddr_str = stk_find_option(options,"bind_address",NULL);
 		void *reuseaddr_str = stk_find_option(options,"reuseaddr",NULL);
+		void *reuseport_str = stk_find_option(options,"reuseport",NULL);
 		void *port_str = stk_find_option(options,"bind_port",NULL);
 		void *sndbuf_str = stk_find_option(options,"send_buffer_size",NULL);
 		void *rcvbuf_str = stk_find_option(options,"receive_buffer_size",NULL);
 		void *nodelay_str = stk_find_option(options,"nodelay",NULL);
+		stk_uring_t *ring = (stk_uring_t *) stk_find_option(options,"io_uring",NULL);
 
 		ts->fd_created_cb = (stk_data_flow_fd_created_cb) stk_find_option(options,"fd_created_cb",NULL);
 		ts->fd_destroyed_cb = (stk_data_flow_fd_destroyed_cb) stk_find_option(options,"fd_destroyed_cb",NULL);
@@ -160,6 +165,16 @@ stk_data_flow_t *stk_tcp_server_create_data_flow(stk_env_t *env,char *name,stk_u
 				STK_LOG(STK_LOG_ERROR,"Failed to set server socket to REUSEADDR on port %d, env %p",port,env);
 		}
 
+		/* Multiple listening sockets may bind the same port, for example one per thread, and the kernel distributes connections between them */
+		if(reuseport_str) {
+#ifdef SO_REUSEPORT
+			int true = 1;
+			rc = setsockopt(ts->sock, SOL_SOCKET, SO_REUSEPORT, &true, sizeof(true));
+			if(rc < 0)
+#endif
+				STK_LOG(STK_LOG_ERROR,"Failed to set server socket to REUSEPORT on port %d, env %p",port,env);
+		}
+
 		{
 		int sndbuf = 1048576, rcvbuf = 8388608; /* Default to 1MB Send buf, 8MB receive */
 
@@ -188,6 +203,13 @@ stk_data_flow_t *stk_tcp_server_create_data_flow(stk_env_t *env,char *name,stk_u
 			return NULL;
 		}
 
+		/* Connections are accepted by the ring, and accepted data flows use it too */
+		if(ring) {
+			ts->uring = stk_uring_attach(ring,df,ts->sock,STK_URING_ATTACH_LISTENING);
+			if(!ts->uring)
+				STK_LOG(STK_LOG_ERROR,"Failed to attach listening socket for data flow '%s'[%lu] to io_uring, env %p",name,id,env);
+		}
+
 		if(ts->fd_created_cb)
 			ts->fd_created_cb(df,stk_get_data_flow_id(df),ts->sock);
 		}
@@ -206,6 +228,7 @@ stk_ret stk_tcp_server_destroy_data_flow(stk_data_flow_t *df)
 		if(ts->fd_destroyed_cb)
 			ts->fd_destroyed_cb(df,stk_get_data_flow_id(df),ts->sock);
 
+		if(ts->uring) stk_uring_detach(ts->uring);
 		close(ts->sock);
 	}
 
@@ -233,7 +256,14 @@ stk_data_flow_t *stk_tcp_server_accept(stk_data_flow_t *svr_df)
 
 	STK_ASSERT(STKA_NET,sts!=NULL,"Getting server control block for data flow %p",svr_df);
 
-	newfd = accept(sts->sock,&saddr,&slen);
+	if(sts->uring) {
+		/* Accepted by the ring's multishot accept */
+		newfd = stk_uring_accept(sts->uring);
+		if(newfd < 0) return NULL;
+		if(getpeername(newfd,&saddr,&slen) == -1)
+			memset(&saddr,0,sizeof(saddr));
+	} else
+		newfd = accept(sts->sock,&saddr,&slen);
 	if(newfd < 0) return NULL;
 
 	{
@@ -255,6 +285,11 @@ stk_data_flow_t *stk_tcp_server_accept(stk_data_flow_t *svr_df)
 	ts->readbuf.sz = STK_CACHED_READBUF_SZ;
 	ts->readbuf.df = df;
 
+	if(sts->uring) {
+		ts->uring = stk_uring_attach(stk_uring_flow_ring(sts->uring),df,ts->sock,0);
+		STK_ASSERT(STKA_NET,ts->uring!=NULL,"attach accepted fd %d to io_uring",ts->sock);
+	}
+
 	if(sts->fd_created_cb)
 		sts->fd_created_cb(df,stk_get_data_flow_id(df),ts->sock);
 	if(sts->fd_destroyed_cb) /* Carry over destroy callback */
@@ -293,7 +328,17 @@ stk_uint64 stk_tcp_server_recv(stk_data_flow_t *df,stk_tcp_wire_read_buf_t *bufr
 	ssize_t ret;
 
 	stk_set_data_flow_errno(df,0);
-	ret = recv(ts->sock,&bufread->buf[bufread->read],bufread->sz - bufread->read,0);
+	if(ts->uring) {
+		/* Copy from the buffers the ring received in to, errors are as recv() would return them */
+		int err;
+
+		ret = (ssize_t) stk_uring_recv(ts->uring,&bufread->buf[bufread->read],bufread->sz - bufread->read,&err);
+		if(err) {
+			ret = -1;
+			errno = err;
+		}
+	} else
+		ret = recv(ts->sock,&bufread->buf[bufread->read],bufread->sz - bufread->read,0);
 	STK_DEBUG(STKA_NET,"recv df %p fd %d ret %ld errno %d",df,ts->sock,ret,errno);
 	STK_DEBUG_BUFFER("",bufread);
 	if(ret == -1) {
@@ -302,7 +347,10 @@ stk_uint64 stk_tcp_server_recv(stk_data_flow_t *df,stk_tcp_wire_read_buf_t *bufr
 			STK_LOG(STK_LOG_ERROR,"recv failed, bad fd %d",ts->sock);
 			return 0;
 		}
-		if(errno != EWOULDBLOCK && errno != ECONNRESET && errno != EINTR) {
+		if(errno == EWOULDBLOCK || errno == EAGAIN)
+			stk_set_data_flow_errno(df,EWOULDBLOCK); /* No more data, as distinct from the peer closing */
+		else
+		if(errno != ECONNRESET && errno != EINTR) {
 			stk_set_data_flow_errno(df,errno);
 			STK_LOG(STK_LOG_ERROR,"recv failed, errno %d",errno);
 		}
@@ -325,6 +373,8 @@ stk_ret stk_tcp_read_segment_hdr(stk_data_flow_t *df,stk_tcp_wire_read_buf_t *re
 	readbuf->seqiter = NULL;
 
 	while(stk_tcp_data_buffered(readbuf) < sizeof(readbuf->segment_hdr)) {
+		if(readbuf->read == readbuf->sz && (readbuf->sz - readbuf->orig_elem_start > 0))
+			STK_ASSERT(STKA_NET,stk_tcp_shift_buf(&ts->readbuf)==STK_SUCCESS,"shift readbuf down %p %lu",readbuf,readbuf->elem_start);
 		bytes_read = stk_tcp_server_recv(df,readbuf);
 		if(bytes_read == 0) {
 			readbuf->cb_rc = !STK_SUCCESS;
@@ -332,8 +382,6 @@ stk_ret stk_tcp_read_segment_hdr(stk_data_flow_t *df,stk_tcp_wire_read_buf_t *re
 			return STK_SUCCESS;
 		}
 		readbuf->read += bytes_read;
-		if(readbuf->read == readbuf->sz)
-			STK_ASSERT(STKA_NET,stk_tcp_shift_buf(&ts->readbuf)==STK_SUCCESS,"shift readbuf down %p %lu",readbuf,readbuf->elem_start);
 	}
 	memcpy(&readbuf->segment_hdr,&ts->readbuf.buf[ts->readbuf.elem_start],sizeof(readbuf->segment_hdr));
 	ts->readbuf.elem_start += sizeof(readbuf->segment_hdr);
@@ -475,20 +523,13 @@ stk_sequence_t *stk_tcp_server_data_flow_rcv_internal(stk_data_flow_t *df,stk_tc
 		return NULL;
 	}
 
-	rc = stk_data_flow_add_client_ip(data_sequence,&ts->accept_addr,sizeof(ts->accept_addr));
+	rc = stk_data_flow_set_received(df,data_sequence,&ts->accept_addr,sizeof(ts->accept_addr));
 	if(rc != STK_SUCCESS) {
 		STK_LOG(STK_LOG_ERROR,"update the client IP for a sequence from tcp fd %d for data flow %s[%lu], env %p rc %d",
 			ts->sock,stk_data_flow_name(df),stk_get_data_flow_id(df),stk_env_from_data_flow(df),rc);
 		return NULL;
 	}
 
-	rc = stk_data_flow_add_client_protocol(data_sequence,stk_tcp_server_data_flow_protocol(df));
-	if(rc != STK_SUCCESS) {
-		STK_LOG(STK_LOG_ERROR,"update the client protocol for a sequence from tcp fd %d for data flow %s[%lu], env %p rc %d",
-			ts->sock,stk_data_flow_name(df),stk_get_data_flow_id(df),stk_env_from_data_flow(df),rc);
-		return NULL;
-	}
-
 	if(bhdr.flags & STK_TCP_FLAG_NAME_FOLLOWS) {
 		/* Read in to temporary buffer */
 		stk_uint16 slen;
@@ -519,14 +560,13 @@ stk_sequence_t *stk_tcp_server_data_flow_rcv_internal(stk_data_flow_t *df,stk_tc
 		}
 
 		{
-		char *str = (char *) malloc(slen);
-		memcpy(str,&ts->readbuf.buf[ts->readbuf.elem_start],slen);
+		char *str = &ts->readbuf.buf[ts->readbuf.elem_start];
 		ts->readbuf.elem_start += slen;
 
 		STK_DEBUG(STKA_NET,"sqn name %s",str);
 
 		/* Sequence Name is in the next element */
-		rc = stk_set_sequence_name(data_sequence,str);
+		rc = stk_copy_sequence_name(data_sequence,str);
 		if(rc != STK_SUCCESS) {
 			STK_LOG(STK_LOG_ERROR,"update the sequence name for a sequence from tcp fd %d for data flow %s[%lu], env %p rc %d",
 				ts->sock,stk_data_flow_name(df),stk_get_data_flow_id(df),stk_env_from_data_flow(df),rc);
@@ -604,6 +644,7 @@ stk_sequence_t *stk_tcp_server_data_flow_rcv(stk_data_flow_t *df,stk_sequence_t
 typedef struct stk_tcp_vector_cb_stct {
 	stk_uint16 segment_id;
 	struct iovec *vptr;
+	stk_tcp_wire_seqment_hdr_t *sgmt;
 	stk_uint8 nblks;
 	stk_uint8 blk_num;
 } stk_tcp_vector_cb_t;
@@ -611,9 +652,8 @@ typedef struct stk_tcp_vector_cb_stct {
 stk_ret stk_tcp_server_vector_cb(stk_sequence_t *seq, void *data, stk_uint64 sz, stk_uint64 user_type, void *clientd)
 {
 	stk_tcp_vector_cb_t *vcb = (stk_tcp_vector_cb_t *) clientd;
-	stk_tcp_wire_seqment_hdr_t *sgmt;
+	stk_tcp_wire_seqment_hdr_t *sgmt = vcb->sgmt++;
 
-	sgmt = calloc(1,sizeof(stk_tcp_wire_seqment_hdr_t));
 	sgmt->segment_id = vcb->segment_id++;
 	/* TODO: create multiple vectors if the element size is larger than a segment */
 	sgmt->nblks = vcb->nblks;
@@ -633,19 +673,28 @@ stk_ret stk_tcp_server_data_flow_send(stk_data_flow_t *df,stk_sequence_t *data_s
 {
 	stk_tcp_server_t *ts = stk_data_flow_module_data(df); /* Asserts on structure type */
 	stk_tcp_wire_basic_hdr_t bhdr;
-	struct iovec *vectors,*vptr;
+	struct iovec *vectors;
 	char *seq_name = stk_get_sequence_name(data_sequence);
 	int num_elements = stk_number_of_sequence_elements(data_sequence);
 	int num_chunks = (num_elements * 2 /* segment hdr + data */) + (seq_name ? 2 : 1);
 	int start_idx = 1;
-	char *allocname = NULL;
+	int slen = seq_name ? strlen(seq_name) + 1 : 0;
+	stk_slab_allocator_t *slab = stk_env_get_slab_allocator(stk_env_from_data_flow(df));
+	stk_uint64 sendbufsz;
+	stk_tcp_wire_seqment_hdr_t *sgmts;
+	char *sendbuf, *allocname;
 
 	if(ts->sock == -1) return STK_WOULDBLOCK; /* May happen if a connection from a tcp client reset and is in the process of reconnecting */
 
 	STK_ASSERT(STKA_NET,num_chunks<STK_MAX_IOV,"number of chunks for scatter gather send on this O/S (%d %d)",num_chunks,STK_MAX_IOV);
 
-	vectors = calloc(num_chunks, sizeof(struct iovec));
-	STK_ASSERT(STKA_NET,vectors!=NULL,"allocate a vector for %d chunks",num_chunks);
+	/* A single allocation holds the vector, the segment headers and the wire name */
+	sendbufsz = (num_chunks * sizeof(struct iovec)) + (num_elements * sizeof(stk_tcp_wire_seqment_hdr_t)) + (slen ? slen + sizeof(stk_uint16) : 0);
+	sendbuf = stk_slab_calloc(slab,sendbufsz);
+	STK_ASSERT(STKA_NET,sendbuf!=NULL,"allocate a vector for %d chunks",num_chunks);
+	vectors = (struct iovec *) sendbuf;
+	sgmts = (stk_tcp_wire_seqment_hdr_t *) &vectors[num_chunks];
+	allocname = (char *) &sgmts[num_elements];
 
 	/* After the first vector, they follow the pattern of header, data
 	 * with headers dynamically allocated
@@ -662,10 +711,6 @@ stk_ret stk_tcp_server_data_flow_send(stk_data_flow_t *df,stk_sequence_t *data_s
 		stk_ret rc;
 
 		if(bhdr.flags & STK_TCP_FLAG_NAME_FOLLOWS) {
-			int slen = strlen(seq_name) + 1;
-			allocname = malloc(slen + sizeof(stk_uint16));
-			STK_ASSERT(STKA_NET,allocname!=NULL,"allocate wire name for sequence to send");
-
 			*((stk_uint16*)allocname) = (stk_uint16) slen;
 			strcpy(&allocname[sizeof(stk_uint16)],seq_name);
 
@@ -678,6 +723,7 @@ stk_ret stk_tcp_server_data_flow_send(stk_data_flow_t *df,stk_sequence_t *data_s
 				stk_bump_sequence_generation(data_sequence);
 
 			vcb.vptr = &vectors[start_idx];
+			vcb.sgmt = sgmts;
 
 			vcb.segment_id = 0;
 			vcb.nblks = num_elements;
@@ -689,26 +735,22 @@ stk_ret stk_tcp_server_data_flow_send(stk_data_flow_t *df,stk_sequence_t *data_s
 				STK_LOG(STK_LOG_ERROR,"iterate reading data for a sequence from tcp fd %d for data flow %s[%lu], env %p rc %d",
 					ts->sock,stk_data_flow_name(df),stk_get_data_flow_id(df),stk_env_from_data_flow(df),rc);
 
-				/* Free vector segments and vector */
-				for(int idx = start_idx; idx < num_chunks; idx+=2)
-					free(vectors[idx].iov_base);
-				free(vectors);
-				if(allocname) free(allocname);
+				stk_slab_free(slab,sendbuf,sendbufsz);
 				return rc;
 			}
 		}
 	}
 
 	{
-	stk_ret rc = stk_send_vector(df,vectors,num_chunks,start_idx,flags);
+	stk_ret rc = stk_send_vector(df,vectors,num_chunks,flags);
 
-	if(allocname) free(allocname);
+	stk_slab_free(slab,sendbuf,sendbufsz);
 
 	return rc;
 	}
 }
 
-stk_ret stk_send_vector(stk_data_flow_t *df,struct iovec *vectors,int num_chunks,int free_start_idx,stk_uint64 flags)
+stk_ret stk_send_vector(stk_data_flow_t *df,struct iovec *vectors,int num_chunks,stk_uint64 flags)
 {
 	stk_tcp_server_t *ts = stk_data_flow_module_data(df); /* Asserts on structure type */
 	ssize_t sendsz = 0,sentsz;
@@ -726,6 +768,15 @@ stk_ret stk_send_vector(stk_data_flow_t *df,struct iovec *vectors,int num_chunks
 		STK_DEBUG(STKA_NET,"vector base %p size %lu",vectors[idx].iov_base,vectors[idx].iov_len);
 	}
 
+	if(ts->uring) {
+		/* Queued and submitted in a batch with other sends on the ring */
+		stk_ret rc = stk_uring_send(ts->uring,vectors,num_chunks);
+		if(rc != STK_SUCCESS)
+			STK_LOG(STK_LOG_NET_ERROR,"Send failed on tcp fd %d for data flow '%s[%lu]', env %p rc %d",
+				ts->sock,stk_data_flow_name(df),stk_get_data_flow_id(df),stk_env_from_data_flow(df),rc);
+		return rc;
+	}
+
 	if(flags & STK_TCP_SEND_FLAG_NONBLOCK)
 		sentsz = sendmsg(ts->sock, &msg, STK_NB_SEND_FLAGS);
 	else {
@@ -752,7 +803,9 @@ stk_ret stk_send_vector(stk_data_flow_t *df,struct iovec *vectors,int num_chunks
 		unsent_offset_for_iov = sentsz - countsz;
 
 		/* Alloc a new vector from resend_start_idx to the end */
-		new_vectors = calloc(num_chunks - resend_start_idx, sizeof(struct iovec));
+		stk_slab_allocator_t *slab = stk_env_get_slab_allocator(stk_env_from_data_flow(df));
+		stk_uint64 new_vectors_sz = (num_chunks - resend_start_idx) * sizeof(struct iovec);
+		new_vectors = stk_slab_alloc(slab,new_vectors_sz);
 		STK_ASSERT(STKA_NET,new_vectors!=NULL,"allocate a vector for %d chunks to be resent",num_chunks - resend_start_idx);
 
 		/* Now set the first vector to the first unsent byte in the first vector, and iterate copying all the other vector pointers */
@@ -763,17 +816,13 @@ stk_ret stk_send_vector(stk_data_flow_t *df,struct iovec *vectors,int num_chunks
 		/* Send the new vector containing the remainder of the data!! */
 		{
 		/* This converts a non blocking send in to a blocking send... Bad... But necessary because we don't track partial sends... To be improved... */
-		stk_ret rc = stk_send_vector(df,new_vectors,num_chunks - resend_start_idx,num_chunks /* set greater than size to avoid frees */,flags & ~STK_TCP_SEND_FLAG_NONBLOCK);
+		stk_ret rc = stk_send_vector(df,new_vectors,num_chunks - resend_start_idx,flags & ~STK_TCP_SEND_FLAG_NONBLOCK);
 		STK_DEBUG(STKA_NET,"resending unsent data, rc %d",rc);
+		stk_slab_free(slab,new_vectors,new_vectors_sz);
 		if(rc != STK_SUCCESS) return rc;
 		}
 	}
 
-	/* Free vector segments and vector */
-	for(int idx = free_start_idx; idx < num_chunks; idx+=2)
-		free(vectors[idx].iov_base);
-	free(vectors);
-
 	if(sentsz == -1) {
 		int rc;
 
@@ -828,6 +877,7 @@ size_t stk_tcp_data_buffered(stk_tcp_wire_read_buf_t *readbuf)
 stk_ret stk_tcp_server_data_flow_buffered(stk_data_flow_t *df)
 {
 	stk_tcp_server_t *ts = stk_data_flow_module_data(df); /* Asserts on structure type */
+	if(ts->uring && stk_uring_buffered(ts->uring) > 0) return STK_SUCCESS;
 	return stk_tcp_data_buffered(&ts->readbuf) > 0 ? STK_SUCCESS : !STK_SUCCESS;
 }
 
@@ -2,12 +2,48 @@
 #include "stk_internal.h"
 #include "stk_env_api.h"
 #include "stk_sync_api.h"
+#include "stk_options_api.h"
+#include "stk_clock_api.h"
 #include "PLists.h"
 
 #include <sys/time.h>
+#include <pthread.h>
+
+/* Implemented in stk_env.c */
+void stk_env_timer_scheduled(stk_env_t *env,stk_timer_set_t *tset,struct timeval *deadline);
+
+/* Hierarchical timing wheel with a 1ms tick.
+ * Level 0 has a slot per tick, each higher level has slots covering a whole
+ * rotation of the level below, giving a range of 2^32ms (~49 days).
+ * Timers further out are parked in the last level and re-inserted when it cascades.
+ */
+#define STK_TIMER_WHEEL_LEVELS 5
+#define STK_TIMER_WHEEL_L0_BITS 8
+#define STK_TIMER_WHEEL_LN_BITS 6
+#define STK_TIMER_WHEEL_L0_SZ (1 << STK_TIMER_WHEEL_L0_BITS)
+#define STK_TIMER_WHEEL_LN_SZ (1 << STK_TIMER_WHEEL_LN_BITS)
+#define STK_TIMER_WHEEL_L0_MASK (STK_TIMER_WHEEL_L0_SZ - 1)
+#define STK_TIMER_WHEEL_LN_MASK (STK_TIMER_WHEEL_LN_SZ - 1)
+#define STK_TIMER_WHEEL_SHIFT(_level) (STK_TIMER_WHEEL_L0_BITS + (STK_TIMER_WHEEL_LN_BITS * ((_level) - 1)))
+#define STK_TIMER_WHEEL_MAX_DELTA ((((stk_uint64) 1) << STK_TIMER_WHEEL_SHIFT(STK_TIMER_WHEEL_LEVELS)) - 1)
+
+/* Values of the level field of timers which are not in a wheel slot */
+#define STK_TIMER_WHEEL_UNLINKED -1
+#define STK_TIMER_WHEEL_EXPIRING STK_TIMER_WHEEL_LEVELS
+
+typedef struct stk_timer_wheel_stct {
+	stk_uint64 now;            /* Next tick (ms) to be processed */
+	stk_uint64 next_expiry;    /* Cached earliest expiry, valid if next_valid */
+	stk_bool next_valid;
+	stk_uint32 slotted;        /* Timers in slots on any level */
+	stk_uint32 l0_count;       /* Timers in level 0 slots */
+	List *slots[STK_TIMER_WHEEL_LEVELS][STK_TIMER_WHEEL_L0_SZ]; /* Higher levels use STK_TIMER_WHEEL_LN_SZ */
+	List *expiring;            /* Timers due to be called back by stk_dispatch_timers() */
+} stk_timer_wheel_t;
 
 /* Timer sets are distributes in to three pools based on their scheduled time 
  * This probably isn't the best algorithm or storage mechanism, but is workable.
+ * Timer sets created with the "timer_wheel" option use a timing wheel instead.
  */
 struct stk_timer_set_stct {
 	stk_stct_type stct_type;
@@ -16,12 +52,42 @@ struct stk_timer_set_stct {
 	List *free_list;
 	List *ms; /* Medium length timers */
 	List *secs; /* Long timers */
+	stk_timer_wheel_t *wheel;
+	struct stk_timer_stct **id_buckets; /* Scheduled timers hashed by ID */
+	int id_bits;
+	stk_uint32 id_count;
 	stk_uint32 max_timers;
 	int flags;
+	int pool_idx; /* Position in the env timer pool, maintained by stk_env.c */
 	stk_mutex_t *timer_lock;
+	pthread_t owner;                             /* Owner thread of sets created with "timer_owner_thread" */
+	struct stk_timer_request_stct *requests;     /* Requests from other threads, pushed lock free, newest first */
+	stk_timer_set_wakeup_cb wakeup_cb;           /* Wakes the owner when other threads queue requests */
+	struct timeval env_deadline;                 /* The earliest deadline of an owned set known to the env */
+	stk_bool env_deadline_valid;
+	stk_timer_set_stats_t stats;
 };
 
 #define STK_TIMER_FLAG_ADDED_ENV 1
+#define STK_TIMER_FLAG_WHEEL 2
+#define STK_TIMER_FLAG_OWNED 4
+
+/* Timer sets owned by a thread are not locked, other threads queue requests
+ * which the owner applies (in order) the next time it uses the set.
+ */
+#define STK_TIMER_REQ_SCHEDULE 0
+#define STK_TIMER_REQ_RESCHEDULE 1
+#define STK_TIMER_REQ_CANCEL 2
+#define STK_TIMER_REQ_CANCEL_ID 3
+
+struct stk_timer_request_stct {
+	struct stk_timer_request_stct *next;
+	int op;
+	Node *n;
+	stk_uint32 gen;     /* Generation of the timer when the request was made */
+	stk_uint64 id;
+	struct timeval tv;
+};
 
 struct stk_timer_stct {
 	stk_timer_cb cb;
@@ -29,9 +95,391 @@ struct stk_timer_stct {
 	void *userdata;
 	struct timeval tv;
 	long ms;
+	stk_uint64 expires; /* Tick at which a wheel timer expires */
+	int level;          /* Wheel level the timer is slotted in */
+	Node *node;         /* The node this is the data of */
+	stk_uint32 gen;     /* Bumped each time the node is reused so stale requests from other threads are dropped */
+	struct stk_timer_stct *id_next;   /* Next timer in the ID hash bucket */
+	struct stk_timer_stct **id_pprev; /* Link to this timer in the ID hash bucket, NULL when not scheduled */
 };
 
+/* Scheduled timers are hashed by ID so they can be found without searching the timer lists.
+ * The chains are intrusive and doubly linked so timers are unhashed in constant time.
+ */
+#define STK_TIMER_ID_HASH_MIN_BITS 6
+
+static stk_uint32 stk_timer_id_bucket(stk_timer_set_t *timer_set,stk_uint64 id)
+{
+	return (stk_uint32) ((id * 0x9E3779B97F4A7C15ULL) >> (64 - timer_set->id_bits));
+}
+
+static void stk_timer_id_insert(stk_timer_set_t *timer_set,struct stk_timer_stct *t)
+{
+	struct stk_timer_stct **head = &timer_set->id_buckets[stk_timer_id_bucket(timer_set,t->id)];
+
+	t->id_next = *head;
+	if(*head) (*head)->id_pprev = &t->id_next;
+	*head = t;
+	t->id_pprev = head;
+	timer_set->id_count++;
+}
+
+/* Double the number of buckets when the chains average 2 timers */
+static void stk_timer_id_resize(stk_timer_set_t *timer_set)
+{
+	struct stk_timer_stct **old_buckets = timer_set->id_buckets;
+	int old_sz = old_buckets ? 1 << timer_set->id_bits : 0;
+
+	timer_set->id_bits = old_buckets ? timer_set->id_bits + 1 : STK_TIMER_ID_HASH_MIN_BITS;
+	timer_set->id_buckets = calloc(1 << timer_set->id_bits,sizeof(struct stk_timer_stct *));
+	STK_ASSERT(STKA_TIMER,timer_set->id_buckets!=NULL,"allocate %d timer ID hash buckets",1 << timer_set->id_bits);
+	timer_set->id_count = 0;
+
+	for(int idx = 0; idx < old_sz; idx++) {
+		struct stk_timer_stct *t = old_buckets[idx];
+		while(t) {
+			struct stk_timer_stct *nxt = t->id_next;
+			stk_timer_id_insert(timer_set,t);
+			t = nxt;
+		}
+	}
+	if(old_buckets) free(old_buckets);
+}
+
+static void stk_timer_id_link(stk_timer_set_t *timer_set,struct stk_timer_stct *t)
+{
+	if(!timer_set->id_buckets || timer_set->id_count >= ((stk_uint32) 2 << timer_set->id_bits))
+		stk_timer_id_resize(timer_set);
+	stk_timer_id_insert(timer_set,t);
+}
+
+static void stk_timer_id_unlink(stk_timer_set_t *timer_set,struct stk_timer_stct *t)
+{
+	if(!t->id_pprev) return;
+
+	*t->id_pprev = t->id_next;
+	if(t->id_next) t->id_next->id_pprev = t->id_pprev;
+	t->id_next = NULL;
+	t->id_pprev = NULL;
+	timer_set->id_count--;
+}
+
+/* Find the scheduled timer with an ID, the earliest to expire if the ID is reused */
+static struct stk_timer_stct *stk_timer_id_find(stk_timer_set_t *timer_set,stk_uint64 id)
+{
+	struct stk_timer_stct *found = NULL;
+
+	if(!timer_set->id_buckets) return NULL;
+
+	for(struct stk_timer_stct *t = timer_set->id_buckets[stk_timer_id_bucket(timer_set,id)]; t; t = t->id_next)
+		if(t->id == id && (!found || timercmp(&t->tv,&found->tv,<))) found = t;
+
+	return found;
+}
+
+stk_ret stk_cancel_timer_nolock(stk_timer_set_t *timer_set,stk_timer_t *timer);
+static void stk_timer_link(stk_timer_set_t *timer_set,Node *n,struct stk_timer_stct *t);
+static void stk_timer_unlink(stk_timer_set_t *timer_set,Node *n,struct stk_timer_stct *t);
+static void stk_timer_set_drain(stk_timer_set_t *timer_set);
+
+static stk_bool stk_timer_set_foreign(stk_timer_set_t *timer_set)
+{
+	return (timer_set->flags & STK_TIMER_FLAG_OWNED) && !pthread_equal(pthread_self(),timer_set->owner);
+}
+
+/* Owned timer sets are not locked, instead the owner applies requests queued by other threads */
+static stk_ret stk_timer_set_lock(stk_timer_set_t *timer_set)
+{
+	if(timer_set->flags & STK_TIMER_FLAG_OWNED) {
+		STK_ASSERT(STKA_TIMER,!stk_timer_set_foreign(timer_set),"timer set %p used by a thread which does not own it",timer_set);
+		stk_timer_set_drain(timer_set);
+		return STK_SUCCESS;
+	}
+	return stk_mutex_lock(timer_set->timer_lock);
+}
+
+static stk_ret stk_timer_set_unlock(stk_timer_set_t *timer_set)
+{
+	if(timer_set->flags & STK_TIMER_FLAG_OWNED) return STK_SUCCESS;
+	return stk_mutex_unlock(timer_set->timer_lock);
+}
+
+/* Queue a request from a thread which does not own the timer set, and wake the owner so it dispatches the set */
+static stk_ret stk_timer_queue_request(stk_timer_set_t *timer_set,int op,Node *n,stk_uint64 id,struct timeval *tv)
+{
+	struct stk_timer_request_stct *req = calloc(1,sizeof(struct stk_timer_request_stct));
+	STK_CHECK_RET(STKA_TIMER,req!=NULL,STK_MEMERR,"allocate request for timer set %p",timer_set);
+
+	req->op = op;
+	req->n = n;
+	req->id = id;
+	if(n) req->gen = stk_atomic_load_32(&((struct stk_timer_stct *) NodeData(n))->gen,STK_MO_RELAXED);
+	if(tv)
+		req->tv = *tv;
+	else if(stk_now(&req->tv) != STK_SUCCESS) {
+		free(req);
+		return STK_SYSERR;
+	}
+
+	/* The owner may free the set once it has applied the request, so read what is needed to wake it first */
+	{
+	stk_timer_set_wakeup_cb wakeup_cb = timer_set->wakeup_cb;
+	void *user_setdata = timer_set->user_setdata;
+	stk_env_t *env = timer_set->env;
+	stk_bool pooled = (timer_set->flags & STK_TIMER_FLAG_ADDED_ENV) ? STK_TRUE : STK_FALSE;
+	struct timeval tv = req->tv;
+
+	req->next = stk_atomic_load_ptr(&timer_set->requests,STK_MO_RELAXED);
+	while(!stk_atomic_cas_ptr(&timer_set->requests,&req->next,req,STK_MO_RELEASE));
+
+	if(wakeup_cb)
+		wakeup_cb(timer_set,user_setdata);
+	if(!wakeup_cb || pooled)
+		stk_env_timer_scheduled(env,timer_set,&tv);
+	}
+	return STK_SUCCESS;
+}
+
+/* Apply the requests queued by other threads, called by the owner */
+static void stk_timer_set_drain(stk_timer_set_t *timer_set)
+{
+	struct stk_timer_request_stct *reqs, *ordered = NULL;
+
+	if(!(timer_set->flags & STK_TIMER_FLAG_OWNED) || !stk_atomic_load_ptr(&timer_set->requests,STK_MO_RELAXED)) return;
+
+	reqs = stk_atomic_exchange_ptr(&timer_set->requests,NULL,STK_MO_ACQUIRE);
+	while(reqs) {
+		struct stk_timer_request_stct *nxt = reqs->next;
+		reqs->next = ordered;
+		ordered = reqs;
+		reqs = nxt;
+	}
+
+	while(ordered) {
+		struct stk_timer_request_stct *req = ordered;
+		struct stk_timer_stct *t = req->n ? (struct stk_timer_stct *) NodeData(req->n) : NULL;
+
+		ordered = req->next;
+		switch(req->op) {
+		case STK_TIMER_REQ_SCHEDULE:
+			stk_timer_link(timer_set,req->n,t);
+			break;
+		case STK_TIMER_REQ_RESCHEDULE:
+			/* Drop requests for timers which were reused, or expired or were cancelled and are on the free list */
+			if(t->gen != req->gen || (!t->id_pprev && IsLinked(req->n))) break;
+			if(t->id_pprev) stk_timer_unlink(timer_set,req->n,t);
+			t->tv = req->tv;
+			stk_timer_link(timer_set,req->n,t);
+			break;
+		case STK_TIMER_REQ_CANCEL:
+			if(t->gen == req->gen && t->id_pprev) stk_cancel_timer_nolock(timer_set,(stk_timer_t *) req->n);
+			break;
+		case STK_TIMER_REQ_CANCEL_ID:
+			t = stk_timer_id_find(timer_set,req->id);
+			if(t) stk_cancel_timer_nolock(timer_set,(stk_timer_t *) t->node);
+			break;
+		}
+		free(req);
+	}
+}
+
+static stk_uint64 stk_timer_tv_to_ms(struct timeval *tv,stk_bool round_up)
+{
+	return ((stk_uint64) tv->tv_sec * 1000) + ((tv->tv_usec + (round_up ? 999 : 0)) / 1000);
+}
+
+static stk_timer_wheel_t *stk_timer_wheel_create()
+{
+	struct timeval tv;
+	stk_timer_wheel_t *wheel = calloc(1,sizeof(stk_timer_wheel_t));
+	STK_ASSERT(STKA_TIMER,wheel!=NULL,"allocate timer wheel");
+
+	for(int level = 0; level < STK_TIMER_WHEEL_LEVELS; level++)
+		for(int idx = 0; idx < (level ? STK_TIMER_WHEEL_LN_SZ : STK_TIMER_WHEEL_L0_SZ); idx++) {
+			wheel->slots[level][idx] = NewPList();
+			STK_ASSERT(STKA_TIMER,wheel->slots[level][idx]!=NULL,"allocate timer wheel slot");
+		}
+	wheel->expiring = NewPList();
+	STK_ASSERT(STKA_TIMER,wheel->expiring!=NULL,"allocate timer wheel expiring list");
+
+	stk_now(&tv);
+	wheel->now = stk_timer_tv_to_ms(&tv,STK_FALSE);
+	return wheel;
+}
+
+static void stk_timer_wheel_destroy(stk_timer_wheel_t *wheel)
+{
+	for(int level = 0; level < STK_TIMER_WHEEL_LEVELS; level++)
+		for(int idx = 0; idx < (level ? STK_TIMER_WHEEL_LN_SZ : STK_TIMER_WHEEL_L0_SZ); idx++)
+			FreeList(wheel->slots[level][idx]);
+	FreeList(wheel->expiring);
+	free(wheel);
+}
+
+static void stk_timer_wheel_insert(stk_timer_wheel_t *wheel,Node *n,struct stk_timer_stct *t)
+{
+	/* Timers already due go in the slot of the next tick to be processed */
+	stk_uint64 expires = t->expires > wheel->now ? t->expires : wheel->now;
+	stk_uint64 delta = expires - wheel->now;
+	int level = 0;
+	List *slot;
+
+	if(delta < STK_TIMER_WHEEL_L0_SZ)
+		slot = wheel->slots[0][expires & STK_TIMER_WHEEL_L0_MASK];
+	else {
+		if(delta > STK_TIMER_WHEEL_MAX_DELTA)
+			expires = wheel->now + STK_TIMER_WHEEL_MAX_DELTA;
+		for(level = 1; level < STK_TIMER_WHEEL_LEVELS - 1; level++)
+			if(delta < (((stk_uint64) 1) << STK_TIMER_WHEEL_SHIFT(level + 1))) break;
+		slot = wheel->slots[level][(expires >> STK_TIMER_WHEEL_SHIFT(level)) & STK_TIMER_WHEEL_LN_MASK];
+	}
+
+	AddTail(slot,n);
+	t->level = level;
+	wheel->slotted++;
+	if(level == 0) wheel->l0_count++;
+	if(wheel->next_valid && t->expires < wheel->next_expiry)
+		wheel->next_expiry = t->expires;
+}
+
+static void stk_timer_wheel_unlink(stk_timer_wheel_t *wheel,Node *n,struct stk_timer_stct *t)
+{
+	if(t->level == STK_TIMER_WHEEL_UNLINKED) {
+		/* Expired timers are on the free list, take them off it like the list timers */
+		if(IsLinked(n)) Remove(n);
+		return;
+	}
+
+	Remove(n);
+	if(t->level != STK_TIMER_WHEEL_EXPIRING) {
+		wheel->slotted--;
+		if(t->level == 0) wheel->l0_count--;
+		if(wheel->next_valid && t->expires == wheel->next_expiry)
+			wheel->next_valid = STK_FALSE;
+	}
+	t->level = STK_TIMER_WHEEL_UNLINKED;
+}
+
+/* Re-insert the timers of a higher level slot now that the wheel has reached it */
+static void stk_timer_wheel_cascade(stk_timer_wheel_t *wheel,int level,int idx)
+{
+	List *slot = wheel->slots[level][idx];
+	List cascading;
+
+	if(IsPListEmpty(slot)) return;
+
+	/* Move the timers off the slot first, timers beyond the range of the wheel are put back in it */
+	cascading.lh_Head = (Node *) &cascading.lh_Tail;
+	cascading.lh_Tail = NULL;
+	cascading.lh_TailPred = (Node *) &cascading;
+	while(!IsPListEmpty(slot)) {
+		Node *n = FirstNode(slot);
+		stk_timer_wheel_unlink(wheel,n,(struct stk_timer_stct *) NodeData(n));
+		AddTail(&cascading,n);
+	}
+	while(!IsPListEmpty(&cascading)) {
+		Node *n = FirstNode(&cascading);
+		Remove(n);
+		stk_timer_wheel_insert(wheel,n,(struct stk_timer_stct *) NodeData(n));
+	}
+}
+
+/* Process the ticks up to and including tick, moving due timers to the expiring list */
+static void stk_timer_wheel_advance(stk_timer_wheel_t *wheel,stk_uint64 tick)
+{
+	while(wheel->now <= tick) {
+		int idx = wheel->now & STK_TIMER_WHEEL_L0_MASK;
+		List *slot;
+
+		if(wheel->slotted == 0) {
+			wheel->now = tick + 1;
+			break;
+		}
+
+		if(idx == 0) {
+			for(int level = 1; level < STK_TIMER_WHEEL_LEVELS; level++) {
+				int lidx = (wheel->now >> STK_TIMER_WHEEL_SHIFT(level)) & STK_TIMER_WHEEL_LN_MASK;
+				stk_timer_wheel_cascade(wheel,level,lidx);
+				if(lidx != 0) break;
+			}
+		} else if(wheel->l0_count == 0) {
+			/* Nothing can expire before the next cascade */
+			stk_uint64 next = (wheel->now | STK_TIMER_WHEEL_L0_MASK) + 1;
+			wheel->now = next <= tick ? next : tick + 1;
+			continue;
+		}
+
+		slot = wheel->slots[0][idx];
+		while(!IsPListEmpty(slot)) {
+			Node *n = FirstNode(slot);
+			struct stk_timer_stct *t = (struct stk_timer_stct *) NodeData(n);
+			stk_timer_wheel_unlink(wheel,n,t);
+			AddTail(wheel->expiring,n);
+			t->level = STK_TIMER_WHEEL_EXPIRING;
+		}
+		wheel->now++;
+	}
+}
+
+static stk_uint64 stk_timer_wheel_earliest_in_slot(List *slot,stk_uint64 earliest)
+{
+	for(Node *n = FirstNode(slot); !AtListEnd(n); n = NxtNode(n)) {
+		struct stk_timer_stct *t = (struct stk_timer_stct *) NodeData(n);
+		if(t->expires < earliest) earliest = t->expires;
+	}
+	return earliest;
+}
+
+/* Find the earliest expiry of the slotted timers. Only the first occupied slot
+ * of each level needs to be searched, the slots of a level are in time order
+ * starting after the one the wheel last cascaded.
+ */
+static stk_uint64 stk_timer_wheel_next_expiry(stk_timer_wheel_t *wheel)
+{
+	stk_uint64 earliest = (stk_uint64) -1;
+
+	if(wheel->next_valid) return wheel->next_expiry;
+
+	for(int level = 0; level < STK_TIMER_WHEEL_LEVELS; level++) {
+		int sz = level ? STK_TIMER_WHEEL_LN_SZ : STK_TIMER_WHEEL_L0_SZ;
+		int start = level ? ((wheel->now >> STK_TIMER_WHEEL_SHIFT(level)) + 1) & STK_TIMER_WHEEL_LN_MASK
+			: wheel->now & STK_TIMER_WHEEL_L0_MASK;
+
+		for(int i = 0; i < sz; i++) {
+			List *slot = wheel->slots[level][(start + i) & (sz - 1)];
+			if(!IsPListEmpty(slot)) {
+				earliest = stk_timer_wheel_earliest_in_slot(slot,earliest);
+				break;
+			}
+		}
+	}
+
+	wheel->next_expiry = earliest;
+	wheel->next_valid = STK_TRUE;
+	return earliest;
+}
+
+/* Return the first timer in a wheel (to be freed or cancelled), or NULL when it is empty */
+static Node *stk_timer_wheel_first(stk_timer_wheel_t *wheel)
+{
+	if(!IsPListEmpty(wheel->expiring)) return FirstNode(wheel->expiring);
+
+	for(int level = 0; level < STK_TIMER_WHEEL_LEVELS; level++)
+		for(int idx = 0; idx < (level ? STK_TIMER_WHEEL_LN_SZ : STK_TIMER_WHEEL_L0_SZ); idx++)
+			if(!IsPListEmpty(wheel->slots[level][idx])) return FirstNode(wheel->slots[level][idx]);
+
+	return NULL;
+}
+
 stk_timer_set_t *stk_new_timer_set(stk_env_t *env,void *user_setdata,stk_uint32 max_timers,stk_bool add_to_pool)
+{
+	return stk_new_timer_set_with_options(env,user_setdata,max_timers,add_to_pool,NULL);
+}
+
+/* The env keeps the position of timer sets in its timer pool heap here */
+int *stk_timer_set_pool_idx(stk_timer_set_t *timer_set) { return &timer_set->pool_idx; }
+
+stk_timer_set_t *stk_new_timer_set_with_options(stk_env_t *env,void *user_setdata,stk_uint32 max_timers,stk_bool add_to_pool,stk_options_t *options)
 {
 	stk_timer_set_t *timer_set;
 
@@ -39,9 +487,19 @@ stk_timer_set_t *stk_new_timer_set(stk_env_t *env,void *user_setdata,stk_uint32
 	if(timer_set) {
 		timer_set->env = env;                        /* For future use, maybe memory pools, or global timer config */
 		timer_set->user_setdata = user_setdata;
+		timer_set->pool_idx = -1;
 		timer_set->free_list = NewPList();
 		timer_set->ms = NewPList();
 		timer_set->secs = NewPList();
+		if(stk_find_option(options,"timer_wheel",NULL)) {
+			timer_set->wheel = stk_timer_wheel_create();
+			timer_set->flags |= STK_TIMER_FLAG_WHEEL;
+		}
+		if(stk_find_option(options,"timer_owner_thread",NULL)) {
+			timer_set->owner = pthread_self();
+			timer_set->flags |= STK_TIMER_FLAG_OWNED;
+			timer_set->wakeup_cb = (stk_timer_set_wakeup_cb) stk_find_option(options,"timer_wakeup_cb",NULL);
+		}
 		if(max_timers > 0) {
 			/* Preallocate timers */
 			timer_set->max_timers = max_timers;
@@ -72,6 +530,8 @@ stk_ret stk_free_timer_set(stk_timer_set_t *timer_set,stk_bool cancel_timers)
 	stk_ret rc = STK_SUCCESS;
 
 	STK_ASSERT(STKA_TIMER,timer_set->stct_type==STK_STCT_TIMER_SET,"destroy a timer set, the pointer was to a structure of type %d",timer_set->stct_type);
+	STK_ASSERT(STKA_TIMER,!stk_timer_set_foreign(timer_set),"destroy timer set %p from a thread which does not own it",timer_set);
+	stk_timer_set_drain(timer_set);
 
 	while(!IsPListEmpty(timer_set->ms)) {
 		Node *n = FirstNode(timer_set->ms);
@@ -93,9 +553,21 @@ stk_ret stk_free_timer_set(stk_timer_set_t *timer_set,stk_bool cancel_timers)
 			FreeNode(n);
 		}
 	}
+	if(timer_set->wheel) {
+		Node *n;
+		while((n = stk_timer_wheel_first(timer_set->wheel))) {
+			if(cancel_timers) {
+				rc = stk_cancel_timer(timer_set,(stk_timer_t *) n); /* Puts on free list */
+				STK_CHECK(STKA_TIMER,rc==STK_SUCCESS,"cancel timer in timer set %p rc %d",timer_set,rc);
+			} else {
+				stk_timer_wheel_unlink(timer_set->wheel,n,(struct stk_timer_stct *) NodeData(n));
+				FreeNode(n);
+			}
+		}
+	}
 
 	/* must cancel before locking, because cancel locks! */
-	rc = stk_mutex_lock(timer_set->timer_lock);
+	rc = stk_timer_set_lock(timer_set);
 	STK_ASSERT(STKA_TIMER,rc==STK_SUCCESS,"lock timer set %p to destroy",timer_set);
 
 	while(!IsPListEmpty(timer_set->free_list)) {
@@ -110,7 +582,7 @@ stk_ret stk_free_timer_set(stk_timer_set_t *timer_set,stk_bool cancel_timers)
 		STK_ASSERT(STKA_MEM,rc==STK_SUCCESS,"delete timer set %p from env %p",timer_set,timer_set->env);
 	}
 
-	rc = stk_mutex_unlock(timer_set->timer_lock);
+	rc = stk_timer_set_unlock(timer_set);
 	STK_ASSERT(STKA_TIMER,rc==STK_SUCCESS,"unlock timer set %p to destroy",timer_set);
 
 	rc = stk_mutex_destroy(timer_set->timer_lock);
@@ -118,6 +590,8 @@ stk_ret stk_free_timer_set(stk_timer_set_t *timer_set,stk_bool cancel_timers)
 
 	if(timer_set->ms) FreeList(timer_set->ms);
 	if(timer_set->secs) FreeList(timer_set->secs);
+	if(timer_set->wheel) stk_timer_wheel_destroy(timer_set->wheel);
+	if(timer_set->id_buckets) free(timer_set->id_buckets);
 
 	STK_FREE_STCT(STK_STCT_TIMER_SET,timer_set);
 	return rc;
@@ -145,13 +619,52 @@ void stk_timer_insert(List *timer_list,Node *n,struct stk_timer_stct *t)
 	}
 }
 
+/* Link a timer in to the ID hash and the timer lists (or wheel) of a set */
+static void stk_timer_link(stk_timer_set_t *timer_set,Node *n,struct stk_timer_stct *t)
+{
+	stk_timer_id_link(timer_set,t);
+	timer_set->stats.scheduled++;
+
+	if(timer_set->wheel) {
+		t->expires = stk_timer_tv_to_ms(&t->tv,STK_TRUE);
+		stk_timer_wheel_insert(timer_set->wheel,n,t);
+	}
+	else
+	if(t->ms < 1000)
+		stk_timer_insert(timer_set->ms,n,t);
+	else
+		stk_timer_insert(timer_set->secs,n,t);
+}
+
+static void stk_timer_unlink(stk_timer_set_t *timer_set,Node *n,struct stk_timer_stct *t)
+{
+	if(timer_set->wheel)
+		stk_timer_wheel_unlink(timer_set->wheel,n,t);
+	else
+		Remove(n);
+	stk_timer_id_unlink(timer_set,t);
+}
+
+/* Wake up any dispatcher (or rearm the env timer fd) if this timer shortens the time it should be a sleep.
+ * Owned sets only tell the env about timers earlier than it already knows of, to avoid locking the env.
+ */
+static void stk_timer_set_scheduled(stk_timer_set_t *timer_set,struct timeval *tv)
+{
+	if(timer_set->flags & STK_TIMER_FLAG_OWNED) {
+		if(timer_set->env_deadline_valid && !timercmp(tv,&timer_set->env_deadline,<)) return;
+		timer_set->env_deadline = *tv;
+		timer_set->env_deadline_valid = STK_TRUE;
+	}
+	stk_env_timer_scheduled(timer_set->env,timer_set,tv);
+}
+
 stk_timer_t *stk_schedule_timer(stk_timer_set_t *timer_set,stk_timer_cb cb,stk_uint64 id,void *userdata,long ms)
 {
 	struct stk_timer_stct *t;
 	Node *n;
 	struct timeval tv;
-	int rc = gettimeofday(&tv, NULL);
-	if(rc != 0) return NULL;
+	stk_ret rc = stk_now(&tv);
+	if(rc != STK_SUCCESS) return NULL;
 
 	STK_ASSERT(STKA_TIMER,ms > 0,"stk_schedule_timer passed %ld <= 0 ms",ms);
 	STK_ASSERT(STKA_TIMER,cb != NULL,"stk_schedule_timer passed null callback");
@@ -159,19 +672,41 @@ stk_timer_t *stk_schedule_timer(stk_timer_set_t *timer_set,stk_timer_cb cb,stk_u
 	tv.tv_sec += tv.tv_usec / 1000000;
 	tv.tv_usec = tv.tv_usec % 1000000;
 
+	if(stk_timer_set_foreign(timer_set)) {
+		/* The free list belongs to the owner */
+		n = NewDataNode(sizeof(struct stk_timer_stct));
+		STK_CHECK(STKA_TIMER,n!=NULL,"allocated timer node");
+		if(!n) return NULL;
+
+		t = (struct stk_timer_stct *) NodeData(n);
+		t->cb = cb;
+		t->id = id;
+		t->userdata = userdata;
+		t->tv = tv;
+		t->ms = ms;
+		t->node = n;
+		if(stk_timer_queue_request(timer_set,STK_TIMER_REQ_SCHEDULE,n,id,&tv) != STK_SUCCESS) {
+			FreeNode(n);
+			return NULL;
+		}
+		return (stk_timer_t *) n;
+	}
+
 	{
-	stk_ret ret = stk_mutex_lock(timer_set->timer_lock);
+	stk_ret ret = stk_timer_set_lock(timer_set);
 	STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"lock timer set %p ret %d",timer_set,ret);
 
 	if(!IsPListEmpty(timer_set->free_list))
 	{
 		n = FirstNode(timer_set->free_list);
 		Remove(n);
+		t = (struct stk_timer_stct *) NodeData(n);
+		stk_atomic_store_32(&t->gen,t->gen + 1,STK_MO_RELAXED);
 	} else {
 		n = NewDataNode(sizeof(struct stk_timer_stct));
 		STK_CHECK(STKA_TIMER,n!=NULL,"allocated timer node");
 		if(!n) {
-			ret = stk_mutex_unlock(timer_set->timer_lock);
+			ret = stk_timer_set_unlock(timer_set);
 			STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"unlock timer set %p ret %d",timer_set,ret);
 			return NULL;
 		}
@@ -182,18 +717,14 @@ stk_timer_t *stk_schedule_timer(stk_timer_set_t *timer_set,stk_timer_cb cb,stk_u
 	t->userdata = userdata;
 	t->tv = tv;
 	t->ms = ms;
+	t->node = n;
+	stk_timer_link(timer_set,n,t);
 
-	if(ms < 1000)
-		stk_timer_insert(timer_set->ms,n,t);
-	else
-		stk_timer_insert(timer_set->secs,n,t);
-
-	ret = stk_mutex_unlock(timer_set->timer_lock);
+	ret = stk_timer_set_unlock(timer_set);
 	STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"unlock timer set %p ret %d",timer_set,ret);
 	}
 
-	/* Now wake up any dispatcher so it can determine if this timer shortens the time it should be a sleep */
-	stk_wakeup_dispatcher(timer_set->env);
+	stk_timer_set_scheduled(timer_set,&tv);
 
 	return (stk_timer_t *) n;
 }
@@ -201,26 +732,33 @@ stk_timer_t *stk_schedule_timer(stk_timer_set_t *timer_set,stk_timer_cb cb,stk_u
 stk_ret stk_reschedule_timer(stk_timer_set_t *timer_set,stk_timer_t *n)
 {
 	struct stk_timer_stct *t = (struct stk_timer_stct *) NodeData(n);
-	int rc = gettimeofday(&t->tv, NULL);
-	if(rc != 0) return STK_SYSERR;
+	struct timeval tv;
+	stk_ret rc = stk_now(&tv);
+	if(rc != STK_SUCCESS) return STK_SYSERR;
 
-	t->tv.tv_usec += (t->ms*1000);
-	t->tv.tv_sec += t->tv.tv_usec / 1000000;
-	t->tv.tv_usec = t->tv.tv_usec % 1000000;
+	tv.tv_usec += (t->ms*1000);
+	tv.tv_sec += tv.tv_usec / 1000000;
+	tv.tv_usec = tv.tv_usec % 1000000;
+
+	if(stk_timer_set_foreign(timer_set))
+		return stk_timer_queue_request(timer_set,STK_TIMER_REQ_RESCHEDULE,(Node *) n,0,&tv);
 
 	{
-	stk_ret ret = stk_mutex_lock(timer_set->timer_lock);
+	stk_ret ret = stk_timer_set_lock(timer_set);
 	STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"reschedule lock timer set %p timer %p ret %d",timer_set,n,ret);
 
-	if(t->ms < 1000)
-		stk_timer_insert(timer_set->ms,(Node*)n,t);
-	else
-		stk_timer_insert(timer_set->secs,(Node*)n,t);
+	/* Timers may be rescheduled while they are still scheduled */
+	if(t->id_pprev)
+		stk_timer_unlink(timer_set,(Node*)n,t);
+	t->tv = tv;
+	stk_timer_link(timer_set,(Node*)n,t);
 
-	ret = stk_mutex_unlock(timer_set->timer_lock);
+	ret = stk_timer_set_unlock(timer_set);
 	STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"unlock timer set %p ret %d",timer_set,ret);
 	}
 
+	stk_timer_set_scheduled(timer_set,&tv);
+
 	return STK_SUCCESS;
 }
 
@@ -232,7 +770,8 @@ stk_ret stk_cancel_timer_nolock(stk_timer_set_t *timer_set,stk_timer_t *timer)
 
 	t = (struct stk_timer_stct *) NodeData(n);
 
-	Remove(n);
+	stk_timer_unlink(timer_set,n,t);
+	timer_set->stats.cancelled++;
 	t->cb(timer_set,timer,t->id,t->userdata,timer_set->user_setdata,STK_TIMER_CANCELLED);
 
 	AddHead(timer_set->free_list,(Node *) timer);
@@ -243,12 +782,17 @@ stk_ret stk_cancel_timer_nolock(stk_timer_set_t *timer_set,stk_timer_t *timer)
 stk_ret stk_cancel_timer(stk_timer_set_t *timer_set,stk_timer_t *timer)
 {
 	stk_ret rc;
-	stk_ret ret = stk_mutex_lock(timer_set->timer_lock);
+	stk_ret ret;
+
+	if(stk_timer_set_foreign(timer_set))
+		return stk_timer_queue_request(timer_set,STK_TIMER_REQ_CANCEL,(Node *) timer,0,NULL);
+
+	ret = stk_timer_set_lock(timer_set);
 	STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"cancel lock timer set %p ret %d",timer_set,ret);
 
 	rc = stk_cancel_timer_nolock(timer_set,timer);
 
-	ret = stk_mutex_unlock(timer_set->timer_lock);
+	ret = stk_timer_set_unlock(timer_set);
 	STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"unlock timer set %p ret %d",timer_set,ret);
 	return rc;
 }
@@ -256,34 +800,136 @@ stk_ret stk_cancel_timer(stk_timer_set_t *timer_set,stk_timer_t *timer)
 
 stk_ret stk_cancel_timer_id(stk_timer_set_t *timer_set,stk_uint64 id)
 {
-	stk_ret ret = stk_mutex_lock(timer_set->timer_lock);
+	stk_ret ret;
+
+	if(stk_timer_set_foreign(timer_set))
+		return stk_timer_queue_request(timer_set,STK_TIMER_REQ_CANCEL_ID,NULL,id,NULL);
+
+	ret = stk_timer_set_lock(timer_set);
 	STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"cancel id lock timer set %p ret %d",timer_set,ret);
 
-	if(!IsPListEmpty(timer_set->ms))
-		for(Node *n = FirstNode(timer_set->ms); !AtListEnd(n); n = NxtNode(n)) {
-			struct stk_timer_stct *t = (struct stk_timer_stct *) NodeData(n);
-			if(t->id == id) {
-				stk_cancel_timer_nolock(timer_set,(stk_timer_t *)n);
-				ret = stk_mutex_unlock(timer_set->timer_lock);
-				STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"unlock timer set %p ret %d",timer_set,ret);
-				return STK_SUCCESS;
-			}
-		}
-	if(!IsPListEmpty(timer_set->secs))
-		for(Node *n = FirstNode(timer_set->secs); !AtListEnd(n); n = NxtNode(n)) {
-			struct stk_timer_stct *t = (struct stk_timer_stct *) NodeData(n);
-			if(t->id == id) {
-				stk_cancel_timer_nolock(timer_set,(stk_timer_t *)n);
-				ret = stk_mutex_unlock(timer_set->timer_lock);
-				STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"unlock timer set %p ret %d",timer_set,ret);
-				return STK_SUCCESS;
-			}
-		}
+	{
+	struct stk_timer_stct *t = stk_timer_id_find(timer_set,id);
+	if(t) stk_cancel_timer_nolock(timer_set,(stk_timer_t *)t->node);
 
-	ret = stk_mutex_unlock(timer_set->timer_lock);
+	ret = stk_timer_set_unlock(timer_set);
 	STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"unlock timer set %p ret %d",timer_set,ret);
 
-	return STK_NOT_FOUND;
+	return t ? STK_SUCCESS : STK_NOT_FOUND;
+	}
+}
+
+stk_ret stk_timer_set_get_stats(stk_timer_set_t *timer_set,stk_timer_set_stats_t *stats)
+{
+	stk_ret ret = stk_timer_set_lock(timer_set);
+	STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"stats lock timer set %p ret %d",timer_set,ret);
+
+	*stats = timer_set->stats;
+
+	ret = stk_timer_set_unlock(timer_set);
+	STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"unlock timer set %p ret %d",timer_set,ret);
+	return STK_SUCCESS;
+}
+
+stk_timer_t *stk_find_timer_id(stk_timer_set_t *timer_set,stk_uint64 id)
+{
+	struct stk_timer_stct *t;
+	stk_ret ret = stk_timer_set_lock(timer_set);
+	STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"find id lock timer set %p ret %d",timer_set,ret);
+
+	t = stk_timer_id_find(timer_set,id);
+
+	ret = stk_timer_set_unlock(timer_set);
+	STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"unlock timer set %p ret %d",timer_set,ret);
+
+	return t ? (stk_timer_t *) t->node : NULL;
+}
+
+stk_bool stk_timer_is_scheduled(stk_timer_set_t *timer_set,stk_timer_t *timer)
+{
+	stk_bool scheduled;
+	stk_ret ret = stk_timer_set_lock(timer_set);
+	STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"is scheduled lock timer set %p ret %d",timer_set,ret);
+
+	scheduled = ((struct stk_timer_stct *) NodeData((Node *) timer))->id_pprev ? STK_TRUE : STK_FALSE;
+
+	ret = stk_timer_set_unlock(timer_set);
+	STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"unlock timer set %p ret %d",timer_set,ret);
+
+	return scheduled;
+}
+
+static void stk_timer_histogram_add(stk_uint64 *histogram,stk_uint64 *max,stk_uint64 usecs)
+{
+	int bucket = usecs ? 64 - __builtin_clzll(usecs) : 0;
+
+	histogram[bucket < STK_TIMER_HISTOGRAM_BUCKETS ? bucket : STK_TIMER_HISTOGRAM_BUCKETS - 1]++;
+	if(usecs > *max) *max = usecs;
+}
+
+static stk_uint64 stk_timer_usecs_between(struct timeval *from,struct timeval *to)
+{
+	if(!timercmp(to,from,>)) return 0;
+	return ((stk_uint64) (to->tv_sec - from->tv_sec) * 1000000) + to->tv_usec - from->tv_usec;
+}
+
+/* Call back an expired timer, recording how late it is and how long the callback takes.
+ * The clock is read directly because the dispatcher's cached time is older than the callback.
+ */
+static void stk_timer_expire(stk_timer_set_t *timer_set,Node *n,struct stk_timer_stct *t)
+{
+	struct timeval fired, done;
+	stk_uint64 late;
+
+	if(stk_now_precise(&fired) != STK_SUCCESS) timerclear(&fired);
+	late = stk_timer_usecs_between(&t->tv,&fired);
+
+	t->cb(timer_set,(stk_timer_t*)n,t->id,t->userdata,timer_set->user_setdata,STK_TIMER_EXPIRED);
+
+	if(stk_now_precise(&done) != STK_SUCCESS) done = fired;
+	timer_set->stats.fired++;
+	stk_timer_histogram_add(timer_set->stats.lateness,&timer_set->stats.lateness_max_us,late);
+	stk_timer_histogram_add(timer_set->stats.callback,&timer_set->stats.callback_max_us,stk_timer_usecs_between(&fired,&done));
+}
+
+/* Timers due in a wheel are moved to its expiring list, and called back from there
+ * so callbacks may schedule and cancel timers, and remaining timers are called back
+ * on the next dispatch if max_callbacks is met.
+ */
+static stk_ret stk_dispatch_wheel_timers(stk_timer_set_t *timer_set,struct timeval *tv,unsigned short max_callbacks)
+{
+	stk_timer_wheel_t *wheel = timer_set->wheel;
+	unsigned short cbs = 0;
+	stk_ret ret = stk_timer_set_lock(timer_set);
+	STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"dispatch lock timer set %p ret %d",timer_set,ret);
+
+	stk_timer_wheel_advance(wheel,stk_timer_tv_to_ms(tv,STK_FALSE));
+
+	while(!IsPListEmpty(wheel->expiring) && (max_callbacks ? cbs < max_callbacks : 1)) {
+		Node *n = FirstNode(wheel->expiring);
+		struct stk_timer_stct *t = (struct stk_timer_stct *) NodeData(n);
+		stk_timer_wheel_unlink(wheel,n,t);
+		stk_timer_id_unlink(timer_set,t);
+
+		ret = stk_timer_set_unlock(timer_set);
+		STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"unlock timer set %p ret %d",timer_set,ret);
+
+		stk_timer_expire(timer_set,n,t);
+		cbs++;
+
+		ret = stk_timer_set_lock(timer_set);
+		STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"dispatch lock timer set %p ret %d",timer_set,ret);
+
+		/* Only add it to the free list if the callback didn't reschedule it */
+		if(!IsLinked(n))
+			AddHead(timer_set->free_list,n);
+	}
+
+	ret = stk_timer_set_unlock(timer_set);
+	STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"unlock timer set %p ret %d",timer_set,ret);
+
+	if(max_callbacks > 0 && cbs == max_callbacks) return STK_MAX_TIMERS;
+	return STK_SUCCESS;
 }
 
 stk_ret stk_dispatch_timers(stk_timer_set_t *timer_set,unsigned short max_callbacks)
@@ -291,12 +937,18 @@ stk_ret stk_dispatch_timers(stk_timer_set_t *timer_set,unsigned short max_callba
 	unsigned short cbs = 0;
 	int found = 0;
 	struct timeval tv;
-	int rc = gettimeofday(&tv, NULL);
-	if(rc != 0) return !STK_SUCCESS;
+	stk_ret rc = stk_now(&tv);
+	if(rc != STK_SUCCESS) return !STK_SUCCESS;
+
+	STK_CHECK_RET(STKA_TIMER,!stk_timer_set_foreign(timer_set),!STK_SUCCESS,"dispatch timer set %p from a thread which does not own it",timer_set);
+	stk_timer_set_drain(timer_set);
+
+	if(timer_set->wheel)
+		return stk_dispatch_wheel_timers(timer_set,&tv,max_callbacks);
 
 #if 0
 Locking while dispatching prevents scheduling/cancelling from callbacks.... Need to resolve
-	stk_ret ret = stk_mutex_lock(timer_set->timer_lock);
+	stk_ret ret = stk_timer_set_lock(timer_set);
 	STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"dispatch lock timer set %p ret %d",timer_set,ret);
 #endif
 
@@ -308,7 +960,8 @@ Locking while dispatching prevents scheduling/cancelling from callbacks.... Need
 				if(timercmp(&tv,&t->tv,>) || timercmp(&tv,&t->tv,==)) {
 					Node *n2 = NxtNode(n);
 					Remove(n);
-					t->cb(timer_set,(stk_timer_t*)n,t->id,t->userdata,timer_set->user_setdata,STK_TIMER_EXPIRED);
+					stk_timer_id_unlink(timer_set,t);
+					stk_timer_expire(timer_set,n,t);
 					/* If a callback calls stk_reschedule_timer(), the timer will be linked in to a timer list.
 					 * So, only add it to the free list if it is still unlinked.
 					 */
@@ -327,7 +980,8 @@ Locking while dispatching prevents scheduling/cancelling from callbacks.... Need
 				if(timercmp(&tv,&t->tv,>) || timercmp(&tv,&t->tv,==)) {
 					Node *n2 = NxtNode(n);
 					Remove(n);
-					t->cb(timer_set,(stk_timer_t*)n,t->id,t->userdata,timer_set->user_setdata,STK_TIMER_EXPIRED);
+					stk_timer_id_unlink(timer_set,t);
+					stk_timer_expire(timer_set,n,t);
 					/* If a callback calls stk_reschedule_timer(), the timer will be linked in to a timer list.
 					 * So, only add it to the free list if it is still unlinked.
 					 */
@@ -344,7 +998,7 @@ Locking while dispatching prevents scheduling/cancelling from callbacks.... Need
 	if(max_callbacks > 0 && cbs == max_callbacks) return STK_MAX_TIMERS;
 
 #if 0
-	ret = stk_mutex_unlock(timer_set->timer_lock);
+	ret = stk_timer_set_unlock(timer_set);
 	STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"unlock timer set %p ret %d",timer_set,ret);
 #endif
 
@@ -355,17 +1009,37 @@ int stk_next_timer_ms(stk_timer_set_t *timer_set)
 {
 	int ms = 0;
 	struct timeval curr_time;
-	int rc = gettimeofday(&curr_time, NULL);
-	if(rc != 0) return 0;
+	stk_ret rc = stk_now(&curr_time);
+	if(rc != STK_SUCCESS) return 0;
 
-	stk_ret ret = stk_mutex_lock(timer_set->timer_lock);
+	stk_ret ret = stk_timer_set_lock(timer_set);
 	STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"next lock timer set %p ret %d",timer_set,ret);
 
+	if(timer_set->wheel) {
+		stk_timer_wheel_t *wheel = timer_set->wheel;
+		stk_uint64 now = stk_timer_tv_to_ms(&curr_time,STK_FALSE);
+		stk_uint64 next;
+
+		if(!IsPListEmpty(wheel->expiring))
+			ms = 0;
+		else if(wheel->slotted == 0)
+			ms = -1;
+		else {
+			next = stk_timer_wheel_next_expiry(wheel);
+			ms = next > now ? (int) (next - now > 0x7fffffff ? 0x7fffffff : next - now) : 0;
+		}
+
+		ret = stk_timer_set_unlock(timer_set);
+		STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"unlock timer set %p ret %d",timer_set,ret);
+
+		return ms;
+	}
+
 	if(!IsPListEmpty(timer_set->ms)) {
 		struct stk_timer_stct *t = (struct stk_timer_stct *) NodeData(FirstNode(timer_set->ms));
 
 		if(timercmp(&curr_time,&t->tv,>)) {
-			ret = stk_mutex_unlock(timer_set->timer_lock);
+			ret = stk_timer_set_unlock(timer_set);
 			STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"unlock timer set %p ret %d",timer_set,ret);
 
 			return 0;
@@ -378,7 +1052,7 @@ int stk_next_timer_ms(stk_timer_set_t *timer_set)
 		} else
 			ms += (t->tv.tv_usec - curr_time.tv_usec)/ 1000;
 
-		ret = stk_mutex_unlock(timer_set->timer_lock);
+		ret = stk_timer_set_unlock(timer_set);
 		STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"unlock timer set %p ret %d",timer_set,ret);
 
 		return ms > 0 ? ms : 1; /* If we rounded down to 0, lets assume a 1ms delay */
@@ -388,7 +1062,7 @@ int stk_next_timer_ms(stk_timer_set_t *timer_set)
 		struct stk_timer_stct *t = (struct stk_timer_stct *) NodeData(FirstNode(timer_set->secs));
 
 		if(timercmp(&curr_time,&t->tv,>)) {
-			ret = stk_mutex_unlock(timer_set->timer_lock);
+			ret = stk_timer_set_unlock(timer_set);
 			STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"unlock timer set %p ret %d",timer_set,ret);
 
 			return 0;
@@ -401,18 +1075,64 @@ int stk_next_timer_ms(stk_timer_set_t *timer_set)
 		} else
 			ms += (t->tv.tv_usec - curr_time.tv_usec)/ 1000;
 
-		ret = stk_mutex_unlock(timer_set->timer_lock);
+		ret = stk_timer_set_unlock(timer_set);
 		STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"unlock timer set %p ret %d",timer_set,ret);
 
 		return ms > 0 ? ms : 1; /* If we rounded down to 0, lets assume a 1ms delay */
 	}
 
-	ret = stk_mutex_unlock(timer_set->timer_lock);
+	ret = stk_timer_set_unlock(timer_set);
 	STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"unlock timer set %p ret %d",timer_set,ret);
 
 	return -1;
 }
 
+stk_ret stk_next_timer_deadline(stk_timer_set_t *timer_set,struct timeval *deadline)
+{
+	stk_ret rc = STK_SUCCESS;
+	stk_ret ret = stk_timer_set_lock(timer_set);
+	STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"deadline lock timer set %p ret %d",timer_set,ret);
+
+	if(timer_set->wheel) {
+		stk_timer_wheel_t *wheel = timer_set->wheel;
+
+		if(!IsPListEmpty(wheel->expiring))
+			rc = stk_now(deadline);
+		else if(wheel->slotted == 0)
+			rc = STK_NOT_FOUND;
+		else {
+			/* Wheel timers expire on the tick boundary */
+			stk_uint64 next = stk_timer_wheel_next_expiry(wheel);
+			deadline->tv_sec = next / 1000;
+			deadline->tv_usec = (next % 1000) * 1000;
+		}
+	} else {
+		struct stk_timer_stct *t = NULL;
+
+		if(!IsPListEmpty(timer_set->ms))
+			t = (struct stk_timer_stct *) NodeData(FirstNode(timer_set->ms));
+		if(!IsPListEmpty(timer_set->secs)) {
+			struct stk_timer_stct *st = (struct stk_timer_stct *) NodeData(FirstNode(timer_set->secs));
+			if(!t || timercmp(&st->tv,&t->tv,<)) t = st;
+		}
+		if(t)
+			*deadline = t->tv;
+		else
+			rc = STK_NOT_FOUND;
+	}
+
+	/* The env reads this deadline, it doesn't need to be told of later timers */
+	if(timer_set->flags & STK_TIMER_FLAG_OWNED) {
+		timer_set->env_deadline_valid = rc == STK_SUCCESS;
+		if(rc == STK_SUCCESS) timer_set->env_deadline = *deadline;
+	}
+
+	ret = stk_timer_set_unlock(timer_set);
+	STK_ASSERT(STKA_TIMER,ret==STK_SUCCESS,"unlock timer set %p ret %d",timer_set,ret);
+
+	return rc;
+}
+
 stk_env_t *stk_env_from_timer_set(stk_timer_set_t *tset)
 {
 	STK_ASSERT(STKA_TIMER,tset!=NULL,"timer set null or invalid :%p",tset);
@@ -62,7 +62,7 @@ stk_data_flow_t *stk_udp_client_create_data_flow(stk_env_t *env,char *name,stk_u
 	if(!df) return NULL;
 
 	/* Set the client's unique ID */
-	ts->unique_id = (stk_uint32) rand();
+	ts->unique_id = (stk_uint32) stk_acquire_sequence_id(env,STK_SERVICE_TYPE_DATA);
 
 	/* substitute callbacks for internal callbacks in options?? */
 
@@ -124,37 +124,28 @@ typedef struct stk_udp_wire_fmt_stct {
 	char frag[65536];
 } stk_udp_wire_fmt_t;
 
-stk_ret stk_udp_calc_fragments_before(stk_sequence_t *seq, void *data, stk_uint64 sz, stk_uint64 user_type, void *clientd)
+/* A segment header starts a new fragment when it doesn't fit in the current one along with some of its data */
+static stk_bool stk_udp_segment_fits(stk_udp_wire_fmt_t *wirefmt,stk_uint64 sz)
 {
-	stk_udp_wire_fmt_t *wirefmt = (stk_udp_wire_fmt_t *) clientd; 
-	if(wirefmt->hdrs->num_fragments == 1 && wirefmt->curr_offset == 0) {
-		wirefmt->curr_offset += sizeof(*wirefmt->hdrs);
-		wirefmt->seq_name = stk_get_sequence_name(seq);
-		wirefmt->curr_offset += sizeof(stk_udp_wire_fragment0_hdr_t);
-		wirefmt->curr_offset += sizeof(stk_uint16);
-		if(wirefmt->seq_name) {
-			STK_UDP_DBG("calc frag offset name %lu\n",wirefmt->curr_offset);
-			wirefmt->slen = strlen(wirefmt->seq_name) + 1;
-			wirefmt->curr_offset += wirefmt->slen;
-		}
-		wirefmt->total_len = wirefmt->curr_offset;
-	}
-	return STK_SUCCESS;
+	return wirefmt->mru - wirefmt->curr_offset >= sizeof(stk_udp_wire_seqment_hdr_t) + (sz > 0 ? 1 : 0) ? STK_TRUE : STK_FALSE;
 }
 
-stk_ret stk_udp_calc_fragments(stk_sequence_t *seq, void *data, stk_uint64 sz, stk_uint64 user_type, void *clientd)
+/* Lay out an element as stk_udp_send_fragments() does, counting the fragments and bytes sent */
+stk_ret stk_udp_calc_fragments_layout(stk_sequence_t *seq, void *data, stk_uint64 sz, stk_uint64 user_type, void *clientd)
 {
 	stk_udp_wire_fmt_t *wirefmt = (stk_udp_wire_fmt_t *) clientd; 
-	stk_uint64 fraglen;
 
-	while(sz > 0)
+	do
 	{
-		STK_UDP_DBG("calc frag offset loop %lu\n",wirefmt->curr_offset);
+		if(!stk_udp_segment_fits(wirefmt,sz)) {
+			wirefmt->total_len += wirefmt->curr_offset;
+			wirefmt->hdrs->num_fragments++;
+			wirefmt->curr_offset = sizeof(*wirefmt->hdrs);
+		}
 		wirefmt->curr_offset += sizeof(stk_udp_wire_seqment_hdr_t);
 		if(sz > wirefmt->mru - wirefmt->curr_offset) {
-			stk_uint64 partialsz = wirefmt->mru - wirefmt->curr_offset;
-			sz -= partialsz;
-			wirefmt->total_len += partialsz;
+			sz -= wirefmt->mru - wirefmt->curr_offset;
+			wirefmt->total_len += wirefmt->mru;
 			wirefmt->hdrs->num_fragments++;
 			wirefmt->curr_offset = sizeof(*wirefmt->hdrs);
 		}
@@ -162,14 +153,41 @@ stk_ret stk_udp_calc_fragments(stk_sequence_t *seq, void *data, stk_uint64 sz, s
 			wirefmt->curr_offset += sz;
 			break; /* Ending this segment in the middle of a fragment */
 		}
+	} while(sz > 0);
+
+	return STK_SUCCESS;
+}
+
+/* Calculate the number of fragments, the end offset of the last fragment and the total length.
+ * Sequences which fit in one fragment are sized from the cached element count and size of the sequence,
+ * larger sequences are laid out element by element because segment headers are not split across fragments.
+ */
+stk_ret stk_udp_calc_fragments(stk_sequence_t *seq,stk_udp_wire_fmt_t *wirefmt)
+{
+	stk_uint64 prefix_len, stream_len;
+	stk_ret rc;
+
+	wirefmt->seq_name = stk_get_sequence_name(seq);
+	if(wirefmt->seq_name)
+		wirefmt->slen = strlen(wirefmt->seq_name) + 1;
+
+	prefix_len = sizeof(*wirefmt->hdrs) + sizeof(stk_udp_wire_fragment0_hdr_t) + sizeof(stk_uint16) + wirefmt->slen;
+	stream_len = prefix_len + (stk_number_of_sequence_elements(seq) * sizeof(stk_udp_wire_seqment_hdr_t)) + stk_sequence_total_size(seq);
+
+	wirefmt->hdrs->num_fragments = 1;
+	if(stream_len <= (stk_uint64) wirefmt->mru) {
+		wirefmt->end_offset = wirefmt->total_len = stream_len;
+		STK_UDP_DBG("calc frag num %lu end offset %lu\n",wirefmt->hdrs->num_fragments,wirefmt->end_offset);
+		return STK_SUCCESS;
 	}
-	STK_UDP_DBG("calc frag offset end %lu\n",wirefmt->curr_offset);
-	if(wirefmt->curr_offset == 0)
-		wirefmt->total_len += wirefmt->mru;
-	else
-		wirefmt->total_len += wirefmt->curr_offset;
-	wirefmt->end_offset = wirefmt->curr_offset;
 
+	wirefmt->curr_offset = prefix_len;
+	rc = stk_iterate_sequence(seq,stk_udp_calc_fragments_layout,wirefmt);
+	if(rc != STK_SUCCESS) return rc;
+
+	wirefmt->end_offset = wirefmt->curr_offset;
+	wirefmt->total_len += wirefmt->curr_offset;
+	STK_UDP_DBG("calc frag num %lu end offset %lu\n",wirefmt->hdrs->num_fragments,wirefmt->end_offset);
 	return STK_SUCCESS;
 }
 
@@ -208,8 +226,17 @@ stk_ret stk_udp_send_fragments(stk_sequence_t *seq, void *data, stk_uint64 sz, s
 	seg_hdr.len = sz;
 	seg_hdr.type = user_type;
 
-	while(sz > 0)
+	/* Empty elements are sent as a segment header without data, as in TCP */
+	do
 	{
+		if(!stk_udp_segment_fits(wirefmt,sz)) {
+			/* Segment headers are not split across fragments, send this fragment and start the next */
+			rc = stk_rawudp_listener_data_flow_send_dest(wirefmt->rawudp_df,wirefmt->frag,wirefmt->curr_offset,wirefmt->flags,&wirefmt->dest_addr,sizeof(wirefmt->dest_addr));
+			STK_CHECK(STKA_NET,rc == STK_SUCCESS,"Send a fragment idx %lu",wirefmt->hdrs->fragment_idx);
+
+			wirefmt->hdrs->fragment_idx++;
+			wirefmt->curr_offset = sizeof(*wirefmt->hdrs);
+		}
 		wirefmt->curr_offset += sizeof(seg_hdr);
 		if(sz > wirefmt->mru - wirefmt->curr_offset) {
 			stk_uint32 seglen;
@@ -261,7 +288,7 @@ stk_ret stk_udp_send_fragments(stk_sequence_t *seq, void *data, stk_uint64 sz, s
 
 			break; /* Ending this segment in the middle of a fragment */
 		}
-	}
+	} while(sz > 0);
 	STK_UDP_DBG("returning from send Frag offset end %lu\n",wirefmt->curr_offset);
 
 	return STK_SUCCESS;
@@ -319,7 +346,6 @@ stk_ret stk_udp_client_data_flow_send(stk_data_flow_t *df,stk_sequence_t *data_s
 	memset(&wirefmt,0,sizeof(wirefmt));
 	wirefmt.mru = 65507;
 	wirefmt.hdrs = (stk_udp_wire_fragment_hdr_t *) &wirefmt.frag[0];
-	wirefmt.hdrs->num_fragments = 1;
 	wirefmt.hdrs->seq_id = stk_get_sequence_id(data_sequence);
 	wirefmt.hdrs->seq_generation = stk_get_sequence_generation(data_sequence);
 	wirefmt.hdrs->unique_id = ts->unique_id;
@@ -338,10 +364,10 @@ stk_ret stk_udp_client_data_flow_send(stk_data_flow_t *df,stk_sequence_t *data_s
 	else
 		memcpy(&wirefmt.dest_addr,&ts->server_addr,sizeof(wirefmt.dest_addr));
 
-	/* Calculate the number of fragments etc and init fragment 0 and common headers */
-	rc = stk_iterate_complete_sequence(data_sequence,stk_udp_calc_fragments_before,stk_udp_calc_fragments,NULL,&wirefmt);
+	/* Calculate the number of fragments etc for fragment 0 and common headers */
+	rc = stk_udp_calc_fragments(data_sequence,&wirefmt);
 	if(rc != STK_SUCCESS) {
-		STK_LOG(STK_LOG_ERROR,"iteration failed calculating headers to send, rc %d",rc);
+		STK_LOG(STK_LOG_ERROR,"iteration failed calculating fragments to send, rc %d",rc);
 		return rc;
 	}
 	STK_DEBUG(STKA_NET,"udp send num_fragments %lu total len %lu",wirefmt.hdrs->num_fragments,wirefmt.total_len);
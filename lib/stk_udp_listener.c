@@ -13,6 +13,7 @@
 #include "stk_options_api.h"
 #include "stk_sync_api.h"
 #include "stk_timer_api.h"
+#include "stk_clock_api.h"
 
 #include <sys/time.h>
 
@@ -142,7 +143,9 @@ stk_data_flow_t *stk_udp_listener_create_data_flow(stk_env_t *env,char *name,stk
 
 	ts->rawudp_df = stk_rawudp_listener_create_data_flow(env,name,id,extended_options);
 	if(!ts->rawudp_df) {
-		stk_udp_listener_destroy_data_flow(df);
+		/* Not destroyed, which would release the timer set this data flow hasn't referenced yet */
+		stk_free_options(extended_options);
+		stk_free_data_flow(df);
 		return NULL;
 	}
 
@@ -173,6 +176,12 @@ stk_ret stk_udp_listener_destroy_data_flow(stk_data_flow_t *df)
 		STK_ASSERT(STKA_NET,ret==STK_SUCCESS,"unhook rawudp data flow %p",df);
 	}
 
+	/* The expiration timer refers to the assembler freed with the data flow */
+	if(ts->asmblr.seq_expiration_timer) {
+		ret = stk_cancel_timer(stk_udp_listener_timers,ts->asmblr.seq_expiration_timer);
+		STK_ASSERT(STKA_NET,ret==STK_SUCCESS,"cancel sequence expiration timer of data flow %p",df);
+	}
+
 	ret = stk_free_data_flow(df);
 
 	if(STK_ATOMIC_DECR(&timer_refcount) == 1) {
@@ -259,7 +268,7 @@ void stk_remove_expired_sequences(stk_udp_assembler_t *asmblr)
 	stk_ret rc = STK_SUCCESS;
 	struct timeval curr_time,expire_time;
 
-	gettimeofday(&curr_time,NULL);
+	stk_now_coarse(&curr_time);
 	timersub(&curr_time, &asmblr->opts.expiration_interval, &expire_time);
 
 	for(stk_udp_partial_seq_t *pseq = asmblr->sequences; pseq < asmblr->end_sequence; pseq++) {
@@ -280,7 +289,8 @@ void stk_seq_expiration_cb(stk_timer_set_t *timer_set,stk_timer_t *timer,int id,
 	if(cb_type == STK_TIMER_EXPIRED && (asmblr->end_sequence - asmblr->sequences)) {
 		stk_ret rc = stk_reschedule_timer(timer_set,timer);
 		STK_ASSERT(STKA_NET,rc==STK_SUCCESS,"reschedule reconnect timer for tcp client %p",userdata);
-	}
+	} else
+		asmblr->seq_expiration_timer = NULL; /* Started again by the next partial sequence */
 }
 
 stk_ret stk_reassembler_add_sequence(stk_udp_assembler_t *asmblr, stk_sequence_t *seq, stk_uint32 unique_id)
@@ -321,10 +331,17 @@ stk_udp_partial_seq_t *stk_reassembler_find(stk_udp_assembler_t *asmblr, stk_seq
 stk_ret stk_complete_sequence_with_rcvd_data(stk_udp_partial_seq_t *pseq,stk_sequence_t *seq,stk_udp_listener_t *ts,int idx)
 {
 	stk_udp_assembler_t *asmblr = &ts->asmblr;
-	char *data = malloc(pseq->segments[idx].seg_hdr.len);
 	stk_uint32 expected_offset = 0;
+	char *data;
 	stk_ret rc;
 
+	/* Allocate the element in the sequence and reassemble directly in to it */
+	rc = stk_alloc_in_sequence(seq,pseq->segments[idx].seg_hdr.len,pseq->segments[idx].seg_hdr.type);
+	STK_CHECK(STKA_NET,rc==STK_SUCCESS,"Add reassembled data for segment %lu to sequence %p",
+		pseq->segments[idx].seg_hdr.type,seq);
+	if(rc != STK_SUCCESS) return rc;
+	data = stk_last_sequence_element(seq);
+
 	/* Reassemble, remove segments and add to sequence */
 	do {
 		/* Search for a matching segment to copy */
@@ -342,11 +359,6 @@ stk_ret stk_complete_sequence_with_rcvd_data(stk_udp_partial_seq_t *pseq,stk_seq
 		pseq->segments[idx].data_len = 0; 
 	} while(expected_offset < pseq->segments[idx].seg_hdr.len);
 
-	rc = stk_copy_to_sequence(seq,data,
-		pseq->segments[idx].seg_hdr.len, pseq->segments[idx].seg_hdr.type);
-	STK_CHECK(STKA_NET,rc==STK_SUCCESS,"Add reassembled data for segment %lu to sequence %p",
-		pseq->segments[idx].seg_hdr.type,seq);
-
 	return STK_SUCCESS;
 }
 
@@ -376,7 +388,7 @@ stk_ret stk_update_sequence_with_rcvd_data(stk_udp_partial_seq_t *pseq,stk_seque
 		nlen = *((stk_uint16 *) nexthdr);
 		nexthdr += sizeof(nlen);
 		if(nlen > 0) {
-			stk_set_sequence_name(seq,strdup(nexthdr));
+			stk_copy_sequence_name(seq,nexthdr);
 			nexthdr += nlen;
 		}
 	}
@@ -513,7 +525,7 @@ stk_sequence_t *stk_udp_listener_data_flow_rcv(stk_data_flow_t *df,stk_sequence_
 		seq = stk_create_sequence(stkbase,NULL,hdr->seq_id,0,0,seq_opts);
 		stk_reassembler_add_sequence(&ts->asmblr,seq,hdr->unique_id);
 		pseq = (&ts->asmblr)->end_sequence - 1;
-		gettimeofday(&pseq->create_time,NULL);
+		stk_now_coarse(&pseq->create_time);
 		STK_UDP_DBG("RCV new seq %p",seq);
 	}
 	else {
@@ -539,13 +551,6 @@ stk_sequence_t *stk_udp_listener_data_flow_rcv(stk_data_flow_t *df,stk_sequence_
 			return NULL;
 		}
 
-		rc = stk_data_flow_add_client_protocol(seq,stk_udp_listener_data_flow_protocol(df));
-		if(rc != STK_SUCCESS) {
-			STK_LOG(STK_LOG_ERROR,"update the client protocol for a sequence from udp fd %d for data flow %s[%lu], env %p rc %d",
-				stk_udp_listener_fd(df),stk_data_flow_name(df),stk_get_data_flow_id(df),stk_env_from_data_flow(df),rc);
-			return NULL;
-		}
-
 		STK_UDP_DBG("Complete Sequence: removing seq %p",seq);
 		stk_reassembler_del_sequence(&ts->asmblr, seq);
 		ts->asmblr.stats.complete_sequences++;
@@ -573,7 +578,7 @@ stk_ret stk_udp_listener_data_flow_clientip(stk_data_flow_t *df,struct sockaddr
 stk_ret stk_udp_listener_data_flow_buffered(stk_data_flow_t *df)
 {
 	stk_udp_listener_t *ts = stk_data_flow_module_data(df); /* Asserts on structure type */
-	return !STK_SUCCESS;
+	return stk_rawudp_listener_data_flow_buffered(ts->rawudp_df);
 }
 
 char *stk_udp_listener_data_flow_protocol(stk_data_flow_t *df) { return "udp"; }
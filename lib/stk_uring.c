@@ -0,0 +1,1064 @@
+#include "stk_uring_api.h"
+#include "stk_uring_internal.h"
+#include "stk_internal.h"
+#include "stk_common.h"
+#include "stk_options_api.h"
+#include "stk_sync_api.h"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+/* Multishot receives in to provided buffer rings were added in Linux 6.0 */
+#if defined(IORING_RECV_MULTISHOT) && defined(IORING_ACCEPT_MULTISHOT)
+#define STK_HAVE_URING
+#endif
+
+#ifdef STK_HAVE_URING
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define STK_URING_DEFAULT_ENTRIES 256
+#define STK_URING_DEFAULT_BUFFERS 256
+#define STK_URING_DEFAULT_BUFFER_SZ 16384
+#define STK_URING_MAX_BUFFERS 32768
+#define STK_URING_BGID 0
+/* Sends queued beyond this wait for the send in flight to complete */
+#define STK_URING_MAX_QUEUED_SEND (8 * 1024 * 1024)
+/* Max times stk_uring_process() calls back the data flows made ready by its own callbacks */
+#define STK_URING_MAX_PASSES 4
+#define STK_URING_DESTROY_WAIT_MS 100
+
+/* Requests are identified by the flow they are for, with the operation in the low bits */
+#define STK_URING_OP_RECV 1
+#define STK_URING_OP_SEND 2
+#define STK_URING_OP_ACCEPT 3
+#define STK_URING_OP_SENDMSG 4  /* Datagram sends are identified by the datagram, which refers to its flow */
+#define STK_URING_OP_MASK 7
+#define STK_URING_USER_DATA(_flow,_op) ((__u64) (uintptr_t) (_flow) | (_op))
+
+/* A datagram queued to be sent, it must stay valid until the send completes */
+typedef struct stk_uring_dgram_stct {
+	struct stk_uring_flow_stct *flow;
+	struct msghdr msg;
+	struct iovec iov;
+	struct sockaddr_in6 addr;
+	stk_uint64 sz;              /* Space for data */
+	struct stk_uring_dgram_stct *next_free;
+	char data[];
+} stk_uring_dgram_t;
+
+struct stk_uring_flow_stct {
+	stk_uring_t *ring;
+	stk_data_flow_t *df;        /* NULL once detached */
+	int fd;
+	stk_bool listening;
+	stk_bool datagram;          /* Each buffer received is one datagram, prefixed by its address */
+	stk_bool blocking;          /* Receives wait for data, as recv() does on a blocking socket */
+	int inflight;               /* Requests in flight, a detached flow is freed when there are none */
+	stk_bool recv_armed;
+	stk_bool accept_armed;
+	stk_bool send_armed;
+	stk_bool eof;
+	stk_bool hup;               /* The hangup has been called back */
+	int err;
+	/* Buffers received and not yet copied out, linked through the ring's buf_next */
+	int rcvd_head, rcvd_tail;
+	stk_uint64 rcvd_offset;     /* Bytes copied out of the head buffer */
+	stk_uint64 rcvd_bytes;
+	/* Accepted sockets not yet taken by stk_uring_accept() */
+	int *accepted;
+	int accepted_count, accepted_sz;
+	/* Data queued while a send is in flight, and the data in flight */
+	char *sendq;
+	stk_uint64 sendq_len, sendq_sz;
+	char *sending;
+	stk_uint64 sending_len, sending_off, sending_sz;
+	/* Datagrams in flight, and the error of a datagram send returned by the next send */
+	stk_uint64 dgram_bytes;
+	int dgram_err;
+	/* The header and address space of the datagrams received */
+	struct msghdr recv_msg;
+	stk_bool ready;             /* On the ring's ready list */
+	stk_bool starved;           /* On the ring's starved list */
+	struct stk_uring_flow_stct *next_ready;
+	struct stk_uring_flow_stct *next_starved;
+	struct stk_uring_flow_stct *next_freed;
+};
+
+struct stk_uring_stct {
+	stk_stct_type stct_type;
+	stk_env_t *env;
+	int fd;
+	/* Submission queue */
+	unsigned *sq_head, *sq_tail, *sq_array, sq_mask, sq_entries;
+	unsigned sq_pending_tail;   /* Requests prepared, published when submitted */
+	struct io_uring_sqe *sqes;
+	/* Completion queue */
+	unsigned *cq_head, *cq_tail, cq_mask;
+	struct io_uring_cqe *cqes;
+	void *sq_map, *cq_map;
+	size_t sq_map_sz, cq_map_sz, sqes_sz;
+	/* Buffers provided to the kernel for receives */
+	struct io_uring_buf_ring *buf_ring;
+	size_t buf_ring_sz;
+	char *bufs;
+	unsigned nbufs, buf_sz;
+	stk_uint16 buf_tail;
+	int *buf_next;
+	unsigned *buf_len;
+	stk_uint64 bufs_recycled;
+	stk_uint64 bufs_recycled_at_starve; /* Starved receives are rearmed once buffers are recycled */
+	/* Flows indexed by fd */
+	stk_uring_flow_t **flows;
+	int flows_sz;
+	int nflows;                 /* Flows allocated, including detached flows with requests in flight */
+	stk_uring_flow_t *ready, *ready_tail;
+	stk_uring_flow_t *starved;
+	stk_uring_flow_t *freed;    /* Flows detached while processing, freed afterwards */
+	int processing;
+	stk_uring_dgram_t *dgram_free; /* Datagrams sent, reused for later sends */
+	stk_uring_stats_t stats;
+};
+
+static void stk_uring_free_flow(stk_uring_flow_t *flow);
+
+static int stk_uring_setup_sys(unsigned entries,struct io_uring_params *p)
+{
+	return (int) syscall(__NR_io_uring_setup,entries,p);
+}
+
+static int stk_uring_enter_sys(int fd,unsigned to_submit,unsigned min_complete,unsigned flags)
+{
+	return (int) syscall(__NR_io_uring_enter,fd,to_submit,min_complete,flags,NULL,0);
+}
+
+static int stk_uring_register_sys(int fd,unsigned opcode,void *arg,unsigned nr_args)
+{
+	return (int) syscall(__NR_io_uring_register,fd,opcode,arg,nr_args);
+}
+
+static void stk_uring_unmap(stk_uring_t *ring)
+{
+	if(ring->buf_ring) munmap(ring->buf_ring,ring->buf_ring_sz);
+	if(ring->sqes) munmap(ring->sqes,ring->sqes_sz);
+	if(ring->cq_map && ring->cq_map != ring->sq_map) munmap(ring->cq_map,ring->cq_map_sz);
+	if(ring->sq_map) munmap(ring->sq_map,ring->sq_map_sz);
+	if(ring->fd != -1) close(ring->fd);
+	if(ring->bufs) STK_FREE(ring->bufs);
+	if(ring->buf_next) STK_FREE(ring->buf_next);
+	if(ring->buf_len) STK_FREE(ring->buf_len);
+	if(ring->flows) STK_FREE(ring->flows);
+	while(ring->dgram_free) {
+		stk_uring_dgram_t *dgram = ring->dgram_free;
+
+		ring->dgram_free = dgram->next_free;
+		STK_FREE(dgram);
+	}
+}
+
+static void *stk_uring_mmap(int fd,size_t sz,off_t offset)
+{
+	void *ptr = mmap(NULL,sz,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd,offset);
+	return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+/* Return a buffer to the kernel for receives */
+static void stk_uring_recycle_buf(stk_uring_t *ring,int bid)
+{
+	/* Only set the fields of the entry, the first entry's reserved field is the ring tail */
+	struct io_uring_buf *buf = &ring->buf_ring->bufs[ring->buf_tail & (ring->nbufs - 1)];
+
+	buf->addr = (__u64) (uintptr_t) &ring->bufs[(size_t) bid * ring->buf_sz];
+	buf->len = ring->buf_sz;
+	buf->bid = (__u16) bid;
+	ring->buf_tail++;
+	stk_atomic_store_16(&ring->buf_ring->tail,ring->buf_tail,STK_MO_RELEASE);
+	ring->bufs_recycled++;
+}
+
+stk_uring_t *stk_create_uring(stk_env_t *env,stk_options_t *options)
+{
+	char *entries_str = stk_find_option(options,"uring_entries",NULL);
+	char *buffers_str = stk_find_option(options,"uring_buffers",NULL);
+	char *buffer_sz_str = stk_find_option(options,"uring_buffer_size",NULL);
+	unsigned entries = entries_str ? (unsigned) atoi(entries_str) : STK_URING_DEFAULT_ENTRIES;
+	struct io_uring_params p;
+	struct io_uring_buf_reg reg;
+	stk_uring_t *ring;
+
+	STK_CALLOC_STCT(STK_STCT_URING,stk_uring_t,ring);
+	if(!ring) return NULL;
+
+	ring->env = env;
+	ring->fd = -1;
+	ring->nbufs = buffers_str ? (unsigned) atoi(buffers_str) : STK_URING_DEFAULT_BUFFERS;
+	ring->buf_sz = buffer_sz_str ? (unsigned) atoi(buffer_sz_str) : STK_URING_DEFAULT_BUFFER_SZ;
+	if(ring->nbufs == 0 || ring->nbufs > STK_URING_MAX_BUFFERS || (ring->nbufs & (ring->nbufs - 1)) || ring->buf_sz == 0) {
+		STK_LOG(STK_LOG_ERROR,"io_uring buffers must be a power of 2 up to %d (%u) of a non zero size (%u)",STK_URING_MAX_BUFFERS,ring->nbufs,ring->buf_sz);
+		STK_FREE_STCT(STK_STCT_URING,ring);
+		return NULL;
+	}
+
+	memset(&p,0,sizeof(p));
+	p.flags = IORING_SETUP_CLAMP;
+	ring->fd = stk_uring_setup_sys(entries,&p);
+	if(ring->fd == -1) {
+		STK_LOG(STK_LOG_ERROR,"io_uring is not available, errno %d %s",errno,strerror(errno));
+		STK_FREE_STCT(STK_STCT_URING,ring);
+		return NULL;
+	}
+
+	/* Map the submission and completion queues, which may share a mapping */
+	ring->sq_map_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_map_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if(p.features & IORING_FEAT_SINGLE_MMAP) {
+		if(ring->cq_map_sz > ring->sq_map_sz) ring->sq_map_sz = ring->cq_map_sz;
+		ring->cq_map_sz = ring->sq_map_sz;
+	}
+	ring->sq_map = stk_uring_mmap(ring->fd,ring->sq_map_sz,IORING_OFF_SQ_RING);
+	if(ring->sq_map)
+		ring->cq_map = p.features & IORING_FEAT_SINGLE_MMAP ? ring->sq_map : stk_uring_mmap(ring->fd,ring->cq_map_sz,IORING_OFF_CQ_RING);
+	ring->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	if(ring->cq_map)
+		ring->sqes = stk_uring_mmap(ring->fd,ring->sqes_sz,IORING_OFF_SQES);
+	if(!ring->sqes) {
+		STK_LOG(STK_LOG_ERROR,"map io_uring queues, errno %d",errno);
+		stk_uring_unmap(ring);
+		STK_FREE_STCT(STK_STCT_URING,ring);
+		return NULL;
+	}
+
+	ring->sq_head = (unsigned *) ((char *) ring->sq_map + p.sq_off.head);
+	ring->sq_tail = (unsigned *) ((char *) ring->sq_map + p.sq_off.tail);
+	ring->sq_array = (unsigned *) ((char *) ring->sq_map + p.sq_off.array);
+	ring->sq_mask = *(unsigned *) ((char *) ring->sq_map + p.sq_off.ring_mask);
+	ring->sq_entries = p.sq_entries;
+	ring->sq_pending_tail = *ring->sq_tail;
+	ring->cq_head = (unsigned *) ((char *) ring->cq_map + p.cq_off.head);
+	ring->cq_tail = (unsigned *) ((char *) ring->cq_map + p.cq_off.tail);
+	ring->cq_mask = *(unsigned *) ((char *) ring->cq_map + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) ((char *) ring->cq_map + p.cq_off.cqes);
+
+	/* Register the ring of buffers the kernel receives in to */
+	ring->buf_ring_sz = ring->nbufs * sizeof(struct io_uring_buf);
+	ring->buf_ring = mmap(NULL,ring->buf_ring_sz,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+	if(ring->buf_ring == MAP_FAILED) ring->buf_ring = NULL;
+	ring->bufs = STK_ALLOC_BUF((size_t) ring->nbufs * ring->buf_sz);
+	ring->buf_next = STK_CALLOC(ring->nbufs * sizeof(int));
+	ring->buf_len = STK_CALLOC(ring->nbufs * sizeof(unsigned));
+	if(!ring->buf_ring || !ring->bufs || !ring->buf_next || !ring->buf_len) {
+		STK_LOG(STK_LOG_ERROR,"allocate %u io_uring buffers of %u bytes",ring->nbufs,ring->buf_sz);
+		stk_uring_unmap(ring);
+		STK_FREE_STCT(STK_STCT_URING,ring);
+		return NULL;
+	}
+
+	memset(&reg,0,sizeof(reg));
+	reg.ring_addr = (__u64) (uintptr_t) ring->buf_ring;
+	reg.ring_entries = ring->nbufs;
+	reg.bgid = STK_URING_BGID;
+	if(stk_uring_register_sys(ring->fd,IORING_REGISTER_PBUF_RING,&reg,1) == -1) {
+		STK_LOG(STK_LOG_ERROR,"register io_uring buffer ring, errno %d %s",errno,strerror(errno));
+		stk_uring_unmap(ring);
+		STK_FREE_STCT(STK_STCT_URING,ring);
+		return NULL;
+	}
+	for(unsigned bid = 0; bid < ring->nbufs; bid++)
+		stk_uring_recycle_buf(ring,(int) bid);
+	ring->bufs_recycled = 0;
+
+	return ring;
+}
+
+/* Free a detached flow when it has no requests in flight and is not on a list */
+static void stk_uring_release(stk_uring_flow_t *flow)
+{
+	stk_uring_t *ring = flow->ring;
+
+	if(flow->df || flow->inflight > 0 || flow->ready || flow->starved) return;
+
+	if(ring->processing) {
+		flow->next_freed = ring->freed;
+		ring->freed = flow;
+		flow->ready = STK_TRUE; /* Keep it off the lists */
+		return;
+	}
+	stk_uring_free_flow(flow);
+}
+
+static void stk_uring_free_flow(stk_uring_flow_t *flow)
+{
+	flow->ring->nflows--;
+	if(flow->accepted) STK_FREE(flow->accepted);
+	if(flow->sendq) STK_FREE(flow->sendq);
+	if(flow->sending) STK_FREE(flow->sending);
+	STK_FREE(flow);
+}
+
+/* Publish the requests prepared and enter the kernel, optionally waiting for completions */
+static int stk_uring_enter(stk_uring_t *ring,unsigned min_complete,unsigned flags)
+{
+	unsigned to_submit = ring->sq_pending_tail - stk_atomic_load_32(ring->sq_head,STK_MO_ACQUIRE);
+	int rc;
+
+	if(to_submit == 0 && min_complete == 0 && flags == 0) return 0;
+
+	stk_atomic_store_32(ring->sq_tail,ring->sq_pending_tail,STK_MO_RELEASE);
+	do {
+		rc = stk_uring_enter_sys(ring->fd,to_submit,min_complete,flags);
+	} while(rc == -1 && errno == EINTR);
+
+	if(rc > 0) {
+		ring->stats.submits++;
+		ring->stats.sqes += rc;
+	} else
+	if(rc == -1 && errno != EBUSY && errno != EAGAIN)
+		STK_LOG(STK_LOG_ERROR,"io_uring_enter failed on ring fd %d, errno %d %s",ring->fd,errno,strerror(errno));
+	return rc;
+}
+
+static struct io_uring_sqe *stk_uring_get_sqe(stk_uring_t *ring)
+{
+	struct io_uring_sqe *sqe;
+	unsigned idx;
+
+	while(ring->sq_pending_tail - stk_atomic_load_32(ring->sq_head,STK_MO_ACQUIRE) == ring->sq_entries) {
+		/* The submission queue is full, submit what has been prepared so far */
+		if(stk_uring_enter(ring,0,0) == -1 && errno != EBUSY && errno != EAGAIN) break;
+	}
+	STK_ASSERT(STKA_NET,ring->sq_pending_tail - *ring->sq_head < ring->sq_entries,"get a submission queue entry on ring %p",ring);
+
+	idx = ring->sq_pending_tail & ring->sq_mask;
+	sqe = &ring->sqes[idx];
+	memset(sqe,0,sizeof(*sqe));
+	ring->sq_array[idx] = idx;
+	ring->sq_pending_tail++;
+	return sqe;
+}
+
+static void stk_uring_arm_recv(stk_uring_flow_t *flow)
+{
+	struct io_uring_sqe *sqe = stk_uring_get_sqe(flow->ring);
+
+	if(flow->datagram) {
+		sqe->opcode = IORING_OP_RECVMSG;
+		sqe->addr = (__u64) (uintptr_t) &flow->recv_msg;
+		sqe->len = 1;
+	} else
+		sqe->opcode = IORING_OP_RECV;
+	sqe->fd = flow->fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = STK_URING_BGID;
+	sqe->user_data = STK_URING_USER_DATA(flow,STK_URING_OP_RECV);
+	flow->recv_armed = STK_TRUE;
+	flow->inflight++;
+}
+
+static void stk_uring_arm_accept(stk_uring_flow_t *flow)
+{
+	struct io_uring_sqe *sqe = stk_uring_get_sqe(flow->ring);
+
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = flow->fd;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->user_data = STK_URING_USER_DATA(flow,STK_URING_OP_ACCEPT);
+	flow->accept_armed = STK_TRUE;
+	flow->inflight++;
+}
+
+static void stk_uring_arm_send(stk_uring_flow_t *flow)
+{
+	struct io_uring_sqe *sqe = stk_uring_get_sqe(flow->ring);
+
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = flow->fd;
+	sqe->addr = (__u64) (uintptr_t) &flow->sending[flow->sending_off];
+	sqe->len = (__u32) (flow->sending_len - flow->sending_off);
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = STK_URING_USER_DATA(flow,STK_URING_OP_SEND);
+	flow->send_armed = STK_TRUE;
+	flow->inflight++;
+}
+
+static void stk_uring_arm_sendmsg(stk_uring_flow_t *flow,stk_uring_dgram_t *dgram)
+{
+	struct io_uring_sqe *sqe = stk_uring_get_sqe(flow->ring);
+
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = flow->fd;
+	sqe->addr = (__u64) (uintptr_t) &dgram->msg;
+	sqe->len = 1;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = STK_URING_USER_DATA(dgram,STK_URING_OP_SENDMSG);
+	flow->dgram_bytes += dgram->iov.iov_len;
+	flow->inflight++;
+}
+
+static void stk_uring_cancel(stk_uring_flow_t *flow,int op)
+{
+	struct io_uring_sqe *sqe = stk_uring_get_sqe(flow->ring);
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = STK_URING_USER_DATA(flow,op);
+	sqe->user_data = 0;
+}
+
+/* Send the data queued, swapping the queue with the buffer of the previous send */
+static void stk_uring_start_send(stk_uring_flow_t *flow)
+{
+	char *buf = flow->sending;
+	stk_uint64 sz = flow->sending_sz;
+
+	flow->sending = flow->sendq;
+	flow->sending_sz = flow->sendq_sz;
+	flow->sending_len = flow->sendq_len;
+	flow->sending_off = 0;
+	flow->sendq = buf;
+	flow->sendq_sz = sz;
+	flow->sendq_len = 0;
+	stk_uring_arm_send(flow);
+}
+
+static void stk_uring_set_ready(stk_uring_flow_t *flow)
+{
+	stk_uring_t *ring = flow->ring;
+
+	if(flow->ready || !flow->df) return;
+	flow->ready = STK_TRUE;
+	flow->next_ready = NULL;
+	if(ring->ready_tail)
+		ring->ready_tail->next_ready = flow;
+	else
+		ring->ready = flow;
+	ring->ready_tail = flow;
+}
+
+/* The offset of a datagram's data in its buffer, after the header and address space */
+static stk_uint64 stk_uring_dgram_offset(stk_uring_flow_t *flow)
+{
+	return sizeof(struct io_uring_recvmsg_out) + flow->recv_msg.msg_namelen + flow->recv_msg.msg_controllen;
+}
+
+/* Datagrams which didn't fit in a buffer were truncated, they are dropped as if they had been lost */
+static stk_bool stk_uring_truncated(stk_uring_flow_t *flow,int bid)
+{
+	stk_uring_t *ring = flow->ring;
+	struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *) &ring->bufs[(size_t) bid * ring->buf_sz];
+
+	if((out->flags & MSG_TRUNC) == 0) return STK_FALSE;
+
+	STK_LOG(STK_LOG_NET_ERROR,"io_uring dropped a datagram of %u bytes on fd %d, larger than its %u byte buffers",out->payloadlen,flow->fd,ring->buf_sz);
+	return STK_TRUE;
+}
+
+static void stk_uring_complete(stk_uring_t *ring,__u64 user_data,int res,unsigned flags)
+{
+	stk_uring_flow_t *flow = (stk_uring_flow_t *) (uintptr_t) (user_data & ~(__u64) STK_URING_OP_MASK);
+	stk_bool more = flags & IORING_CQE_F_MORE ? STK_TRUE : STK_FALSE;
+
+	ring->stats.completions++;
+	if(!flow) return; /* Cancellation */
+
+	if((user_data & STK_URING_OP_MASK) == STK_URING_OP_SENDMSG) {
+		stk_uring_dgram_t *dgram = (stk_uring_dgram_t *) flow;
+
+		flow = dgram->flow;
+		flow->dgram_bytes -= dgram->iov.iov_len;
+		dgram->next_free = ring->dgram_free;
+		ring->dgram_free = dgram;
+	}
+
+	switch(user_data & STK_URING_OP_MASK) {
+	case STK_URING_OP_RECV:
+		if(flags & IORING_CQE_F_BUFFER) {
+			int bid = (int) (flags >> IORING_CQE_BUFFER_SHIFT);
+
+			if(res > 0 && flow->df && !(flow->datagram && stk_uring_truncated(flow,bid))) {
+				/* Queue the buffer until the data is copied out of it */
+				ring->buf_len[bid] = (unsigned) res;
+				ring->buf_next[bid] = -1;
+				if(flow->rcvd_tail == -1)
+					flow->rcvd_head = bid;
+				else
+					ring->buf_next[flow->rcvd_tail] = bid;
+				flow->rcvd_tail = bid;
+				flow->rcvd_bytes += res;
+			} else
+				stk_uring_recycle_buf(ring,bid);
+		}
+		if(res > 0) ring->stats.recv_bytes += flow->datagram ? res - stk_uring_dgram_offset(flow) : (stk_uint64) res;
+
+		if(!more) {
+			flow->recv_armed = STK_FALSE;
+			flow->inflight--;
+			if(res == 0)
+				flow->eof = STK_TRUE;
+			else
+			if(res == -ENOBUFS) {
+				/* Rearmed when buffers are recycled, meanwhile received directly from the socket */
+				ring->stats.starved++;
+				if(flow->df && !flow->starved) {
+					/* Rearmed once a buffer is recycled after the first of the starved flows */
+					if(!ring->starved) ring->bufs_recycled_at_starve = ring->bufs_recycled;
+					flow->starved = STK_TRUE;
+					flow->next_starved = ring->starved;
+					ring->starved = flow;
+				}
+			} else
+			if(res < 0) {
+				if(res != -ECANCELED && !flow->err) flow->err = -res;
+			} else
+			if(flow->df)
+				stk_uring_arm_recv(flow); /* Multishot receives may end at any time */
+		}
+		if(res > 0 || (!more && res != -ENOBUFS && res != -ECANCELED))
+			stk_uring_set_ready(flow);
+		break;
+
+	case STK_URING_OP_ACCEPT:
+		if(res >= 0) {
+			ring->stats.accepts++;
+			if(flow->df) {
+				if(flow->accepted_count == flow->accepted_sz) {
+					flow->accepted_sz = flow->accepted_sz ? flow->accepted_sz * 2 : 16;
+					STK_REALLOC(flow->accepted,flow->accepted_sz * sizeof(int));
+					STK_ASSERT(STKA_NET,flow->accepted!=NULL,"grow accepted sockets of listening fd %d",flow->fd);
+				}
+				flow->accepted[flow->accepted_count++] = res;
+				stk_uring_set_ready(flow);
+			} else
+				close(res);
+		}
+		if(!more) {
+			flow->accept_armed = STK_FALSE;
+			flow->inflight--;
+			if(res < 0 && res != -ECANCELED)
+				STK_LOG(STK_LOG_NET_ERROR,"io_uring accept failed on listening fd %d, errno %d",flow->fd,-res);
+			if(flow->df && res != -ECANCELED)
+				stk_uring_arm_accept(flow);
+		}
+		break;
+
+	case STK_URING_OP_SEND:
+		flow->send_armed = STK_FALSE;
+		flow->inflight--;
+		if(res < 0) {
+			if(res != -ECANCELED && !flow->err) {
+				flow->err = -res;
+				stk_uring_set_ready(flow);
+			}
+			break;
+		}
+		ring->stats.send_bytes += res;
+		flow->sending_off += res;
+		if(!flow->df) break; /* Detached, the socket may have been closed and its fd reused */
+		if(flow->sending_off < flow->sending_len)
+			stk_uring_arm_send(flow); /* Partial send */
+		else
+		if(flow->sendq_len > 0)
+			stk_uring_start_send(flow);
+		break;
+
+	case STK_URING_OP_SENDMSG:
+		flow->inflight--;
+		if(res < 0) {
+			/* A failed datagram doesn't stop the data flow, as for sendto() the error is returned by the next send */
+			if(res != -ECANCELED && flow->df) {
+				flow->dgram_err = -res;
+				STK_LOG(STK_LOG_NET_ERROR,"io_uring datagram send failed on fd %d, errno %d",flow->fd,-res);
+			}
+		} else
+			ring->stats.send_bytes += res;
+		break;
+	}
+
+	stk_uring_release(flow);
+}
+
+/* Reap the completions posted, without calling back */
+static void stk_uring_reap(stk_uring_t *ring)
+{
+	unsigned head = *ring->cq_head;
+	unsigned tail;
+
+	while(head != (tail = stk_atomic_load_32(ring->cq_tail,STK_MO_ACQUIRE))) {
+		while(head != tail) {
+			struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+			__u64 user_data = cqe->user_data;
+			int res = cqe->res;
+			unsigned flags = cqe->flags;
+
+			head++;
+			stk_atomic_store_32(ring->cq_head,head,STK_MO_RELEASE);
+			stk_uring_complete(ring,user_data,res,flags);
+		}
+	}
+}
+
+/* Submit, run the kernel's pending work for the ring and reap the completions */
+static void stk_uring_wait(stk_uring_t *ring,unsigned min_complete)
+{
+	stk_uring_enter(ring,min_complete,IORING_ENTER_GETEVENTS);
+	stk_uring_reap(ring);
+}
+
+static void stk_uring_rearm_starved(stk_uring_t *ring)
+{
+	stk_uring_flow_t *flow = ring->starved;
+
+	if(!flow || ring->bufs_recycled == ring->bufs_recycled_at_starve) return;
+
+	ring->starved = NULL;
+	while(flow) {
+		stk_uring_flow_t *next = flow->next_starved;
+
+		flow->starved = STK_FALSE;
+		if(flow->df && !flow->recv_armed && !flow->eof && !flow->err)
+			stk_uring_arm_recv(flow);
+		else
+			stk_uring_release(flow);
+		flow = next;
+	}
+}
+
+stk_ret stk_destroy_uring(stk_uring_t *ring)
+{
+	STK_ASSERT(STKA_NET,ring->stct_type==STK_STCT_URING,"destroy an io_uring, the pointer was to a structure of type %d",ring->stct_type);
+
+	/* Wait briefly for the cancellation of requests from detached flows */
+	for(int waited = 0; ring->nflows > 0 && waited < STK_URING_DESTROY_WAIT_MS; waited++) {
+		stk_uring_flow_t *flow;
+
+		while((flow = ring->ready)) {
+			ring->ready = flow->next_ready;
+			flow->ready = STK_FALSE;
+			stk_uring_release(flow);
+		}
+		ring->ready_tail = NULL;
+		while((flow = ring->starved)) {
+			ring->starved = flow->next_starved;
+			flow->starved = STK_FALSE;
+			stk_uring_release(flow);
+		}
+		if(ring->nflows == 0) break;
+		stk_uring_wait(ring,0);
+		usleep(1000);
+	}
+	if(ring->nflows > 0)
+		STK_LOG(STK_LOG_ERROR,"destroying io_uring %p with %d data flows attached",ring,ring->nflows);
+
+	stk_uring_unmap(ring);
+	STK_FREE_STCT(STK_STCT_URING,ring);
+	return STK_SUCCESS;
+}
+
+int stk_uring_fd(stk_uring_t *ring)
+{
+	STK_ASSERT(STKA_NET,ring->stct_type==STK_STCT_URING,"get the fd of an io_uring, the pointer was to a structure of type %d",ring->stct_type);
+	return ring->fd;
+}
+
+stk_ret stk_uring_submit(stk_uring_t *ring)
+{
+	STK_ASSERT(STKA_NET,ring->stct_type==STK_STCT_URING,"submit to an io_uring, the pointer was to a structure of type %d",ring->stct_type);
+
+	stk_uring_rearm_starved(ring);
+	return stk_uring_enter(ring,0,0) == -1 ? STK_SYSERR : STK_SUCCESS;
+}
+
+stk_ret stk_uring_process(stk_uring_t *ring,stk_uring_cb cb,void *clientd)
+{
+	STK_ASSERT(STKA_NET,ring->stct_type==STK_STCT_URING,"process an io_uring, the pointer was to a structure of type %d",ring->stct_type);
+
+	stk_uring_rearm_starved(ring);
+	stk_uring_wait(ring,0);
+
+	ring->processing++;
+	for(int pass = 0; ring->ready && pass < STK_URING_MAX_PASSES; pass++) {
+		/* Flows made ready by the callbacks (which reap completions when receiving) are called back in the next pass */
+		stk_uring_flow_t *flow = ring->ready;
+
+		ring->ready = ring->ready_tail = NULL;
+		while(flow) {
+			stk_uring_flow_t *next = flow->next_ready;
+
+			flow->ready = STK_FALSE;
+			if(flow->listening) {
+				for(int accepted = flow->accepted_count; accepted > 0 && flow->df; accepted--)
+					cb(ring,flow->df,flow->fd,STK_URING_READABLE,clientd);
+			} else {
+				if(flow->df && flow->rcvd_bytes > 0)
+					cb(ring,flow->df,flow->fd,STK_URING_READABLE,clientd);
+				if(flow->df && (flow->eof || flow->err) && flow->rcvd_bytes == 0 && !flow->hup) {
+					flow->hup = STK_TRUE;
+					cb(ring,flow->df,flow->fd,STK_URING_HUP,clientd);
+				}
+			}
+			/* Data left is called back again, like a level triggered poll() */
+			if(flow->df && (flow->rcvd_bytes > 0 || (flow->listening && flow->accepted_count > 0)))
+				stk_uring_set_ready(flow);
+			stk_uring_release(flow);
+			flow = next;
+		}
+	}
+	ring->processing--;
+
+	while(ring->freed) {
+		stk_uring_flow_t *flow = ring->freed;
+
+		ring->freed = flow->next_freed;
+		stk_uring_free_flow(flow);
+	}
+
+	/* Submit the requests made by the callbacks, e.g. sends */
+	stk_uring_enter(ring,0,0);
+	return STK_SUCCESS;
+}
+
+stk_bool stk_uring_pending(stk_uring_t *ring)
+{
+	return ring->ready ? STK_TRUE : STK_FALSE;
+}
+
+stk_bool stk_uring_owns_fd(stk_uring_t *ring,int fd)
+{
+	return fd >= 0 && fd < ring->flows_sz && ring->flows[fd] ? STK_TRUE : STK_FALSE;
+}
+
+stk_ret stk_uring_get_stats(stk_uring_t *ring,stk_uring_stats_t *stats)
+{
+	STK_ASSERT(STKA_NET,ring->stct_type==STK_STCT_URING,"get stats of an io_uring, the pointer was to a structure of type %d",ring->stct_type);
+	memcpy(stats,&ring->stats,sizeof(*stats));
+	return STK_SUCCESS;
+}
+
+stk_uring_flow_t *stk_uring_attach(stk_uring_t *ring,stk_data_flow_t *df,int fd,int flags)
+{
+	stk_uring_flow_t *flow;
+	int fl;
+
+	STK_ASSERT(STKA_NET,ring->stct_type==STK_STCT_URING,"attach to an io_uring, the pointer was to a structure of type %d",ring->stct_type);
+	if(fd < 0) return NULL;
+
+	if((flags & STK_URING_ATTACH_DATAGRAM) && !(flags & STK_URING_ATTACH_SEND_ONLY) && ring->buf_sz < STK_URING_DATAGRAM_BUFFER_SIZE) {
+		STK_LOG(STK_LOG_ERROR,"io_uring buffers of %u bytes are too small to receive datagrams on fd %d, %d bytes are needed",
+			ring->buf_sz,fd,STK_URING_DATAGRAM_BUFFER_SIZE);
+		return NULL;
+	}
+
+	if(fd >= ring->flows_sz) {
+		int sz = ring->flows_sz ? ring->flows_sz : 64;
+		stk_uring_flow_t **flows;
+
+		while(sz <= fd) sz *= 2;
+		flows = realloc(ring->flows,sz * sizeof(stk_uring_flow_t *));
+		if(!flows) return NULL;
+		memset(&flows[ring->flows_sz],0,(sz - ring->flows_sz) * sizeof(stk_uring_flow_t *));
+		ring->flows = flows;
+		ring->flows_sz = sz;
+	}
+
+	flow = STK_CALLOC(sizeof(stk_uring_flow_t));
+	if(!flow) return NULL;
+
+	fl = fcntl(fd,F_GETFL);
+	flow->ring = ring;
+	flow->df = df;
+	flow->fd = fd;
+	flow->listening = flags & STK_URING_ATTACH_LISTENING ? STK_TRUE : STK_FALSE;
+	flow->datagram = flags & STK_URING_ATTACH_DATAGRAM ? STK_TRUE : STK_FALSE;
+	flow->blocking = fl != -1 && (fl & O_NONBLOCK) == 0 ? STK_TRUE : STK_FALSE;
+	flow->rcvd_head = flow->rcvd_tail = -1;
+	flow->recv_msg.msg_namelen = sizeof(struct sockaddr_in6);
+	ring->flows[fd] = flow;
+	ring->nflows++;
+
+	if(flow->listening)
+		stk_uring_arm_accept(flow);
+	else
+	if(!(flags & STK_URING_ATTACH_SEND_ONLY))
+		stk_uring_arm_recv(flow);
+	stk_uring_enter(ring,0,0);
+
+	return flow;
+}
+
+void stk_uring_detach(stk_uring_flow_t *flow)
+{
+	stk_uring_t *ring = flow->ring;
+
+	/* Data already sent is flushed to the socket, as if it had been sent by send() */
+	while((flow->send_armed || flow->dgram_bytes > 0) && !flow->err)
+		stk_uring_wait(ring,1);
+
+	if(ring->flows[flow->fd] == flow)
+		ring->flows[flow->fd] = NULL;
+	flow->df = NULL;
+
+	if(flow->recv_armed) stk_uring_cancel(flow,STK_URING_OP_RECV);
+	if(flow->accept_armed) stk_uring_cancel(flow,STK_URING_OP_ACCEPT);
+	if(flow->send_armed) stk_uring_cancel(flow,STK_URING_OP_SEND);
+	/* Cancel before the caller closes the socket */
+	stk_uring_enter(ring,0,0);
+
+	while(flow->rcvd_head != -1) {
+		int bid = flow->rcvd_head;
+
+		flow->rcvd_head = ring->buf_next[bid];
+		stk_uring_recycle_buf(ring,bid);
+	}
+	flow->rcvd_tail = -1;
+	flow->rcvd_bytes = 0;
+	while(flow->accepted_count > 0)
+		close(flow->accepted[--flow->accepted_count]);
+
+	stk_uring_release(flow);
+}
+
+stk_uring_t *stk_uring_flow_ring(stk_uring_flow_t *flow) { return flow->ring; }
+
+stk_uint64 stk_uring_buffered(stk_uring_flow_t *flow) { return flow->rcvd_bytes; }
+
+/* Wait for data to be received in to the ring's buffers, or receive directly from the socket while the flow
+ * is starved of buffers. Returns the length received directly, or -1 when there is nothing to receive directly.
+ */
+static ssize_t stk_uring_recv_wait(stk_uring_flow_t *flow,char *buf,stk_uint64 len,struct sockaddr *from,socklen_t *fromlen)
+{
+	stk_uring_t *ring = flow->ring;
+
+	if(flow->rcvd_bytes == 0 && flow->starved)
+		stk_uring_rearm_starved(ring); /* Buffers may have been recycled since the flow was starved */
+
+	while(len > 0 && flow->rcvd_bytes == 0 && !flow->eof && !flow->err) {
+		ssize_t ret;
+
+		if(flow->recv_armed) {
+			/* Reap data which has arrived since the ring was last processed */
+			stk_uring_wait(ring,0);
+			while(flow->blocking && flow->rcvd_bytes == 0 && flow->recv_armed)
+				stk_uring_wait(ring,1);
+			if(flow->recv_armed || flow->rcvd_bytes > 0 || flow->eof || flow->err) break;
+		}
+
+		/* Starved of buffers, receive what has arrived directly from the socket */
+		ret = recvfrom(flow->fd,buf,len,MSG_DONTWAIT,from,fromlen);
+		if(ret > 0 || (ret == 0 && flow->datagram)) return ret;
+		if(ret == 0) flow->eof = STK_TRUE;
+		else
+		if(errno == EWOULDBLOCK || errno == EAGAIN) {
+			/* Rearm so the ring reports more data, blocking flows wait on the ring rather than in recv()
+			 * so the ring's other flows are still received from
+			 */
+			stk_uring_arm_recv(flow);
+			if(!flow->blocking) {
+				stk_uring_enter(ring,0,0);
+				break;
+			}
+		} else
+		if(errno != EINTR) flow->err = errno;
+	}
+	return -1;
+}
+
+/* Return the head buffer received by a flow to the kernel */
+static void stk_uring_pop_buf(stk_uring_flow_t *flow)
+{
+	stk_uring_t *ring = flow->ring;
+	int bid = flow->rcvd_head;
+
+	flow->rcvd_head = ring->buf_next[bid];
+	if(flow->rcvd_head == -1) flow->rcvd_tail = -1;
+	flow->rcvd_offset = 0;
+	stk_uring_recycle_buf(ring,bid);
+}
+
+stk_uint64 stk_uring_recv(stk_uring_flow_t *flow,char *buf,stk_uint64 len,int *err)
+{
+	stk_uring_t *ring = flow->ring;
+	stk_uint64 copied = 0;
+	ssize_t ret;
+
+	*err = 0;
+	ret = stk_uring_recv_wait(flow,buf,len,NULL,NULL);
+	if(ret >= 0) return (stk_uint64) ret;
+
+	while(copied < len && flow->rcvd_head != -1) {
+		int bid = flow->rcvd_head;
+		stk_uint64 avail = ring->buf_len[bid] - flow->rcvd_offset;
+		stk_uint64 n = len - copied < avail ? len - copied : avail;
+
+		memcpy(&buf[copied],&ring->bufs[((size_t) bid * ring->buf_sz) + flow->rcvd_offset],n);
+		copied += n;
+		flow->rcvd_offset += n;
+		flow->rcvd_bytes -= n;
+		if(flow->rcvd_offset == ring->buf_len[bid])
+			stk_uring_pop_buf(flow);
+	}
+
+	if(copied == 0 && flow->err)
+		*err = flow->err;
+	else
+	if(copied == 0 && !flow->eof)
+		*err = EWOULDBLOCK;
+	return copied;
+}
+
+stk_uint64 stk_uring_recvfrom(stk_uring_flow_t *flow,char *buf,stk_uint64 len,struct sockaddr *from,socklen_t *fromlen,int *err)
+{
+	stk_uring_t *ring = flow->ring;
+	struct io_uring_recvmsg_out *out;
+	char *dgram;
+	stk_uint64 n;
+	ssize_t ret;
+
+	*err = 0;
+	ret = stk_uring_recv_wait(flow,buf,len,from,fromlen);
+	if(ret >= 0) return (stk_uint64) ret;
+
+	if(flow->rcvd_head == -1) {
+		*err = flow->err ? flow->err : EWOULDBLOCK;
+		return 0;
+	}
+
+	/* Each buffer holds one datagram, after its header and address */
+	dgram = &ring->bufs[(size_t) flow->rcvd_head * ring->buf_sz];
+	out = (struct io_uring_recvmsg_out *) dgram;
+	if(from) {
+		memcpy(from,&dgram[sizeof(*out)],out->namelen < *fromlen ? out->namelen : *fromlen);
+		*fromlen = out->namelen;
+	}
+	n = out->payloadlen < len ? out->payloadlen : len;
+	memcpy(buf,&dgram[stk_uring_dgram_offset(flow)],n);
+
+	flow->rcvd_bytes -= ring->buf_len[flow->rcvd_head];
+	stk_uring_pop_buf(flow);
+	return n;
+}
+
+int stk_uring_accept(stk_uring_flow_t *flow)
+{
+	int fd;
+
+	if(flow->accepted_count == 0) {
+		errno = EWOULDBLOCK;
+		return -1;
+	}
+	fd = flow->accepted[0];
+	memmove(&flow->accepted[0],&flow->accepted[1],(--flow->accepted_count) * sizeof(int));
+	return fd;
+}
+
+stk_ret stk_uring_send(stk_uring_flow_t *flow,struct iovec *vectors,int num_chunks)
+{
+	stk_uint64 sendsz = 0;
+
+	if(flow->err)
+		return flow->err == EPIPE || flow->err == ECONNRESET ? STK_RESET : STK_SYSERR;
+
+	for(int idx = 0; idx < num_chunks; idx++)
+		sendsz += vectors[idx].iov_len;
+
+	if(flow->sendq_len + sendsz > flow->sendq_sz) {
+		stk_uint64 sz = flow->sendq_sz ? flow->sendq_sz : 4096;
+
+		while(sz < flow->sendq_len + sendsz) sz *= 2;
+		STK_REALLOC(flow->sendq,sz);
+		STK_CHECK_RET(STKA_NET,flow->sendq!=NULL,STK_MEMERR,"grow io_uring send queue of fd %d to %lu bytes",flow->fd,sz);
+		flow->sendq_sz = sz;
+	}
+	for(int idx = 0; idx < num_chunks; idx++) {
+		memcpy(&flow->sendq[flow->sendq_len],vectors[idx].iov_base,vectors[idx].iov_len);
+		flow->sendq_len += vectors[idx].iov_len;
+	}
+
+	if(!flow->send_armed)
+		stk_uring_start_send(flow);
+
+	/* Wait for the peer to receive if too much is queued */
+	while(flow->sendq_len > STK_URING_MAX_QUEUED_SEND && flow->send_armed && !flow->err)
+		stk_uring_wait(flow->ring,1);
+
+	if(flow->err)
+		return flow->err == EPIPE || flow->err == ECONNRESET ? STK_RESET : STK_SYSERR;
+	return STK_SUCCESS;
+}
+
+stk_ret stk_uring_sendto(stk_uring_flow_t *flow,char *buf,stk_uint64 len,struct sockaddr *to,socklen_t tolen)
+{
+	stk_uring_t *ring = flow->ring;
+	stk_uring_dgram_t *dgram = ring->dgram_free;
+	int err = flow->dgram_err;
+
+	flow->dgram_err = 0;
+	if(err)
+		return err == EPIPE ? STK_RESET : STK_SYSERR;
+	STK_CHECK_RET(STKA_NET,tolen <= sizeof(dgram->addr),STK_INVALID_ARG,"send a datagram to an address of %u bytes on fd %d",tolen,flow->fd);
+
+	if(dgram) {
+		ring->dgram_free = dgram->next_free;
+		if(dgram->sz < len) {
+			STK_FREE(dgram);
+			dgram = NULL;
+		}
+	}
+	if(!dgram) {
+		dgram = STK_ALLOC_BUF(sizeof(*dgram) + len);
+		STK_CHECK_RET(STKA_NET,dgram!=NULL,STK_MEMERR,"allocate a datagram of %lu bytes to send on fd %d",len,flow->fd);
+		dgram->sz = len;
+	}
+
+	dgram->flow = flow;
+	memcpy(dgram->data,buf,len);
+	memcpy(&dgram->addr,to,tolen);
+	memset(&dgram->msg,0,sizeof(dgram->msg));
+	dgram->msg.msg_name = &dgram->addr;
+	dgram->msg.msg_namelen = tolen;
+	dgram->iov.iov_base = dgram->data;
+	dgram->iov.iov_len = len;
+	dgram->msg.msg_iov = &dgram->iov;
+	dgram->msg.msg_iovlen = 1;
+	stk_uring_arm_sendmsg(flow,dgram);
+
+	/* Wait for the datagrams in flight to be sent if too many are queued */
+	while(flow->dgram_bytes > STK_URING_MAX_QUEUED_SEND)
+		stk_uring_wait(ring,1);
+	return STK_SUCCESS;
+}
+
+#else
+
+stk_uring_t *stk_create_uring(stk_env_t *env,stk_options_t *options)
+{
+	STK_LOG(STK_LOG_ERROR,"io_uring is not supported on this platform");
+	return NULL;
+}
+
+stk_ret stk_destroy_uring(stk_uring_t *ring) { return STK_SUCCESS; }
+int stk_uring_fd(stk_uring_t *ring) { return -1; }
+stk_ret stk_uring_submit(stk_uring_t *ring) { return STK_SUCCESS; }
+stk_ret stk_uring_process(stk_uring_t *ring,stk_uring_cb cb,void *clientd) { return STK_SUCCESS; }
+stk_bool stk_uring_pending(stk_uring_t *ring) { return STK_FALSE; }
+stk_bool stk_uring_owns_fd(stk_uring_t *ring,int fd) { return STK_FALSE; }
+stk_ret stk_uring_get_stats(stk_uring_t *ring,stk_uring_stats_t *stats) { memset(stats,0,sizeof(*stats)); return STK_SUCCESS; }
+stk_uring_flow_t *stk_uring_attach(stk_uring_t *ring,stk_data_flow_t *df,int fd,int flags) { return NULL; }
+void stk_uring_detach(stk_uring_flow_t *flow) {}
+stk_uring_t *stk_uring_flow_ring(stk_uring_flow_t *flow) { return NULL; }
+stk_uint64 stk_uring_recv(stk_uring_flow_t *flow,char *buf,stk_uint64 len,int *err) { *err = ENOSYS; return 0; }
+stk_uint64 stk_uring_recvfrom(stk_uring_flow_t *flow,char *buf,stk_uint64 len,struct sockaddr *from,socklen_t *fromlen,int *err) { *err = ENOSYS; return 0; }
+stk_uint64 stk_uring_buffered(stk_uring_flow_t *flow) { return 0; }
+int stk_uring_accept(stk_uring_flow_t *flow) { errno = ENOSYS; return -1; }
+stk_ret stk_uring_send(stk_uring_flow_t *flow,struct iovec *vectors,int num_chunks) { return STK_SYSERR; }
+stk_ret stk_uring_sendto(stk_uring_flow_t *flow,char *buf,stk_uint64 len,struct sockaddr *to,socklen_t tolen) { return STK_SYSERR; }
+
+#endif
@@ -0,0 +1,41 @@
+/*
+ * Internal header for data flow modules using the io_uring I/O engine
+ */
+#ifndef STK_URING_INTERNAL_H
+#define STK_URING_INTERNAL_H
+#include "stk_uring.h"
+#include <sys/uio.h>
+#include <sys/socket.h>
+
+/* The state of a socket using a ring, allocated when a data flow attaches its socket */
+typedef struct stk_uring_flow_stct stk_uring_flow_t;
+
+/* Flags for stk_uring_attach() */
+#define STK_URING_ATTACH_LISTENING 0x1 /* Accept connections on the socket */
+#define STK_URING_ATTACH_DATAGRAM  0x2 /* Receive and send datagrams, with the peer's address */
+#define STK_URING_ATTACH_SEND_ONLY 0x4 /* Don't receive, e.g. for udp clients */
+
+/* Attach a data flow's socket to a ring, arming a multishot accept for listening sockets or receive otherwise */
+stk_uring_flow_t *stk_uring_attach(stk_uring_t *ring,stk_data_flow_t *df,int fd,int flags);
+/* Detach a data flow from a ring before its socket is closed, requests in flight are cancelled */
+void stk_uring_detach(stk_uring_flow_t *flow);
+/* The ring a data flow is attached to */
+stk_uring_t *stk_uring_flow_ring(stk_uring_flow_t *flow);
+/* Copy received data in to buf, returns 0 if there is no data (or the peer closed), *err is set on failure.
+ * Receives from blocking sockets wait for data, as recv() would.
+ */
+stk_uint64 stk_uring_recv(stk_uring_flow_t *flow,char *buf,stk_uint64 len,int *err);
+/* Copy the next datagram received in to buf and its sender's address in to from, as recvfrom() would.
+ * Returns 0 with *err set to EWOULDBLOCK if no datagram has been received.
+ */
+stk_uint64 stk_uring_recvfrom(stk_uring_flow_t *flow,char *buf,stk_uint64 len,struct sockaddr *from,socklen_t *fromlen,int *err);
+/* The number of bytes received and not yet copied out, for datagrams this includes their headers */
+stk_uint64 stk_uring_buffered(stk_uring_flow_t *flow);
+/* Get the next accepted socket of a listening data flow, or -1 */
+int stk_uring_accept(stk_uring_flow_t *flow);
+/* Queue data to be sent, returns STK_RESET if the connection was reset */
+stk_ret stk_uring_send(stk_uring_flow_t *flow,struct iovec *vectors,int num_chunks);
+/* Queue a datagram to be sent to an address, a failed send is returned by the next send as for sendto() */
+stk_ret stk_uring_sendto(stk_uring_flow_t *flow,char *buf,stk_uint64 len,struct sockaddr *to,socklen_t tolen);
+
+#endif
@@ -0,0 +1,428 @@
+#include "stk_worker_pool_api.h"
+#include "stk_sequence_api.h"
+#include "stk_internal.h"
+#include "stk_common.h"
+#include "stk_options_api.h"
+#include "stk_sync_api.h"
+#include "stk_clock_api.h"
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#define STK_WORKER_POOL_DEFAULT_WORKERS 4
+#define STK_WORKER_POOL_DEFAULT_QUEUE_SZ 1024
+/* Times a full queue is retried yielding the CPU before sleeping between retries */
+#define STK_WORKER_POOL_FULL_YIELDS 64
+#define STK_WORKER_POOL_FULL_SLEEP_NS 50000
+/* Times a worker polls its empty queue before sleeping */
+#define STK_WORKER_POOL_IDLE_SPINS 128
+
+/* A queue entry. seqno is the position a producer may write the entry at, or
+ * the position + 1 once written, so producers and the worker claim entries
+ * without locks and a full queue is detected without a shared count.
+ */
+typedef struct {
+	volatile stk_uint64 seqno;
+	stk_sequence_t *seq;
+	stk_data_flow_t *df;
+	stk_uint64 queued_us;
+} stk_worker_entry_t;
+
+typedef struct stk_worker_stct {
+	stk_worker_pool_t *pool;
+	int idx;
+	pthread_t thread;
+	stk_bool started;
+	stk_worker_entry_t *entries;
+	stk_uint64 mask;
+	volatile stk_uint64 enqueue_pos;    /* Claimed by dispatching threads */
+	char pad[64];                       /* Keep the worker's fields off the dispatchers' cache line */
+	stk_uint64 dequeue_pos;             /* Owned by the worker */
+	volatile stk_uint64 processed;      /* Sequences processed, for stk_worker_pool_flush() */
+	volatile stk_uint32 sleeping;       /* The worker is, or is about to, wait on cond */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	/* Statistics, those updated by dispatching threads are atomic */
+	volatile stk_uint64 unkeyed;
+	volatile stk_uint64 full;
+	volatile stk_uint64 rejected;
+	volatile stk_uint64 blocked_us;
+	volatile stk_uint64 depth_max;
+	volatile stk_uint64 wait_max_us;
+	volatile stk_uint64 wait[STK_WORKER_POOL_HISTOGRAM_BUCKETS];
+} stk_worker_t;
+
+struct stk_worker_pool_stct {
+	stk_stct_type stct_type;
+	stk_env_t *env;
+	stk_worker_cb cb;
+	void *clientd;
+	int nworkers;
+	stk_worker_t *workers;
+	stk_worker_pool_key_t shard_key;
+	stk_uint64 shard_user_type;
+	volatile stk_uint32 stopping;
+};
+
+static stk_uint64 stk_worker_now_us()
+{
+	struct timeval tv;
+
+	stk_now_precise(&tv);
+	return (stk_uint64) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* Determine if the next entry of a worker's queue has been written */
+static stk_bool stk_worker_ready(stk_worker_t *w)
+{
+	stk_worker_entry_t *e = &w->entries[w->dequeue_pos & w->mask];
+	return stk_atomic_load_64(&e->seqno,STK_MO_SEQ_CST) == w->dequeue_pos + 1;
+}
+
+/* Wake a worker if it is waiting for sequences */
+static void stk_worker_wake(stk_worker_t *w)
+{
+	pthread_mutex_lock(&w->lock);
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+}
+
+static void stk_worker_process(stk_worker_t *w)
+{
+	stk_worker_entry_t *e = &w->entries[w->dequeue_pos & w->mask];
+	stk_sequence_t *seq = e->seq;
+	stk_data_flow_t *df = e->df;
+	stk_uint64 wait_us = stk_worker_now_us() - e->queued_us;
+	int bucket = wait_us ? 64 - __builtin_clzll(wait_us) : 0;
+
+	/* Free the entry for the dispatchers before calling back */
+	stk_atomic_store_64(&e->seqno,w->dequeue_pos + w->mask + 1,STK_MO_RELEASE);
+	w->dequeue_pos++;
+
+	stk_atomic_fetch_add_64(&w->wait[bucket < STK_WORKER_POOL_HISTOGRAM_BUCKETS ? bucket : STK_WORKER_POOL_HISTOGRAM_BUCKETS - 1],1,STK_MO_RELAXED);
+	if(wait_us > w->wait_max_us) stk_atomic_store_64(&w->wait_max_us,wait_us,STK_MO_RELAXED);
+
+	w->pool->cb(w->pool,df,seq,w->pool->clientd);
+
+	STK_CHECK(STKA_SYNC,stk_destroy_sequence(seq)==STK_SUCCESS,"release sequence %p processed by worker %d",seq,w->idx);
+	stk_atomic_fetch_add_64(&w->processed,1,STK_MO_RELEASE);
+}
+
+static void *stk_worker_main(void *arg)
+{
+	stk_worker_t *w = (stk_worker_t *) arg;
+	stk_worker_pool_t *pool = w->pool;
+
+	while(1) {
+		int spins;
+
+		for(spins = 0; spins < STK_WORKER_POOL_IDLE_SPINS && !stk_worker_ready(w); spins++)
+			if(stk_atomic_load_32(&pool->stopping,STK_MO_ACQUIRE)) break;
+
+		if(stk_worker_ready(w)) {
+			stk_worker_process(w);
+			continue;
+		}
+		if(stk_atomic_load_32(&pool->stopping,STK_MO_ACQUIRE)) break;
+
+		/* Dispatchers check sleeping after writing an entry, and the worker checks
+		 * for entries after setting sleeping, so one of them sees the other.
+		 */
+		pthread_mutex_lock(&w->lock);
+		stk_atomic_store_32(&w->sleeping,1,STK_MO_SEQ_CST);
+		if(!stk_worker_ready(w) && !stk_atomic_load_32(&pool->stopping,STK_MO_SEQ_CST))
+			pthread_cond_wait(&w->cond,&w->lock);
+		stk_atomic_store_32(&w->sleeping,0,STK_MO_RELAXED);
+		pthread_mutex_unlock(&w->lock);
+	}
+	return NULL;
+}
+
+static void stk_worker_pool_free(stk_worker_pool_t *pool)
+{
+	for(int idx = 0; idx < pool->nworkers; idx++) {
+		stk_worker_t *w = &pool->workers[idx];
+
+		if(!w->entries) continue;
+		pthread_mutex_destroy(&w->lock);
+		pthread_cond_destroy(&w->cond);
+		STK_FREE(w->entries);
+	}
+	STK_FREE(pool->workers);
+	STK_FREE_STCT(STK_STCT_WORKER_POOL,pool);
+}
+
+static void stk_worker_pool_stop(stk_worker_pool_t *pool)
+{
+	stk_atomic_store_32(&pool->stopping,1,STK_MO_SEQ_CST);
+	for(int idx = 0; idx < pool->nworkers; idx++) {
+		stk_worker_t *w = &pool->workers[idx];
+
+		if(!w->started) continue;
+		stk_worker_wake(w);
+		STK_CHECK(STKA_SYNC,pthread_join(w->thread,NULL)==0,"join worker %d of pool %p",idx,pool);
+		w->started = STK_FALSE;
+	}
+}
+
+stk_worker_pool_t *stk_create_worker_pool(stk_env_t *env,stk_worker_cb cb,void *clientd,stk_options_t *options)
+{
+	char *workers_str = stk_find_option(options,"workers",NULL);
+	char *queue_sz_str = stk_find_option(options,"worker_queue_size",NULL);
+	char *shard_key_str = stk_find_option(options,"shard_key",NULL);
+	char *shard_user_type_str = stk_find_option(options,"shard_user_type",NULL);
+	int queue_sz = queue_sz_str ? atoi(queue_sz_str) : STK_WORKER_POOL_DEFAULT_QUEUE_SZ;
+	stk_uint64 entries = 2;
+	stk_worker_pool_t *pool;
+	int rc;
+
+	STK_CHECK_RET(STKA_SYNC,cb!=NULL,NULL,"create a worker pool without a callback");
+	STK_CHECK_RET(STKA_SYNC,!shard_key_str || !strcasecmp(shard_key_str,"data_flow") || !strcasecmp(shard_key_str,"sequence_id") ||
+		!strcasecmp(shard_key_str,"user_type"),NULL,"create a worker pool with unknown shard_key '%s'",shard_key_str);
+	STK_CHECK_RET(STKA_SYNC,!shard_key_str || strcasecmp(shard_key_str,"user_type") || shard_user_type_str,NULL,
+		"create a worker pool keyed by user_type without a shard_user_type");
+
+	STK_CALLOC_STCT(STK_STCT_WORKER_POOL,stk_worker_pool_t,pool);
+	if(!pool) return NULL;
+
+	pool->env = env;
+	pool->cb = cb;
+	pool->clientd = clientd;
+	pool->nworkers = workers_str ? atoi(workers_str) : STK_WORKER_POOL_DEFAULT_WORKERS;
+	if(pool->nworkers < 1) pool->nworkers = 1;
+	if(shard_key_str && !strcasecmp(shard_key_str,"sequence_id"))
+		pool->shard_key = STK_WORKER_POOL_KEY_SEQUENCE_ID;
+	else
+	if(shard_key_str && !strcasecmp(shard_key_str,"user_type")) {
+		pool->shard_key = STK_WORKER_POOL_KEY_USER_TYPE;
+		pool->shard_user_type = strtoull(shard_user_type_str,NULL,0);
+	} else
+		pool->shard_key = STK_WORKER_POOL_KEY_DATA_FLOW;
+	while(entries < (stk_uint64) queue_sz) entries *= 2;
+
+	pool->workers = STK_CALLOC(pool->nworkers * sizeof(stk_worker_t));
+	if(!pool->workers) {
+		STK_FREE_STCT(STK_STCT_WORKER_POOL,pool);
+		return NULL;
+	}
+
+	for(int idx = 0; idx < pool->nworkers; idx++) {
+		stk_worker_t *w = &pool->workers[idx];
+
+		w->pool = pool;
+		w->idx = idx;
+		w->mask = entries - 1;
+		w->entries = STK_CALLOC(entries * sizeof(stk_worker_entry_t));
+		if(!w->entries) {
+			STK_LOG(STK_LOG_ERROR,"allocate queue of %lu sequences for worker %d",entries,idx);
+			stk_worker_pool_stop(pool);
+			stk_worker_pool_free(pool);
+			return NULL;
+		}
+		for(stk_uint64 pos = 0; pos < entries; pos++)
+			w->entries[pos].seqno = pos;
+		pthread_mutex_init(&w->lock,NULL);
+		pthread_cond_init(&w->cond,NULL);
+
+		rc = pthread_create(&w->thread,NULL,stk_worker_main,w);
+		if(rc != 0) {
+			STK_LOG(STK_LOG_ERROR,"start worker %d thread, rc %d",idx,rc);
+			stk_worker_pool_stop(pool);
+			stk_worker_pool_free(pool);
+			return NULL;
+		}
+		w->started = STK_TRUE;
+	}
+	return pool;
+}
+
+stk_ret stk_destroy_worker_pool(stk_worker_pool_t *pool)
+{
+	STK_ASSERT(STKA_SYNC,pool->stct_type==STK_STCT_WORKER_POOL,"destroy a worker pool, the pointer was to a structure of type %d",pool->stct_type);
+
+	/* Workers drain their queues before exiting */
+	stk_worker_pool_stop(pool);
+	stk_worker_pool_free(pool);
+	return STK_SUCCESS;
+}
+
+/* Claim and write an entry in a worker's queue, returns STK_FALSE if the queue is full */
+static stk_bool stk_worker_enqueue(stk_worker_t *w,stk_data_flow_t *df,stk_sequence_t *seq)
+{
+	stk_uint64 pos = stk_atomic_load_64(&w->enqueue_pos,STK_MO_RELAXED);
+	stk_worker_entry_t *e;
+	stk_uint64 depth;
+
+	while(1) {
+		long long diff;
+
+		e = &w->entries[pos & w->mask];
+		diff = (long long) (stk_atomic_load_64(&e->seqno,STK_MO_ACQUIRE) - pos);
+		if(diff == 0) {
+			if(stk_atomic_cas_64(&w->enqueue_pos,&pos,pos + 1,STK_MO_RELAXED)) break;
+		} else
+		if(diff < 0)
+			return STK_FALSE; /* The worker has not processed the entry a lap behind */
+		else
+			pos = stk_atomic_load_64(&w->enqueue_pos,STK_MO_RELAXED);
+	}
+
+	e->seq = seq;
+	e->df = df;
+	e->queued_us = stk_worker_now_us();
+	stk_atomic_store_64(&e->seqno,pos + 1,STK_MO_SEQ_CST);
+
+	depth = pos + 1 - stk_atomic_load_64(&w->processed,STK_MO_RELAXED);
+	{
+	stk_uint64 depth_max = stk_atomic_load_64(&w->depth_max,STK_MO_RELAXED);
+	while(depth > depth_max && !stk_atomic_cas_64(&w->depth_max,&depth_max,depth,STK_MO_RELAXED));
+	}
+
+	if(stk_atomic_load_32(&w->sleeping,STK_MO_SEQ_CST))
+		stk_worker_wake(w);
+	return STK_TRUE;
+}
+
+/* Sequences with the same key always go to the same worker to keep them in order */
+static stk_worker_t *stk_worker_for_key(stk_worker_pool_t *pool,stk_uint64 key)
+{
+	return &pool->workers[((key * 0x9E3779B97F4A7C15ULL) >> 32) % (stk_uint64) pool->nworkers];
+}
+
+/* FNV-1a, so keys of any length spread across the workers */
+static stk_uint64 stk_worker_hash_data(unsigned char *data,stk_uint64 sz)
+{
+	stk_uint64 hash = 0xCBF29CE484222325ULL;
+
+	for(stk_uint64 idx = 0; idx < sz; idx++) {
+		hash ^= data[idx];
+		hash *= 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+stk_ret stk_worker_pool_dispatch(stk_worker_pool_t *pool,stk_data_flow_t *df,stk_sequence_t *seq,int flags)
+{
+	STK_ASSERT(STKA_SYNC,pool->stct_type==STK_STCT_WORKER_POOL,"dispatch to a worker pool, the pointer was to a structure of type %d",pool->stct_type);
+
+	switch(pool->shard_key) {
+	case STK_WORKER_POOL_KEY_SEQUENCE_ID:
+		return stk_worker_pool_dispatch_key(pool,df,seq,stk_get_sequence_id(seq),flags);
+
+	case STK_WORKER_POOL_KEY_USER_TYPE:
+		{
+		void *data;
+		stk_uint64 sz;
+
+		if(stk_sequence_find_data_by_type(seq,pool->shard_user_type,&data,&sz) == STK_SUCCESS)
+			return stk_worker_pool_dispatch_key(pool,df,seq,stk_worker_hash_data(data,sz),flags);
+
+		stk_atomic_fetch_add_64(&stk_worker_for_key(pool,(stk_uint64) (uintptr_t) df)->unkeyed,1,STK_MO_RELAXED);
+		}
+		/* Fall through - key sequences without the element by their data flow */
+
+	case STK_WORKER_POOL_KEY_DATA_FLOW:
+	default:
+		return stk_worker_pool_dispatch_key(pool,df,seq,(stk_uint64) (uintptr_t) df,flags);
+	}
+}
+
+stk_ret stk_worker_pool_dispatch_key(stk_worker_pool_t *pool,stk_data_flow_t *df,stk_sequence_t *seq,stk_uint64 key,int flags)
+{
+	stk_worker_t *w;
+	stk_uint64 blocked_at = 0;
+
+	STK_ASSERT(STKA_SYNC,pool->stct_type==STK_STCT_WORKER_POOL,"dispatch to a worker pool, the pointer was to a structure of type %d",pool->stct_type);
+
+	w = stk_worker_for_key(pool,key);
+
+	stk_hold_sequence(seq);
+	for(int attempts = 0; !stk_worker_enqueue(w,df,seq); attempts++) {
+		if(attempts == 0) {
+			stk_atomic_fetch_add_64(&w->full,1,STK_MO_RELAXED);
+			if(flags & STK_WORKER_POOL_NONBLOCK) {
+				stk_atomic_fetch_add_64(&w->rejected,1,STK_MO_RELAXED);
+				STK_CHECK(STKA_SYNC,stk_destroy_sequence(seq)==STK_SUCCESS,"release hold on rejected sequence %p",seq);
+				return STK_WOULDBLOCK;
+			}
+			blocked_at = stk_worker_now_us();
+		}
+
+		/* Backpressure - wait for the worker to make space */
+		if(attempts < STK_WORKER_POOL_FULL_YIELDS)
+			sched_yield();
+		else {
+			struct timespec ts = { 0, STK_WORKER_POOL_FULL_SLEEP_NS };
+			nanosleep(&ts,NULL);
+		}
+	}
+	if(blocked_at)
+		stk_atomic_fetch_add_64(&w->blocked_us,stk_worker_now_us() - blocked_at,STK_MO_RELAXED);
+	return STK_SUCCESS;
+}
+
+stk_ret stk_worker_pool_flush(stk_worker_pool_t *pool)
+{
+	STK_ASSERT(STKA_SYNC,pool->stct_type==STK_STCT_WORKER_POOL,"flush a worker pool, the pointer was to a structure of type %d",pool->stct_type);
+
+	for(int idx = 0; idx < pool->nworkers; idx++) {
+		stk_worker_t *w = &pool->workers[idx];
+		stk_uint64 dispatched = stk_atomic_load_64(&w->enqueue_pos,STK_MO_ACQUIRE);
+
+		for(int attempts = 0; stk_atomic_load_64(&w->processed,STK_MO_ACQUIRE) < dispatched; attempts++) {
+			if(attempts < STK_WORKER_POOL_FULL_YIELDS)
+				sched_yield();
+			else {
+				struct timespec ts = { 0, STK_WORKER_POOL_FULL_SLEEP_NS };
+				nanosleep(&ts,NULL);
+			}
+		}
+	}
+	return STK_SUCCESS;
+}
+
+int stk_worker_pool_workers(stk_worker_pool_t *pool) { return pool->nworkers; }
+
+/* Add the statistics of a worker to stats */
+static void stk_worker_add_stats(stk_worker_t *w,stk_worker_pool_stats_t *stats)
+{
+	stk_uint64 processed = stk_atomic_load_64(&w->processed,STK_MO_ACQUIRE);
+	stk_uint64 dispatched = stk_atomic_load_64(&w->enqueue_pos,STK_MO_RELAXED);
+	stk_uint64 depth_max = stk_atomic_load_64(&w->depth_max,STK_MO_RELAXED);
+	stk_uint64 wait_max_us = stk_atomic_load_64(&w->wait_max_us,STK_MO_RELAXED);
+
+	stats->dispatched += dispatched;
+	stats->processed += processed;
+	stats->depth += dispatched - processed;
+	stats->unkeyed += stk_atomic_load_64(&w->unkeyed,STK_MO_RELAXED);
+	stats->full += stk_atomic_load_64(&w->full,STK_MO_RELAXED);
+	stats->rejected += stk_atomic_load_64(&w->rejected,STK_MO_RELAXED);
+	stats->blocked_us += stk_atomic_load_64(&w->blocked_us,STK_MO_RELAXED);
+	if(depth_max > stats->depth_max) stats->depth_max = depth_max;
+	if(wait_max_us > stats->wait_max_us) stats->wait_max_us = wait_max_us;
+	for(int bucket = 0; bucket < STK_WORKER_POOL_HISTOGRAM_BUCKETS; bucket++)
+		stats->wait[bucket] += stk_atomic_load_64(&w->wait[bucket],STK_MO_RELAXED);
+}
+
+stk_ret stk_worker_pool_get_stats(stk_worker_pool_t *pool,stk_worker_pool_stats_t *stats)
+{
+	STK_ASSERT(STKA_SYNC,pool->stct_type==STK_STCT_WORKER_POOL,"get stats of a worker pool, the pointer was to a structure of type %d",pool->stct_type);
+
+	memset(stats,0,sizeof(*stats));
+	for(int idx = 0; idx < pool->nworkers; idx++)
+		stk_worker_add_stats(&pool->workers[idx],stats);
+	return STK_SUCCESS;
+}
+
+stk_ret stk_worker_pool_get_worker_stats(stk_worker_pool_t *pool,int idx,stk_worker_pool_stats_t *stats)
+{
+	STK_ASSERT(STKA_SYNC,pool->stct_type==STK_STCT_WORKER_POOL,"get worker stats of a worker pool, the pointer was to a structure of type %d",pool->stct_type);
+	STK_CHECK_RET(STKA_SYNC,idx >= 0 && idx < pool->nworkers,STK_INVALID_ARG,"get stats of worker %d of a pool of %d",idx,pool->nworkers);
+
+	memset(stats,0,sizeof(*stats));
+	stk_worker_add_stats(&pool->workers[idx],stats);
+	return STK_SUCCESS;
+}
@@ -0,0 +1,442 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "stk_env_api.h"
+#include "stk_timer_api.h"
+#include "stk_sync_api.h"
+#include "stk_tcp_server_api.h"
+#include "stk_tcp_client_api.h"
+#include "stk_rawudp_api.h"
+#include "stk_sequence_api.h"
+#include "stk_data_flow_api.h"
+#include "stk_tcp.h"
+#include "eg_dispatcher_api.h"
+#include "stk_test.h"
+
+/* More than the 500 fds a poll() dispatcher is limited to */
+#define DISPATCHER_TEST_FDS 1200
+
+int hangups;
+int hangups_expected;
+int dummy_flow; /* Hangups are only called back for fds with a data flow */
+
+void test_hup_cb(stk_dispatcher_t *d,stk_data_flow_t *flow,int fd)
+{
+	int removed;
+
+	TEST_ASSERT(flow==(stk_data_flow_t *) &dummy_flow,"Unexpected data flow %p for fd %d",flow,fd);
+	removed = dispatch_remove_fd(d,fd);
+	TEST_ASSERT(removed != -1,"Failed to remove fd %d from dispatcher",fd);
+	close(fd);
+
+	if(++hangups == hangups_expected)
+		stop_dispatching(d);
+}
+
+/* Add many copies of the read end of a pipe, remove half of them and check
+ * the rest are hung up when the write end is closed
+ */
+void hangup_tests(stk_dispatcher_t *d,stk_env_t *stkbase,int nfds)
+{
+	int fds[DISPATCHER_TEST_FDS];
+	int pipe_fds[2];
+	int rc;
+
+	rc = pipe(pipe_fds);
+	TEST_ASSERT(rc!=-1,"Failed to create pipe");
+
+	for(int i = 0; i < nfds; i++) {
+		fds[i] = dup(pipe_fds[0]);
+		TEST_ASSERT(fds[i]!=-1,"Failed to dup fd %d",i);
+		rc = dispatch_add_fd(d,(stk_data_flow_t *) &dummy_flow,fds[i],test_hup_cb,NULL);
+		TEST_ASSERT(rc==0,"Failed to add fd %d (%d) to dispatcher",i,fds[i]);
+	}
+	close(pipe_fds[0]);
+
+	for(int i = 0; i < nfds; i += 2) {
+		rc = dispatch_remove_fd(d,fds[i]);
+		TEST_ASSERT(rc!=-1,"Failed to remove fd %d from dispatcher",fds[i]);
+	}
+
+	hangups = 0;
+	hangups_expected = nfds / 2;
+	close(pipe_fds[1]);
+	client_dispatcher_timed(d,stkbase,NULL,2000);
+	TEST_ASSERT(hangups==hangups_expected,"Received %d hangups, expected %d",hangups,hangups_expected);
+
+	for(int i = 0; i < nfds; i += 2)
+		close(fds[i]);
+}
+
+/* Hangups found while spinning are dispatched without sleeping, and an idle dispatcher
+ * sleeps once its spin budget is spent
+ */
+void busy_poll_tests(stk_env_t *stkbase)
+{
+	stk_dispatcher_t *d = alloc_dispatcher();
+	stk_uint64 spin_polls, spin_hits, sleeps;
+
+	TEST_ASSERT(d!=NULL,"Failed to allocate dispatcher");
+	TEST_ASSERT(dispatch_set_busy_poll(d,-1,0)==-1,"Set a negative spin budget");
+	TEST_ASSERT(dispatch_set_busy_poll(d,1000000,0)==0,"Failed to set busy poll");
+
+	hangup_tests(d,stkbase,100);
+	dispatcher_spin_stats(d,&spin_polls,&spin_hits,&sleeps);
+	TEST_ASSERT(spin_hits > 0 && spin_polls >= spin_hits,"Hangups not found while spinning, %lu polls %lu hits",spin_polls,spin_hits);
+
+	TEST_ASSERT(dispatch_set_busy_poll(d,100,0)==0,"Failed to set busy poll");
+	client_dispatcher_timed(d,stkbase,NULL,50);
+	dispatcher_spin_stats(d,&spin_polls,&spin_hits,&sleeps);
+	TEST_ASSERT(sleeps > 0,"Idle dispatcher did not sleep after spinning, %lu polls",spin_polls);
+
+	/* Spinning stops at the earliest timer */
+	{
+	struct timeval start, end;
+
+	TEST_ASSERT(dispatch_set_busy_poll(d,1000000,0)==0,"Failed to set busy poll");
+	gettimeofday(&start,NULL);
+	client_dispatcher_timed(d,stkbase,NULL,20);
+	gettimeofday(&end,NULL);
+	TEST_ASSERT(((end.tv_sec - start.tv_sec) * 1000) + ((end.tv_usec - start.tv_usec) / 1000) < 500,"Timer fired late while spinning");
+	}
+
+	terminate_dispatcher(d);
+	free_dispatcher(d);
+}
+
+#define BUDGET_HOT_SEQS 400
+#define BUDGET_COLD_SEQS 10
+#define BUDGET_SEQS 16
+
+stk_dispatcher_t *budget_d;
+int hot_rcvd, cold_rcvd, hot_rcvd_at_cold_done, udp_rcvd;
+
+/* The hot client's sequences are numbered from 1, the cold client's from 1001 */
+void budget_data_cb(stk_dispatcher_t *d,stk_data_flow_t *df,stk_sequence_t *seq)
+{
+	stk_sequence_id id = stk_get_sequence_id(seq);
+
+	if(stk_get_sequence_type(seq) != STK_SEQUENCE_TYPE_DATA) return;
+	if(id > 1000) {
+		TEST_ASSERT(id==(stk_sequence_id) cold_rcvd + 1001,"Cold client sequence %lu, expected %d",id,cold_rcvd + 1001);
+		if(++cold_rcvd == BUDGET_COLD_SEQS) hot_rcvd_at_cold_done = hot_rcvd;
+	} else {
+		TEST_ASSERT(id==(stk_sequence_id) hot_rcvd + 1,"Hot client sequence %lu, expected %d",id,hot_rcvd + 1);
+		hot_rcvd++;
+	}
+}
+
+void budget_udp_cb(stk_dispatcher_t *d,stk_data_flow_t *df,stk_sequence_t *seq)
+{
+	udp_rcvd++;
+}
+
+void budget_fd_created_cb(stk_data_flow_t *df,stk_data_flow_id id,int fd)
+{
+	int rc = 0;
+
+	/* The clients only send */
+	switch(stk_get_data_flow_type(df)) {
+	case STK_TCP_SERVER_FLOW: rc = server_dispatch_add_fd(budget_d,fd,df,budget_data_cb); break;
+	case STK_TCP_ACCEPTED_FLOW: rc = dispatch_add_accepted_fd(budget_d,fd,df,budget_data_cb); break;
+	default: break;
+	}
+	TEST_ASSERT(rc==0,"Failed to add fd %d to dispatcher",fd);
+}
+
+void budget_fd_destroyed_cb(stk_data_flow_t *df,stk_data_flow_id id,int fd)
+{
+	if(stk_get_data_flow_type(df) == STK_TCP_SERVER_FLOW || stk_get_data_flow_type(df) == STK_TCP_ACCEPTED_FLOW)
+		dispatch_remove_fd(budget_d,fd);
+}
+
+void budget_send(stk_env_t *stkbase,stk_data_flow_t *df,int nseqs,stk_sequence_id first_id)
+{
+	for(int i = 0; i < nseqs; i++) {
+		stk_sequence_t *seq = stk_create_sequence(stkbase,NULL,first_id + i,STK_SEQUENCE_TYPE_DATA,STK_SERVICE_TYPE_DATA,NULL);
+		char data[32] = { 0 };
+		stk_ret rc;
+
+		TEST_ASSERT(seq!=NULL,"Failed to create sequence %d",i);
+		rc = stk_copy_to_sequence(seq,data,sizeof(data),0x1);
+		TEST_ASSERT(rc==STK_SUCCESS,"Failed to copy to sequence %d",i);
+		rc = stk_data_flow_send(df,seq,0);
+		TEST_ASSERT(rc==STK_SUCCESS,"Failed to send sequence %d",i);
+		stk_destroy_sequence(seq);
+	}
+}
+
+/* A connection with a backlog is drained a budget at a time, taking turns with a quieter connection,
+ * and a rawudp listener is drained until EWOULDBLOCK without receiving a datagram twice
+ */
+void rcv_budget_tests(stk_env_t *stkbase)
+{
+	stk_options_t server_options[] = { { "bind_address", "127.0.0.1"}, {"bind_port", "29317"}, { "reuseaddr", (void *) STK_TRUE},
+		{ "fd_created_cb", (void *) budget_fd_created_cb }, { "fd_destroyed_cb", (void *) budget_fd_destroyed_cb }, { NULL, NULL } };
+	stk_options_t client_options[] = { { "connect_address", "127.0.0.1"}, {"connect_port", "29317"}, { "nodelay", (void *) STK_TRUE},
+		{ "fd_created_cb", (void *) budget_fd_created_cb }, { "fd_destroyed_cb", (void *) budget_fd_destroyed_cb }, { NULL, NULL } };
+	stk_options_t listener_options[] = { { "bind_address", "127.0.0.1"}, {"bind_port", "29318"}, {"reuseaddr", NULL},
+		{ "receive_buffer_size", "1024000" }, { NULL, NULL } };
+	stk_options_t sender_options[] = { { "destination_address", "127.0.0.1"}, {"destination_port", "29318"}, { NULL, NULL } };
+	stk_data_flow_t *server_df, *hot_df, *cold_df, *listener_df, *sender_df;
+	stk_uint64 events, seqs, exhausted;
+	stk_ret rc;
+
+	budget_d = alloc_dispatcher();
+	TEST_ASSERT(budget_d!=NULL,"Failed to allocate dispatcher");
+	TEST_ASSERT(dispatch_set_rcv_budget(budget_d,-1,0)==-1,"Set a negative receive budget");
+	TEST_ASSERT(dispatch_set_rcv_budget(budget_d,BUDGET_SEQS,0)==0,"Failed to set receive budget");
+
+	server_df = stk_tcp_server_create_data_flow(stkbase,"budget server",1,server_options);
+	TEST_ASSERT(server_df!=NULL,"Failed to create listening data flow");
+	hot_df = stk_tcp_client_create_data_flow(stkbase,"budget hot client",2,client_options);
+	TEST_ASSERT(hot_df!=NULL,"Failed to create hot client data flow");
+	cold_df = stk_tcp_client_create_data_flow(stkbase,"budget cold client",3,client_options);
+	TEST_ASSERT(cold_df!=NULL,"Failed to create cold client data flow");
+
+	/* Accept both connections before they have data */
+	client_dispatcher_timed(budget_d,stkbase,NULL,50);
+
+	budget_send(stkbase,hot_df,BUDGET_HOT_SEQS,1);
+	budget_send(stkbase,cold_df,BUDGET_COLD_SEQS,1001);
+
+	for(int i = 0; i < 100 && (hot_rcvd < BUDGET_HOT_SEQS || cold_rcvd < BUDGET_COLD_SEQS); i++)
+		client_dispatcher_timed(budget_d,stkbase,NULL,10);
+	TEST_ASSERT(hot_rcvd==BUDGET_HOT_SEQS && cold_rcvd==BUDGET_COLD_SEQS,"Received %d hot and %d cold sequences",hot_rcvd,cold_rcvd);
+	TEST_ASSERT(hot_rcvd_at_cold_done < BUDGET_HOT_SEQS / 2,"Cold connection waited for %d hot sequences",hot_rcvd_at_cold_done);
+
+	dispatcher_rcv_stats(budget_d,&events,&seqs,&exhausted);
+	TEST_ASSERT(seqs==BUDGET_HOT_SEQS + BUDGET_COLD_SEQS,"Dispatcher counted %lu sequences received",seqs);
+	TEST_ASSERT(exhausted >= BUDGET_HOT_SEQS / BUDGET_SEQS - 1,"Budget spent %lu times",exhausted);
+	TEST_ASSERT(events < seqs / 4,"%lu receive events for %lu sequences",events,seqs);
+
+	/* A budget of bytes */
+	TEST_ASSERT(dispatch_set_rcv_budget(budget_d,0,1024)==0,"Failed to set receive budget");
+	budget_send(stkbase,hot_df,BUDGET_HOT_SEQS,BUDGET_HOT_SEQS + 1);
+	for(int i = 0; i < 100 && hot_rcvd < BUDGET_HOT_SEQS * 2; i++)
+		client_dispatcher_timed(budget_d,stkbase,NULL,10);
+	TEST_ASSERT(hot_rcvd==BUDGET_HOT_SEQS * 2,"Received %d hot sequences",hot_rcvd);
+	{
+	stk_uint64 exhausted_before = exhausted;
+
+	dispatcher_rcv_stats(budget_d,&events,&seqs,&exhausted);
+	TEST_ASSERT(exhausted - exhausted_before >= BUDGET_HOT_SEQS * 32 / 1024 - 1,"Byte budget spent %lu times",exhausted - exhausted_before);
+	}
+
+	/* The accepted data flows are destroyed when the clients close */
+	rc = stk_destroy_data_flow(hot_df);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy hot client data flow");
+	rc = stk_destroy_data_flow(cold_df);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy cold client data flow");
+	client_dispatcher_timed(budget_d,stkbase,NULL,50);
+	rc = stk_destroy_data_flow(server_df);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy listening data flow");
+
+	/* Datagrams are received once each, the listener is drained until EWOULDBLOCK */
+	listener_df = stk_rawudp_listener_create_data_flow(stkbase,"budget udp listener",4,listener_options);
+	TEST_ASSERT(listener_df!=NULL,"Failed to create rawudp listener data flow");
+	TEST_ASSERT(dispatch_add_fd(budget_d,listener_df,stk_rawudp_listener_fd(listener_df),NULL,budget_udp_cb)==0,"Failed to add rawudp listener");
+	sender_df = stk_rawudp_client_create_data_flow(stkbase,"budget udp sender",5,sender_options);
+	TEST_ASSERT(sender_df!=NULL,"Failed to create rawudp client data flow");
+
+	TEST_ASSERT(dispatch_set_rcv_budget(budget_d,BUDGET_SEQS,0)==0,"Failed to set receive budget");
+	budget_send(stkbase,sender_df,50,1);
+	client_dispatcher_timed(budget_d,stkbase,NULL,100);
+	TEST_ASSERT(udp_rcvd==50,"Received %d of 50 datagrams",udp_rcvd);
+
+	dispatch_remove_fd(budget_d,stk_rawudp_listener_fd(listener_df));
+	rc = stk_destroy_data_flow(sender_df);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy rawudp client data flow");
+	rc = stk_destroy_data_flow(listener_df);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy rawudp listener data flow");
+
+	terminate_dispatcher(budget_d);
+	free_dispatcher(budget_d);
+}
+
+#define REACTORS 4
+#define REACTOR_TEST_FDS 40
+
+eg_reactors_t *reactors;
+volatile stk_uint32 reactor_hangups[REACTORS];
+volatile stk_uint32 reactor_timers_fired[REACTORS];
+
+int reactor_idx(stk_dispatcher_t *d)
+{
+	for(int i = 0; i < REACTORS; i++)
+		if(reactor_dispatcher(reactors,i) == d) return i;
+	return -1;
+}
+
+/* Hangups must be called back on the thread of the reactor the fd was added to */
+void reactor_hup_cb(stk_dispatcher_t *d,stk_data_flow_t *flow,int fd)
+{
+	int idx = reactor_idx(d);
+
+	TEST_ASSERT(idx!=-1,"Hangup on unknown dispatcher %p",d);
+	TEST_ASSERT(current_dispatcher()==d,"Hangup for reactor %d on another thread",idx);
+	dispatch_remove_fd(d,fd);
+	close(fd);
+	stk_atomic_fetch_add_32(&reactor_hangups[idx],1,STK_MO_RELAXED);
+}
+
+void reactor_timer_cb(stk_timer_set_t *timer_set,stk_timer_t *timer,int id,void *userdata,void * user_setdata, stk_timer_cb_type cb_type)
+{
+	stk_dispatcher_t *d = (stk_dispatcher_t *) user_setdata;
+
+	TEST_ASSERT(cb_type==STK_TIMER_EXPIRED,"Reactor timer %d cancelled",id);
+	TEST_ASSERT(current_dispatcher()==d,"Timer for reactor %d called back on another thread",id);
+	stk_atomic_fetch_add_32(&reactor_timers_fired[id],1,STK_MO_RELAXED);
+}
+
+stk_uint32 reactor_total(volatile stk_uint32 *counts)
+{
+	stk_uint32 total = 0;
+	for(int i = 0; i < REACTORS; i++)
+		total += stk_atomic_load_32(&counts[i],STK_MO_RELAXED);
+	return total;
+}
+
+/* fds added by the main thread are handed off to reactors round robin and hung up on their threads */
+void reactor_tests(stk_env_t *stkbase)
+{
+	int pipe_fds[REACTOR_TEST_FDS][2];
+	int rc;
+
+	reactors = alloc_reactors(stkbase,REACTORS);
+	TEST_ASSERT(reactors!=NULL,"Failed to allocate reactors");
+	TEST_ASSERT(reactor_count(reactors)==REACTORS,"Unexpected reactor count %d",reactor_count(reactors));
+	rc = start_reactors(reactors);
+	TEST_ASSERT(rc==0,"Failed to start reactors");
+	TEST_ASSERT(current_dispatcher()==default_dispatcher(),"Main thread is not using the default dispatcher");
+
+	/* The first reactor dispatches the env timers, so env wakeups go to it */
+	{
+	stk_uint64 issued, suppressed, issued_before, suppressed_before;
+
+	dispatcher_wakeup_stats(reactor_dispatcher(reactors,0),&issued_before,&suppressed_before);
+	wakeup_dispatcher(stkbase);
+	dispatcher_wakeup_stats(reactor_dispatcher(reactors,0),&issued,&suppressed);
+	TEST_ASSERT(issued + suppressed == issued_before + suppressed_before + 1,"env wakeup did not wake the first reactor");
+	}
+
+	for(int i = 0; i < REACTOR_TEST_FDS; i++) {
+		rc = pipe(pipe_fds[i]);
+		TEST_ASSERT(rc!=-1,"Failed to create pipe %d",i);
+		rc = dispatch_add_fd(next_reactor(reactors),(stk_data_flow_t *) &dummy_flow,pipe_fds[i][0],reactor_hup_cb,NULL);
+		TEST_ASSERT(rc==0,"Failed to add fd %d to reactor",pipe_fds[i][0]);
+	}
+	for(int i = 0; i < REACTOR_TEST_FDS; i++)
+		close(pipe_fds[i][1]);
+
+	for(int i = 0; i < REACTORS; i++) {
+		stk_timer_set_t *timers = reactor_timer_set(reactor_dispatcher(reactors,i));
+		TEST_ASSERT(timers!=NULL,"Reactor %d has no timer set",i);
+		TEST_ASSERT(stk_schedule_timer(timers,reactor_timer_cb,i,NULL,10)!=NULL,"Failed to schedule timer on reactor %d",i);
+	}
+
+	for(int waited = 0; waited < 2000 && (reactor_total(reactor_hangups) < REACTOR_TEST_FDS || reactor_total(reactor_timers_fired) < REACTORS); waited += 10)
+		usleep(10000);
+
+	for(int i = 0; i < REACTORS; i++) {
+		TEST_ASSERT(reactor_hangups[i]==REACTOR_TEST_FDS / REACTORS,"Reactor %d received %u hangups",i,reactor_hangups[i]);
+		TEST_ASSERT(reactor_timers_fired[i]==1,"Reactor %d fired %u timers",i,reactor_timers_fired[i]);
+	}
+
+	stop_reactors(reactors);
+	free_reactors(reactors);
+}
+
+/* Listening data flows may share a port with "reuseport", so each reactor may accept its own connections */
+void reuseport_tests(stk_env_t *stkbase)
+{
+	stk_options_t options[] = { { "bind_address", "127.0.0.1"}, {"bind_port", "29313"}, {"reuseport", (void *) STK_TRUE}, { NULL, NULL } };
+	stk_data_flow_t *df[REACTORS];
+
+	for(int i = 0; i < REACTORS; i++) {
+		df[i] = stk_tcp_server_create_data_flow(stkbase,"reuseport server",i,options);
+		TEST_ASSERT(df[i]!=NULL,"Failed to create listening data flow %d on a shared port",i);
+	}
+	for(int i = 0; i < REACTORS; i++)
+		TEST_ASSERT(stk_destroy_data_flow(df[i])==STK_SUCCESS,"Failed to destroy listening data flow %d",i);
+}
+
+void wakeup_timer_cb(stk_timer_set_t *timer_set,stk_timer_t *timer,int id,void *userdata,void * user_setdata, stk_timer_cb_type cb_type)
+{
+}
+
+/* Scheduling timers wakes the default dispatcher only for timers earlier than it knows of,
+ * and wakeups are coalesced until the dispatcher next runs
+ */
+void wakeup_tests(stk_env_t *stkbase)
+{
+	stk_timer_set_t *timers;
+	stk_uint64 issued, suppressed, issued_before, suppressed_before;
+	stk_ret rc;
+
+	timers = stk_new_timer_set(stkbase,NULL,0,STK_TRUE);
+	TEST_ASSERT(timers!=NULL,"Failed to create timer set");
+
+	/* Let the dispatcher see the earliest timer */
+	client_dispatcher_poll(default_dispatcher(),stkbase,NULL);
+	dispatcher_wakeup_stats(default_dispatcher(),&issued_before,&suppressed_before);
+
+	/* Later timers than the first do not wake the dispatcher */
+	for(int i = 0; i < 1000; i++)
+		TEST_ASSERT(stk_schedule_timer(timers,wakeup_timer_cb,i,NULL,10000 + i)!=NULL,"Failed to schedule timer %d",i);
+	dispatcher_wakeup_stats(default_dispatcher(),&issued,&suppressed);
+	TEST_ASSERT(issued==issued_before + 1 && suppressed==suppressed_before,"Unexpected wakeups issued %lu suppressed %lu after scheduling later timers",
+		issued - issued_before,suppressed - suppressed_before);
+
+	/* Earlier timers wake the dispatcher, but only one wakeup is written until it runs */
+	for(int i = 0; i < 100; i++)
+		TEST_ASSERT(stk_schedule_timer(timers,wakeup_timer_cb,i,NULL,9000 - i)!=NULL,"Failed to schedule timer %d",i);
+	dispatcher_wakeup_stats(default_dispatcher(),&issued,&suppressed);
+	TEST_ASSERT(issued==issued_before + 1 && suppressed==suppressed_before + 100,"Unexpected wakeups issued %lu suppressed %lu after scheduling earlier timers",
+		issued - issued_before,suppressed - suppressed_before);
+
+	client_dispatcher_poll(default_dispatcher(),stkbase,NULL);
+	TEST_ASSERT(stk_schedule_timer(timers,wakeup_timer_cb,0,NULL,10)!=NULL,"Failed to schedule timer");
+	dispatcher_wakeup_stats(default_dispatcher(),&issued,&suppressed);
+	TEST_ASSERT(issued==issued_before + 2,"Wakeup not written after the dispatcher ran, issued %lu",issued - issued_before);
+
+	rc = stk_free_timer_set(timers,STK_TRUE);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to free timer set");
+}
+
+int main(int argc,char *argv[])
+{
+	stk_env_t *stkbase;
+	stk_dispatcher_t *d;
+	stk_ret rc;
+
+	{
+	stk_options_t options[] = { { "inhibit_name_service", (void *)STK_TRUE}, { "wakeup_cb", (void *) wakeup_dispatcher}, { NULL, NULL } };
+
+	stkbase = stk_create_env(options);
+	TEST_ASSERT(stkbase!=NULL,"allocate an stk environment");
+	}
+
+	d = alloc_dispatcher();
+	TEST_ASSERT(d!=NULL,"Failed to allocate dispatcher");
+
+	hangup_tests(d,stkbase,DISPATCHER_TEST_FDS);
+
+	TEST_ASSERT(dispatch_set_edge_triggered(d,1)==0,"Failed to set edge triggered");
+	hangup_tests(d,stkbase,100);
+
+	terminate_dispatcher(d);
+	free_dispatcher(d);
+
+	busy_poll_tests(stkbase);
+	rcv_budget_tests(stkbase);
+	reactor_tests(stkbase);
+	reuseport_tests(stkbase);
+	wakeup_tests(stkbase);
+
+	rc = stk_destroy_env(stkbase);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy stk env");
+
+	printf("%s PASSED\n",argv[0]);
+	return 0;
+}
@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <string.h>
+#include "stk_env_api.h"
+#include "stk_sequence_api.h"
+#include "stk_sequence_pool_api.h"
+#include "stk_test.h"
+
+#define POOL_TEST_ITERATIONS 1000
+
+int main(int argc,char *argv[])
+{
+	stk_env_t *stkbase;
+	stk_sequence_pool_t *pool;
+	stk_sequence_pool_stats_t stats;
+	stk_sequence_t *seq, *seq2;
+	char payload[2000];
+	void *first_buf;
+	stk_ret rc;
+
+	{
+	stk_options_t options[] = { { "inhibit_name_service", (void *)STK_TRUE}, { "slab_allocator", (void *)STK_TRUE}, { NULL, NULL } };
+
+	stkbase = stk_create_env(options);
+	TEST_ASSERT(stkbase!=NULL,"allocate an stk environment");
+	}
+
+	{
+	stk_options_t options[] = { { "sequence_pool_size", "2" }, { NULL, NULL } };
+
+	pool = stk_create_sequence_pool(stkbase,options);
+	TEST_ASSERT(pool!=NULL,"Failed to create a sequence pool");
+	}
+
+	memset(payload,0x5a,sizeof(payload));
+
+	/* First acquire creates a sequence */
+	seq = stk_sequence_pool_acquire(pool,"pool test",0x100,STK_SEQUENCE_TYPE_DATA,STK_SERVICE_TYPE_DATA);
+	TEST_ASSERT(seq!=NULL,"Failed to acquire a sequence");
+	rc = stk_copy_to_sequence(seq,payload,sizeof(payload),0x1);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to copy data to pooled sequence");
+	first_buf = stk_last_sequence_element(seq);
+	rc = stk_copy_to_sequence_meta_data(seq,payload,16,0x2);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to copy meta data to pooled sequence");
+
+	rc = stk_sequence_pool_release(pool,seq);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to release a sequence");
+
+	/* Second acquire reuses it, empty, with its payload buffer retained */
+	seq2 = stk_sequence_pool_acquire(pool,"pool test 2",0x101,STK_SEQUENCE_TYPE_DATA,STK_SERVICE_TYPE_DATA);
+	TEST_ASSERT(seq2==seq,"Pool did not reuse the released sequence");
+	TEST_ASSERT(stk_number_of_sequence_elements(seq2)==0,"Recycled sequence is not empty");
+	TEST_ASSERT(stk_sequence_total_size(seq2)==0,"Recycled sequence total size is %lu",stk_sequence_total_size(seq2));
+	TEST_ASSERT(stk_get_sequence_id(seq2)==0x101,"Recycled sequence id not reset");
+	TEST_ASSERT(strcmp(stk_get_sequence_name(seq2),"pool test 2")==0,"Recycled sequence name not reset");
+	{
+	void *data_ptr;
+	stk_uint64 sz;
+	TEST_ASSERT(stk_sequence_find_meta_data_by_type(seq2,0x2,&data_ptr,&sz)==STK_NOT_FOUND,"Recycled sequence still has meta data");
+	}
+
+	rc = stk_alloc_in_sequence(seq2,sizeof(payload) / 2,0x3);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to allocate in recycled sequence");
+	TEST_ASSERT(stk_last_sequence_element(seq2)==first_buf,"Recycled sequence did not reuse its payload buffer");
+	rc = stk_add_reference_to_sequence(seq2,payload,sizeof(payload),0x4);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to add reference to recycled sequence");
+	TEST_ASSERT(stk_number_of_sequence_elements(seq2)==2,"Recycled sequence has %d elements",stk_number_of_sequence_elements(seq2));
+
+	/* A held sequence is not recycled */
+	stk_hold_sequence(seq2);
+	rc = stk_sequence_pool_release(pool,seq2);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to release a held sequence");
+	TEST_ASSERT(stk_number_of_sequence_elements(seq2)==2,"Held sequence was emptied");
+	rc = stk_destroy_sequence(seq2);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy held sequence");
+
+	/* Steady state receive loop */
+	for(int i = 0; i < POOL_TEST_ITERATIONS; i++) {
+		seq = stk_sequence_pool_acquire(pool,"pool loop",STK_SEQUENCE_ID_INVALID,STK_SEQUENCE_TYPE_DATA,STK_SERVICE_TYPE_DATA);
+		TEST_ASSERT(seq!=NULL,"Failed to acquire a sequence in loop");
+		for(int e = 0; e < 6; e++) {
+			rc = stk_copy_to_sequence(seq,payload,100 * (e + 1),e);
+			TEST_ASSERT(rc==STK_SUCCESS,"Failed to copy data in loop");
+		}
+		TEST_ASSERT(stk_sequence_total_size(seq)==2100,"Unexpected total size %lu in loop",stk_sequence_total_size(seq));
+		rc = stk_sequence_pool_release(pool,seq);
+		TEST_ASSERT(rc==STK_SUCCESS,"Failed to release a sequence in loop");
+	}
+
+	/* Overflow the pool */
+	seq = stk_sequence_pool_acquire(pool,NULL,0x200,STK_SEQUENCE_TYPE_DATA,STK_SERVICE_TYPE_DATA);
+	seq2 = stk_sequence_pool_acquire(pool,NULL,0x201,STK_SEQUENCE_TYPE_DATA,STK_SERVICE_TYPE_DATA);
+	{
+	stk_sequence_t *seq3 = stk_sequence_pool_acquire(pool,NULL,0x202,STK_SEQUENCE_TYPE_DATA,STK_SERVICE_TYPE_DATA);
+	TEST_ASSERT(seq!=NULL && seq2!=NULL && seq3!=NULL,"Failed to acquire sequences to overflow the pool");
+	TEST_ASSERT(stk_get_sequence_name(seq)==NULL,"Recycled sequence kept its name");
+	TEST_ASSERT(stk_sequence_pool_release(pool,seq)==STK_SUCCESS,"Failed to release sequence 1");
+	TEST_ASSERT(stk_sequence_pool_release(pool,seq2)==STK_SUCCESS,"Failed to release sequence 2");
+	TEST_ASSERT(stk_sequence_pool_release(pool,seq3)==STK_SUCCESS,"Failed to release sequence 3");
+	}
+
+	rc = stk_sequence_pool_get_stats(pool,&stats);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to get pool stats");
+	TEST_ASSERT(stats.acquires==POOL_TEST_ITERATIONS + 5,"Unexpected acquires %lu",stats.acquires);
+	TEST_ASSERT(stats.hits + stats.misses==stats.acquires,"Hits %lu and misses %lu don't add up",stats.hits,stats.misses);
+	TEST_ASSERT(stats.misses==4,"Unexpected misses %lu",stats.misses);
+	TEST_ASSERT(stats.held==1,"Unexpected held count %lu",stats.held);
+	TEST_ASSERT(stats.discards==1,"Unexpected discards %lu",stats.discards);
+	printf("pool: %lu acquires, hit rate %.1f%%, %lu discards\n",stats.acquires,(stats.hits * 100.0) / stats.acquires,stats.discards);
+
+	rc = stk_destroy_sequence_pool(pool);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy sequence pool");
+
+	rc = stk_destroy_env(stkbase);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy stk env");
+
+	printf("%s PASSED\n",argv[0]);
+	return 0;
+}
@@ -1,8 +1,64 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
 #include "stk_env_api.h"
 #include "stk_sequence_api.h"
 #include "stk_test.h"
 
+#define SEQUENCE_ID_TEST_COUNT 100000
+
+int compare_sequence_ids(const void *a,const void *b)
+{
+	stk_sequence_id ida = *(const stk_sequence_id *) a, idb = *(const stk_sequence_id *) b;
+	return ida < idb ? -1 : ida > idb ? 1 : 0;
+}
+
+#define CLONE_THREADS 4
+#define CLONE_ROUNDS 500
+
+typedef struct {
+	stk_sequence_t *clone;
+	int value;
+} clone_writer_t;
+
+/* Write to a clone's copied data and archive its reference data while other clones do the same */
+void *clone_writer(void *arg)
+{
+	stk_sequence_t *clone = ((clone_writer_t *) arg)->clone;
+	int value = ((clone_writer_t *) arg)->value;
+	stk_sequence_iterator_t *seqiter = stk_sequence_iterator(clone);
+	int *data = 0;
+	stk_uint64 sz;
+	stk_ret rc;
+
+	stk_sequence_iterator_next(seqiter);
+	rc = stk_sequence_iterator_copy_data(seqiter,&value,sizeof(value));
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to write clone data rc %d",rc);
+	stk_end_sequence_iterator(seqiter);
+
+	rc = stk_update_ref_data_in_sequence(clone,NULL);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to archive clone rc %d",rc);
+
+	rc = stk_sequence_find_data_by_type(clone,0x702,(void **) &data,&sz);
+	TEST_ASSERT(rc==STK_SUCCESS && *data==value,"Concurrent clone write lost, found %x",*data);
+	return NULL;
+}
+
+/* Find elements while other threads search the same sequence */
+void *find_reader(void *arg)
+{
+	stk_sequence_t *seq = (stk_sequence_t *) arg;
+	int *data = 0;
+	stk_uint64 sz;
+
+	for(int i = 0; i < 1000; i++) {
+		stk_ret rc = stk_sequence_find_data_by_type(seq,0x800 + (i % 10),(void **) &data,&sz);
+		TEST_ASSERT(rc==STK_SUCCESS,"Concurrent find of type %x failed rc %d",0x800 + (i % 10),rc);
+		rc = stk_sequence_find_meta_data_by_type(seq,0x900 + (i % 50),(void **) &data,&sz);
+		TEST_ASSERT(rc==STK_SUCCESS && *data==i % 50,"Concurrent find of meta data %x failed rc %d",0x900 + (i % 50),rc);
+	}
+	return NULL;
+}
 
 int main(int argc,char *argv[])
 {
@@ -104,6 +160,16 @@ int main(int argc,char *argv[])
 	count = stk_number_of_sequence_elements(seq2);
 	TEST_ASSERT(count == 1,"incorrect count %d of elements on seq2 after merge, should be 1",count);
 	}
+	TEST_ASSERT(stk_sequence_total_size(seq1) == 2 * sizeof(test_data),"incorrect total size %lu of seq1 after merge",stk_sequence_total_size(seq1));
+
+	/* Sizes track changes to merged sequences and removals */
+	rc = stk_copy_to_sequence(seq2,&test_data,sizeof(test_data), 0x5e5);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to copy data, size %ld to sequence",sizeof(test_data));
+	TEST_ASSERT(stk_number_of_sequence_elements(seq1) == 3,"incorrect count %d of elements on seq1 after growing seq2",stk_number_of_sequence_elements(seq1));
+	TEST_ASSERT(stk_sequence_total_size(seq1) == 3 * sizeof(test_data),"incorrect total size %lu of seq1 after growing seq2",stk_sequence_total_size(seq1));
+	TEST_ASSERT(stk_remove_sequence_data_by_type(seq1,0x5e2,0) == 1,"Failed to remove element from seq1");
+	TEST_ASSERT(stk_number_of_sequence_elements(seq1) == 2,"incorrect count %d of elements on seq1 after removal",stk_number_of_sequence_elements(seq1));
+	TEST_ASSERT(stk_sequence_total_size(seq1) == 2 * sizeof(test_data),"incorrect total size %lu of seq1 after removal",stk_sequence_total_size(seq1));
 
 	/* Now delete the sequences */
 	rc = stk_destroy_sequence(seq1);                                                  
@@ -154,6 +220,235 @@ int main(int argc,char *argv[])
 	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy the basic unnamed data sequence object : %d",rc);
 	}
 
+	/* Clone and archiving tests */
+	{
+	int ref_data = 0x10;
+	int copy_data = 0x20;
+	int *data = 0;
+	stk_uint64 sz;
+	stk_generation_id gen;
+	stk_sequence_t *clone, *clone2;
+	stk_sequence_t *seq = stk_create_sequence(stkbase, NULL, 0x700, STK_SEQUENCE_TYPE_DATA, STK_SERVICE_TYPE_DATA, NULL);
+	TEST_ASSERT(seq!=NULL,"Failed to create a basic unnamed data sequence object");
+
+	rc = stk_add_reference_to_sequence(seq,&ref_data,sizeof(ref_data),0x701);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to add reference to sequence");
+	rc = stk_copy_to_sequence(seq,&copy_data,sizeof(copy_data),0x702);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to copy data to sequence");
+	rc = stk_copy_to_sequence_meta_data(seq,&copy_data,sizeof(copy_data),0x703);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to copy meta data to sequence");
+
+	/* Archiving data which isn't shared only bumps the generation */
+	rc = stk_update_ref_data_in_sequence(seq,&gen);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to archive unshared data rc %d",rc);
+	TEST_ASSERT(stk_get_sequence_generation(seq)==gen + 1,"Generation not bumped by archiving");
+	rc = stk_sequence_find_data_by_type(seq,0x701,(void **) &data,&sz);
+	TEST_ASSERT(rc==STK_SUCCESS && data==&ref_data,"Unshared reference data was copied");
+
+	clone = stk_clone_sequence(seq);
+	TEST_ASSERT(clone!=NULL,"Failed to clone sequence");
+	clone2 = stk_clone_sequence(seq);
+	TEST_ASSERT(clone2!=NULL,"Failed to clone sequence twice");
+	TEST_ASSERT(stk_get_sequence_id(clone)==0x700,"Clone id mismatch");
+	TEST_ASSERT(stk_get_sequence_generation(clone)==gen + 1,"Clone generation mismatch");
+	TEST_ASSERT(stk_number_of_sequence_elements(clone)==2,"Clone has %d elements",stk_number_of_sequence_elements(clone));
+	TEST_ASSERT(stk_sequence_total_size(clone)==stk_sequence_total_size(seq),"Clone total size mismatch");
+
+	/* Clones share the data until it is archived */
+	rc = stk_sequence_find_data_by_type(clone,0x701,(void **) &data,&sz);
+	TEST_ASSERT(rc==STK_SUCCESS && data==&ref_data,"Clone does not share reference data");
+	rc = stk_sequence_find_meta_data_by_type(clone,0x703,(void **) &data,&sz);
+	TEST_ASSERT(rc==STK_SUCCESS && *data==0x20,"Clone meta data not copied");
+
+	{
+	int *owned_data = 0;
+	rc = stk_sequence_find_data_by_type(seq,0x702,(void **) &owned_data,&sz);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to find copied data");
+
+	rc = stk_update_ref_data_in_sequence(seq,&gen);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to archive shared data rc %d",rc);
+	ref_data = 0x11;
+
+	/* Copied data is copied on write, so archiving leaves it shared */
+	rc = stk_sequence_find_data_by_type(seq,0x702,(void **) &data,&sz);
+	TEST_ASSERT(rc==STK_SUCCESS && data==owned_data,"Archiving copied shared data it didn't need to");
+	rc = stk_sequence_find_data_by_type(clone,0x702,(void **) &data,&sz);
+	TEST_ASSERT(rc==STK_SUCCESS && data==owned_data,"Archiving unshared the clone's copied data");
+	}
+
+	rc = stk_sequence_find_data_by_type(seq,0x701,(void **) &data,&sz);
+	TEST_ASSERT(rc==STK_SUCCESS && data==&ref_data,"Archived sequence no longer references application data");
+	rc = stk_sequence_find_data_by_type(clone,0x701,(void **) &data,&sz);
+	TEST_ASSERT(rc==STK_SUCCESS && *data==0x10,"Clone reference data not archived, found %x",*data);
+	rc = stk_sequence_find_data_by_type(clone2,0x701,(void **) &data,&sz);
+	TEST_ASSERT(rc==STK_SUCCESS && *data==0x10,"Second clone reference data not archived, found %x",*data);
+
+	/* Writing to a clone's copied data doesn't affect the others */
+	{
+	stk_sequence_iterator_t *seqiter = stk_sequence_iterator(clone);
+	int new_data = 0x21;
+	stk_sequence_iterator_next(seqiter);
+	rc = stk_sequence_iterator_copy_data(seqiter,&new_data,sizeof(new_data));
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to write clone data rc %d",rc);
+	stk_end_sequence_iterator(seqiter);
+	}
+	rc = stk_sequence_find_data_by_type(clone,0x702,(void **) &data,&sz);
+	TEST_ASSERT(rc==STK_SUCCESS && *data==0x21,"Clone data not written");
+	rc = stk_sequence_find_data_by_type(seq,0x702,(void **) &data,&sz);
+	TEST_ASSERT(rc==STK_SUCCESS && *data==0x20,"Clone write changed the original");
+	rc = stk_sequence_find_data_by_type(clone2,0x702,(void **) &data,&sz);
+	TEST_ASSERT(rc==STK_SUCCESS && *data==0x20,"Clone write changed the second clone");
+
+	/* Destroy in an order which leaves the clone owning the archived data */
+	rc = stk_destroy_sequence(seq);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy the original sequence : %d",rc);
+	rc = stk_destroy_sequence(clone);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy the clone : %d",rc);
+	rc = stk_sequence_find_data_by_type(clone2,0x701,(void **) &data,&sz);
+	TEST_ASSERT(rc==STK_SUCCESS && *data==0x10,"Second clone lost archived data");
+	rc = stk_destroy_sequence(clone2);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy the second clone : %d",rc);
+	}
+
+	/* Clones written and archived concurrently */
+	for(int round = 0; round < CLONE_ROUNDS; round++)
+	{
+	int ref_data = round;
+	int copy_data = 0x20;
+	int *data = 0;
+	stk_uint64 sz;
+	clone_writer_t clones[CLONE_THREADS];
+	pthread_t threads[CLONE_THREADS];
+	stk_sequence_t *seq = stk_create_sequence(stkbase, NULL, 0x710, STK_SEQUENCE_TYPE_DATA, STK_SERVICE_TYPE_DATA, NULL);
+	TEST_ASSERT(seq!=NULL,"Failed to create a basic unnamed data sequence object");
+
+	rc = stk_add_reference_to_sequence(seq,&ref_data,sizeof(ref_data),0x701);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to add reference to sequence");
+	rc = stk_copy_to_sequence(seq,&copy_data,sizeof(copy_data),0x702);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to copy data to sequence");
+
+	for(int idx = 0; idx < CLONE_THREADS; idx++) {
+		clones[idx].clone = stk_clone_sequence(seq);
+		clones[idx].value = 0x100 + idx;
+		TEST_ASSERT(clones[idx].clone!=NULL,"Failed to clone sequence");
+	}
+	for(int idx = 0; idx < CLONE_THREADS; idx++) {
+		int err = pthread_create(&threads[idx],NULL,clone_writer,&clones[idx]);
+		TEST_ASSERT(err==0,"Failed to create clone writer thread %d",err);
+	}
+	for(int idx = 0; idx < CLONE_THREADS; idx++)
+		pthread_join(threads[idx],NULL);
+
+	/* The original still shares the reference data with the archive the clones published */
+	ref_data = -1;
+	rc = stk_sequence_find_data_by_type(seq,0x701,(void **) &data,&sz);
+	TEST_ASSERT(rc==STK_SUCCESS && data!=&ref_data && *data==round,"Original lost the archived reference data, found %x",*data);
+	rc = stk_sequence_find_data_by_type(seq,0x702,(void **) &data,&sz);
+	TEST_ASSERT(rc==STK_SUCCESS && *data==0x20,"Clone writes changed the original, found %x",*data);
+
+	for(int idx = 0; idx < CLONE_THREADS; idx++) {
+		rc = stk_destroy_sequence(clones[idx].clone);
+		TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy the clone : %d",rc);
+	}
+	rc = stk_destroy_sequence(seq);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy the original sequence : %d",rc);
+	}
+
+	/* Find by type in large (indexed) sequences */
+	{
+	int values[50];
+	int *data = 0;
+	stk_uint64 sz;
+	int found;
+	stk_sequence_iterator_t *seqiter;
+	stk_sequence_t *seq = stk_create_sequence(stkbase, NULL, 0, STK_SEQUENCE_TYPE_KVPAIR, STK_SERVICE_TYPE_DATA, NULL);
+	TEST_ASSERT(seq!=NULL,"Failed to create a kv pair sequence object");
+
+	for(int i = 0; i < 50; i++) {
+		values[i] = i;
+		rc = stk_copy_to_sequence(seq,&values[i],sizeof(values[i]),0x800 + (i % 10));
+		TEST_ASSERT(rc==STK_SUCCESS,"Failed to copy element %d to sequence",i);
+		rc = stk_copy_to_sequence_meta_data(seq,&values[i],sizeof(values[i]),0x900 + i);
+		TEST_ASSERT(rc==STK_SUCCESS,"Failed to copy meta data %d to sequence",i);
+	}
+
+	for(int t = 0; t < 10; t++) {
+		rc = stk_sequence_find_data_by_type(seq,0x800 + t,(void **) &data,&sz);
+		TEST_ASSERT(rc==STK_SUCCESS && *data==t,"Failed to find first element of type %x",0x800 + t);
+	}
+	rc = stk_sequence_find_data_by_type(seq,0x80a,(void **) &data,&sz);
+	TEST_ASSERT(rc==STK_NOT_FOUND,"Found non existant type 0x80a rc %d",rc);
+	rc = stk_sequence_find_meta_data_by_type(seq,0x900 + 37,(void **) &data,&sz);
+	TEST_ASSERT(rc==STK_SUCCESS && *data==37,"Failed to find indexed meta data");
+
+	/* Elements added after the index was built are found */
+	rc = stk_copy_to_sequence(seq,&values[7],sizeof(values[7]),0x80a);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to copy element to indexed sequence");
+	rc = stk_sequence_find_data_by_type(seq,0x80a,(void **) &data,&sz);
+	TEST_ASSERT(rc==STK_SUCCESS && *data==7,"Failed to find element added after indexing");
+
+	/* Find all elements of a type */
+	seqiter = stk_sequence_iterator(seq);
+	found = 0;
+	for(rc = stk_sequence_find_data_by_type((stk_sequence_t *) seqiter,0x803,(void **) &data,&sz); rc == STK_SUCCESS;
+		rc = stk_sequence_iterator_find_next_by_type(seqiter,0x803,(void **) &data,&sz)) {
+		TEST_ASSERT(*data==(found * 10) + 3,"Element %d of type 0x803 is %d",found,*data);
+		found++;
+	}
+	TEST_ASSERT(found==5,"Found %d elements of type 0x803",found);
+
+	/* Changing a type and removing elements are reflected in lookups */
+	rc = stk_sequence_find_data_by_type((stk_sequence_t *) seqiter,0x804,(void **) &data,&sz);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to find element of type 0x804");
+	rc = stk_sequence_iterator_set_user_type(seqiter,0x80b);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to set user type");
+	rc = stk_end_sequence_iterator(seqiter);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to end iterator");
+	rc = stk_sequence_find_data_by_type(seq,0x80b,(void **) &data,&sz);
+	TEST_ASSERT(rc==STK_SUCCESS && *data==4,"Failed to find element with changed type");
+	rc = stk_sequence_find_data_by_type(seq,0x804,(void **) &data,&sz);
+	TEST_ASSERT(rc==STK_SUCCESS && *data==14,"Found element %d after its type changed",*data);
+
+	TEST_ASSERT(stk_remove_sequence_data_by_type(seq,0x805,2)==2,"Failed to remove elements of type 0x805");
+	rc = stk_sequence_find_data_by_type(seq,0x805,(void **) &data,&sz);
+	TEST_ASSERT(rc==STK_SUCCESS && *data==25,"Found element %d of type 0x805 after removal",*data);
+	rc = stk_sequence_find_data_by_type(seq,0x809,(void **) &data,&sz);
+	TEST_ASSERT(rc==STK_SUCCESS && *data==9,"Failed to find element after removal");
+
+	/* Finds don't modify the sequence, so threads may search it concurrently */
+	{
+	pthread_t threads[4];
+	for(int idx = 0; idx < 4; idx++) {
+		int err = pthread_create(&threads[idx],NULL,find_reader,seq);
+		TEST_ASSERT(err==0,"Failed to create find thread %d",err);
+	}
+	for(int idx = 0; idx < 4; idx++)
+		pthread_join(threads[idx],NULL);
+	}
+
+	rc = stk_destroy_sequence(seq);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy the kv pair sequence object : %d",rc);
+	}
+
+	/* Sequence IDs are unique, whether acquired singly or in bulk */
+	{
+	stk_sequence_id *ids = malloc(SEQUENCE_ID_TEST_COUNT * 2 * sizeof(stk_sequence_id));
+	stk_uint64 acquired;
+	TEST_ASSERT(ids!=NULL,"Failed to allocate sequence id array");
+
+	for(int i = 0; i < SEQUENCE_ID_TEST_COUNT; i++) {
+		ids[i] = stk_acquire_sequence_id(stkbase,STK_SERVICE_TYPE_DATA);
+		TEST_ASSERT(ids[i]!=STK_SEQUENCE_ID_INVALID,"Acquired an invalid sequence id");
+	}
+	acquired = stk_acquire_sequence_ids(stkbase,STK_SERVICE_TYPE_DATA,&ids[SEQUENCE_ID_TEST_COUNT],SEQUENCE_ID_TEST_COUNT);
+	TEST_ASSERT(acquired==SEQUENCE_ID_TEST_COUNT,"Acquired %lu sequence ids in bulk",acquired);
+
+	qsort(ids,SEQUENCE_ID_TEST_COUNT * 2,sizeof(stk_sequence_id),compare_sequence_ids);
+	for(int i = 1; i < SEQUENCE_ID_TEST_COUNT * 2; i++)
+		TEST_ASSERT(ids[i]!=ids[i - 1],"Duplicate sequence id %lx",ids[i]);
+	free(ids);
+	}
+
 	rc = stk_destroy_env(stkbase);
 	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy a stk env object : %d",rc);
 
@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "stk_env_api.h"
+#include "stk_sequence_api.h"
+#include "stk_shm_sequence_api.h"
+#include "stk_test.h"
+
+#define SHM_TEST_NAME "/stk_shm_sequence_tests"
+
+/* Check a sequence imported from shared memory has the data exported by main() */
+void check_imported_sequence(stk_shm_arena_t *arena,stk_shm_handle_t handle,char *payload)
+{
+	stk_sequence_t *seq;
+	char *data;
+	stk_uint64 sz;
+	stk_ret rc;
+
+	seq = stk_shm_import_sequence(arena,handle);
+	TEST_ASSERT(seq!=NULL,"Failed to import sequence from shared memory");
+	TEST_ASSERT(stk_get_sequence_id(seq)==0x5a5a,"Imported sequence id mismatch");
+	TEST_ASSERT(strcmp(stk_get_sequence_name(seq),"shm sequence")==0,"Imported sequence name mismatch");
+	TEST_ASSERT(stk_number_of_sequence_elements(seq)==3,"Imported sequence has %d elements",stk_number_of_sequence_elements(seq));
+	TEST_ASSERT(stk_sequence_total_size(seq)==1000+24+500,"Imported sequence total size %lu",stk_sequence_total_size(seq));
+
+	rc = stk_sequence_find_data_by_type(seq,0x2,(void **) &data,&sz);
+	TEST_ASSERT(rc==STK_SUCCESS && sz==24,"Failed to find imported element 0x2");
+	TEST_ASSERT(memcmp(data,payload + 100,sz)==0,"Imported element 0x2 data mismatch");
+	rc = stk_sequence_find_data_by_type(seq,0x3,(void **) &data,&sz);
+	TEST_ASSERT(rc==STK_SUCCESS && sz==500,"Failed to find merged element 0x3");
+	TEST_ASSERT(memcmp(data,payload + 200,sz)==0,"Imported element 0x3 data mismatch");
+
+	rc = stk_destroy_sequence(seq);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy imported sequence");
+}
+
+int main(int argc,char *argv[])
+{
+	stk_env_t *stkbase;
+	stk_shm_arena_t *arena;
+	stk_shm_arena_stats_t stats;
+	stk_shm_handle_t handle;
+	stk_sequence_t *seq, *merged;
+	char payload[2000];
+	stk_ret rc;
+
+	{
+	stk_options_t options[] = { { "inhibit_name_service", (void *)STK_TRUE}, { NULL, NULL } };
+
+	stkbase = stk_create_env(options);
+	TEST_ASSERT(stkbase!=NULL,"allocate an stk environment");
+	}
+
+	{
+	stk_options_t options[] = { { "shm_name", SHM_TEST_NAME }, { "shm_create", (void *)STK_TRUE }, { "shm_size", "1048576" }, { NULL, NULL } };
+
+	arena = stk_create_shm_arena(stkbase,options);
+	TEST_ASSERT(arena!=NULL,"Failed to create a shared memory arena");
+	}
+
+	for(int i = 0; i < (int) sizeof(payload); i++) payload[i] = (char) i;
+
+	seq = stk_create_sequence(stkbase,"shm sequence",0x5a5a,STK_SEQUENCE_TYPE_DATA,STK_SERVICE_TYPE_DATA,NULL);
+	TEST_ASSERT(seq!=NULL,"Failed to create a sequence");
+	merged = stk_create_sequence(stkbase,NULL,0x5a5b,STK_SEQUENCE_TYPE_DATA,STK_SERVICE_TYPE_DATA,NULL);
+	TEST_ASSERT(merged!=NULL,"Failed to create a sequence to merge");
+	rc = stk_add_reference_to_sequence(seq,payload,1000,0x1);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to add reference to sequence");
+	rc = stk_copy_to_sequence(seq,payload + 100,24,0x2);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to copy to sequence");
+	rc = stk_copy_to_sequence(merged,payload + 200,500,0x3);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to copy to merged sequence");
+	rc = stk_add_sequence_reference_in_sequence(seq,merged,0x4);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to merge sequence");
+
+	handle = stk_shm_export_sequence(arena,seq);
+	TEST_ASSERT(handle!=STK_SHM_HANDLE_INVALID,"Failed to export sequence to shared memory");
+
+	/* Take a reference for the child, which releases it */
+	rc = stk_shm_hold(arena,handle);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to hold shared memory sequence");
+
+	{
+	pid_t pid = fork();
+	TEST_ASSERT(pid!=-1,"Failed to fork");
+	if(pid == 0) {
+		stk_options_t options[] = { { "shm_name", SHM_TEST_NAME }, { NULL, NULL } };
+		stk_shm_arena_t *child_arena = stk_create_shm_arena(stkbase,options);
+		TEST_ASSERT(child_arena!=NULL,"Failed to attach to shared memory arena");
+
+		check_imported_sequence(child_arena,handle,payload);
+		TEST_ASSERT(stk_shm_release(child_arena,handle)==STK_SUCCESS,"Child failed to release handle");
+		TEST_ASSERT(stk_destroy_shm_arena(child_arena)==STK_SUCCESS,"Child failed to detach from arena");
+		_exit(0);
+	} else {
+		int status;
+		TEST_ASSERT(waitpid(pid,&status,0)==pid,"Failed to wait for child");
+		TEST_ASSERT(WIFEXITED(status) && WEXITSTATUS(status)==0,"Child failed, status %d",status);
+	}
+	}
+
+	/* The child's reference has gone, ours remains */
+	check_imported_sequence(arena,handle,payload);
+	rc = stk_shm_arena_get_stats(arena,&stats);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to get arena stats");
+	TEST_ASSERT(stats.allocs==1 && stats.frees==0,"Unexpected allocs %lu frees %lu",stats.allocs,stats.frees);
+
+	rc = stk_shm_release(arena,handle);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to release handle");
+	rc = stk_shm_arena_get_stats(arena,&stats);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to get arena stats");
+	TEST_ASSERT(stats.frees==1 && stats.used==0,"Sequence not freed, frees %lu used %lu",stats.frees,stats.used);
+	TEST_ASSERT(stk_shm_import_sequence(arena,handle)==NULL,"Imported a released handle");
+
+	/* Freed blocks are reused and a full arena fails cleanly */
+	TEST_ASSERT(stk_shm_export_sequence(arena,seq)==handle,"Freed block was not reused");
+	{
+	stk_uint64 exported = 1;
+	while(stk_shm_export_sequence(arena,seq) != STK_SHM_HANDLE_INVALID) exported++;
+	rc = stk_shm_arena_get_stats(arena,&stats);
+	TEST_ASSERT(stats.alloc_failures==1,"Unexpected alloc failures %lu",stats.alloc_failures);
+	TEST_ASSERT(exported > 100,"Only exported %lu sequences to a 1MB arena",exported);
+	}
+
+	rc = stk_destroy_sequence(seq);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy sequence");
+	rc = stk_destroy_sequence(merged);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy merged sequence");
+
+	rc = stk_destroy_shm_arena(arena);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy shared memory arena");
+
+	rc = stk_destroy_env(stkbase);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy stk env");
+
+	printf("%s PASSED\n",argv[0]);
+	return 0;
+}
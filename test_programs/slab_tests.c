@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <string.h>
+#include "stk_env_api.h"
+#include "stk_sequence_api.h"
+#include "stk_slab_api.h"
+#include "stk_test.h"
+
+#define SLAB_TEST_ITERATIONS 10000
+
+/* Simulate a receive loop: create a named sequence, add/grow elements, iterate and destroy */
+void slab_sequence_cycle(stk_env_t *stkbase,int iteration)
+{
+	stk_sequence_t *seq;
+	stk_sequence_iterator_t *seqiter;
+	char payload[3000];
+	stk_ret rc;
+
+	memset(payload,iteration & 0xff,sizeof(payload));
+
+	seq = stk_create_sequence(stkbase,"slab test sequence",0x51ab,STK_SEQUENCE_TYPE_DATA,STK_SERVICE_TYPE_DATA,NULL);
+	TEST_ASSERT(seq!=NULL,"Failed to create a sequence from the slab");
+
+	rc = stk_copy_to_sequence(seq,payload,100,0x1);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to copy 100 bytes to sequence");
+	rc = stk_copy_to_sequence(seq,payload,sizeof(payload),0x2);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to copy %ld bytes to sequence",sizeof(payload));
+	rc = stk_copy_to_sequence_meta_data(seq,payload,16,0x3);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to copy meta data to sequence");
+	rc = stk_copy_sequence_name(seq,"renamed slab sequence");
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to copy name to sequence");
+	TEST_ASSERT(strcmp(stk_get_sequence_name(seq),"renamed slab sequence")==0,"Sequence name not copied");
+
+	/* Grow the first element in place and beyond its size class */
+	seqiter = stk_sequence_iterator(seq);
+	TEST_ASSERT(seqiter!=NULL,"Failed to create an iterator from the slab");
+	{
+	unsigned char *data = stk_sequence_iterator_ensure_segment_size(seqiter,120);
+	TEST_ASSERT(data!=NULL && data[99]==(iteration & 0xff),"Data not preserved growing element within size class");
+	data = stk_sequence_iterator_ensure_segment_size(seqiter,1000);
+	TEST_ASSERT(data!=NULL && data[99]==(iteration & 0xff),"Data not preserved growing element beyond size class");
+	TEST_ASSERT(stk_sequence_iterator_data_size(seqiter)==1000,"Element size not updated after growth");
+	TEST_ASSERT(stk_sequence_total_size(seq)==1000+sizeof(payload),"Sequence total size not updated after growth %lu",stk_sequence_total_size(seq));
+	}
+	rc = stk_end_sequence_iterator(seqiter);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to end iterator");
+
+	TEST_ASSERT(stk_remove_sequence_data_by_type(seq,0x2,1)==1,"Failed to remove element from slab sequence");
+
+	rc = stk_destroy_sequence(seq);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy slab sequence");
+}
+
+void slab_test(char *desc,stk_options_t *options)
+{
+	stk_env_t *stkbase;
+	stk_slab_allocator_t *slab;
+	stk_slab_stats_t warm,steady;
+	stk_ret rc;
+
+	stkbase = stk_create_env(options);
+	TEST_ASSERT(stkbase!=NULL,"allocate an stk environment");
+
+	slab = stk_env_get_slab_allocator(stkbase);
+	TEST_ASSERT(slab!=NULL,"Environment did not create a slab allocator");
+
+	/* Warm up the slab, then check no more chunks are needed in the steady state */
+	slab_sequence_cycle(stkbase,0);
+	rc = stk_slab_get_stats(slab,&warm);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to get slab stats");
+	TEST_ASSERT(warm.allocs==warm.frees,"Slab allocations (%lu) and frees (%lu) mismatched after warm up",warm.allocs,warm.frees);
+
+	for(int i = 1; i < SLAB_TEST_ITERATIONS; i++)
+		slab_sequence_cycle(stkbase,i);
+
+	rc = stk_slab_get_stats(slab,&steady);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to get slab stats");
+	TEST_ASSERT(steady.chunk_allocs==warm.chunk_allocs,"Slab allocated chunks in the steady state (%lu -> %lu)",warm.chunk_allocs,steady.chunk_allocs);
+	TEST_ASSERT(steady.sys_allocs==0,"Slab used the system allocator %lu times",steady.sys_allocs);
+	TEST_ASSERT(steady.allocs==steady.frees,"Slab allocations (%lu) and frees (%lu) mismatched",steady.allocs,steady.frees);
+	TEST_ASSERT(steady.allocs > warm.allocs,"Slab allocations not counted");
+
+	printf("%s: %lu allocations, %lu chunks (%lu bytes) reserved\n",desc,steady.allocs,steady.chunk_allocs,steady.bytes_reserved);
+
+	rc = stk_destroy_env(stkbase);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy stk env");
+}
+
+int main(int argc,char *argv[])
+{
+	{
+	stk_options_t options[] = { { "inhibit_name_service", (void *)STK_TRUE}, { "slab_allocator", (void *)STK_TRUE}, { NULL, NULL } };
+	slab_test("shared slab",options);
+	}
+
+	{
+	stk_options_t options[] = { { "inhibit_name_service", (void *)STK_TRUE}, { "slab_allocator", (void *)STK_TRUE},
+		{ "slab_thread_cache", (void *)STK_TRUE}, { "slab_chunk_size", "65536"}, { NULL, NULL } };
+	slab_test("thread cached slab",options);
+	}
+
+	/* Oversized allocations fall back to the system allocator */
+	{
+	stk_slab_allocator_t *slab = stk_create_slab_allocator(NULL);
+	stk_slab_stats_t stats;
+	void *big, *small;
+
+	TEST_ASSERT(slab!=NULL,"Failed to create a standalone slab allocator");
+	small = stk_slab_alloc(slab,33);
+	TEST_ASSERT(small!=NULL,"Failed to allocate from slab");
+	TEST_ASSERT(stk_slab_capacity(slab,33)==64,"Unexpected capacity for 33 bytes %lu",stk_slab_capacity(slab,33));
+	big = stk_slab_alloc(slab,1024*1024);
+	TEST_ASSERT(big!=NULL,"Failed to allocate oversized memory");
+	stk_slab_free(slab,big,1024*1024);
+	stk_slab_free(slab,small,33);
+	stk_slab_get_stats(slab,&stats);
+	TEST_ASSERT(stats.sys_allocs==1,"Oversized allocation not counted");
+	TEST_ASSERT(stk_destroy_slab_allocator(slab)==STK_SUCCESS,"Failed to destroy standalone slab");
+	}
+
+	printf("%s PASSED\n",argv[0]);
+	return 0;
+}
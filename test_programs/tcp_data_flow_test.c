@@ -54,6 +54,19 @@ void process_data(stk_data_flow_t *rcvchannel,stk_sequence_t *rcv_seq)
 	printf("IP: %08x Port: %d\n",from_address.sin_addr.s_addr,from_address.sin_port);
 	}
 
+	{
+	struct timeval received;
+	char protocol[16];
+	stk_uint64 protocol_len = sizeof(protocol);
+
+	TEST_ASSERT(stk_data_flow_client_protocol_id(rcv_seq)==STK_DATA_FLOW_PROTOCOL_TCP,"Received sequence protocol is %d",stk_data_flow_client_protocol_id(rcv_seq));
+	rc = stk_data_flow_client_protocol(rcv_seq,protocol,&protocol_len);
+	TEST_ASSERT(rc==STK_SUCCESS && strcmp(protocol,"tcp")==0,"Failed to get received sequence protocol rc %d",rc);
+	rc = stk_data_flow_receive_time(rcv_seq,&received);
+	TEST_ASSERT(rc==STK_SUCCESS && received.tv_sec > 0,"Failed to get received sequence receive time rc %d",rc);
+	TEST_ASSERT(stk_data_flow_received_on(rcv_seq)!=NULL,"Received sequence has no data flow");
+	}
+
 	/* Call process_seq_segment() on each element in the sequence */
 	rc = stk_iterate_sequence(rcv_seq,process_seq_segment,NULL);
 	TEST_ASSERT(rc==STK_SUCCESS,"Failed to process received sequencebuffer space to receive");
@@ -1,8 +1,15 @@
 #include "stk_env_api.h"
 #include "stk_timer_api.h"
+#include "stk_clock_api.h"
+#include "stk_sync_api.h"
 #include "stk_test.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
 #include <unistd.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <pthread.h>
 
 int expired;
 int cancelled;
@@ -27,6 +34,423 @@ void reset_cbdata()
 	glsetdata = NULL;
 }
 
+int last_expired_id;
+int reschedules;
+void resched_timer_cb(stk_timer_set_t *timer_set,stk_timer_t *timer,int id,void *userdata,void * user_setdata, stk_timer_cb_type cb_type)
+{
+	timer_cb(timer_set,timer,id,userdata,user_setdata,cb_type);
+	if(cb_type == STK_TIMER_EXPIRED) {
+		last_expired_id = id;
+		if(reschedules > 0) {
+			reschedules--;
+			stk_reschedule_timer(timer_set,timer);
+		}
+	}
+}
+
+void null_timer_cb(stk_timer_set_t *timer_set,stk_timer_t *timer,int id,void *userdata,void * user_setdata, stk_timer_cb_type cb_type)
+{
+}
+
+long usecs_since(struct timeval *start)
+{
+	struct timeval now;
+	gettimeofday(&now,NULL);
+	return ((now.tv_sec - start->tv_sec) * 1000000) + (now.tv_usec - start->tv_usec);
+}
+
+void clock_tests()
+{
+	struct timeval t1, t2, c1, c2;
+
+	TEST_ASSERT(stk_now(&t1)==STK_SUCCESS,"Failed to read monotonic clock");
+	usleep(2000);
+	TEST_ASSERT(stk_now(&t2)==STK_SUCCESS,"Failed to read monotonic clock");
+	TEST_ASSERT(timercmp(&t2,&t1,>),"monotonic clock did not advance");
+
+	/* Cached times don't change until the cache is updated */
+	stk_clock_cache_update();
+	TEST_ASSERT(stk_now(&c1)==STK_SUCCESS && stk_now_realtime(&t1)==STK_SUCCESS,"Failed to read cached clock");
+	usleep(2000);
+	TEST_ASSERT(stk_now_coarse(&c2)==STK_SUCCESS && stk_now_realtime(&t2)==STK_SUCCESS,"Failed to read cached clock");
+	TEST_ASSERT(timercmp(&c1,&c2,==) && timercmp(&t1,&t2,==),"cached clock changed");
+	stk_clock_cache_update();
+	TEST_ASSERT(stk_now(&c2)==STK_SUCCESS && timercmp(&c2,&c1,>),"updated cached clock did not advance");
+	stk_clock_cache_clear();
+	usleep(2000);
+	TEST_ASSERT(stk_now(&c1)==STK_SUCCESS && timercmp(&c1,&c2,>),"clock still cached after clearing");
+}
+
+void timer_wheel_tests(stk_env_t *env)
+{
+	stk_options_t options[] = { { "timer_wheel", (void *)STK_TRUE}, { NULL, NULL } };
+	stk_timer_set_t *tset;
+	stk_timer_t t1, t2;
+	stk_ret rc;
+	int next;
+
+	tset = stk_new_timer_set_with_options(env,(void*) 0x232,0,STK_FALSE,options);
+	TEST_ASSERT(tset!=NULL,"Failed to allocate a timer wheel set");
+	TEST_ASSERT(stk_next_timer_ms(tset) == -1,"empty timer wheel has a timer");
+
+	/* Timers on the first level, the second level (cascaded) and beyond */
+	reset_cbdata();
+	t1 = stk_schedule_timer(tset,resched_timer_cb,1,(void*) 0x8008,50);
+	t2 = stk_schedule_timer(tset,resched_timer_cb,2,NULL,300);
+	TEST_ASSERT(stk_schedule_timer(tset,resched_timer_cb,3,NULL,100000)!=NULL,"Failed to schedule a long timer");
+	TEST_ASSERT(t1!=NULL && t2!=NULL,"Failed to schedule timers in wheel");
+	next = stk_next_timer_ms(tset);
+	TEST_ASSERT(next > 40 && next <= 51,"next timer in wheel %d ms, expected 50",next);
+
+	rc = stk_dispatch_timers(tset,0);
+	TEST_ASSERT(rc==STK_SUCCESS && expired == 0,"wheel timer expired early (%d)",rc);
+	usleep(60000);
+	TEST_ASSERT(stk_next_timer_ms(tset) == 0,"expected wheel timer to be due");
+	rc = stk_dispatch_timers(tset,0);
+	TEST_ASSERT(rc==STK_SUCCESS,"timer wheel dispatch returned unexpectedly (%d)",rc);
+	TEST_ASSERT(expired == 1 && last_expired_id == 1,"expected timer 1 to expire, expired %d id %d",expired,last_expired_id);
+	TEST_ASSERT(glsetdata == (void*)0x232 && gluserdata == (void*) 0x8008,"Didn't receive expected data from wheel timer");
+	next = stk_next_timer_ms(tset);
+	TEST_ASSERT(next > 200 && next <= 251,"next timer in wheel %d ms, expected 240",next);
+
+	usleep(260000);
+	rc = stk_dispatch_timers(tset,0);
+	TEST_ASSERT(expired == 2 && last_expired_id == 2,"expected timer 2 to expire, expired %d id %d",expired,last_expired_id);
+	next = stk_next_timer_ms(tset);
+	TEST_ASSERT(next > 99000 && next <= 100000,"next timer in wheel %d ms, expected 99700",next);
+
+	TEST_ASSERT(stk_find_timer_id(tset,1)==NULL && !stk_timer_is_scheduled(tset,t1),"expired wheel timer still scheduled");
+	TEST_ASSERT(stk_find_timer_id(tset,3)!=NULL,"Failed to find wheel timer by id");
+	rc = stk_cancel_timer_id(tset,3);
+	TEST_ASSERT(rc==STK_SUCCESS && cancelled == 1,"Failed to cancel wheel timer by id (%d)",rc);
+	TEST_ASSERT(stk_cancel_timer_id(tset,3)==STK_NOT_FOUND,"cancelled wheel timer found by id");
+	TEST_ASSERT(stk_next_timer_ms(tset) == -1,"timer wheel should be empty");
+
+	/* max_callbacks leaves due timers for the next dispatch, and timers rescheduled from callbacks fire again */
+	reset_cbdata();
+	for(int i = 0; i < 5; i++)
+		stk_schedule_timer(tset,resched_timer_cb,10 + i,NULL,5);
+	reschedules = 1;
+	usleep(10000);
+	rc = stk_dispatch_timers(tset,2);
+	TEST_ASSERT(rc==STK_MAX_TIMERS && expired == 2,"expected 2 wheel timers to expire (%d), expired %d",rc,expired);
+	TEST_ASSERT(stk_next_timer_ms(tset) == 0,"expected remaining wheel timers to be due");
+	rc = stk_dispatch_timers(tset,0);
+	TEST_ASSERT(rc==STK_SUCCESS && expired == 5,"expected 5 wheel timers to expire (%d), expired %d",rc,expired);
+	usleep(10000);
+	rc = stk_dispatch_timers(tset,0);
+	TEST_ASSERT(rc==STK_SUCCESS && expired == 6 && last_expired_id == 10,"rescheduled wheel timer did not expire, expired %d",expired);
+
+	/* Cancelling an expired timer mustn't link it on the free list twice */
+	reset_cbdata();
+	t1 = stk_schedule_timer(tset,resched_timer_cb,30,NULL,5);
+	usleep(10000);
+	rc = stk_dispatch_timers(tset,0);
+	TEST_ASSERT(rc==STK_SUCCESS && expired == 1 && last_expired_id == 30,"wheel timer 30 did not expire, expired %d",expired);
+	rc = stk_cancel_timer(tset,t1);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to cancel expired wheel timer (%d)",rc);
+	t1 = stk_schedule_timer(tset,resched_timer_cb,31,NULL,5);
+	t2 = stk_schedule_timer(tset,resched_timer_cb,32,NULL,5);
+	TEST_ASSERT(t1!=NULL && t2!=NULL && t1!=t2,"timers scheduled after cancelling an expired wheel timer share a handle");
+	usleep(10000);
+	rc = stk_dispatch_timers(tset,0);
+	TEST_ASSERT(rc==STK_SUCCESS && expired == 3,"expected timers 31 and 32 to expire, expired %d",expired);
+
+	/* Cancelling timers left in the set when freeing it */
+	reset_cbdata();
+	stk_schedule_timer(tset,resched_timer_cb,20,NULL,10);
+	stk_schedule_timer(tset,resched_timer_cb,21,NULL,10000);
+	rc = stk_free_timer_set(tset,STK_TRUE);
+	TEST_ASSERT(rc==STK_SUCCESS && cancelled == 2,"Failed to destroy the timer wheel set: %d cancelled %d",rc,cancelled);
+}
+
+/* Timers in the pool of an env with a timer fd are dispatched when the fd is ready */
+void timer_fd_tests()
+{
+	stk_options_t options[] = { { "inhibit_name_service", (void *)STK_TRUE}, { "timer_fd", (void *)STK_TRUE}, { NULL, NULL } };
+	stk_env_t *env = stk_create_env(options);
+	stk_timer_set_t *tset;
+	struct pollfd pfd;
+	struct timeval start;
+	long elapsed;
+	stk_ret rc;
+
+	TEST_ASSERT(env!=NULL,"allocate an stk environment with a timer fd");
+	pfd.fd = stk_env_get_timer_fd(env);
+	pfd.events = POLLIN;
+	if(pfd.fd == -1) {
+		printf("timer fd not supported, skipping timer fd tests\n");
+		TEST_ASSERT(stk_destroy_env(env)==STK_SUCCESS,"Failed to destroy env");
+		return;
+	}
+
+	tset = stk_new_timer_set(env,NULL,0,STK_TRUE);
+	TEST_ASSERT(tset!=NULL,"Failed to allocate a timer set in the env pool");
+	TEST_ASSERT(poll(&pfd,1,0) == 0,"timer fd ready with no timers");
+
+	/* A shorter timer rearms the fd */
+	reset_cbdata();
+	stk_schedule_timer(tset,timer_cb,1,NULL,500);
+	stk_schedule_timer(tset,timer_cb,2,NULL,30);
+	gettimeofday(&start,NULL);
+	TEST_ASSERT(poll(&pfd,1,1000) == 1,"timer fd not ready after 1 second");
+	elapsed = usecs_since(&start);
+	TEST_ASSERT(elapsed >= 20000 && elapsed < 400000,"timer fd ready after %ld us, expected 30ms",elapsed);
+	rc = stk_env_dispatch_timer_fd(env,0);
+	TEST_ASSERT(rc==STK_SUCCESS && expired == 1,"dispatch timer fd rc %d expired %d",rc,expired);
+
+	/* The fd is rearmed to the remaining timer and disarmed when it is cancelled */
+	TEST_ASSERT(poll(&pfd,1,0) == 0,"timer fd ready after dispatching");
+	TEST_ASSERT(stk_cancel_timer_id(tset,1)==STK_SUCCESS,"Failed to cancel timer 1");
+	rc = stk_env_dispatch_timer_fd(env,0);
+	TEST_ASSERT(rc==STK_SUCCESS && expired == 1,"dispatch timer fd rc %d expired %d",rc,expired);
+	TEST_ASSERT(poll(&pfd,1,600) == 0,"timer fd ready with no timers");
+
+	rc = stk_free_timer_set(tset,STK_FALSE);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy the timer set: %d",rc);
+	TEST_ASSERT(stk_destroy_env(env)==STK_SUCCESS,"Failed to destroy env with a timer fd");
+}
+
+/* Requests from a thread which does not own the timer set */
+stk_timer_t *foreign_timer;
+void *foreign_timer_thread(void *arg)
+{
+	stk_timer_set_t *tset = (stk_timer_set_t *) arg;
+	stk_timer_t t;
+
+	foreign_timer = stk_schedule_timer(tset,resched_timer_cb,50,NULL,10);
+	t = stk_schedule_timer(tset,resched_timer_cb,51,NULL,10);
+	TEST_ASSERT(foreign_timer!=NULL && t!=NULL,"Failed to schedule timers from another thread");
+	TEST_ASSERT(stk_cancel_timer(tset,t)==STK_SUCCESS,"Failed to cancel timer from another thread");
+	TEST_ASSERT(stk_cancel_timer_id(tset,2)==STK_SUCCESS,"Failed to cancel timer by id from another thread");
+	return NULL;
+}
+
+/* Requests for a timer which expired before they were made */
+void *stale_timer_thread(void *arg)
+{
+	stk_timer_set_t *tset = (stk_timer_set_t *) arg;
+
+	TEST_ASSERT(stk_reschedule_timer(tset,foreign_timer)==STK_SUCCESS,"Failed to reschedule expired timer from another thread");
+	TEST_ASSERT(stk_cancel_timer(tset,foreign_timer)==STK_SUCCESS,"Failed to cancel expired timer from another thread");
+	return NULL;
+}
+
+stk_uint32 owner_wakeups;
+void owner_wakeup_cb(stk_timer_set_t *timer_set,void *user_setdata)
+{
+	stk_atomic_fetch_add_32(&owner_wakeups,1,STK_MO_RELAXED);
+}
+
+void owned_timer_tests(stk_env_t *env)
+{
+	stk_options_t options[] = { { "timer_owner_thread", (void *)STK_TRUE},
+		{ "timer_wakeup_cb", (void *) owner_wakeup_cb }, { NULL, NULL } };
+	stk_timer_set_t *tset;
+	stk_timer_t reused;
+	pthread_t thread;
+	stk_ret rc;
+
+	tset = stk_new_timer_set_with_options(env,NULL,0,STK_FALSE,options);
+	TEST_ASSERT(tset!=NULL,"Failed to allocate an owned timer set");
+
+	reset_cbdata();
+	stk_schedule_timer(tset,resched_timer_cb,1,NULL,10);
+	stk_schedule_timer(tset,resched_timer_cb,2,NULL,10000);
+
+	TEST_ASSERT(pthread_create(&thread,NULL,foreign_timer_thread,tset)==0,"Failed to create timer thread");
+	TEST_ASSERT(pthread_join(thread,NULL)==0,"Failed to join timer thread");
+
+	/* Requests are applied in order when the owner next uses the set */
+	TEST_ASSERT(stk_atomic_load_32(&owner_wakeups,STK_MO_RELAXED) == 4,"expected 4 owner wakeups, got %u",owner_wakeups);
+	TEST_ASSERT(cancelled == 0,"requests applied before the owner used the timer set");
+	TEST_ASSERT(stk_next_timer_ms(tset) > 0,"expected timers to be pending");
+	TEST_ASSERT(cancelled == 2,"expected 2 timers cancelled by another thread, got %d",cancelled);
+	TEST_ASSERT(stk_timer_is_scheduled(tset,foreign_timer),"timer scheduled by another thread is not scheduled");
+
+	usleep(20000);
+	rc = stk_dispatch_timers(tset,0);
+	TEST_ASSERT(rc==STK_SUCCESS && expired == 2,"expected 2 owned timers to expire (%d), expired %d",rc,expired);
+	TEST_ASSERT(stk_next_timer_ms(tset) == -1,"owned timer set should be empty");
+
+	/* Requests for timers which expired before the owner applied them are dropped */
+	reset_cbdata();
+	TEST_ASSERT(pthread_create(&thread,NULL,stale_timer_thread,tset)==0,"Failed to create timer thread");
+	TEST_ASSERT(pthread_join(thread,NULL)==0,"Failed to join timer thread");
+	TEST_ASSERT(stk_next_timer_ms(tset) == -1,"stale reschedule request revived an expired timer");
+	TEST_ASSERT(cancelled == 0,"stale cancel request called back an expired timer");
+
+	/* Expired timers are reused, and continue to expire normally */
+	reused = stk_schedule_timer(tset,resched_timer_cb,3,NULL,10);
+	stk_schedule_timer(tset,resched_timer_cb,4,NULL,10);
+	stk_schedule_timer(tset,resched_timer_cb,5,NULL,10);
+	TEST_ASSERT(reused!=NULL && stk_timer_is_scheduled(tset,reused),"Failed to reuse expired timer");
+	usleep(20000);
+	rc = stk_dispatch_timers(tset,0);
+	TEST_ASSERT(rc==STK_SUCCESS && expired == 3 && cancelled == 0,"expected 3 reused timers to expire (%d), expired %d cancelled %d",rc,expired,cancelled);
+	TEST_ASSERT(stk_next_timer_ms(tset) == -1,"owned timer set should be empty after reuse");
+
+	rc = stk_free_timer_set(tset,STK_TRUE);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy the owned timer set: %d",rc);
+}
+
+/* The env timer pool grows beyond its initial size and orders sets by their earliest timer */
+void timer_pool_tests()
+{
+	stk_options_t options[] = { { "inhibit_name_service", (void *)STK_TRUE}, { NULL, NULL } };
+	stk_env_t *env = stk_create_env(options);
+	stk_timer_set_t *tsets[40], *default_set;
+	stk_timer_t early;
+	stk_ret rc;
+	int next, pooled = 0;
+
+	TEST_ASSERT(env!=NULL,"allocate an stk environment");
+	default_set = stk_env_get_default_timer_set(env);
+	TEST_ASSERT(default_set!=NULL,"env has no default timer set");
+	for(int i = 0; i < 40; i++) {
+		tsets[i] = stk_new_timer_set(env,NULL,0,STK_TRUE);
+		TEST_ASSERT(tsets[i]!=NULL,"Failed to allocate timer set %d in the env pool",i);
+	}
+	TEST_ASSERT(stk_next_timer_ms_in_pool(env) == INT_MAX,"timer pool has timers");
+
+	reset_cbdata();
+	for(int i = 0; i < 40; i++)
+		stk_schedule_timer(tsets[i],timer_cb,i,NULL,2000 + (100 * i));
+	early = stk_schedule_timer(tsets[17],timer_cb,100,NULL,300);
+	next = stk_next_timer_ms_in_pool(env);
+	TEST_ASSERT(next > 200 && next <= 300,"next timer in pool %d ms, expected 300",next);
+	TEST_ASSERT(stk_env_get_timer_set(env,0) == tsets[17],"timer set with the earliest timer is not first in the pool");
+	TEST_ASSERT(stk_env_get_default_timer_set(env) == default_set,"env default timer set changed when the pool was reordered");
+
+	/* Cancelling the earliest timer moves its set down the pool */
+	rc = stk_cancel_timer(tsets[17],early);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to cancel timer (%d)",rc);
+	next = stk_next_timer_ms_in_pool(env);
+	TEST_ASSERT(next > 1900 && next <= 2000,"next timer in pool %d ms, expected 2000",next);
+	TEST_ASSERT(stk_env_get_timer_set(env,0) == tsets[0],"timer set 0 is not first in the pool");
+
+	/* Only sets with expired timers are dispatched */
+	stk_schedule_timer(tsets[33],timer_cb,101,NULL,20);
+	usleep(40000);
+	rc = stk_env_dispatch_timer_pools(env,0);
+	TEST_ASSERT(rc==STK_SUCCESS && expired == 1,"dispatch timer pool rc %d expired %d",rc,expired);
+	next = stk_next_timer_ms_in_pool(env);
+	TEST_ASSERT(next > 1800 && next <= 2000,"next timer in pool %d ms after dispatch, expected 1960",next);
+
+	/* Freeing the sets removes them from the pool, the env may have its own sets */
+	while(stk_env_get_timer_set(env,pooled)) pooled++;
+	for(int i = 0; i < 40; i++) {
+		rc = stk_free_timer_set(tsets[i],STK_TRUE);
+		TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy timer set %d: %d",i,rc);
+	}
+	TEST_ASSERT(cancelled == 41,"expected 41 timers cancelled, got %d",cancelled);
+	TEST_ASSERT(stk_env_get_timer_set(env,pooled - 40) == NULL && (pooled == 40 || stk_env_get_timer_set(env,pooled - 41) != NULL),
+		"timer pool has %d sets after freeing 40",pooled);
+	TEST_ASSERT(stk_destroy_env(env)==STK_SUCCESS,"Failed to destroy env");
+}
+
+void dump_timer_stats(char *name,stk_timer_set_stats_t *stats)
+{
+	printf("%s: scheduled %lu cancelled %lu fired %lu, max lateness %lu us, max callback %lu us\n",
+		name,stats->scheduled,stats->cancelled,stats->fired,stats->lateness_max_us,stats->callback_max_us);
+	for(int i = 0; i < STK_TIMER_HISTOGRAM_BUCKETS; i++) {
+		if(stats->lateness[i] || stats->callback[i])
+			printf("  < %8lu us: lateness %lu callback %lu\n",1UL << i,stats->lateness[i],stats->callback[i]);
+	}
+}
+
+void slow_timer_cb(stk_timer_set_t *timer_set,stk_timer_t *timer,int id,void *userdata,void * user_setdata, stk_timer_cb_type cb_type)
+{
+	timer_cb(timer_set,timer,id,userdata,user_setdata,cb_type);
+	if(cb_type == STK_TIMER_EXPIRED) usleep(5000);
+}
+
+void timer_stats_tests(stk_env_t *env)
+{
+	stk_timer_set_t *tset;
+	stk_timer_set_stats_t stats;
+	stk_uint64 late = 0, slow = 0;
+	stk_timer_t t;
+	stk_ret rc;
+
+	tset = stk_new_timer_set(env,NULL,0,STK_FALSE);
+	TEST_ASSERT(tset!=NULL,"Failed to allocate a timer set");
+
+	reset_cbdata();
+	stk_schedule_timer(tset,timer_cb,1,NULL,5);
+	stk_schedule_timer(tset,slow_timer_cb,2,NULL,5);
+	t = stk_schedule_timer(tset,timer_cb,3,NULL,5);
+	TEST_ASSERT(stk_cancel_timer(tset,t)==STK_SUCCESS,"Failed to cancel timer");
+	usleep(20000);
+	rc = stk_dispatch_timers(tset,0);
+	TEST_ASSERT(rc==STK_SUCCESS && expired == 2,"expected 2 timers to expire (%d), expired %d",rc,expired);
+
+	rc = stk_timer_set_get_stats(tset,&stats);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to get timer set stats (%d)",rc);
+	dump_timer_stats("timer stats",&stats);
+	TEST_ASSERT(stats.scheduled == 3 && stats.cancelled == 1 && stats.fired == 2,"unexpected timer counts scheduled %lu cancelled %lu fired %lu",
+		stats.scheduled,stats.cancelled,stats.fired);
+
+	/* Both timers were dispatched at least 15ms late, and one callback took at least 5ms */
+	for(int i = 14; i < STK_TIMER_HISTOGRAM_BUCKETS; i++) late += stats.lateness[i];
+	for(int i = 13; i < STK_TIMER_HISTOGRAM_BUCKETS; i++) slow += stats.callback[i];
+	TEST_ASSERT(late == 2 && stats.lateness_max_us >= 15000,"expected 2 timers over 8ms late, got %lu (max %lu us)",late,stats.lateness_max_us);
+	TEST_ASSERT(slow == 1 && stats.callback_max_us >= 5000,"expected 1 callback over 4ms, got %lu (max %lu us)",slow,stats.callback_max_us);
+
+	rc = stk_free_timer_set(tset,STK_FALSE);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy the timer set: %d",rc);
+}
+
+/* Compare the cost of scheduling, querying and cancelling many timers in list and wheel timer sets */
+void timer_benchmark(stk_env_t *env,stk_options_t *options,char *name,int num_timers)
+{
+	stk_timer_set_t *tset;
+	stk_timer_t *timers = calloc(num_timers,sizeof(stk_timer_t));
+	struct timeval start;
+	long sched_usecs, next_usecs, find_usecs, cancel_usecs, cancel_id_usecs;
+
+	TEST_ASSERT(timers!=NULL,"Failed to allocate timer benchmark array");
+	tset = stk_new_timer_set_with_options(env,NULL,num_timers,STK_FALSE,options);
+	TEST_ASSERT(tset!=NULL,"Failed to allocate a timer set for benchmarking");
+
+	srand(1);
+	gettimeofday(&start,NULL);
+	for(int i = 0; i < num_timers; i++) {
+		timers[i] = stk_schedule_timer(tset,null_timer_cb,i,NULL,10000 + (rand() % 60000));
+		TEST_ASSERT(timers[i]!=NULL,"Failed to schedule benchmark timer %d",i);
+	}
+	sched_usecs = usecs_since(&start);
+
+	gettimeofday(&start,NULL);
+	for(int i = 0; i < num_timers; i++)
+		TEST_ASSERT(stk_next_timer_ms(tset) > 0,"benchmark timer due unexpectedly");
+	stk_dispatch_timers(tset,0);
+	next_usecs = usecs_since(&start);
+
+	gettimeofday(&start,NULL);
+	for(int i = 0; i < num_timers; i++)
+		TEST_ASSERT(stk_find_timer_id(tset,i) == timers[i] && stk_timer_is_scheduled(tset,timers[i]),"Failed to find benchmark timer %d",i);
+	find_usecs = usecs_since(&start);
+
+	/* Cancel half of the timers by ID and the rest by handle */
+	gettimeofday(&start,NULL);
+	for(int i = 0; i < num_timers; i += 2)
+		TEST_ASSERT(stk_cancel_timer_id(tset,i) == STK_SUCCESS,"Failed to cancel benchmark timer %d by id",i);
+	cancel_id_usecs = usecs_since(&start);
+
+	gettimeofday(&start,NULL);
+	for(int i = 1; i < num_timers; i += 2)
+		stk_cancel_timer(tset,timers[i]);
+	cancel_usecs = usecs_since(&start);
+
+	printf("%s: %d timers schedule %ld us, next/dispatch %ld us, find/is scheduled %ld us, cancel %ld us, cancel id %ld us\n",
+		name,num_timers,sched_usecs,next_usecs,find_usecs,cancel_usecs,cancel_id_usecs);
+
+	TEST_ASSERT(stk_next_timer_ms(tset) == -1,"benchmark timer set not empty");
+	TEST_ASSERT(stk_free_timer_set(tset,STK_FALSE)==STK_SUCCESS,"Failed to destroy benchmark timer set");
+	free(timers);
+}
+
 int main(int argc,char *argv[])
 {
 	stk_env_t *env;
@@ -78,13 +502,47 @@ int main(int argc,char *argv[])
 	reset_cbdata();
 	stk_timer_t t1 = stk_schedule_timer(tset,timer_cb,2,(void*) 0x8008,1000);
 	TEST_ASSERT(stk_next_timer_ms(tset) > 900,"less than 900ms after scheduling timer! (%d)",rc);
+	TEST_ASSERT(stk_timer_is_scheduled(tset,t1),"timer not scheduled");
 	rc = stk_cancel_timer(tset,t1);
 	TEST_ASSERT(rc==STK_SUCCESS,"Failed to cancel timer (%d)",rc);
+	TEST_ASSERT(!stk_timer_is_scheduled(tset,t1),"cancelled timer still scheduled");
+	}
+
+	{
+	/* Rescheduling a pending timer moves it, rather than adding it twice */
+	reset_cbdata();
+	stk_timer_t t1 = stk_schedule_timer(tset,timer_cb,7,NULL,500);
+	rc = stk_reschedule_timer(tset,t1);
+	TEST_ASSERT(rc==STK_SUCCESS && stk_find_timer_id(tset,7)==t1,"Failed to find rescheduled timer (%d)",rc);
+	TEST_ASSERT(stk_cancel_timer_id(tset,7)==STK_SUCCESS && cancelled == 1,"Failed to cancel rescheduled timer by id");
+	TEST_ASSERT(stk_find_timer_id(tset,7)==NULL && stk_cancel_timer_id(tset,7)==STK_NOT_FOUND,"rescheduled timer scheduled twice");
+	TEST_ASSERT(stk_next_timer_ms(tset) == -1,"timer set should be empty");
 	}
 
 	rc = stk_free_timer_set(tset,0);
 	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy the timer set: %d",rc);
 
+	clock_tests();
+	timer_wheel_tests(env);
+	timer_fd_tests();
+	timer_pool_tests();
+	owned_timer_tests(env);
+	timer_stats_tests(env);
+
+	{
+	stk_options_t options[] = { { "timer_wheel", (void *)STK_TRUE}, { NULL, NULL } };
+
+	timer_benchmark(env,NULL,"list",5000);
+	timer_benchmark(env,options,"wheel",5000);
+	}
+	{
+	stk_options_t options[] = { { "timer_owner_thread", (void *)STK_TRUE}, { NULL, NULL } };
+	stk_options_t wheel_options[] = { { "timer_wheel", (void *)STK_TRUE}, { "timer_owner_thread", (void *)STK_TRUE}, { NULL, NULL } };
+
+	timer_benchmark(env,options,"owned list",5000);
+	timer_benchmark(env,wheel_options,"owned wheel",5000);
+	}
+
 	rc = stk_destroy_env(env);
 	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy a stk env object : %d",rc);
 
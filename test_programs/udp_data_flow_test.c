@@ -153,6 +153,99 @@ void dispatch(stk_data_flow_t *df)
 	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy the test sequence : %d",rc);
 }
 
+stk_ret check_boundary_segment(stk_sequence_t *seq, void *vdata, stk_uint64 sz, stk_uint64 user_type, void *clientd)
+{
+	unsigned char *data = (unsigned char *) vdata;
+	int *idx = (int *) clientd;
+
+	TEST_ASSERT(user_type == (stk_uint64) 0x4f0 + *idx,"Boundary sequence element %d has the wrong user type %lx",*idx,user_type);
+	for(stk_uint64 i = 0; i < sz; i++)
+		TEST_ASSERT(data[i] == (unsigned char) user_type,"Boundary sequence element %d byte %lu is corrupt",*idx,i);
+	(*idx)++;
+	return STK_SUCCESS;
+}
+
+/* Send a sequence whose first element leaves 'room' bytes in the first fragment and check it is reassembled.
+ * The fragment, fragment 0 and segment headers of an unnamed sequence take 82 bytes of the 65507 byte MRU.
+ */
+void send_boundary_sequence(stk_env_t *stkbase,stk_data_flow_t *client_df,stk_data_flow_t *listener_df,int room)
+{
+	int sizes[2] = { 65507 - 82 - room, 10 };
+	stk_sequence_t *seq, *rcv_seq, *ret_seq = NULL;
+	unsigned char *bufs[2];
+	struct pollfd pfd;
+	stk_ret rc;
+	int idx = 0;
+
+	seq = stk_create_sequence(stkbase,NULL,0,STK_SEQUENCE_TYPE_DATA,STK_SERVICE_TYPE_DATA,NULL);
+	TEST_ASSERT(seq!=NULL,"Failed to allocate boundary test sequence");
+
+	for(int i = 0; i < 2; i++) {
+		bufs[i] = malloc(sizes[i]);
+		TEST_ASSERT(bufs[i]!=NULL,"Failed to allocate boundary buffer %d",i);
+		memset(bufs[i],0xf0 + i,sizes[i]);
+		rc = stk_add_reference_to_sequence(seq,bufs[i],sizes[i],0x4f0 + i);
+		TEST_ASSERT(rc==STK_SUCCESS,"Failed to add boundary element %d size %d",i,sizes[i]);
+	}
+
+	printf("sending boundary sequence with %d bytes left in the first fragment\n",room);
+	rc = stk_data_flow_send(client_df,seq,0);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to send boundary sequence with %d bytes left",room);
+
+	rcv_seq = stk_create_sequence(stkbase,NULL,0,0,0,NULL);
+	TEST_ASSERT(rcv_seq!=NULL,"Failed to allocate boundary rcv sequence");
+
+	pfd.fd = stk_udp_listener_fd(listener_df);
+	pfd.events = POLLIN;
+	while(!ret_seq) {
+		pfd.revents = 0;
+		rc = poll(&pfd,1,1000);
+		TEST_ASSERT(rc > 0,"Timed out receiving boundary sequence with %d bytes left",room);
+		ret_seq = stk_data_flow_rcv(listener_df,rcv_seq,0);
+	}
+
+	TEST_ASSERT(stk_number_of_sequence_elements(ret_seq) == 2,"Boundary sequence has %d elements",stk_number_of_sequence_elements(ret_seq));
+	TEST_ASSERT(stk_sequence_total_size(ret_seq) == (stk_uint64) (sizes[0] + sizes[1]),"Boundary sequence has %lu bytes",stk_sequence_total_size(ret_seq));
+	rc = stk_iterate_sequence(ret_seq,check_boundary_segment,&idx);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to check boundary sequence");
+
+	/* The udp listener returns the sequence it reassembled into */
+	if(ret_seq != rcv_seq) {
+		rc = stk_destroy_sequence(ret_seq);
+		TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy the reassembled boundary sequence : %d",rc);
+	}
+	rc = stk_destroy_sequence(rcv_seq);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy the boundary rcv sequence : %d",rc);
+	rc = stk_destroy_sequence(seq);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy the boundary sequence : %d",rc);
+	for(int i = 0; i < 2; i++) free(bufs[i]);
+}
+
+void boundary_test(stk_env_t *stkbase)
+{
+	stk_options_t listener_options[] = { { "bind_address", "127.0.0.1"}, {"bind_port", "29313"}, {"reuseaddr", NULL},
+		{ "receive_buffer_size", "1024000" }, { NULL, NULL } };
+	stk_options_t client_options[] = { { "destination_address", "127.0.0.1"}, {"destination_port", "29313"}, { NULL, NULL } };
+	stk_data_flow_t *listener_df, *client_df;
+	stk_ret rc;
+
+	listener_df = stk_udp_listener_create_data_flow(stkbase,"udp listener socket for boundary test",29191,listener_options);
+	TEST_ASSERT(listener_df!=NULL,"Failed to create udp boundary listener data flow");
+
+	client_df = stk_udp_client_create_data_flow(stkbase,"udp client socket for boundary test",29091,client_options);
+	TEST_ASSERT(client_df!=NULL,"Failed to create udp boundary client data flow");
+
+	/* The first element ends exactly at the MRU */
+	send_boundary_sequence(stkbase,client_df,listener_df,0);
+	/* Too little room is left for the second element's segment header */
+	send_boundary_sequence(stkbase,client_df,listener_df,10);
+
+	rc = stk_destroy_data_flow(client_df);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy the boundary client data flow : %d",rc);
+	rc = stk_destroy_data_flow(listener_df);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy the boundary listener data flow : %d",rc);
+}
+
 int main(int argc,char *argv[])
 {
 	stk_env_t *stkbase;
@@ -296,6 +389,9 @@ int main(int argc,char *argv[])
 
 		printf("sent %d sequences\n",seqs_sent);
 		}
+
+		/* Check sequences whose segment headers land at the end of a fragment */
+		boundary_test(stkbase);
 	}
 	free(default_buffer);
 
@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "stk_env_api.h"
+#include "stk_sequence_api.h"
+#include "stk_data_flow_api.h"
+#include "stk_tcp_server_api.h"
+#include "stk_tcp_client_api.h"
+#include "stk_tcp.h"
+#include "stk_udp_listener_api.h"
+#include "stk_udp_client_api.h"
+#include "stk_uring_api.h"
+#include "eg_dispatcher_api.h"
+#include "stk_test.h"
+
+#define URING_TEST_SEQS 500
+/* Sequences span several of the ring's receive buffers */
+#define URING_TEST_MAX_LEN 40000
+#define URING_TEST_UDP_SEQS 200
+/* UDP sequences sent before waiting for them to be received, so the socket doesn't drop any */
+#define URING_TEST_UDP_BATCH 10
+
+stk_dispatcher_t *d;
+char payload[URING_TEST_MAX_LEN];
+int received, echoed, accepted, destroyed, udp_received;
+
+/* Sequence IDs start at 1, 0 is STK_SEQUENCE_ID_INVALID */
+
+int test_seq_len(stk_sequence_id id) { return (int) ((id * 997) % URING_TEST_MAX_LEN) + 1; }
+
+void check_seq(stk_sequence_t *seq)
+{
+	char *data;
+	stk_uint64 sz;
+	stk_ret rc;
+
+	rc = stk_sequence_find_data_by_type(seq,0x1,(void **) &data,&sz);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to find data in sequence %lu",stk_get_sequence_id(seq));
+	TEST_ASSERT(sz==(stk_uint64) test_seq_len(stk_get_sequence_id(seq)),"Sequence %lu has %lu bytes",stk_get_sequence_id(seq),sz);
+	TEST_ASSERT(memcmp(data,payload,sz)==0,"Sequence %lu data mismatch",stk_get_sequence_id(seq));
+}
+
+/* Sequences are echoed back to the client in the order received */
+void server_data_cb(stk_dispatcher_t *d,stk_data_flow_t *df,stk_sequence_t *seq)
+{
+	stk_ret rc;
+
+	if(stk_get_sequence_type(seq) != STK_SEQUENCE_TYPE_DATA) return;
+	TEST_ASSERT(stk_get_sequence_id(seq)==(stk_sequence_id) received + 1,"Server received sequence %lu, expected %d",stk_get_sequence_id(seq),received + 1);
+	check_seq(seq);
+	received++;
+
+	rc = stk_data_flow_send(df,seq,STK_TCP_SEND_FLAG_NONBLOCK);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to echo sequence %lu",stk_get_sequence_id(seq));
+}
+
+void client_data_cb(stk_dispatcher_t *d,stk_data_flow_t *df,stk_sequence_t *seq)
+{
+	if(stk_get_sequence_type(seq) != STK_SEQUENCE_TYPE_DATA) return;
+	TEST_ASSERT(stk_get_sequence_id(seq)==(stk_sequence_id) echoed + 1,"Client received sequence %lu, expected %d",stk_get_sequence_id(seq),echoed + 1);
+	check_seq(seq);
+	if(++echoed == URING_TEST_SEQS)
+		stop_dispatching(d);
+}
+
+/* Every third UDP sequence has a second element, so it is sent in two fragments */
+void udp_data_cb(stk_dispatcher_t *d,stk_data_flow_t *df,stk_sequence_t *seq)
+{
+	stk_sequence_id id = stk_get_sequence_id(seq);
+	stk_ret rc;
+
+	TEST_ASSERT(id==(stk_sequence_id) udp_received + 1,"UDP listener received sequence %lu, expected %d",id,udp_received + 1);
+	check_seq(seq);
+	TEST_ASSERT(stk_number_of_sequence_elements(seq)==(id % 3 == 0 ? 2 : 1),"UDP sequence %lu has %d elements",id,stk_number_of_sequence_elements(seq));
+	udp_received++;
+
+	/* The udp listener received in to its own sequence */
+	rc = stk_destroy_sequence(seq);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy received UDP sequence %lu",id);
+}
+
+void client_hup_cb(stk_dispatcher_t *d,stk_data_flow_t *df,int fd)
+{
+	TEST_ASSERT(0,"Client data flow hung up");
+}
+
+void fd_created_cb(stk_data_flow_t *df,stk_data_flow_id id,int fd)
+{
+	int rc;
+
+	switch(stk_get_data_flow_type(df)) {
+	case STK_TCP_SERVER_FLOW: rc = server_dispatch_add_fd(d,fd,df,server_data_cb); break;
+	case STK_TCP_ACCEPTED_FLOW: rc = dispatch_add_accepted_fd(d,fd,df,server_data_cb); accepted++; break;
+	case STK_UDP_LISTENER_FLOW: rc = dispatch_add_fd(d,df,fd,client_hup_cb,udp_data_cb); break;
+	default: rc = dispatch_add_fd(d,df,fd,client_hup_cb,client_data_cb); break;
+	}
+	TEST_ASSERT(rc==0,"Failed to add fd %d to dispatcher",fd);
+}
+
+void fd_destroyed_cb(stk_data_flow_t *df,stk_data_flow_id id,int fd)
+{
+	dispatch_remove_fd(d,fd);
+	if(stk_get_data_flow_type(df) == STK_TCP_ACCEPTED_FLOW)
+		destroyed++;
+}
+
+int main(int argc,char *argv[])
+{
+	stk_env_t *stkbase;
+	stk_uring_t *ring;
+	stk_uring_stats_t stats;
+	stk_data_flow_t *server_df, *client_df;
+	stk_ret rc;
+
+	{
+	stk_options_t options[] = { { "inhibit_name_service", (void *)STK_TRUE}, { "wakeup_cb", (void *) wakeup_dispatcher}, { NULL, NULL } };
+
+	stkbase = stk_create_env(options);
+	TEST_ASSERT(stkbase!=NULL,"allocate an stk environment");
+	}
+
+	ring = stk_create_uring(stkbase,NULL);
+	if(!ring) {
+		/* Not supported by this kernel, or disabled */
+		stk_destroy_env(stkbase);
+		printf("%s PASSED (io_uring not available)\n",argv[0]);
+		return 0;
+	}
+
+	d = alloc_dispatcher();
+	TEST_ASSERT(d!=NULL,"Failed to allocate dispatcher");
+	TEST_ASSERT(dispatch_set_uring(d,ring)==0,"Failed to set dispatcher io_uring");
+
+	for(int i = 0; i < (int) sizeof(payload); i++) payload[i] = (char) i;
+
+	{
+	stk_options_t options[] = { { "bind_address", "127.0.0.1"}, {"bind_port", "29315"}, { "reuseaddr", (void *) STK_TRUE},
+		{ "fd_created_cb", (void *) fd_created_cb }, { "fd_destroyed_cb", (void *) fd_destroyed_cb }, { "io_uring", ring }, { NULL, NULL } };
+
+	server_df = stk_tcp_server_create_data_flow(stkbase,"uring server",1,options);
+	TEST_ASSERT(server_df!=NULL,"Failed to create listening data flow");
+	TEST_ASSERT(stk_uring_owns_fd(ring,stk_tcp_server_fd(server_df)),"Listening fd not attached to io_uring");
+	}
+
+	{
+	stk_options_t options[] = { { "connect_address", "127.0.0.1"}, {"connect_port", "29315"}, { "nodelay", (void *) STK_TRUE},
+		{ "fd_created_cb", (void *) fd_created_cb }, { "fd_destroyed_cb", (void *) fd_destroyed_cb }, { "io_uring", ring }, { NULL, NULL } };
+
+	client_df = stk_tcp_client_create_data_flow(stkbase,"uring client",2,options);
+	TEST_ASSERT(client_df!=NULL,"Failed to create client data flow");
+	TEST_ASSERT(stk_uring_owns_fd(ring,stk_tcp_client_fd(client_df)),"Client fd not attached to io_uring");
+	}
+
+	/* Queue all the sends, they are submitted in batches by the dispatcher */
+	for(int i = 0; i < URING_TEST_SEQS; i++) {
+		stk_sequence_t *seq = stk_create_sequence(stkbase,NULL,i + 1,STK_SEQUENCE_TYPE_DATA,STK_SERVICE_TYPE_DATA,NULL);
+
+		TEST_ASSERT(seq!=NULL,"Failed to create sequence %d",i);
+		rc = stk_copy_to_sequence(seq,payload,test_seq_len(i + 1),0x1);
+		TEST_ASSERT(rc==STK_SUCCESS,"Failed to copy to sequence %d",i);
+		rc = stk_data_flow_send(client_df,seq,STK_TCP_SEND_FLAG_NONBLOCK);
+		TEST_ASSERT(rc==STK_SUCCESS,"Failed to send sequence %d",i);
+		stk_destroy_sequence(seq);
+	}
+
+	client_dispatcher_timed(d,stkbase,NULL,10000);
+	TEST_ASSERT(accepted==1,"Accepted %d connections",accepted);
+	TEST_ASSERT(received==URING_TEST_SEQS && echoed==URING_TEST_SEQS,"Received %d sequences and %d echoes of %d",received,echoed,URING_TEST_SEQS);
+
+	rc = stk_uring_get_stats(ring,&stats);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to get io_uring stats");
+	TEST_ASSERT(stats.accepts==1,"Unexpected accepts %lu",stats.accepts);
+	/* Data received while starved of buffers is received directly from the socket */
+	TEST_ASSERT(stats.recv_bytes > 0 && stats.send_bytes >= stats.recv_bytes,"Received %lu bytes in to buffers, sent %lu",stats.recv_bytes,stats.send_bytes);
+	TEST_ASSERT(stats.sqes > stats.submits,"Requests were not batched, %lu requests in %lu submits",stats.sqes,stats.submits);
+
+	/* The accepted data flow is destroyed by the dispatcher when the client closes */
+	rc = stk_destroy_data_flow(client_df);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy client data flow");
+	for(int i = 0; i < 100 && destroyed == 0; i++)
+		client_dispatcher_timed(d,stkbase,NULL,10);
+	TEST_ASSERT(destroyed==1,"Accepted data flow not destroyed when the client closed");
+
+	rc = stk_destroy_data_flow(server_df);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy listening data flow");
+
+	{
+	/* Rings receiving datagrams need buffers large enough for any datagram */
+	stk_options_t options[] = { { "bind_address", "127.0.0.1"}, {"bind_port", "29316"}, { "reuseaddr", (void *) STK_TRUE},
+		{ "fd_created_cb", (void *) fd_created_cb }, { "fd_destroyed_cb", (void *) fd_destroyed_cb }, { "io_uring", ring }, { NULL, NULL } };
+
+	server_df = stk_udp_listener_create_data_flow(stkbase,"uring udp listener",3,options);
+	TEST_ASSERT(server_df==NULL,"Created a udp listener on an io_uring with buffers too small for datagrams");
+	}
+
+	terminate_dispatcher(d);
+	free_dispatcher(d);
+
+	rc = stk_destroy_uring(ring);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy io_uring");
+
+	{
+	char buffer_sz[16];
+	stk_options_t options[] = { { "uring_buffers", "64" }, { "uring_buffer_size", buffer_sz }, { NULL, NULL } };
+
+	snprintf(buffer_sz,sizeof(buffer_sz),"%d",STK_URING_DATAGRAM_BUFFER_SIZE);
+	ring = stk_create_uring(stkbase,options);
+	TEST_ASSERT(ring!=NULL,"Failed to create io_uring for datagrams");
+	}
+
+	d = alloc_dispatcher();
+	TEST_ASSERT(d!=NULL,"Failed to allocate dispatcher");
+	TEST_ASSERT(dispatch_set_uring(d,ring)==0,"Failed to set dispatcher io_uring");
+
+	{
+	stk_options_t options[] = { { "bind_address", "127.0.0.1"}, {"bind_port", "29316"}, { "reuseaddr", (void *) STK_TRUE},
+		{ "receive_buffer_size", "4000000" },
+		{ "fd_created_cb", (void *) fd_created_cb }, { "fd_destroyed_cb", (void *) fd_destroyed_cb }, { "io_uring", ring }, { NULL, NULL } };
+
+	server_df = stk_udp_listener_create_data_flow(stkbase,"uring udp listener",3,options);
+	TEST_ASSERT(server_df!=NULL,"Failed to create udp listener data flow");
+	TEST_ASSERT(stk_uring_owns_fd(ring,stk_udp_listener_fd(server_df)),"UDP listener fd not attached to io_uring");
+	}
+
+	{
+	stk_options_t options[] = { { "destination_address", "127.0.0.1"}, {"destination_port", "29316"},
+		{ "fd_created_cb", (void *) fd_created_cb }, { "fd_destroyed_cb", (void *) fd_destroyed_cb }, { "io_uring", ring }, { NULL, NULL } };
+
+	client_df = stk_udp_client_create_data_flow(stkbase,"uring udp client",4,options);
+	TEST_ASSERT(client_df!=NULL,"Failed to create udp client data flow");
+	TEST_ASSERT(stk_uring_owns_fd(ring,stk_udp_client_fd(client_df)),"UDP client fd not attached to io_uring");
+	}
+
+	for(int i = 0; i < URING_TEST_UDP_SEQS; i++) {
+		stk_sequence_t *seq = stk_create_sequence(stkbase,NULL,i + 1,STK_SEQUENCE_TYPE_DATA,STK_SERVICE_TYPE_DATA,NULL);
+
+		TEST_ASSERT(seq!=NULL,"Failed to create UDP sequence %d",i);
+		rc = stk_copy_to_sequence(seq,payload,test_seq_len(i + 1),0x1);
+		TEST_ASSERT(rc==STK_SUCCESS,"Failed to copy to UDP sequence %d",i);
+		if((i + 1) % 3 == 0) {
+			rc = stk_copy_to_sequence(seq,payload,sizeof(payload),0x2);
+			TEST_ASSERT(rc==STK_SUCCESS,"Failed to copy second element to UDP sequence %d",i);
+		}
+		rc = stk_data_flow_send(client_df,seq,0);
+		TEST_ASSERT(rc==STK_SUCCESS,"Failed to send UDP sequence %d",i);
+		stk_destroy_sequence(seq);
+
+		if((i + 1) % URING_TEST_UDP_BATCH == 0)
+			for(int waited = 0; waited < 1000 && udp_received < i + 1; waited++)
+				client_dispatcher_timed(d,stkbase,NULL,1);
+	}
+	TEST_ASSERT(udp_received==URING_TEST_UDP_SEQS,"UDP listener received %d sequences of %d",udp_received,URING_TEST_UDP_SEQS);
+
+	rc = stk_uring_get_stats(ring,&stats);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to get io_uring stats");
+	TEST_ASSERT(stats.recv_bytes > 0 && stats.send_bytes >= stats.recv_bytes,"Received %lu bytes of datagrams in to buffers, sent %lu",stats.recv_bytes,stats.send_bytes);
+	TEST_ASSERT(stats.sqes > stats.submits,"Datagram sends were not batched, %lu requests in %lu submits",stats.sqes,stats.submits);
+
+	rc = stk_destroy_data_flow(client_df);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy udp client data flow");
+	rc = stk_destroy_data_flow(server_df);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy udp listener data flow");
+
+	terminate_dispatcher(d);
+	free_dispatcher(d);
+
+	rc = stk_destroy_uring(ring);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy datagram io_uring");
+
+	rc = stk_destroy_env(stkbase);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy stk env");
+
+	printf("%s PASSED\n",argv[0]);
+	return 0;
+}
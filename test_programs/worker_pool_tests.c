@@ -0,0 +1,372 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "stk_env_api.h"
+#include "stk_sequence_api.h"
+#include "stk_data_flow_api.h"
+#include "stk_tcp_server_api.h"
+#include "stk_tcp_client_api.h"
+#include "stk_tcp.h"
+#include "stk_sync_api.h"
+#include "stk_worker_pool_api.h"
+#include "eg_dispatcher_api.h"
+#include "stk_test.h"
+
+#define ORDER_TEST_FLOWS 8
+#define ORDER_TEST_SEQS 20000
+
+stk_env_t *stkbase;
+
+/* Each flow is processed by one worker, so its sequences arrive in order */
+int flows[ORDER_TEST_FLOWS];
+stk_sequence_id next_id[ORDER_TEST_FLOWS];
+
+void order_cb(stk_worker_pool_t *pool,stk_data_flow_t *df,stk_sequence_t *seq,void *clientd)
+{
+	int flow = (int) ((int *) df - flows);
+
+	TEST_ASSERT(flow >= 0 && flow < ORDER_TEST_FLOWS,"Unexpected data flow %p",df);
+	TEST_ASSERT(stk_get_sequence_id(seq)==next_id[flow],"Flow %d sequence %lu, expected %lu",flow,stk_get_sequence_id(seq),next_id[flow]);
+	next_id[flow]++;
+
+	/* A slow handler, so the queues fill */
+	if(stk_get_sequence_id(seq) % 1000 == 0) usleep(1000);
+}
+
+void order_tests()
+{
+	stk_options_t options[] = { { "workers", "4" }, { "worker_queue_size", "8" }, { NULL, NULL } };
+	stk_worker_pool_t *pool = stk_create_worker_pool(stkbase,order_cb,NULL,options);
+	stk_worker_pool_stats_t stats;
+	stk_uint64 waits = 0;
+	stk_ret rc;
+
+	TEST_ASSERT(pool!=NULL,"Failed to create worker pool");
+	TEST_ASSERT(stk_worker_pool_workers(pool)==4,"Unexpected number of workers %d",stk_worker_pool_workers(pool));
+
+	for(int i = 0; i < ORDER_TEST_FLOWS; i++) next_id[i] = 1;
+
+	for(int i = 0; i < ORDER_TEST_SEQS; i++) {
+		stk_sequence_t *seq = stk_create_sequence(stkbase,NULL,(i / ORDER_TEST_FLOWS) + 1,STK_SEQUENCE_TYPE_DATA,STK_SERVICE_TYPE_DATA,NULL);
+
+		TEST_ASSERT(seq!=NULL,"Failed to create sequence %d",i);
+		rc = stk_worker_pool_dispatch(pool,(stk_data_flow_t *) &flows[i % ORDER_TEST_FLOWS],seq,0);
+		TEST_ASSERT(rc==STK_SUCCESS,"Failed to dispatch sequence %d",i);
+		/* The pool holds the sequence until it is processed */
+		stk_destroy_sequence(seq);
+	}
+
+	rc = stk_worker_pool_flush(pool);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to flush worker pool");
+	for(int i = 0; i < ORDER_TEST_FLOWS; i++)
+		TEST_ASSERT(next_id[i]==(ORDER_TEST_SEQS / ORDER_TEST_FLOWS) + 1,"Flow %d processed %lu sequences",i,next_id[i] - 1);
+
+	rc = stk_worker_pool_get_stats(pool,&stats);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to get worker pool stats");
+	for(int i = 0; i < STK_WORKER_POOL_HISTOGRAM_BUCKETS; i++) waits += stats.wait[i];
+	TEST_ASSERT(stats.dispatched==ORDER_TEST_SEQS && stats.processed==ORDER_TEST_SEQS && stats.depth==0,
+		"Unexpected stats dispatched %lu processed %lu depth %lu",stats.dispatched,stats.processed,stats.depth);
+	TEST_ASSERT(waits==ORDER_TEST_SEQS,"Wait histogram counts %lu sequences",waits);
+	TEST_ASSERT(stats.full > 0 && stats.rejected == 0 && stats.depth_max <= 9,"Unexpected backpressure stats full %lu rejected %lu depth max %lu",
+		stats.full,stats.rejected,stats.depth_max);
+
+	rc = stk_destroy_worker_pool(pool);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy worker pool");
+}
+
+#define SHARD_TEST_KEYS 32
+#define SHARD_TEST_SEQS 8000
+#define SHARD_KEY_TYPE 0x2
+
+/* Sequences of each key are counted by the key's worker, so they arrive in order */
+stk_uint32 next_count[SHARD_TEST_KEYS];
+volatile stk_uint32 unkeyed_processed;
+
+void shard_cb(stk_worker_pool_t *pool,stk_data_flow_t *df,stk_sequence_t *seq,void *clientd)
+{
+	stk_uint32 *key, *count;
+	stk_uint64 sz;
+
+	if(stk_sequence_find_data_by_type(seq,SHARD_KEY_TYPE,(void **) &key,&sz) != STK_SUCCESS) {
+		stk_atomic_fetch_add_32(&unkeyed_processed,1,STK_MO_RELAXED);
+		return;
+	}
+	TEST_ASSERT(stk_sequence_find_data_by_type(seq,0x1,(void **) &count,&sz)==STK_SUCCESS,"Failed to find count");
+	TEST_ASSERT(*count==next_count[*key],"Key %u count %u, expected %u",*key,*count,next_count[*key]);
+	next_count[*key]++;
+}
+
+/* Sequences of one data flow are spread across the workers by key, and each key stays in order */
+void shard_test(char *shard_key,stk_bool app_key)
+{
+	stk_options_t options[] = { { "workers", "4" }, { "worker_queue_size", "16" }, { "shard_key", shard_key },
+		{ "shard_user_type", "0x2" }, { NULL, NULL } };
+	stk_worker_pool_t *pool = stk_create_worker_pool(stkbase,shard_cb,NULL,options);
+	stk_worker_pool_stats_t stats;
+	stk_ret rc;
+
+	TEST_ASSERT(pool!=NULL,"Failed to create worker pool sharded by %s",shard_key);
+	memset(next_count,0,sizeof(next_count));
+	unkeyed_processed = 0;
+
+	for(int i = 0; i < SHARD_TEST_SEQS; i++) {
+		stk_uint32 key = i % SHARD_TEST_KEYS, count = i / SHARD_TEST_KEYS;
+		stk_sequence_t *seq = stk_create_sequence(stkbase,NULL,key + 1,STK_SEQUENCE_TYPE_DATA,STK_SERVICE_TYPE_DATA,NULL);
+
+		TEST_ASSERT(seq!=NULL,"Failed to create sequence %d",i);
+		rc = stk_copy_to_sequence(seq,&key,sizeof(key),SHARD_KEY_TYPE);
+		TEST_ASSERT(rc==STK_SUCCESS,"Failed to copy key to sequence %d",i);
+		rc = stk_copy_to_sequence(seq,&count,sizeof(count),0x1);
+		TEST_ASSERT(rc==STK_SUCCESS,"Failed to copy count to sequence %d",i);
+		if(app_key)
+			rc = stk_worker_pool_dispatch_key(pool,(stk_data_flow_t *) &flows[0],seq,key,0);
+		else
+			rc = stk_worker_pool_dispatch(pool,(stk_data_flow_t *) &flows[0],seq,0);
+		TEST_ASSERT(rc==STK_SUCCESS,"Failed to dispatch sequence %d",i);
+		stk_destroy_sequence(seq);
+	}
+
+	/* Sequences without the key element go to the data flow's worker */
+	for(int i = 0; i < 10; i++) {
+		stk_sequence_t *seq = stk_create_sequence(stkbase,NULL,1,STK_SEQUENCE_TYPE_DATA,STK_SERVICE_TYPE_DATA,NULL);
+
+		TEST_ASSERT(seq!=NULL,"Failed to create unkeyed sequence %d",i);
+		rc = stk_worker_pool_dispatch(pool,(stk_data_flow_t *) &flows[0],seq,0);
+		TEST_ASSERT(rc==STK_SUCCESS,"Failed to dispatch unkeyed sequence %d",i);
+		stk_destroy_sequence(seq);
+	}
+
+	rc = stk_worker_pool_flush(pool);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to flush worker pool");
+	for(int key = 0; key < SHARD_TEST_KEYS; key++)
+		TEST_ASSERT(next_count[key]==SHARD_TEST_SEQS / SHARD_TEST_KEYS,"Key %d processed %u sequences",key,next_count[key]);
+	TEST_ASSERT(unkeyed_processed==10,"Processed %u unkeyed sequences",unkeyed_processed);
+
+	rc = stk_worker_pool_get_stats(pool,&stats);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to get worker pool stats");
+	TEST_ASSERT(stats.unkeyed==(strcmp(shard_key,"user_type") == 0 ? 10 : 0),"Sharded by %s, %lu unkeyed",shard_key,stats.unkeyed);
+
+	/* Every worker was given keys */
+	for(int idx = 0; idx < 4; idx++) {
+		stk_worker_pool_stats_t worker_stats;
+
+		rc = stk_worker_pool_get_worker_stats(pool,idx,&worker_stats);
+		TEST_ASSERT(rc==STK_SUCCESS,"Failed to get stats of worker %d",idx);
+		TEST_ASSERT(worker_stats.processed > 0 && worker_stats.processed < stats.processed,
+			"Sharded by %s, worker %d processed %lu of %lu",shard_key,idx,worker_stats.processed,stats.processed);
+	}
+	TEST_ASSERT(stk_worker_pool_get_worker_stats(pool,4,&stats)==STK_INVALID_ARG,"Got stats of a worker not in the pool");
+
+	rc = stk_destroy_worker_pool(pool);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy worker pool");
+}
+
+void shard_tests()
+{
+	shard_test("sequence_id",STK_FALSE);
+	shard_test("user_type",STK_FALSE);
+	shard_test("data_flow",STK_TRUE);
+
+	{
+	stk_options_t options[] = { { "shard_key", "instrument" }, { NULL, NULL } };
+	TEST_ASSERT(stk_create_worker_pool(stkbase,shard_cb,NULL,options)==NULL,"Created a worker pool with an unknown shard key");
+	}
+	{
+	stk_options_t options[] = { { "shard_key", "user_type" }, { NULL, NULL } };
+	TEST_ASSERT(stk_create_worker_pool(stkbase,shard_cb,NULL,options)==NULL,"Created a worker pool keyed by user type without the type");
+	}
+}
+
+volatile stk_uint32 release_worker;
+volatile stk_uint32 nonblock_processed;
+
+void blocked_cb(stk_worker_pool_t *pool,stk_data_flow_t *df,stk_sequence_t *seq,void *clientd)
+{
+	while(!stk_atomic_load_32(&release_worker,STK_MO_ACQUIRE)) usleep(100);
+	stk_atomic_fetch_add_32(&nonblock_processed,1,STK_MO_RELAXED);
+}
+
+/* Non blocking dispatches are rejected when the worker's queue is full, and queued sequences are processed on destroy */
+void nonblock_tests()
+{
+	stk_options_t options[] = { { "workers", "1" }, { "worker_queue_size", "4" }, { NULL, NULL } };
+	stk_worker_pool_t *pool = stk_create_worker_pool(stkbase,blocked_cb,NULL,options);
+	stk_worker_pool_stats_t stats;
+	stk_sequence_t *seq = stk_create_sequence(stkbase,NULL,1,STK_SEQUENCE_TYPE_DATA,STK_SERVICE_TYPE_DATA,NULL);
+	int queued = 0;
+	stk_ret rc;
+
+	TEST_ASSERT(pool!=NULL && seq!=NULL,"Failed to create worker pool and sequence");
+
+	/* The worker takes one sequence and blocks in the callback, then the queue fills */
+	while((rc = stk_worker_pool_dispatch(pool,NULL,seq,STK_WORKER_POOL_NONBLOCK)) == STK_SUCCESS && queued < 100)
+		queued++;
+	TEST_ASSERT(rc==STK_WOULDBLOCK,"Non blocking dispatch returned %d when the queue was full",rc);
+	TEST_ASSERT(queued >= 4 && queued <= 5,"Queued %d sequences to a queue of 4",queued);
+
+	rc = stk_worker_pool_get_stats(pool,&stats);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to get worker pool stats");
+	TEST_ASSERT(stats.rejected==1 && stats.full==1,"Unexpected stats rejected %lu full %lu",stats.rejected,stats.full);
+	TEST_ASSERT(stats.depth==(stk_uint64) queued,"Depth %lu, %d queued",stats.depth,queued);
+
+	stk_atomic_store_32(&release_worker,1,STK_MO_RELEASE);
+	rc = stk_destroy_worker_pool(pool);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy worker pool");
+	TEST_ASSERT(nonblock_processed==(stk_uint32) queued,"Processed %u of %d sequences on destroy",nonblock_processed,queued);
+
+	/* Holds taken by the pool were released */
+	rc = stk_destroy_sequence(seq);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy sequence");
+}
+
+#define ECHO_TEST_SEQS 2000
+
+stk_dispatcher_t *d;
+stk_sequence_id echo_next_id = 1;
+volatile stk_uint32 echoed;
+volatile stk_uint32 accepted_destroyed;
+stk_sequence_t *last_echo; /* Held past the destruction of the data flow it was received on */
+
+/* The dispatcher receives, the workers echo sequences on the accepted data flow and check the echoes */
+void echo_cb(stk_worker_pool_t *pool,stk_data_flow_t *df,stk_sequence_t *seq,void *clientd)
+{
+	if(stk_get_sequence_type(seq) != STK_SEQUENCE_TYPE_DATA) return;
+
+	if(stk_get_data_flow_type(df) == STK_TCP_ACCEPTED_FLOW) {
+		stk_ret rc = stk_data_flow_send(df,seq,STK_TCP_SEND_FLAG_NONBLOCK);
+		TEST_ASSERT(rc==STK_SUCCESS,"Failed to echo sequence %lu",stk_get_sequence_id(seq));
+		return;
+	}
+
+	TEST_ASSERT(stk_get_sequence_id(seq)==echo_next_id,"Echo of sequence %lu, expected %lu",stk_get_sequence_id(seq),echo_next_id);
+	TEST_ASSERT(stk_data_flow_received_on(seq)==df,"Echo %lu received on %p, dispatched for %p",stk_get_sequence_id(seq),stk_data_flow_received_on(seq),df);
+	if(echo_next_id == ECHO_TEST_SEQS) {
+		stk_hold_sequence(seq);
+		last_echo = seq;
+	}
+	echo_next_id++;
+	stk_atomic_fetch_add_32(&echoed,1,STK_MO_RELEASE);
+}
+
+void client_hup_cb(stk_dispatcher_t *d,stk_data_flow_t *df,int fd)
+{
+	TEST_ASSERT(0,"Client data flow hung up");
+}
+
+void fd_created_cb(stk_data_flow_t *df,stk_data_flow_id id,int fd)
+{
+	int rc;
+
+	switch(stk_get_data_flow_type(df)) {
+	case STK_TCP_SERVER_FLOW: rc = server_dispatch_add_fd(d,fd,df,NULL); break;
+	case STK_TCP_ACCEPTED_FLOW: rc = dispatch_add_accepted_fd(d,fd,df,NULL); break;
+	default: rc = dispatch_add_fd(d,df,fd,client_hup_cb,NULL); break;
+	}
+	TEST_ASSERT(rc==0,"Failed to add fd %d to dispatcher",fd);
+}
+
+void fd_destroyed_cb(stk_data_flow_t *df,stk_data_flow_id id,int fd)
+{
+	dispatch_remove_fd(d,fd);
+	if(stk_get_data_flow_type(df) == STK_TCP_ACCEPTED_FLOW)
+		accepted_destroyed++;
+}
+
+void dispatcher_tests()
+{
+	stk_worker_pool_t *pool;
+	stk_data_flow_t *server_df, *client_df;
+	stk_worker_pool_stats_t stats;
+	stk_ret rc;
+
+	pool = stk_create_worker_pool(stkbase,echo_cb,NULL,NULL);
+	TEST_ASSERT(pool!=NULL,"Failed to create worker pool");
+
+	d = alloc_dispatcher();
+	TEST_ASSERT(d!=NULL,"Failed to allocate dispatcher");
+	dispatch_set_worker_pool(d,pool);
+
+	{
+	stk_options_t options[] = { { "bind_address", "127.0.0.1"}, {"bind_port", "29316"}, { "reuseaddr", (void *) STK_TRUE},
+		{ "fd_created_cb", (void *) fd_created_cb }, { "fd_destroyed_cb", (void *) fd_destroyed_cb }, { NULL, NULL } };
+
+	server_df = stk_tcp_server_create_data_flow(stkbase,"worker pool server",1,options);
+	TEST_ASSERT(server_df!=NULL,"Failed to create listening data flow");
+	}
+
+	{
+	stk_options_t options[] = { { "connect_address", "127.0.0.1"}, {"connect_port", "29316"}, { "nodelay", (void *) STK_TRUE},
+		{ "fd_created_cb", (void *) fd_created_cb }, { "fd_destroyed_cb", (void *) fd_destroyed_cb }, { NULL, NULL } };
+
+	client_df = stk_tcp_client_create_data_flow(stkbase,"worker pool client",2,options);
+	TEST_ASSERT(client_df!=NULL,"Failed to create client data flow");
+	}
+
+	for(int i = 0; i < ECHO_TEST_SEQS; i++) {
+		stk_sequence_t *seq = stk_create_sequence(stkbase,NULL,i + 1,STK_SEQUENCE_TYPE_DATA,STK_SERVICE_TYPE_DATA,NULL);
+		char data[64];
+
+		TEST_ASSERT(seq!=NULL,"Failed to create sequence %d",i);
+		memset(data,i,sizeof(data));
+		rc = stk_copy_to_sequence(seq,data,sizeof(data),0x1);
+		TEST_ASSERT(rc==STK_SUCCESS,"Failed to copy to sequence %d",i);
+		rc = stk_data_flow_send(client_df,seq,0);
+		TEST_ASSERT(rc==STK_SUCCESS,"Failed to send sequence %d",i);
+		stk_destroy_sequence(seq);
+
+		if(i % 100 == 0) client_dispatcher_poll(d,stkbase,NULL);
+	}
+
+	for(int i = 0; i < 500 && stk_atomic_load_32(&echoed,STK_MO_ACQUIRE) < ECHO_TEST_SEQS; i++)
+		client_dispatcher_timed(d,stkbase,NULL,10);
+	TEST_ASSERT(echoed==ECHO_TEST_SEQS,"Received %u echoes of %d",echoed,ECHO_TEST_SEQS);
+
+	rc = stk_worker_pool_get_stats(pool,&stats);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to get worker pool stats");
+	TEST_ASSERT(stats.processed >= ECHO_TEST_SEQS * 2,"Workers processed %lu sequences",stats.processed);
+
+	/* The accepted data flow is destroyed by the dispatcher when the client closes, after the pool is flushed */
+	rc = stk_destroy_data_flow(client_df);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy client data flow");
+	for(int i = 0; i < 100 && accepted_destroyed == 0; i++)
+		client_dispatcher_timed(d,stkbase,NULL,10);
+	TEST_ASSERT(accepted_destroyed==1,"Accepted data flow not destroyed when the client closed");
+
+	/* A sequence holds the data flow it was received on */
+	TEST_ASSERT(last_echo!=NULL,"Last echo not kept");
+	TEST_ASSERT(stk_get_data_flow_id(stk_data_flow_received_on(last_echo))==2,"Data flow of a sequence received on a destroyed data flow is invalid");
+	rc = stk_destroy_sequence(last_echo);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy last echo");
+
+	rc = stk_destroy_data_flow(server_df);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy listening data flow");
+
+	terminate_dispatcher(d);
+	free_dispatcher(d);
+
+	rc = stk_destroy_worker_pool(pool);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy worker pool");
+}
+
+int main(int argc,char *argv[])
+{
+	stk_ret rc;
+
+	{
+	stk_options_t options[] = { { "inhibit_name_service", (void *)STK_TRUE}, { "wakeup_cb", (void *) wakeup_dispatcher}, { NULL, NULL } };
+
+	stkbase = stk_create_env(options);
+	TEST_ASSERT(stkbase!=NULL,"allocate an stk environment");
+	}
+
+	order_tests();
+	shard_tests();
+	nonblock_tests();
+	dispatcher_tests();
+
+	rc = stk_destroy_env(stkbase);
+	TEST_ASSERT(rc==STK_SUCCESS,"Failed to destroy stk env");
+
+	printf("%s PASSED\n",argv[0]);
+	return 0;
+}
@@ -4,6 +4,56 @@
 #include "stk_unit_test.h"
 #include <stdio.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#define HAMMER_THREADS 4
+#define HAMMER_ITERATIONS 1000000
+
+static int hammer_int;
+static stk_uint16 hammer_16;
+static stk_uint32 hammer_cas_32;
+static stk_uint64 hammer_64;
+
+void *hammer_thread(void *arg)
+{
+	for(int i = 0; i < HAMMER_ITERATIONS; i++) {
+		STK_ATOMIC_INCR(&hammer_int);
+		stk_atomic_fetch_add_16(&hammer_16,1,STK_MO_RELAXED);
+		stk_atomic_fetch_add_64(&hammer_64,2,STK_MO_ACQ_REL);
+		{
+		stk_uint32 old = stk_atomic_load_32(&hammer_cas_32,STK_MO_ACQUIRE);
+		while(!stk_atomic_cas_32(&hammer_cas_32,&old,old + 1,STK_MO_ACQ_REL)) ;
+		}
+	}
+	return NULL;
+}
+
+void hammer_test()
+{
+	pthread_t threads[HAMMER_THREADS];
+	struct timeval start, end;
+	double secs;
+	int rc;
+
+	gettimeofday(&start,NULL);
+	for(int i = 0; i < HAMMER_THREADS; i++) {
+		rc = pthread_create(&threads[i],NULL,hammer_thread,NULL);
+		TEST_ASSERT(rc==0,"Failed to create hammer thread %d",rc);
+	}
+	for(int i = 0; i < HAMMER_THREADS; i++)
+		pthread_join(threads[i],NULL);
+	gettimeofday(&end,NULL);
+
+	TEST_ASSERT(hammer_int==HAMMER_THREADS * HAMMER_ITERATIONS,"hammered int should be %d, is %d",HAMMER_THREADS * HAMMER_ITERATIONS,hammer_int);
+	TEST_ASSERT(hammer_16==(stk_uint16) (HAMMER_THREADS * HAMMER_ITERATIONS),"hammered 16 bit value wrong %d",hammer_16);
+	TEST_ASSERT(hammer_64==(stk_uint64) HAMMER_THREADS * HAMMER_ITERATIONS * 2,"hammered 64 bit value wrong %lu",hammer_64);
+	TEST_ASSERT(hammer_cas_32==HAMMER_THREADS * HAMMER_ITERATIONS,"hammered CAS value wrong %u",hammer_cas_32);
+
+	secs = (end.tv_sec - start.tv_sec) + ((double) end.tv_usec - start.tv_usec) / 1000000;
+	printf("Atomic hammer: %d threads, %d ops in %.3f secs (%.0f ops/sec)\n",HAMMER_THREADS,HAMMER_THREADS * HAMMER_ITERATIONS * 4,
+		secs,secs > 0 ? (HAMMER_THREADS * HAMMER_ITERATIONS * 4) / secs : 0);
+}
 
 
 int main(int argc,char *argv[])
@@ -16,6 +66,26 @@ int main(int argc,char *argv[])
 	TEST_ASSERT(STK_ATOMIC_DECR(&num)==6,"should return 6 on first decrement");
 	TEST_ASSERT(num==5,"num should be 5 after first decrement");
 
+	/* Test sized atomics */
+	{
+	stk_uint16 v16 = 0xffff;
+	stk_uint32 v32 = 10, expected = 11;
+	stk_uint64 v64 = 0;
+
+	TEST_ASSERT(stk_atomic_fetch_add_16(&v16,1,STK_MO_RELAXED)==0xffff,"16 bit add should return old value");
+	TEST_ASSERT(v16==0,"16 bit value should wrap to 0, is %d",v16);
+	TEST_ASSERT(stk_atomic_cas_32(&v32,&expected,20,STK_MO_ACQ_REL)==STK_FALSE,"CAS with wrong expected value should fail");
+	TEST_ASSERT(expected==10,"failed CAS should return current value, got %u",expected);
+	TEST_ASSERT(stk_atomic_cas_32(&v32,&expected,20,STK_MO_ACQ_REL)==STK_TRUE,"CAS with correct expected value should succeed");
+	TEST_ASSERT(stk_atomic_load_32(&v32,STK_MO_ACQUIRE)==20,"CAS should have stored 20");
+	stk_atomic_store_64(&v64,0x100000000UL,STK_MO_RELEASE);
+	TEST_ASSERT(stk_atomic_fetch_sub_64(&v64,1,STK_MO_SEQ_CST)==0x100000000UL,"64 bit sub should return old value");
+	TEST_ASSERT(stk_atomic_load_64(&v64,STK_MO_RELAXED)==0xffffffffUL,"64 bit value wrong");
+	}
+
+	/* Hammer atomics from multiple threads */
+	hammer_test();
+
 	/* Test mutex */
 	{
 	stk_mutex_t *m;